@@ -52,6 +52,7 @@ endif()
 check_function_exists(strerror_r HAVE_STRERROR_R)
 check_function_exists(utimes HAVE_UTIMES)
 check_function_exists(lstat HAVE_LSTAT)
+check_function_exists(syncfs HAVE_SYNCFS)
 check_function_exists(asprintf HAVE_ASPRINTF)
 if (UNIX AND HAVE_ASPRINTF)
     add_definitions(-D_GNU_SOURCE)
@@ -3,3 +3,4 @@ if ( NOT WIN32 )
 endif()
 option(UNIT_TESTING "Build with unit tests" OFF)
 option(MEM_NULL_TESTS "Enable NULL memory testing" OFF)
+option(WITH_BENCHMARKS "Build the benchmarks" OFF)
@@ -0,0 +1,483 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ft=c.doxygen ts=2 sw=2 et cindent
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "bench_tree.h"
+
+#define BENCH_TREE_MAX_DEPTH 64
+
+/* 2010-01-01, the files are older than anything csync writes */
+#define BENCH_TREE_MTIME 1262304000
+
+void bench_tree_defaults(struct bench_tree_s *tree) {
+  tree->files = 10000;
+  tree->depth = 3;
+  tree->fanout = 8;
+  tree->min_size = 16;
+  tree->max_size = 16 * 1024;
+  tree->seed = 1;
+  tree->change_ratio = 0.01;
+  tree->change_mode = BENCH_TREE_CHANGE_MIXED;
+}
+
+int bench_parse_number(const char *arg, uint64_t *value) {
+  char *end = NULL;
+  unsigned long long n;
+
+  errno = 0;
+  n = strtoull(arg, &end, 10);
+  if (errno != 0 || end == arg) {
+    return -1;
+  }
+
+  switch (*end) {
+    case 'G':
+      n *= 1000;
+      /* fall through */
+    case 'M':
+      n *= 1000;
+      /* fall through */
+    case 'k':
+      n *= 1000;
+      end++;
+      break;
+    default:
+      break;
+  }
+
+  if (*end != '\0') {
+    return -1;
+  }
+  *value = n;
+
+  return 0;
+}
+
+int bench_tree_option(struct bench_tree_s *tree, int opt, const char *arg) {
+  uint64_t n = 0;
+  char *end = NULL;
+
+  if (opt == 'C') {
+    tree->change_ratio = strtod(arg, &end);
+    if (end == arg || *end != '\0' ||
+        tree->change_ratio < 0.0 || tree->change_ratio > 1.0) {
+      return -1;
+    }
+    return 0;
+  }
+
+  if (opt == 'K') {
+    if (strcmp(arg, "mixed") == 0) {
+      tree->change_mode = BENCH_TREE_CHANGE_MIXED;
+    } else if (strcmp(arg, "append") == 0) {
+      tree->change_mode = BENCH_TREE_CHANGE_APPEND;
+    } else if (strcmp(arg, "edit") == 0) {
+      tree->change_mode = BENCH_TREE_CHANGE_EDIT;
+    } else {
+      return -1;
+    }
+    return 0;
+  }
+
+  if (bench_parse_number(arg, &n) < 0) {
+    return -1;
+  }
+
+  switch (opt) {
+    case 'F':
+      tree->files = n;
+      break;
+    case 'D':
+      if (n > BENCH_TREE_MAX_DEPTH) {
+        return -1;
+      }
+      tree->depth = n;
+      break;
+    case 'O':
+      if (n < 1 || n > 1000) {
+        return -1;
+      }
+      tree->fanout = n;
+      break;
+    case 'm':
+      tree->min_size = n;
+      break;
+    case 'M':
+      tree->max_size = n;
+      break;
+    case 'S':
+      tree->seed = n;
+      break;
+    default:
+      return -1;
+  }
+
+  if (tree->min_size > tree->max_size) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* splitmix64, a good spread for consecutive inputs */
+static uint64_t _hash(struct bench_tree_s *tree, uint64_t i, uint64_t round) {
+  uint64_t x = tree->seed ^ (i * 0x9e3779b97f4a7c15ULL) ^ (round << 48);
+
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+  return x ^ (x >> 31);
+}
+
+static unsigned long _dirs(struct bench_tree_s *tree) {
+  unsigned long dirs = 1;
+  unsigned long level = 1;
+  int i;
+
+  if (tree->fanout < 1) {
+    return 1;
+  }
+
+  /* more directories than files would only add empty ones */
+  for (i = 0; i < tree->depth && dirs < tree->files; i++) {
+    level *= tree->fanout;
+    dirs += level;
+  }
+
+  return dirs < tree->files ? dirs : (tree->files ? tree->files : 1);
+}
+
+static int _dir_path(char *buf, size_t len, const char *root,
+    struct bench_tree_s *tree, unsigned long n) {
+  unsigned long names[BENCH_TREE_MAX_DEPTH];
+  size_t off;
+  int depth = 0;
+  int rc;
+
+  while (n > 0 && depth < BENCH_TREE_MAX_DEPTH) {
+    names[depth++] = (n - 1) % tree->fanout;
+    n = (n - 1) / tree->fanout;
+  }
+
+  rc = snprintf(buf, len, "%s", root);
+  off = rc;
+  while (depth > 0 && off < len) {
+    rc = snprintf(buf + off, len - off, "/d%lu", names[--depth]);
+    off += rc;
+  }
+
+  if (off >= len) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* the files added next to file i are in the same directory */
+static int _file_path(char *buf, size_t len, const char *root,
+    struct bench_tree_s *tree, unsigned long dirs, unsigned long i,
+    const char *name) {
+  size_t off;
+  int rc;
+
+  if (_dir_path(buf, len, root, tree, i % dirs) < 0) {
+    return -1;
+  }
+
+  off = strlen(buf);
+  rc = snprintf(buf + off, len - off, "/%s", name);
+  if (rc < 0 || (size_t) rc >= len - off) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return 0;
+}
+
+static uint64_t _size(struct bench_tree_s *tree, uint64_t h) {
+  int lmin = 0;
+  int lmax = 0;
+  int bits;
+  uint64_t low;
+  uint64_t size;
+
+  while (lmin < 62 && (2ULL << lmin) <= tree->min_size) {
+    lmin++;
+  }
+  while (lmax < 62 && (2ULL << lmax) <= tree->max_size) {
+    lmax++;
+  }
+
+  bits = lmin + (int) (h % (lmax - lmin + 1));
+  low = 1ULL << bits;
+  size = low + (h >> 16) % low;
+
+  if (size < tree->min_size) {
+    size = tree->min_size;
+  }
+  if (size > tree->max_size) {
+    size = tree->max_size;
+  }
+
+  return size;
+}
+
+/* the content of a file, a block repeated */
+static void _fill(char *buf, size_t len, uint64_t h) {
+  uint64_t x = h | 1;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    buf[i] = (char) x;
+  }
+}
+
+static int _write_data(int fd, const char *buf, size_t len, uint64_t size) {
+  ssize_t n;
+
+  while (size > 0) {
+    n = write(fd, buf, size < len ? size : len);
+    if (n < 0) {
+      return -1;
+    }
+    size -= n;
+  }
+
+  return 0;
+}
+
+static int _set_mtime(int fd, time_t mtime) {
+  struct timeval times[2];
+
+  times[0].tv_sec = times[1].tv_sec = mtime;
+  times[0].tv_usec = times[1].tv_usec = 0;
+
+  return futimes(fd, times);
+}
+
+static int _write_file(const char *path, uint64_t h, uint64_t size,
+    time_t mtime) {
+  char buf[4096];
+  int fd;
+  int rc = -1;
+
+  _fill(buf, sizeof(buf), h);
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (_write_data(fd, buf, sizeof(buf), size) < 0 ||
+      _set_mtime(fd, mtime) < 0) {
+    goto out;
+  }
+
+  rc = 0;
+out:
+  if (close(fd) < 0) {
+    rc = -1;
+  }
+  return rc;
+}
+
+/*
+ * Appends to a file or overwrites a part of it, the bytes written are added
+ * to counts. A file removed in an earlier round is left alone.
+ */
+static int _change_file(const char *path, struct bench_tree_s *tree,
+    uint64_t h, time_t mtime, struct bench_tree_counts_s *counts) {
+  char buf[4096];
+  struct stat sb;
+  uint64_t size;
+  int fd;
+  int rc = -1;
+
+  _fill(buf, sizeof(buf), h);
+
+  fd = open(path, O_WRONLY);
+  if (fd < 0) {
+    return errno == ENOENT ? 0 : -1;
+  }
+  if (fstat(fd, &sb) < 0) {
+    goto out;
+  }
+
+  if (tree->change_mode == BENCH_TREE_CHANGE_APPEND) {
+    size = sb.st_size / 16 + 1;
+    if (lseek(fd, 0, SEEK_END) < 0 ||
+        _write_data(fd, buf, sizeof(buf), size) < 0) {
+      goto out;
+    }
+  } else {
+    size = sb.st_size < 64 ? sb.st_size : 64;
+    if (lseek(fd, sb.st_size > 64 ? (h >> 8) % (sb.st_size - 64) : 0,
+          SEEK_SET) < 0 ||
+        _write_data(fd, buf, sizeof(buf), size) < 0) {
+      goto out;
+    }
+  }
+
+  if (_set_mtime(fd, mtime) < 0) {
+    goto out;
+  }
+  counts->modified++;
+  counts->bytes += size;
+
+  rc = 0;
+out:
+  if (close(fd) < 0) {
+    rc = -1;
+  }
+  return rc;
+}
+
+int bench_tree_create(const char *root, struct bench_tree_s *tree,
+    struct bench_tree_counts_s *counts) {
+  char path[4096];
+  char name[64];
+  unsigned long dirs;
+  unsigned long n;
+  uint64_t h;
+  uint64_t size;
+
+  memset(counts, 0, sizeof(struct bench_tree_counts_s));
+  dirs = _dirs(tree);
+
+  if (mkdir(root, 0755) < 0) {
+    return -1;
+  }
+
+  /* breadth first, the parents exist before their children */
+  for (n = 1; n < dirs; n++) {
+    if (_dir_path(path, sizeof(path), root, tree, n) < 0) {
+      return -1;
+    }
+    if (mkdir(path, 0755) < 0) {
+      return -1;
+    }
+    counts->dirs++;
+  }
+
+  for (n = 0; n < tree->files; n++) {
+    snprintf(name, sizeof(name), "f%lu.dat", n);
+    if (_file_path(path, sizeof(path), root, tree, dirs, n, name) < 0) {
+      return -1;
+    }
+
+    h = _hash(tree, n, 0);
+    size = _size(tree, h);
+    if (_write_file(path, h, size, BENCH_TREE_MTIME + h % 31536000) < 0) {
+      return -1;
+    }
+    counts->files++;
+    counts->bytes += size;
+  }
+
+  return 0;
+}
+
+int bench_tree_change(const char *root, struct bench_tree_s *tree, int round,
+    struct bench_tree_counts_s *counts) {
+  char path[4096];
+  char name[64];
+  unsigned long dirs;
+  unsigned long n;
+  uint64_t limit;
+  uint64_t h;
+  uint64_t size;
+  time_t mtime;
+
+  memset(counts, 0, sizeof(struct bench_tree_counts_s));
+  dirs = _dirs(tree);
+  limit = (uint64_t) (tree->change_ratio * 1000000);
+  /* a year after the files were created, one hour per round */
+  mtime = BENCH_TREE_MTIME + 31536000 + round * 3600;
+
+  for (n = 0; n < tree->files; n++) {
+    h = _hash(tree, n, round);
+    if (h % 1000000 >= limit) {
+      continue;
+    }
+
+    if (tree->change_mode != BENCH_TREE_CHANGE_MIXED) {
+      snprintf(name, sizeof(name), "f%lu.dat", n);
+      if (_file_path(path, sizeof(path), root, tree, dirs, n, name) < 0 ||
+          _change_file(path, tree, h, mtime, counts) < 0) {
+        return -1;
+      }
+      continue;
+    }
+
+    switch ((h >> 20) % 3) {
+      case 0:
+        snprintf(name, sizeof(name), "f%lu.dat", n);
+        if (_file_path(path, sizeof(path), root, tree, dirs, n, name) < 0) {
+          return -1;
+        }
+        size = _size(tree, h);
+        if (_write_file(path, h, size, mtime) < 0) {
+          return -1;
+        }
+        counts->modified++;
+        counts->bytes += size;
+        break;
+      case 1:
+        snprintf(name, sizeof(name), "f%lu.dat", n);
+        if (_file_path(path, sizeof(path), root, tree, dirs, n, name) < 0) {
+          return -1;
+        }
+        /* it may be gone since an earlier round */
+        if (unlink(path) == 0) {
+          counts->removed++;
+        } else if (errno != ENOENT) {
+          return -1;
+        }
+        break;
+      default:
+        snprintf(name, sizeof(name), "n%d-%lu.dat", round, n);
+        if (_file_path(path, sizeof(path), root, tree, dirs, n, name) < 0) {
+          return -1;
+        }
+        size = _size(tree, h);
+        if (_write_file(path, h, size, mtime) < 0) {
+          return -1;
+        }
+        counts->added++;
+        counts->bytes += size;
+        break;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ft=c.doxygen ts=2 sw=2 et cindent
+ */
+
+#ifndef _CSYNC_BENCH_TREE_H
+#define _CSYNC_BENCH_TREE_H
+
+#include <stdint.h>
+
+/*
+ * A synthetic tree for the benchmarks. It only depends on the parameters,
+ * the same parameters give the same names, sizes, contents and modification
+ * times on every run.
+ *
+ * The directories are numbered breadth first, directory n has the children
+ * n * fanout + 1 .. n * fanout + fanout, down to depth levels below the
+ * root. File i is f<i>.dat in directory i % directories, so the files are
+ * spread evenly. The sizes are distributed log-uniformly between min_size
+ * and max_size, most files are small and a few are big, as in a home
+ * directory.
+ */
+enum bench_tree_change_e {
+  BENCH_TREE_CHANGE_MIXED = 0,  /* files rewritten, removed and added */
+  BENCH_TREE_CHANGE_APPEND,     /* data appended to files, like to logs */
+  BENCH_TREE_CHANGE_EDIT        /* a few bytes overwritten in the files */
+};
+
+struct bench_tree_s {
+  unsigned long files;
+  int depth;
+  int fanout;
+  uint64_t min_size;
+  uint64_t max_size;
+  unsigned long seed;
+  double change_ratio;  /* share of the files bench_tree_change() touches */
+  enum bench_tree_change_e change_mode;
+};
+
+struct bench_tree_counts_s {
+  unsigned long dirs;
+  unsigned long files;
+  uint64_t bytes;
+  unsigned long modified;
+  unsigned long removed;
+  unsigned long added;
+};
+
+void bench_tree_defaults(struct bench_tree_s *tree);
+
+/* the options of the parameters for getopt_long, shared by the programs */
+#define BENCH_TREE_OPTIONS \
+  {"files", required_argument, 0, 'F'}, \
+  {"depth", required_argument, 0, 'D'}, \
+  {"fanout", required_argument, 0, 'O'}, \
+  {"min-size", required_argument, 0, 'm'}, \
+  {"max-size", required_argument, 0, 'M'}, \
+  {"seed", required_argument, 0, 'S'}, \
+  {"change", required_argument, 0, 'C'}, \
+  {"change-mode", required_argument, 0, 'K'}
+
+#define BENCH_TREE_OPTIONS_DOC \
+"    --files=N              The number of files (10k)\n\
+    --depth=N              The levels of directories below the root (3)\n\
+    --fanout=N             The subdirectories of a directory (8)\n\
+    --min-size=N           The size of the smallest file (16)\n\
+    --max-size=N           The size of the biggest file (16k)\n\
+    --seed=N               Another seed gives another tree (1)\n\
+    --change=RATIO         The share of the files a change touches (0.01)\n\
+    --change-mode=MODE     mixed, append or edit (mixed)\n"
+
+/* a number with an optional k, M or G suffix */
+int bench_parse_number(const char *arg, uint64_t *value);
+
+/* applies an option of BENCH_TREE_OPTIONS, -1 if the argument is invalid */
+int bench_tree_option(struct bench_tree_s *tree, int opt, const char *arg);
+
+/* creates the tree below root, which must not exist */
+int bench_tree_create(const char *root, struct bench_tree_s *tree,
+    struct bench_tree_counts_s *counts);
+
+/*
+ * Changes change_ratio of the files of the tree: a third of them are
+ * rewritten with another size and modification time, a third removed and
+ * next to a third a new file is added. In the append mode a sixteenth of
+ * its size is appended to every file changed, in the edit mode 64 bytes of
+ * it are overwritten at a random offset. Each round changes other files,
+ * the rounds start at 1.
+ */
+int bench_tree_change(const char *root, struct bench_tree_s *tree, int round,
+    struct bench_tree_counts_s *counts);
+
+#endif /* _CSYNC_BENCH_TREE_H */
@@ -0,0 +1,450 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ft=c.doxygen ts=2 sw=2 et cindent
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "csync_private.h"
+#include "c_dir.h"
+
+#include "bench_tree.h"
+
+#define BENCH_MAX_SCENARIOS 16
+
+static const char doc[] = "Usage: csync_bench [OPTION...]\n\
+csync_bench -- syncs synthetic trees and reports the costs of the phases.\n\
+\n\
+For every number of files and target a tree is created and synced three\n\
+times: the first sync, a sync without changes and a sync after a small\n\
+change. Every run is a process of its own, so the peak RSS is its own.\n\
+\n\
+    --dir=DIR              Where the trees are created (/tmp/csync_bench)\n\
+    --scenarios=N,...      The numbers of files to run (10k)\n\
+    --target=TARGET        local, dummy or both (both)\n\
+    --dummy-args=ARGS      The settings of the dummy module (keep_data=0)\n\
+    --delta                Patch the modified files with delta_transfer\n\
+    --keep                 Don't remove the trees after the run\n\
+\n"
+BENCH_TREE_OPTIONS_DOC
+"-?, --help                 Give this help list\n\
+\n\
+The numbers take a k, M or G suffix. --files sets a single scenario.\n";
+
+enum bench_target_e {
+  BENCH_TARGET_LOCAL = 1,
+  BENCH_TARGET_DUMMY = 2
+};
+
+struct bench_options_s {
+  struct bench_tree_s tree;
+  uint64_t scenarios[BENCH_MAX_SCENARIOS];
+  int nscenarios;
+  int targets;
+  const char *dir;
+  const char *dummy_args;
+  int delta;
+  int keep;
+};
+
+/* what is measured at the start and the end of a phase */
+struct bench_sample_s {
+  struct timespec time;
+  long maxrss;                  /* KiB */
+  unsigned long vio_local;
+  unsigned long vio_remote;
+  unsigned long long remote_read;       /* bytes */
+  unsigned long long remote_written;
+  unsigned long long syscalls;
+  unsigned long statements;
+};
+
+static const struct {
+  const char *name;
+  int (*fn)(CSYNC *ctx);
+} bench_phases[] = {
+  { "update",    csync_update },
+  { "reconcile", csync_reconcile },
+  { "propagate", csync_propagate },
+  { "commit",    csync_commit },
+};
+
+static unsigned long _vio_calls(struct csync_vio_op_stats_s *ops) {
+  unsigned long calls = 0;
+  int i;
+
+  for (i = 0; i < CSYNC_VIO_STATS_OP_MAX; i++) {
+    calls += ops[i].calls;
+  }
+
+  return calls;
+}
+
+/*
+ * The system calls which read or write, as the kernel counts them. There is
+ * no cheap count of all system calls, the vio calls cover the metadata.
+ */
+static unsigned long long _syscalls(void) {
+  char line[128];
+  unsigned long long n;
+  unsigned long long syscalls = 0;
+  FILE *fp;
+
+  fp = fopen("/proc/self/io", "r");
+  if (fp == NULL) {
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "syscr: %llu", &n) == 1 ||
+        sscanf(line, "syscw: %llu", &n) == 1) {
+      syscalls += n;
+    }
+  }
+  fclose(fp);
+
+  return syscalls;
+}
+
+static void _sample(CSYNC *csync, struct bench_sample_s *s) {
+  struct csync_vio_stats_s stats;
+  struct rusage usage;
+
+  ZERO_STRUCTP(s);
+
+  if (csync_get_vio_stats(csync, &stats) == 0) {
+    s->vio_local = _vio_calls(stats.local);
+    s->vio_remote = _vio_calls(stats.remote);
+    s->remote_read = stats.remote[CSYNC_VIO_STATS_READ].bytes;
+    s->remote_written = stats.remote[CSYNC_VIO_STATS_WRITE].bytes +
+                        stats.remote[CSYNC_VIO_STATS_SENDFILE].bytes;
+  }
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    s->maxrss = usage.ru_maxrss;
+  }
+  s->syscalls = _syscalls();
+  s->statements = csync->statedb.statements;
+
+  clock_gettime(CLOCK_MONOTONIC, &s->time);
+}
+
+static void _report(uint64_t files, const char *target, const char *sync,
+    const char *phase, struct bench_sample_s *start,
+    struct bench_sample_s *end) {
+  double secs;
+
+  secs = (end->time.tv_sec - start->time.tv_sec) +
+         (end->time.tv_nsec - start->time.tv_nsec) / 1000000000.0;
+
+  printf("%-8llu %-6s %-7s %-10s %10.3f %10ld %10lu %10lu %12llu %12llu "
+      "%12llu %10lu\n",
+      (unsigned long long) files, target, sync, phase, secs, end->maxrss,
+      end->vio_local - start->vio_local,
+      end->vio_remote - start->vio_remote,
+      (end->remote_read - start->remote_read) / 1024,
+      (end->remote_written - start->remote_written) / 1024,
+      end->syscalls - start->syscalls,
+      end->statements - start->statements);
+}
+
+/* a sync of the tree, a row per phase and one for all of them */
+static int _bench_sync(CSYNC *csync, uint64_t files, const char *target,
+    const char *sync) {
+  struct bench_sample_s first;
+  struct bench_sample_s start;
+  struct bench_sample_s end;
+  size_t i;
+
+  _sample(csync, &first);
+  start = first;
+
+  for (i = 0; i < sizeof(bench_phases) / sizeof(bench_phases[0]); i++) {
+    if (bench_phases[i].fn(csync) < 0) {
+      fprintf(stderr, "csync_bench: %s sync, csync_%s: %s\n", sync,
+          bench_phases[i].name, csync_get_status_string(csync));
+      return -1;
+    }
+    _sample(csync, &end);
+    _report(files, target, sync, bench_phases[i].name, &start, &end);
+    start = end;
+  }
+  _report(files, target, sync, "total", &first, &end);
+
+  return 0;
+}
+
+static int _bench_run(struct bench_options_s *opts, uint64_t files,
+    enum bench_target_e target) {
+  const char *name = target == BENCH_TARGET_LOCAL ? "local" : "dummy";
+  struct bench_tree_s tree = opts->tree;
+  struct bench_tree_counts_s counts;
+  struct bench_sample_s start;
+  struct bench_sample_s end;
+  CSYNC *csync = NULL;
+  char *base = NULL;
+  char *source = NULL;
+  char *replica = NULL;
+  char *config = NULL;
+  int rc = -1;
+
+  tree.files = files;
+
+  if (asprintf(&base, "%s/%llu-%s", opts->dir, (unsigned long long) files,
+        name) < 0 ||
+      asprintf(&source, "%s/source", base) < 0 ||
+      asprintf(&config, "%s/config", base) < 0) {
+    goto out;
+  }
+  if (target == BENCH_TARGET_LOCAL) {
+    rc = asprintf(&replica, "%s/replica", base);
+  } else {
+    /* the dummy keeps its trees per host, in this process */
+    rc = asprintf(&replica, "dummy://bench-%llu/replica",
+        (unsigned long long) files);
+  }
+  if (rc < 0) {
+    rc = -1;
+    goto out;
+  }
+  rc = -1;
+
+  c_rmdirs(base);
+  if (c_mkdirs(base, 0755) < 0) {
+    fprintf(stderr, "csync_bench: %s: %s\n", base, strerror(errno));
+    goto out;
+  }
+  if (target == BENCH_TARGET_LOCAL && mkdir(replica, 0755) < 0) {
+    fprintf(stderr, "csync_bench: %s: %s\n", replica, strerror(errno));
+    goto out;
+  }
+
+  if (bench_tree_create(source, &tree, &counts) < 0) {
+    fprintf(stderr, "csync_bench: %s: %s\n", source, strerror(errno));
+    goto out;
+  }
+  fprintf(stderr, "csync_bench: %s: %lu directories, %lu files, %llu bytes\n",
+      source, counts.dirs, counts.files, (unsigned long long) counts.bytes);
+
+  setenv("CSYNC_DUMMY_ARGS", opts->dummy_args, 1);
+
+  if (csync_create(&csync, source, replica) < 0 ||
+      csync_set_config_dir(csync, config) < 0) {
+    fprintf(stderr, "csync_bench: csync_create: %s\n", strerror(errno));
+    goto out;
+  }
+
+  _sample(csync, &start);
+  if (csync_init(csync) < 0) {
+    fprintf(stderr, "csync_bench: csync_init: %s\n",
+        csync_get_status_string(csync));
+    goto out;
+  }
+  _sample(csync, &end);
+  _report(files, name, "first", "init", &start, &end);
+
+  /* after the init, which reads the config */
+  csync->options.delta_transfer = opts->delta;
+
+  if (_bench_sync(csync, files, name, "first") < 0 ||
+      _bench_sync(csync, files, name, "noop") < 0) {
+    goto out;
+  }
+
+  if (bench_tree_change(source, &tree, 1, &counts) < 0) {
+    fprintf(stderr, "csync_bench: %s: %s\n", source, strerror(errno));
+    goto out;
+  }
+  fprintf(stderr, "csync_bench: %s: %lu modified, %lu removed, %lu added\n",
+      source, counts.modified, counts.removed, counts.added);
+
+  if (_bench_sync(csync, files, name, "change") < 0) {
+    goto out;
+  }
+
+  rc = 0;
+out:
+  if (csync != NULL) {
+    csync_destroy(csync);
+  }
+  if (base != NULL && !opts->keep) {
+    c_rmdirs(base);
+  }
+  SAFE_FREE(base);
+  SAFE_FREE(source);
+  SAFE_FREE(replica);
+  SAFE_FREE(config);
+  return rc;
+}
+
+/* in a child, the peak RSS and the dummy trees don't carry over */
+static int _bench_fork(struct bench_options_s *opts, uint64_t files,
+    enum bench_target_e target) {
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  pid = fork();
+  if (pid < 0) {
+    return -1;
+  }
+  if (pid == 0) {
+    status = _bench_run(opts, files, target);
+    fflush(stdout);
+    _exit(status < 0 ? 1 : 0);
+  }
+
+  if (waitpid(pid, &status, 0) < 0) {
+    return -1;
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static int _parse_scenarios(struct bench_options_s *opts, const char *arg) {
+  char *list = c_strdup(arg);
+  char *save = NULL;
+  char *tok;
+  int rc = -1;
+
+  opts->nscenarios = 0;
+  for (tok = strtok_r(list, ",", &save); tok != NULL;
+       tok = strtok_r(NULL, ",", &save)) {
+    if (opts->nscenarios == BENCH_MAX_SCENARIOS ||
+        bench_parse_number(tok, &opts->scenarios[opts->nscenarios]) < 0) {
+      goto out;
+    }
+    opts->nscenarios++;
+  }
+
+  rc = opts->nscenarios > 0 ? 0 : -1;
+out:
+  SAFE_FREE(list);
+  return rc;
+}
+
+int main(int argc, char **argv) {
+  struct bench_options_s opts;
+  int failed = 0;
+  int i;
+  int c;
+
+  const struct option options[] = {
+    BENCH_TREE_OPTIONS,
+    {"dir", required_argument, 0, 'd'},
+    {"scenarios", required_argument, 0, 'n'},
+    {"target", required_argument, 0, 't'},
+    {"dummy-args", required_argument, 0, 'a'},
+    {"delta", no_argument, 0, 'x'},
+    {"keep", no_argument, 0, 'k'},
+    {"help", no_argument, 0, '?'},
+    {0, 0, 0, 0}
+  };
+
+  ZERO_STRUCT(opts);
+  bench_tree_defaults(&opts.tree);
+  opts.scenarios[0] = opts.tree.files;
+  opts.nscenarios = 1;
+  opts.targets = BENCH_TARGET_LOCAL | BENCH_TARGET_DUMMY;
+  opts.dir = "/tmp/csync_bench";
+  opts.dummy_args = "keep_data=0";
+
+  while ((c = getopt_long(argc, argv, "?", options, NULL)) != -1) {
+    switch (c) {
+      case 'd':
+        opts.dir = optarg;
+        break;
+      case 'n':
+        if (_parse_scenarios(&opts, optarg) < 0) {
+          fprintf(stderr, "csync_bench: invalid scenarios %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 't':
+        if (c_streq(optarg, "local")) {
+          opts.targets = BENCH_TARGET_LOCAL;
+        } else if (c_streq(optarg, "dummy")) {
+          opts.targets = BENCH_TARGET_DUMMY;
+        } else if (c_streq(optarg, "both")) {
+          opts.targets = BENCH_TARGET_LOCAL | BENCH_TARGET_DUMMY;
+        } else {
+          fprintf(stderr, "csync_bench: invalid target %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'a':
+        opts.dummy_args = optarg;
+        break;
+      case 'x':
+        opts.delta = 1;
+        break;
+      case 'k':
+        opts.keep = 1;
+        break;
+      case '?':
+        fprintf(stderr, "%s", doc);
+        return 1;
+      default:
+        if (bench_tree_option(&opts.tree, c, optarg) < 0) {
+          fprintf(stderr, "csync_bench: invalid argument %s\n", optarg);
+          return 1;
+        }
+        if (c == 'F') {
+          opts.scenarios[0] = opts.tree.files;
+          opts.nscenarios = 1;
+        }
+        break;
+    }
+  }
+
+  printf("%-8s %-6s %-7s %-10s %10s %10s %10s %10s %12s %12s %12s %10s\n",
+      "files", "target", "sync", "phase", "wall[s]", "maxrss[k]",
+      "vio-local", "vio-remote", "remote-rd[k]", "remote-wr[k]",
+      "rw-syscalls", "sql");
+
+  for (i = 0; i < opts.nscenarios; i++) {
+    if ((opts.targets & BENCH_TARGET_LOCAL) &&
+        _bench_fork(&opts, opts.scenarios[i], BENCH_TARGET_LOCAL) < 0) {
+      failed++;
+    }
+    if ((opts.targets & BENCH_TARGET_DUMMY) &&
+        _bench_fork(&opts, opts.scenarios[i], BENCH_TARGET_DUMMY) < 0) {
+      failed++;
+    }
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ft=c.doxygen ts=2 sw=2 et cindent
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_tree.h"
+
+static const char doc[] = "Usage: csync_treegen [OPTION...] DIR\n\
+csync_treegen -- creates the synthetic tree of the csync benchmarks in DIR,\n\
+or changes it with --round.\n\
+\n"
+BENCH_TREE_OPTIONS_DOC
+"    --round=N              Change the tree in DIR instead of creating it,\n\
+                           each round N >= 1 changes other files.\n\
+-?, --help                 Give this help list\n\
+\n\
+The numbers take a k, M or G suffix.\n";
+
+int main(int argc, char **argv) {
+  struct bench_tree_s tree;
+  struct bench_tree_counts_s counts;
+  const char *root;
+  int round = 0;
+  int rc;
+  int c;
+
+  const struct option options[] = {
+    BENCH_TREE_OPTIONS,
+    {"round", required_argument, 0, 'r'},
+    {"help", no_argument, 0, '?'},
+    {0, 0, 0, 0}
+  };
+
+  bench_tree_defaults(&tree);
+
+  while ((c = getopt_long(argc, argv, "?", options, NULL)) != -1) {
+    switch (c) {
+      case 'r':
+        round = atoi(optarg);
+        if (round < 1) {
+          fprintf(stderr, "csync_treegen: the round starts at 1\n");
+          return 1;
+        }
+        break;
+      case '?':
+        fprintf(stderr, "%s", doc);
+        return 1;
+      default:
+        if (bench_tree_option(&tree, c, optarg) < 0) {
+          fprintf(stderr, "csync_treegen: invalid argument %s\n", optarg);
+          return 1;
+        }
+        break;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    fprintf(stderr, "%s", doc);
+    return 1;
+  }
+  root = argv[optind];
+
+  if (round > 0) {
+    rc = bench_tree_change(root, &tree, round, &counts);
+  } else {
+    rc = bench_tree_create(root, &tree, &counts);
+  }
+  if (rc < 0) {
+    fprintf(stderr, "csync_treegen: %s: %s\n", root, strerror(errno));
+    return 1;
+  }
+
+  if (round > 0) {
+    printf("%lu modified, %lu removed, %lu added, %llu bytes written\n",
+        counts.modified, counts.removed, counts.added,
+        (unsigned long long) counts.bytes);
+  } else {
+    printf("%lu directories, %lu files, %llu bytes\n",
+        counts.dirs, counts.files, (unsigned long long) counts.bytes);
+  }
+
+  return 0;
+}
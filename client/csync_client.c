@@ -38,6 +38,7 @@
 #include "csync_auth.h"
 #include "../src/std/c_private.h"
 #include "../src/csync_misc.h"
+#include "../src/csync_log.h"
 
 const char *csync_program_version = "csync commandline client "
   CSYNC_STRINGIFY(LIBCSYNC_VERSION);
@@ -109,6 +110,60 @@ static void print_help()
     exit(0);
 }
 
+/* the upper bound in microseconds of the bucket the share of the calls is in */
+static unsigned long long vio_stats_percentile(struct csync_vio_op_stats_s *op,
+    double share)
+{
+    unsigned long sum = 0;
+    int i;
+
+    for (i = 0; i < CSYNC_VIO_STATS_BUCKETS - 1; i++) {
+        sum += op->histogram[i];
+        if (sum >= share * op->calls) {
+            break;
+        }
+    }
+
+    return 2ULL << i;
+}
+
+static void print_vio_stats_replica(const char *phase, const char *replica,
+    struct csync_vio_op_stats_s *ops)
+{
+    struct csync_vio_op_stats_s *op;
+    int i;
+
+    for (i = 0; i < CSYNC_VIO_STATS_OP_MAX; i++) {
+        op = &ops[i];
+        if (op->calls == 0) {
+            continue;
+        }
+        fprintf(stderr, "%-9s %-6s %-8s %8lu calls %6lu errors %12llu bytes "
+                "%10.1f us avg, p50 < %llu us, p99 < %llu us\n",
+                phase, replica, csync_vio_stats_op_name(i),
+                op->calls, op->errors, op->bytes,
+                (double) op->usecs / op->calls,
+                vio_stats_percentile(op, 0.5),
+                vio_stats_percentile(op, 0.99));
+    }
+}
+
+/* the calls of the phase to the replicas, they are reset for the next one */
+static void print_vio_stats(CSYNC *csync, const char *phase)
+{
+    struct csync_vio_stats_s stats;
+
+    if (csync_get_log_level() < CSYNC_LOG_PRIORITY_DEBUG ||
+        csync_get_vio_stats(csync, &stats) < 0) {
+        return;
+    }
+
+    print_vio_stats_replica(phase, "local", stats.local);
+    print_vio_stats_replica(phase, "remote", stats.remote);
+
+    csync_reset_vio_stats(csync);
+}
+
 static int parse_args(struct argument_s *csync_args, int argc, char **argv)
 {
     while(optind < argc) {
@@ -255,6 +310,7 @@ int main(int argc, char **argv) {
     rc = 1;
     goto out;
   }
+  print_vio_stats(csync, "init");
 
   if (arguments.exclude_file != NULL) {
     if (csync_add_exclude_list(csync, arguments.exclude_file) < 0) {
@@ -272,6 +328,7 @@ int main(int argc, char **argv) {
       rc = 1;
       goto out;
     }
+    print_vio_stats(csync, "update");
   }
 
   if (arguments.reconcile) {
@@ -280,6 +337,7 @@ int main(int argc, char **argv) {
       rc = 1;
       goto out;
     }
+    print_vio_stats(csync, "reconcile");
   }
 
   if (arguments.propagate) {
@@ -288,6 +346,7 @@ int main(int argc, char **argv) {
       rc = 1;
       goto out;
     }
+    print_vio_stats(csync, "propagate");
   }
 
   if (arguments.create_statedb) {
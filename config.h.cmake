@@ -18,5 +18,6 @@
 #cmakedefine HAVE_STRERROR_R 1
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
+#cmakedefine HAVE_SYNCFS 1
 #cmakedefine HAVE_FNMATCH 1
 
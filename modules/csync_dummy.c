@@ -18,11 +18,58 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+/*
+ * The dummy module is a remote replica held in memory, to test and benchmark
+ * csync without a server. It can be made to behave like a server on a slow
+ * line: every operation waits for the latency, reads and writes for the
+ * bandwidth, a part of the operations fail and queued operations run with a
+ * limited parallelism.
+ *
+ * The settings are ints, given as module arguments "key=value,key=value",
+ * in the environment variable CSYNC_DUMMY_ARGS if csync passes no
+ * arguments, or with csync_set_module_property():
+ *
+ *  latency       milliseconds every operation waits, like a round trip
+ *  bandwidth     bytes per second of reads and writes, 0 is unlimited
+ *  error_rate    operations in 1000 which fail with EIO
+ *  seed          the seed of the failures, the same seed fails the same
+ *                operations as long as they are called in the same order
+ *  max_parallel  the number of queued operations run at the same time,
+ *                0 runs them one by one in the caller
+ *  keep_data     0 keeps only the size of the files, reads return zeros
+ *  recursive_delete
+ *                1 removes a directory with its content on rmdir and
+ *                advertises it in the capabilities, it must be given
+ *                before the module is loaded
+ *
+ * The trees are kept per host of the uri for the life of the process, so
+ * another csync context on the same uri finds the files of the last sync.
+ * A tree starts empty, the first directory which is opened is created with
+ * its parents; csync opens the root of the remote replica first.
+ *
+ * Like a server which keeps checksums of the files, it answers the SHA1 of
+ * a file without a read. Without keep_data it is the SHA1 of the zeros the
+ * reads return.
+ *
+ * Like sftp, it writes into existing files at any offset, so modified files
+ * are patched in place with delta_transfer.
+ */
+
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "c_lib.h"
+#include "c_sha1.h"
 #include "vio/csync_vio_module.h"
 #include "vio/csync_vio_file_stat.h"
 
@@ -32,149 +79,1423 @@
 #define DEBUG_DUMMY(x) printf x
 #endif
 
-csync_vio_method_handle_t *mh = NULL;
-csync_vio_file_stat_t fs;
+#define DUMMY_META_MAX 16
+#define DUMMY_META_QUEUE_MAX 256
+
+/* a file or directory of a tree */
+struct dummy_node_s {
+  char *name;
+  enum csync_vio_file_type_e type;
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+  time_t atime;
+  time_t mtime;
+  time_t ctime;
+  struct dummy_node_s *parent;
+
+  c_rbtree_t *children;         /* of a directory, by name */
+
+  char *data;                   /* of a file, NULL without keep_data */
+  size_t size;
+  size_t alloc;
+
+  int open_count;               /* open handles, they keep it alive */
+  int unlinked;                 /* removed from the tree while open */
+};
+
+/* the tree of a host */
+struct dummy_tree_s {
+  char *host;
+  struct dummy_node_s *root;
+  int root_made;
+  struct dummy_tree_s *next;
+};
+
+/* the trees are shared by all instances, a single lock protects them */
+static struct dummy_tree_s *_dummy_trees;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t _dummy_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define DUMMY_LOCK() pthread_mutex_lock(&_dummy_mutex)
+#define DUMMY_UNLOCK() pthread_mutex_unlock(&_dummy_mutex)
+
+/* a thread running queued operations, see dummy_submit */
+struct dummy_meta_worker_s {
+  csync_vio_module_ctx_t *mctx;
+  csync_vio_op_t *op;           /* the operation being run */
+  pthread_t thread;
+};
+
+struct dummy_meta_queue_s {
+  csync_vio_op_t *pending;      /* submitted, in the order of submission */
+  csync_vio_op_t *done;         /* run, not yet reported */
+  int pending_count;
+  int stop;
+  int workers;
+  struct dummy_meta_worker_s worker[DUMMY_META_MAX];
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+  pthread_cond_t finished;
+};
+#else
+#define DUMMY_LOCK()
+#define DUMMY_UNLOCK()
+#endif
+
+/* the state of an instance of the module */
+struct csync_vio_module_ctx_s {
+  int latency;
+  int bandwidth;
+  int error_rate;
+  int max_parallel;
+  int keep_data;
+  int recursive_delete;
+  unsigned int seed;            /* the state of the failures */
+  csync_vio_capabilities_t caps;
+#ifdef HAVE_PTHREAD
+  struct dummy_meta_queue_s meta;
+#endif
+};
+
+/* an open file */
+struct dummy_fhandle_s {
+  struct dummy_node_s *node;
+  off_t offset;
+};
+
+/* an open directory, the names are taken on opendir */
+struct dummy_dhandle_s {
+  struct dummy_node_s *node;
+  c_strlist_t *names;
+  size_t pos;
+};
 
 /*
- * file functions
+ * settings
+ */
+
+static int dummy_set(csync_vio_module_ctx_t *mctx, const char *key, int value) {
+  if (c_streq(key, "latency")) {
+    mctx->latency = value;
+  } else if (c_streq(key, "bandwidth")) {
+    mctx->bandwidth = value;
+  } else if (c_streq(key, "error_rate")) {
+    if (value > 1000) {
+      errno = EINVAL;
+      return -1;
+    }
+    mctx->error_rate = value;
+  } else if (c_streq(key, "seed")) {
+    mctx->seed = value;
+    return 0;
+  } else if (c_streq(key, "max_parallel")) {
+    if (value > DUMMY_META_MAX) {
+      errno = EINVAL;
+      return -1;
+    }
+    mctx->max_parallel = value;
+  } else if (c_streq(key, "keep_data")) {
+    mctx->keep_data = value;
+    return 0;
+  } else if (c_streq(key, "recursive_delete")) {
+    mctx->recursive_delete = value;
+    mctx->caps.recursive_delete_support = value != 0;
+    return 0;
+  } else {
+    return -1;
+  }
+
+  if (value < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* "key=value,key=value" */
+static void dummy_parse_args(csync_vio_module_ctx_t *mctx, const char *args) {
+  char *buf = NULL;
+  char *key = NULL;
+  char *value = NULL;
+  char *save = NULL;
+
+  if (args == NULL || *args == '\0') {
+    return;
+  }
+
+  buf = c_strdup(args);
+  if (buf == NULL) {
+    return;
+  }
+
+  for (key = strtok_r(buf, ",", &save); key != NULL;
+       key = strtok_r(NULL, ",", &save)) {
+    value = strchr(key, '=');
+    if (value == NULL) {
+      continue;
+    }
+    *value++ = '\0';
+    if (dummy_set(mctx, key, atoi(value)) < 0) {
+      DEBUG_DUMMY(("csync_dummy - ignoring %s=%s\n", key, value));
+    }
+  }
+
+  SAFE_FREE(buf);
+}
+
+/*
+ * The cost of an operation on the remote: it waits for the latency and the
+ * transfer of the bytes, outside of the lock, and fails as often as set.
+ */
+static int dummy_remote(csync_vio_module_ctx_t *mctx, size_t bytes) {
+  unsigned long wait = 0;
+  int fail = 0;
+
+  if (mctx->latency > 0) {
+    wait += mctx->latency * 1000UL;
+  }
+  if (mctx->bandwidth > 0 && bytes > 0) {
+    wait += (unsigned long) ((double) bytes * 1000000 / mctx->bandwidth);
+  }
+  if (wait > 0) {
+    usleep(wait);
+  }
+
+  if (mctx->error_rate > 0) {
+    DUMMY_LOCK();
+    mctx->seed = mctx->seed * 1103515245 + 12345;
+    fail = (int) ((mctx->seed >> 16) % 1000) < mctx->error_rate;
+    DUMMY_UNLOCK();
+  }
+  if (fail) {
+    errno = EIO;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * the tree, called with the lock held
  */
 
-static csync_vio_method_handle_t *dummy_open(const char *durl, int flags, mode_t mode) {
-  (void) durl;
-  (void) flags;
-  (void) mode;
+static int dummy_key_cmp(const void *key, const void *data) {
+  const struct dummy_node_s *node = data;
+
+  return strcmp((const char *) key, node->name);
+}
+
+static int dummy_data_cmp(const void *key, const void *data) {
+  const struct dummy_node_s *a = key;
+  const struct dummy_node_s *b = data;
+
+  return strcmp(a->name, b->name);
+}
+
+static struct dummy_node_s *dummy_node_new(const char *name,
+    enum csync_vio_file_type_e type, mode_t mode) {
+  struct dummy_node_s *node;
+
+  node = c_malloc(sizeof(struct dummy_node_s));
+  if (node == NULL) {
+    return NULL;
+  }
+
+  node->name = c_strdup(name);
+  if (node->name == NULL) {
+    SAFE_FREE(node);
+    return NULL;
+  }
+
+  if (type == CSYNC_VIO_FILE_TYPE_DIRECTORY &&
+      c_rbtree_create(&node->children, dummy_key_cmp, dummy_data_cmp) < 0) {
+    SAFE_FREE(node->name);
+    SAFE_FREE(node);
+    return NULL;
+  }
+
+  node->type = type;
+  node->mode = mode & 07777;
+  node->uid = getuid();
+  node->gid = getgid();
+  node->atime = node->mtime = node->ctime = time(NULL);
 
-  return &mh;
+  return node;
 }
 
-static csync_vio_method_handle_t *dummy_creat(const char *durl, mode_t mode) {
-  (void) durl;
-  (void) mode;
+/* frees a node and everything below it, if no handle keeps it open */
+static void dummy_node_free(void *data) {
+  struct dummy_node_s *node = data;
 
-  return &mh;
+  node->parent = NULL;
+  if (node->open_count > 0) {
+    node->unlinked = 1;
+    return;
+  }
+
+  if (node->children != NULL) {
+    c_rbtree_destroy(node->children, dummy_node_free);
+  }
+  SAFE_FREE(node->name);
+  SAFE_FREE(node->data);
+  SAFE_FREE(node);
 }
 
-static int dummy_close(csync_vio_method_handle_t *fhandle) {
-  (void) fhandle;
+static int dummy_node_attach(struct dummy_node_s *dir,
+    struct dummy_node_s *node) {
+  if (c_rbtree_insert(dir->children, node) != 0) {
+    errno = EEXIST;
+    return -1;
+  }
+  node->parent = dir;
+  dir->mtime = time(NULL);
 
   return 0;
 }
 
-static ssize_t dummy_read(csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
-  (void) fhandle;
-  (void) buf;
-  (void) count;
+static void dummy_node_detach(struct dummy_node_s *node) {
+  c_rbnode_t *rbnode;
+
+  if (node->parent == NULL) {
+    return;
+  }
+
+  rbnode = c_rbtree_find(node->parent->children, node->name);
+  if (rbnode != NULL) {
+    c_rbtree_node_delete(rbnode);
+  }
+  node->parent->mtime = time(NULL);
+  node->parent = NULL;
+}
+
+/* the tree of the host of an uri and the path in it */
+static struct dummy_tree_s *dummy_tree(const char *uri, const char **path) {
+  struct dummy_tree_s *tree;
+  const char *host;
+  size_t len;
+
+  host = strstr(uri, "://");
+  host = host != NULL ? host + 3 : uri;
+  len = strcspn(host, "/");
+  *path = host + len;
+
+  for (tree = _dummy_trees; tree != NULL; tree = tree->next) {
+    if (strlen(tree->host) == len && strncmp(tree->host, host, len) == 0) {
+      return tree;
+    }
+  }
+
+  tree = c_malloc(sizeof(struct dummy_tree_s));
+  if (tree == NULL) {
+    return NULL;
+  }
+  tree->host = c_strndup(host, len);
+  tree->root = dummy_node_new("", CSYNC_VIO_FILE_TYPE_DIRECTORY, 0755);
+  if (tree->host == NULL || tree->root == NULL) {
+    SAFE_FREE(tree->host);
+    if (tree->root != NULL) {
+      dummy_node_free(tree->root);
+    }
+    SAFE_FREE(tree);
+    return NULL;
+  }
+  tree->next = _dummy_trees;
+  _dummy_trees = tree;
+
+  return tree;
+}
+
+/*
+ * Walk to the node of an uri. With parent set, it stops at the directory of
+ * the last element and returns it, name points to the last element then.
+ * With create set, missing directories are created on the way.
+ */
+static struct dummy_node_s *dummy_walk(const char *uri, int parent,
+    int create, const char **name) {
+  struct dummy_tree_s *tree;
+  struct dummy_node_s *node;
+  struct dummy_node_s *child;
+  c_rbnode_t *rbnode;
+  const char *path = NULL;
+  const char *next;
+  char elem[1024];
+  size_t len;
+
+  tree = dummy_tree(uri, &path);
+  if (tree == NULL) {
+    return NULL;
+  }
+  node = tree->root;
+
+  for (;;) {
+    while (*path == '/') {
+      path++;
+    }
+    len = strcspn(path, "/");
+    next = path + len;
+    while (*next == '/') {
+      next++;
+    }
+
+    if (len == 0) {
+      if (parent) {
+        /* the root has no parent */
+        errno = EINVAL;
+        return NULL;
+      }
+      return node;
+    }
+    if (parent && *next == '\0') {
+      if (name != NULL) {
+        *name = path;
+      }
+      return node;
+    }
+    if (len >= sizeof(elem)) {
+      errno = ENAMETOOLONG;
+      return NULL;
+    }
+    if (node->type != CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+      errno = ENOTDIR;
+      return NULL;
+    }
+
+    memcpy(elem, path, len);
+    elem[len] = '\0';
+    rbnode = c_rbtree_find(node->children, elem);
+    if (rbnode != NULL) {
+      child = rbnode->data;
+    } else if (create) {
+      child = dummy_node_new(elem, CSYNC_VIO_FILE_TYPE_DIRECTORY, 0755);
+      if (child == NULL || dummy_node_attach(node, child) < 0) {
+        return NULL;
+      }
+    } else {
+      errno = ENOENT;
+      return NULL;
+    }
+
+    node = child;
+    path = next;
+  }
+}
+
+static struct dummy_node_s *dummy_lookup(const char *uri) {
+  return dummy_walk(uri, 0, 0, NULL);
+}
+
+/* the directory of the last element of an uri, with a copy of its name */
+static struct dummy_node_s *dummy_lookup_parent(const char *uri, char **name) {
+  struct dummy_node_s *dir;
+  const char *last = NULL;
+
+  dir = dummy_walk(uri, 1, 0, &last);
+  if (dir == NULL) {
+    return NULL;
+  }
+  if (dir->type != CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+    errno = ENOTDIR;
+    return NULL;
+  }
+
+  *name = c_strndup(last, strcspn(last, "/"));
+  if (*name == NULL) {
+    return NULL;
+  }
+
+  return dir;
+}
+
+static struct dummy_node_s *dummy_child(struct dummy_node_s *dir,
+    const char *name) {
+  c_rbnode_t *rbnode;
+
+  rbnode = c_rbtree_find(dir->children, name);
+
+  return rbnode != NULL ? rbnode->data : NULL;
+}
+
+static void dummy_node_stat(struct dummy_node_s *node,
+    csync_vio_file_stat_t *buf) {
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  buf->type = node->type;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+
+  buf->mode = node->mode;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+
+  buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
+
+  buf->uid = node->uid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
+
+  buf->gid = node->gid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
+
+  buf->size = node->size;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+
+  buf->atime = node->atime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
+
+  buf->mtime = node->mtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  buf->ctime = node->ctime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+}
+
+/*
+ * The operations on the tree, called with the lock held. They are shared by
+ * the methods and the queue.
+ */
+
+static int dummy_do_mkdir(const char *uri, mode_t mode) {
+  struct dummy_node_s *dir;
+  struct dummy_node_s *node;
+  char *name = NULL;
+  int rc = -1;
+
+  dir = dummy_lookup_parent(uri, &name);
+  if (dir == NULL) {
+    return -1;
+  }
+
+  if (dummy_child(dir, name) != NULL) {
+    errno = EEXIST;
+    goto out;
+  }
+
+  node = dummy_node_new(name, CSYNC_VIO_FILE_TYPE_DIRECTORY, mode);
+  if (node == NULL) {
+    goto out;
+  }
+  if (dummy_node_attach(dir, node) < 0) {
+    dummy_node_free(node);
+    goto out;
+  }
+
+  rc = 0;
+out:
+  SAFE_FREE(name);
+  return rc;
+}
+
+static int dummy_do_rmdir(const char *uri, int recursive) {
+  struct dummy_node_s *node;
+
+  node = dummy_lookup(uri);
+  if (node == NULL) {
+    return -1;
+  }
+  if (node->type != CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+    errno = ENOTDIR;
+    return -1;
+  }
+  if (node->parent == NULL) {
+    errno = EBUSY;
+    return -1;
+  }
+  if (node->children->size > 0 && !recursive) {
+    errno = ENOTEMPTY;
+    return -1;
+  }
+
+  dummy_node_detach(node);
+  dummy_node_free(node);
 
   return 0;
 }
 
-static ssize_t dummy_write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
-  (void) fhandle;
-  (void) buf;
-  (void) count;
+static int dummy_do_unlink(const char *uri) {
+  struct dummy_node_s *node;
+
+  node = dummy_lookup(uri);
+  if (node == NULL) {
+    return -1;
+  }
+  if (node->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+    errno = EISDIR;
+    return -1;
+  }
+
+  dummy_node_detach(node);
+  dummy_node_free(node);
 
   return 0;
 }
 
-static off_t dummy_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
-  (void) fhandle;
-  (void) offset;
-  (void) whence;
+static int dummy_do_rename(const char *olduri, const char *newuri) {
+  struct dummy_node_s *node;
+  struct dummy_node_s *dir;
+  struct dummy_node_s *target;
+  struct dummy_node_s *p;
+  char *name = NULL;
+  char *oldname = NULL;
+  int rc = -1;
+
+  node = dummy_lookup(olduri);
+  if (node == NULL) {
+    return -1;
+  }
+  if (node->parent == NULL) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  dir = dummy_lookup_parent(newuri, &name);
+  if (dir == NULL) {
+    return -1;
+  }
+
+  /* a directory can't be moved below itself */
+  for (p = dir; p != NULL; p = p->parent) {
+    if (p == node) {
+      errno = EINVAL;
+      goto out;
+    }
+  }
+
+  target = dummy_child(dir, name);
+  if (target == node) {
+    rc = 0;
+    goto out;
+  }
+  if (target != NULL) {
+    if (target->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+      if (node->type != CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+        errno = EISDIR;
+        goto out;
+      }
+      if (target->children->size > 0) {
+        errno = ENOTEMPTY;
+        goto out;
+      }
+    } else if (node->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+      errno = ENOTDIR;
+      goto out;
+    }
+    dummy_node_detach(target);
+    dummy_node_free(target);
+  }
+
+  dummy_node_detach(node);
+  oldname = node->name;
+  node->name = name;
+  name = NULL;
+  if (dummy_node_attach(dir, node) < 0) {
+    /* can't happen, the name is free */
+    goto out;
+  }
+  node->ctime = time(NULL);
+
+  rc = 0;
+out:
+  SAFE_FREE(name);
+  SAFE_FREE(oldname);
+  return rc;
+}
+
+static int dummy_do_utimes(const char *uri, time_t atime, time_t mtime) {
+  struct dummy_node_s *node;
+
+  node = dummy_lookup(uri);
+  if (node == NULL) {
+    return -1;
+  }
+  node->atime = atime;
+  node->mtime = mtime;
 
   return 0;
 }
 
+/*
+ * file functions
+ */
+
+static csync_vio_method_handle_t *dummy_open(csync_vio_module_ctx_t *mctx,
+    const char *durl, int flags, mode_t mode) {
+  struct dummy_fhandle_s *fh = NULL;
+  struct dummy_node_s *dir;
+  struct dummy_node_s *node;
+  char *name = NULL;
+
+  if (dummy_remote(mctx, 0) < 0) {
+    return NULL;
+  }
+
+  fh = c_malloc(sizeof(struct dummy_fhandle_s));
+  if (fh == NULL) {
+    return NULL;
+  }
+
+  DUMMY_LOCK();
+  dir = dummy_lookup_parent(durl, &name);
+  if (dir == NULL) {
+    goto err;
+  }
+
+  node = dummy_child(dir, name);
+  if (node == NULL) {
+    if (!(flags & O_CREAT)) {
+      errno = ENOENT;
+      goto err;
+    }
+    node = dummy_node_new(name, CSYNC_VIO_FILE_TYPE_REGULAR, mode);
+    if (node == NULL) {
+      goto err;
+    }
+    if (dummy_node_attach(dir, node) < 0) {
+      dummy_node_free(node);
+      goto err;
+    }
+  } else if ((flags & O_CREAT) && (flags & O_EXCL)) {
+    errno = EEXIST;
+    goto err;
+  } else if (node->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+    errno = EISDIR;
+    goto err;
+  } else if (flags & O_TRUNC) {
+    SAFE_FREE(node->data);
+    node->size = node->alloc = 0;
+    node->mtime = time(NULL);
+  }
+
+  node->open_count++;
+  fh->node = node;
+  DUMMY_UNLOCK();
+
+  SAFE_FREE(name);
+  return (csync_vio_method_handle_t *) fh;
+err:
+  DUMMY_UNLOCK();
+  SAFE_FREE(name);
+  SAFE_FREE(fh);
+  return NULL;
+}
+
+static csync_vio_method_handle_t *dummy_creat(csync_vio_module_ctx_t *mctx,
+    const char *durl, mode_t mode) {
+  return dummy_open(mctx, durl, O_CREAT|O_WRONLY|O_TRUNC, mode);
+}
+
+static int dummy_close(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle) {
+  struct dummy_fhandle_s *fh = (struct dummy_fhandle_s *) fhandle;
+  int rc;
+
+  rc = dummy_remote(mctx, 0);
+
+  /* the handle is gone, even if the close fails */
+  DUMMY_LOCK();
+  if (--fh->node->open_count == 0 && fh->node->unlinked) {
+    dummy_node_free(fh->node);
+  }
+  DUMMY_UNLOCK();
+  SAFE_FREE(fh);
+
+  return rc;
+}
+
+static ssize_t dummy_read(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+  struct dummy_fhandle_s *fh = (struct dummy_fhandle_s *) fhandle;
+  struct dummy_node_s *node = fh->node;
+  size_t len = 0;
+
+  DUMMY_LOCK();
+  if ((size_t) fh->offset < node->size) {
+    len = MIN(count, node->size - fh->offset);
+    if (node->data != NULL) {
+      memcpy(buf, node->data + fh->offset, len);
+    } else {
+      memset(buf, 0, len);
+    }
+  }
+  DUMMY_UNLOCK();
+
+  if (dummy_remote(mctx, len) < 0) {
+    return -1;
+  }
+  fh->offset += len;
+
+  return len;
+}
+
+static ssize_t dummy_write(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
+  struct dummy_fhandle_s *fh = (struct dummy_fhandle_s *) fhandle;
+  struct dummy_node_s *node = fh->node;
+  size_t end = fh->offset + count;
+  size_t alloc;
+  char *data;
+
+  if (dummy_remote(mctx, count) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  if (mctx->keep_data) {
+    if (end > node->alloc) {
+      alloc = MAX(end, node->alloc * 2);
+      data = c_realloc(node->data, alloc);
+      if (data == NULL) {
+        DUMMY_UNLOCK();
+        return -1;
+      }
+      /* a gap after a seek past the end reads as zeros */
+      memset(data + node->alloc, 0, alloc - node->alloc);
+      node->data = data;
+      node->alloc = alloc;
+    }
+    memcpy(node->data + fh->offset, buf, count);
+  }
+  if (end > node->size) {
+    node->size = end;
+  }
+  node->mtime = time(NULL);
+  DUMMY_UNLOCK();
+
+  fh->offset = end;
+
+  return count;
+}
+
+static off_t dummy_lseek(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
+  struct dummy_fhandle_s *fh = (struct dummy_fhandle_s *) fhandle;
+  off_t pos;
+
+  (void) mctx;
+
+  switch (whence) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = fh->offset + offset;
+      break;
+    case SEEK_END:
+      DUMMY_LOCK();
+      pos = fh->node->size + offset;
+      DUMMY_UNLOCK();
+      break;
+    default:
+      errno = EINVAL;
+      return (off_t) -1;
+  }
+
+  if (pos < 0) {
+    errno = EINVAL;
+    return (off_t) -1;
+  }
+  fh->offset = pos;
+
+  return pos;
+}
+
+static int dummy_close_stat(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_file_stat_t *buf) {
+  struct dummy_fhandle_s *fh = (struct dummy_fhandle_s *) fhandle;
+
+  /* the stat comes with the answer of the close, no extra round trip */
+  DUMMY_LOCK();
+  dummy_node_stat(fh->node, buf);
+  DUMMY_UNLOCK();
+
+  return dummy_close(mctx, fhandle);
+}
+
 /*
  * directory functions
  */
 
-static csync_vio_method_handle_t *dummy_opendir(const char *name) {
-  (void) name;
+static int dummy_collect_name(void *obj, void *data) {
+  struct dummy_node_s *node = obj;
+
+  return c_strlist_add((c_strlist_t *) data, node->name);
+}
+
+static csync_vio_method_handle_t *dummy_opendir(csync_vio_module_ctx_t *mctx,
+    const char *name) {
+  struct dummy_dhandle_s *dh = NULL;
+  struct dummy_tree_s *tree;
+  struct dummy_node_s *node;
+  const char *path = NULL;
+  c_rbnode_t *rbnode;
+
+  if (dummy_remote(mctx, 0) < 0) {
+    return NULL;
+  }
 
-  return &mh;
+  DUMMY_LOCK();
+  tree = dummy_tree(name, &path);
+  if (tree == NULL) {
+    goto err;
+  }
+  if (!tree->root_made) {
+    /* the root of the replica */
+    DEBUG_DUMMY(("csync_dummy - creating %s\n", name));
+    tree->root_made = 1;
+    node = dummy_walk(name, 0, 1, NULL);
+  } else {
+    node = dummy_lookup(name);
+  }
+  if (node == NULL) {
+    goto err;
+  }
+  if (node->type != CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+    errno = ENOTDIR;
+    goto err;
+  }
+
+  dh = c_malloc(sizeof(struct dummy_dhandle_s));
+  if (dh == NULL) {
+    goto err;
+  }
+  dh->names = c_strlist_new(MAX(node->children->size, 1));
+  if (dh->names == NULL) {
+    goto err;
+  }
+  for (rbnode = c_rbtree_head(node->children); rbnode != NULL;
+       rbnode = c_rbtree_node_next(rbnode)) {
+    if (dummy_collect_name(rbnode->data, dh->names) < 0) {
+      goto err;
+    }
+  }
+  dh->node = node;
+  node->open_count++;
+  DUMMY_UNLOCK();
+
+  return (csync_vio_method_handle_t *) dh;
+err:
+  DUMMY_UNLOCK();
+  if (dh != NULL) {
+    c_strlist_destroy(dh->names);
+    SAFE_FREE(dh);
+  }
+  return NULL;
 }
 
-static int dummy_closedir(csync_vio_method_handle_t *dhandle) {
-  (void) dhandle;
+static int dummy_closedir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
+  struct dummy_dhandle_s *dh = (struct dummy_dhandle_s *) dhandle;
+
+  (void) mctx;
+
+  DUMMY_LOCK();
+  if (--dh->node->open_count == 0 && dh->node->unlinked) {
+    dummy_node_free(dh->node);
+  }
+  DUMMY_UNLOCK();
+
+  c_strlist_destroy(dh->names);
+  SAFE_FREE(dh);
 
   return 0;
 }
 
-static csync_vio_file_stat_t *dummy_readdir(csync_vio_method_handle_t *dhandle) {
-  (void) dhandle;
+/* the listing came with opendir, entries removed since are skipped */
+static csync_vio_file_stat_t *dummy_readdir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
+  struct dummy_dhandle_s *dh = (struct dummy_dhandle_s *) dhandle;
+  struct dummy_node_s *node = NULL;
+  csync_vio_file_stat_t *fs;
+
+  (void) mctx;
+
+  fs = csync_vio_file_stat_new();
+  if (fs == NULL) {
+    return NULL;
+  }
 
-  return &fs;
+  DUMMY_LOCK();
+  while (node == NULL && dh->pos < dh->names->count) {
+    if (!dh->node->unlinked) {
+      node = dummy_child(dh->node, dh->names->vector[dh->pos]);
+    }
+    dh->pos++;
+  }
+  if (node != NULL) {
+    dummy_node_stat(node, fs);
+    fs->name = c_strdup(node->name);
+  }
+  DUMMY_UNLOCK();
+
+  if (node == NULL || fs->name == NULL) {
+    csync_vio_file_stat_destroy(fs);
+    return NULL;
+  }
+
+  return fs;
 }
 
-static int dummy_mkdir(const char *uri, mode_t mode) {
-  (void) uri;
-  (void) mode;
+static int dummy_mkdir(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
+  int rc;
 
-  return 0;
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  rc = dummy_do_mkdir(uri, mode);
+  DUMMY_UNLOCK();
+
+  return rc;
 }
 
-static int dummy_rmdir(const char *uri) {
-  (void) uri;
+static int dummy_rmdir(csync_vio_module_ctx_t *mctx, const char *uri) {
+  int rc;
 
-  return 0;
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  rc = dummy_do_rmdir(uri, mctx->recursive_delete);
+  DUMMY_UNLOCK();
+
+  return rc;
 }
 
-static int dummy_stat(const char *uri, csync_vio_file_stat_t *buf) {
-  time_t now;
+static int dummy_stat(csync_vio_module_ctx_t *mctx, const char *uri,
+    csync_vio_file_stat_t *buf) {
+  struct dummy_node_s *node;
+
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  node = dummy_lookup(uri);
+  if (node != NULL) {
+    dummy_node_stat(node, buf);
+  }
+  DUMMY_UNLOCK();
+
+  if (node == NULL) {
+    return -1;
+  }
 
   buf->name = c_basename(uri);
   if (buf->name == NULL) {
-    csync_vio_file_stat_destroy(buf);
     return -1;
   }
-  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-
-  time(&now);
-  buf->mtime = now;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
 
   return 0;
 }
 
-static int dummy_rename(const char *olduri, const char *newuri) {
-  (void) olduri;
-  (void) newuri;
+static int dummy_checksum(csync_vio_module_ctx_t *mctx, const char *uri,
+    const char *type, char *buf, size_t len) {
+  struct dummy_node_s *node;
+  char zeros[4096] = {0};
+  c_sha1_t sha1;
+  size_t done;
+  size_t n;
 
-  return 0;
+  if (!c_streq(type, "SHA1") || len < C_SHA1_HEX_LEN) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  node = dummy_lookup(uri);
+  if (node != NULL && node->type != CSYNC_VIO_FILE_TYPE_REGULAR) {
+    errno = EISDIR;
+    node = NULL;
+  }
+  if (node != NULL) {
+    c_sha1_init(&sha1);
+    if (node->data != NULL) {
+      c_sha1_update(&sha1, node->data, node->size);
+    } else {
+      for (done = 0; done < node->size; done += n) {
+        n = node->size - done < sizeof(zeros) ? node->size - done : sizeof(zeros);
+        c_sha1_update(&sha1, zeros, n);
+      }
+    }
+    c_sha1_final(&sha1, buf);
+  }
+  DUMMY_UNLOCK();
+
+  return node != NULL ? 0 : -1;
 }
 
-static int dummy_unlink(const char *uri) {
-  (void) uri;
+static int dummy_rename(csync_vio_module_ctx_t *mctx, const char *olduri,
+    const char *newuri) {
+  int rc;
 
-  return 0;
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  rc = dummy_do_rename(olduri, newuri);
+  DUMMY_UNLOCK();
+
+  return rc;
 }
 
-static int dummy_chmod(const char *uri, mode_t mode) {
-  (void) uri;
-  (void) mode;
+static int dummy_unlink(csync_vio_module_ctx_t *mctx, const char *uri) {
+  int rc;
 
-  return 0;
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  rc = dummy_do_unlink(uri);
+  DUMMY_UNLOCK();
+
+  return rc;
+}
+
+static int dummy_chmod(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
+  struct dummy_node_s *node;
+
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  node = dummy_lookup(uri);
+  if (node != NULL) {
+    node->mode = mode & 07777;
+  }
+  DUMMY_UNLOCK();
+
+  return node != NULL ? 0 : -1;
+}
+
+static int dummy_chown(csync_vio_module_ctx_t *mctx, const char *uri,
+    uid_t owner, gid_t group) {
+  struct dummy_node_s *node;
+
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  node = dummy_lookup(uri);
+  if (node != NULL) {
+    node->uid = owner;
+    node->gid = group;
+  }
+  DUMMY_UNLOCK();
+
+  return node != NULL ? 0 : -1;
+}
+
+static int dummy_utimes(csync_vio_module_ctx_t *mctx, const char *uri,
+    const struct timeval *times) {
+  time_t now = time(NULL);
+  int rc;
+
+  if (dummy_remote(mctx, 0) < 0) {
+    return -1;
+  }
+
+  DUMMY_LOCK();
+  if (times == NULL) {
+    rc = dummy_do_utimes(uri, now, now);
+  } else {
+    rc = dummy_do_utimes(uri, times[0].tv_sec, times[1].tv_sec);
+  }
+  DUMMY_UNLOCK();
+
+  return rc;
+}
+
+/*
+ * The queue of operations, see csync_vio_op_t. With max_parallel set it
+ * behaves like the queues of the network modules: the operations wait for
+ * the latency on threads, as many at the same time as set.
+ */
+#ifdef HAVE_PTHREAD
+/* one of the paths is the other one or below it */
+static int dummy_meta_path_conflict(const char *a, const char *b) {
+  size_t la, lb;
+
+  if (a == NULL || b == NULL) {
+    return 0;
+  }
+  la = strlen(a);
+  lb = strlen(b);
+  if (la > lb) {
+    const char *t = a;
+    a = b;
+    b = t;
+    la = lb;
+  }
+  if (strncmp(a, b, la) != 0) {
+    return 0;
+  }
+  return b[la] == '\0' || b[la] == '/' || (la > 0 && a[la - 1] == '/');
+}
+
+static int dummy_meta_op_conflict(const csync_vio_op_t *a,
+    const csync_vio_op_t *b) {
+  return dummy_meta_path_conflict(a->uri, b->uri) ||
+         dummy_meta_path_conflict(a->uri, b->newuri) ||
+         dummy_meta_path_conflict(a->newuri, b->uri) ||
+         dummy_meta_path_conflict(a->newuri, b->newuri);
+}
+
+/*
+ * The next operation which can run: it must not touch the path of a running
+ * operation or of one submitted before it. Called with the mutex held.
+ */
+static csync_vio_op_t *dummy_meta_next(struct dummy_meta_queue_s *q) {
+  csync_vio_op_t *op = NULL;
+  csync_vio_op_t *prev = NULL;
+  csync_vio_op_t *before = NULL;
+  int blocked;
+  int i;
+
+  for (op = q->pending; op != NULL; prev = op, op = op->next) {
+    blocked = 0;
+    for (i = 0; i < q->workers && !blocked; i++) {
+      if (q->worker[i].op != NULL &&
+          dummy_meta_op_conflict(op, q->worker[i].op)) {
+        blocked = 1;
+      }
+    }
+    for (before = q->pending; before != op && !blocked; before = before->next) {
+      blocked = dummy_meta_op_conflict(op, before);
+    }
+    if (!blocked) {
+      if (prev != NULL) {
+        prev->next = op->next;
+      } else {
+        q->pending = op->next;
+      }
+      op->next = NULL;
+      q->pending_count--;
+      return op;
+    }
+  }
+
+  return NULL;
+}
+
+static void dummy_meta_run(csync_vio_module_ctx_t *mctx, csync_vio_op_t *op) {
+  int rc = -1;
+
+  op->rc = -1;
+  op->err = 0;
+
+  if (dummy_remote(mctx, 0) < 0) {
+    op->err = errno;
+    return;
+  }
+
+  DUMMY_LOCK();
+  switch (op->type) {
+    case CSYNC_VIO_OP_MKDIR:
+      rc = dummy_do_mkdir(op->uri, op->mode);
+      break;
+    case CSYNC_VIO_OP_RMDIR:
+      rc = dummy_do_rmdir(op->uri, mctx->recursive_delete);
+      break;
+    case CSYNC_VIO_OP_UNLINK:
+      rc = dummy_do_unlink(op->uri);
+      break;
+    case CSYNC_VIO_OP_RENAME:
+      rc = dummy_do_rename(op->uri, op->newuri);
+      break;
+    case CSYNC_VIO_OP_UTIMES:
+      rc = dummy_do_utimes(op->uri, op->mtime, op->mtime);
+      break;
+    default:
+      errno = EINVAL;
+      break;
+  }
+  if (rc < 0) {
+    op->err = errno;
+  } else {
+    op->rc = 0;
+  }
+  DUMMY_UNLOCK();
+}
+
+static void *dummy_meta_worker(void *userdata) {
+  struct dummy_meta_worker_s *worker = userdata;
+  struct dummy_meta_queue_s *q = &worker->mctx->meta;
+  csync_vio_op_t *op = NULL;
+  csync_vio_op_t **tail = NULL;
+
+  pthread_mutex_lock(&q->mutex);
+  for (;;) {
+    while (!q->stop && (op = dummy_meta_next(q)) == NULL) {
+      pthread_cond_wait(&q->work, &q->mutex);
+    }
+    if (op == NULL) {
+      break;
+    }
+    worker->op = op;
+    pthread_mutex_unlock(&q->mutex);
+
+    dummy_meta_run(worker->mctx, op);
+
+    pthread_mutex_lock(&q->mutex);
+    worker->op = NULL;
+    for (tail = &q->done; *tail != NULL; tail = &(*tail)->next);
+    *tail = op;
+    /* operations waiting for this one may run now */
+    pthread_cond_broadcast(&q->work);
+    pthread_cond_broadcast(&q->finished);
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  return NULL;
 }
+#endif
+
+static int dummy_submit(csync_vio_module_ctx_t *mctx, csync_vio_op_t *op) {
+#ifdef HAVE_PTHREAD
+  struct dummy_meta_queue_s *q = &mctx->meta;
+  struct dummy_meta_worker_s *worker;
+  csync_vio_op_t **tail = NULL;
+
+  if (op == NULL || op->uri == NULL || op->done == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (mctx->max_parallel < 1) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  pthread_mutex_lock(&q->mutex);
+  if (q->workers < q->pending_count + 1 && q->workers < mctx->max_parallel) {
+    worker = &q->worker[q->workers];
+    worker->mctx = mctx;
+    worker->op = NULL;
+    if (pthread_create(&worker->thread, NULL, dummy_meta_worker, worker) == 0) {
+      q->workers++;
+    }
+  }
+  if (q->workers == 0) {
+    pthread_mutex_unlock(&q->mutex);
+    errno = ENOTSUP;
+    return -1;
+  }
 
-static int dummy_chown(const char *uri, uid_t owner, gid_t group) {
-  (void) uri;
-  (void) owner;
-  (void) group;
+  while (q->pending_count >= DUMMY_META_QUEUE_MAX) {
+    pthread_cond_wait(&q->finished, &q->mutex);
+  }
+
+  op->next = NULL;
+  op->rc = -1;
+  op->err = 0;
+  for (tail = &q->pending; *tail != NULL; tail = &(*tail)->next);
+  *tail = op;
+  q->pending_count++;
+
+  pthread_cond_signal(&q->work);
+  pthread_mutex_unlock(&q->mutex);
 
   return 0;
+#else
+  (void) mctx;
+  (void) op;
+  errno = ENOTSUP;
+  return -1;
+#endif
 }
 
-static int dummy_utimes(const char *uri, const struct timeval *times) {
-  (void) uri;
-  (void) times;
+static int dummy_complete(csync_vio_module_ctx_t *mctx, int wait) {
+#ifdef HAVE_PTHREAD
+  struct dummy_meta_queue_s *q = &mctx->meta;
+  csync_vio_op_t *done = NULL;
+  csync_vio_op_t *next = NULL;
+  int running;
+  int count = 0;
+  int i;
+
+  pthread_mutex_lock(&q->mutex);
+  for (;;) {
+    done = q->done;
+    q->done = NULL;
+
+    /* the callbacks may submit again */
+    pthread_mutex_unlock(&q->mutex);
+    for (; done != NULL; done = next) {
+      next = done->next;
+      done->next = NULL;
+      done->done(done);
+      count++;
+    }
+    pthread_mutex_lock(&q->mutex);
+
+    running = 0;
+    for (i = 0; i < q->workers; i++) {
+      if (q->worker[i].op != NULL) {
+        running = 1;
+      }
+    }
+    if (!wait || (q->pending == NULL && !running && q->done == NULL)) {
+      break;
+    }
+    if (q->done == NULL) {
+      pthread_cond_wait(&q->finished, &q->mutex);
+    }
+  }
+
+  if (!wait || q->workers == 0) {
+    pthread_mutex_unlock(&q->mutex);
+    return count;
+  }
+
+  q->stop = 1;
+  pthread_cond_broadcast(&q->work);
+  pthread_mutex_unlock(&q->mutex);
+
+  for (i = 0; i < q->workers; i++) {
+    pthread_join(q->worker[i].thread, NULL);
+  }
+  q->workers = 0;
+  q->stop = 0;
 
+  return count;
+#else
+  (void) mctx;
+  (void) wait;
   return 0;
+#endif
 }
 
-static int dummy_commit() {
+static int dummy_set_property(csync_vio_module_ctx_t *mctx, const char *key,
+    void *data) {
+  if (data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return dummy_set(mctx, key, *(int *) data);
+}
+
+static int dummy_commit(csync_vio_module_ctx_t *mctx) {
+  dummy_complete(mctx, 1);
+
   return 0;
 }
 
+static csync_vio_capabilities_t *dummy_get_capabilities(csync_vio_module_ctx_t *mctx) {
+  return &mctx->caps;
+}
+
 csync_vio_method_t dummy_method = {
   .method_table_size = sizeof(csync_vio_method_t),
   .open = dummy_open,
@@ -194,27 +1515,65 @@ csync_vio_method_t dummy_method = {
   .chmod = dummy_chmod,
   .chown = dummy_chown,
   .utimes = dummy_utimes,
-  .commit = dummy_commit
+  .set_property = dummy_set_property,
+  .commit = dummy_commit,
+  .get_capabilities = dummy_get_capabilities,
+  .close_stat = dummy_close_stat,
+  .submit = dummy_submit,
+  .complete = dummy_complete,
+  .checksum = dummy_checksum
 };
 
 csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
-    csync_auth_callback cb, void *userdata) {
+    csync_auth_callback cb, void *userdata, csync_vio_module_ctx_t **mctx) {
   DEBUG_DUMMY(("csync_dummy - method_name: %s\n", method_name));
   DEBUG_DUMMY(("csync_dummy - args: %s\n", args));
 
   (void) method_name;
-  (void) args;
   (void) cb;
   (void) userdata;
 
-  mh = (void *) method_name;
-  fs.mtime = 42;
+  *mctx = c_malloc(sizeof(csync_vio_module_ctx_t));
+  if (*mctx == NULL) {
+    return NULL;
+  }
+
+  (*mctx)->keep_data = 1;
+  (*mctx)->seed = 1;
+  /* a file is written at any offset, like over sftp */
+  (*mctx)->caps.delta_transfer_support = true;
+
+  if (args == NULL) {
+    args = getenv("CSYNC_DUMMY_ARGS");
+  }
+  dummy_parse_args(*mctx, args);
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&(*mctx)->meta.mutex, NULL);
+  pthread_cond_init(&(*mctx)->meta.work, NULL);
+  pthread_cond_init(&(*mctx)->meta.finished, NULL);
+#endif
 
   return &dummy_method;
 }
 
-void vio_module_shutdown(csync_vio_method_t *method) {
+void vio_module_shutdown(csync_vio_method_t *method,
+    csync_vio_module_ctx_t *mctx) {
   (void) method;
+
+  if (mctx == NULL) {
+    return;
+  }
+
+  dummy_complete(mctx, 1);
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&mctx->meta.mutex);
+  pthread_cond_destroy(&mctx->meta.work);
+  pthread_cond_destroy(&mctx->meta.finished);
+#endif
+
+  SAFE_FREE(mctx);
 }
 
 /* vim: set ts=8 sw=2 et cindent: */
@@ -19,6 +19,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <time.h>
@@ -27,17 +28,22 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include <neon/ne_basic.h>
 #include <neon/ne_socket.h>
 #include <neon/ne_session.h>
 #include <neon/ne_request.h>
 #include <neon/ne_props.h>
+#include <neon/ne_string.h>
 #include <neon/ne_auth.h>
 #include <neon/ne_dates.h>
 #include <neon/ne_compress.h>
 
 #include "c_lib.h"
+#include "c_jhash.h"
 #include "csync.h"
 #include "c_private.h"
 #include "csync_macros.h"
@@ -89,6 +95,7 @@ typedef struct resource {
  * a directory listing from the server.
  */
 struct listdir_context {
+    csync_vio_module_ctx_t *dav;     /* The session the listing is fetched with */
     struct resource *list;           /* The list of result resources */
     struct resource *currResource;   /* A pointer to the current resource */
     char            *target;        /* Request-URI of the PROPFIND */
@@ -97,27 +104,142 @@ struct listdir_context {
 };
 
 /*
- * context to store info about a temp file for GET and PUT requests
- * which store the data in a local file to save memory and secure the
- * transmission.
+ * context of an open file, a GET or a PUT request. The body of a GET is
+ * streamed to the reader, the body of a PUT is pulled from the source by
+ * owncloud_sendfile or buffered by owncloud_write, in memory or spooled to
+ * a temporary file, and sent the same way on close.
  */
 struct transfer_context {
     ne_request *req;            /* the neon request */
-    int         fd;             /* file descriptor of the file to read or write from */
-    char        *tmpFileName;   /* the name of the temp file */
     size_t      bytes_written;  /* the amount of bytes written or read */
     const char  *method;        /* the HTTP method, either PUT or GET  */
     ne_decompress *decompress;  /* the decompress context */
-    int         fileWritten;    /* flag to indicate that a buffer file was written for PUTs */
+    char        *url;           /* the url of a GET request, until the download started */
+    off_t       offset;         /* the offset to start a GET request at */
+    ne_session  *session;       /* the pooled session of the request */
+    int         readerInstalled; /* the body reader of the GET is installed */
+    char        *buf;           /* body data of the GET not yet read, or of the PUT */
+    FILE        *spool;         /* body data of the PUT once it outgrew the buffer */
+    size_t      bufSize;        /* the allocated size of buf */
+    size_t      bufLen;         /* the amount of data in buf */
+    size_t      bufPos;         /* the position of the next read in buf */
+    off_t       skip;           /* bytes to drop if the server ignored the range */
+    int         readDone;       /* the whole body of the GET has been read */
+    int         sent;           /* the PUT has been sent by owncloud_sendfile */
+    char        *path;          /* the path of a PUT request */
+    time_t      mtime;          /* the mtime sent with the PUT, 0 if none */
+    int         mtimeAccepted;  /* the server has set the mtime of the PUT */
+};
+
+/* The header carrying the mtime of an upload, and the server's answer */
+#define DAV_MTIME_HEADER "X-OC-Mtime"
+#define DAV_MTIME_ACCEPTED "accepted"
+
+/* The initial size of the body buffer of a request */
+#define TRANSFER_BUFFER_SIZE 64*1024
+/* The size of the blocks the body of a GET request is read in */
+#define GET_BLOCK_SIZE 1024*16
+/* Data written to a PUT beyond this size is spooled to a temporary file */
+#define PUT_SPOOL_SIZE 1024*1024
+
+/* The number of sessions in the pool, the default and the maximum */
+#define DAV_POOL_SIZE 4
+#define DAV_POOL_MAX 16
+
+/* Connections idle longer than this are most likely closed by the server */
+#define DAV_POOL_IDLE_TIMEOUT 30
+
+/*
+ * Files larger than the chunk size are uploaded in chunks of that size, the
+ * server assembles them. This many chunks are sent at the same time, each on
+ * its own session, and each chunk is tried this often.
+ */
+#define DAV_CHUNK_SIZE 10*1024*1024
+#define DAV_CHUNK_PARALLEL 3
+#define DAV_CHUNK_RETRIES 3
+
+/*
+ * Queued metadata operations are run by this many threads, each on its own
+ * session. The sessions are taken from the pool as long as it keeps enough
+ * for the transfers. Submitting blocks while the queue is full.
+ */
+#define DAV_META_PARALLEL 4
+#define DAV_META_RESERVED 2
+#define DAV_META_QUEUE_MAX 256
+
+/* A neon session of the pool, it keeps its connection open between requests */
+struct dav_pool_entry_s {
+    ne_session *sess;
+    int in_use;
+    time_t last_used;
+};
+
+#ifdef HAVE_PTHREAD
+/* A thread running queued metadata operations, see owncloud_submit */
+struct dav_meta_worker_s {
+    csync_vio_module_ctx_t *dav;
+    ne_session *sess;
+    csync_vio_op_t *op;         /* the operation being run */
+    pthread_t thread;
+};
+
+struct dav_meta_queue_s {
+    csync_vio_op_t *pending;    /* submitted, in the order of submission */
+    csync_vio_op_t *done;       /* run, not yet reported */
+    int pendingCount;
+    int stop;
+    int workers;
+    struct dav_meta_worker_s worker[DAV_POOL_MAX];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t finished;
 };
+#endif
 
-/* Struct with the WebDAV session */
-struct dav_session_s {
-    ne_session *ctx;
+/*
+ * Struct with the WebDAV session, the state of an instance of the module.
+ * It is created by vio_module_init and passed to every method.
+ */
+struct csync_vio_module_ctx_s {
+    ne_session *ctx;    /* the session of the current request */
     char *user;
     char *pwd;
 
     char *error_string;
+
+    char protocol[6];
+    char *host;
+    unsigned int port;
+    int useSSL;
+
+    struct dav_pool_entry_s pool[DAV_POOL_MAX];
+    int pool_size;
+
+    struct csync_connection_stats_s stats;
+
+    off_t chunk_size;   /* 0 disables the chunked upload */
+    int chunk_parallel;
+
+    int meta_parallel;  /* 0 disables the queue of metadata operations */
+
+    struct csync_stat_cache_stats_s stat_cache_stats;
+
+    int connected;      /* flag to indicate if a connection exists, ie. the
+                           session data is valid */
+
+    csync_auth_callback authcb;
+    void *userdata;
+
+    char acceptedCert[NE_SSL_DIGESTLEN]; /* digest of the accepted cert */
+
+    c_rbtree_t *statCache;      /* see _stat_cache_add */
+    c_rbtree_t *knownDirs;      /* see _known_dir_add */
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;      /* see DAV_LOCK */
+    struct dav_meta_queue_s meta;
+#endif
 };
 
 /* The list of properties that is fetched in PropFind on a collection */
@@ -128,29 +250,31 @@ static const ne_propname ls_props[] = {
     { NULL, NULL }
 };
 
+/* The checksums an ownCloud server keeps of a file, "SHA1:<hex> MD5:<hex>" */
+static const ne_propname checksum_props[] = {
+    { "http://owncloud.org/ns", "checksums" },
+    { NULL, NULL }
+};
+
 /*
- * local variables.
+ * The chunks of an upload are sent by threads, which share the statistics
+ * and the callbacks asking the user with the main thread.
  */
-
-struct dav_session_s dav_session; /* The DAV Session, initialised in dav_connect */
-int _connected;                   /* flag to indicate if a connection exists, ie.
-                                     the dav_session is valid */
-csync_vio_file_stat_t _fs;
-
-csync_auth_callback _authcb;
-void *_userdata;
-
-#define PUT_BUFFER_SIZE 1024*5
-
-char _buffer[PUT_BUFFER_SIZE];
+#ifdef HAVE_PTHREAD
+#define DAV_LOCK(dav) pthread_mutex_lock( &(dav)->mutex )
+#define DAV_UNLOCK(dav) pthread_mutex_unlock( &(dav)->mutex )
+#else
+#define DAV_LOCK(dav) (void) (dav)
+#define DAV_UNLOCK(dav) (void) (dav)
+#endif
 
 /* ***************************************************************************** */
 
-static void set_error_message( const char *msg )
+static void set_error_message( csync_vio_module_ctx_t *dav, const char *msg )
 {
-    SAFE_FREE(dav_session.error_string);
+    SAFE_FREE(dav->error_string);
     if( msg )
-        dav_session.error_string = c_strdup(msg);
+        dav->error_string = c_strdup(msg);
 }
 
 
@@ -216,12 +340,12 @@ static void set_errno_from_http_errcode( int err ) {
     errno = new_errno;
 }
 
-static int http_result_code_from_session() {
-    const char *p = ne_get_error( dav_session.ctx );
+static int http_result_code_from_session( csync_vio_module_ctx_t *dav ) {
+    const char *p = ne_get_error( dav->ctx );
     char *q;
     int err;
 
-    set_error_message(p); /* remember the error message */
+    set_error_message(dav, p); /* remember the error message */
 
     err = strtol(p, &q, 10);
     if (p == q) {
@@ -230,8 +354,8 @@ static int http_result_code_from_session() {
     return err;
 }
 
-static void set_errno_from_session() {
-    int err = http_result_code_from_session();
+static void set_errno_from_session( csync_vio_module_ctx_t *dav ) {
+    int err = http_result_code_from_session( dav );
 
     if( err == EIO || err == ERRNO_ERROR_STRING) {
         errno = err;
@@ -240,7 +364,7 @@ static void set_errno_from_session() {
     }
 }
 
-static void set_errno_from_neon_errcode( int neon_code ) {
+static void set_errno_from_neon_errcode( csync_vio_module_ctx_t *dav, int neon_code ) {
 
     if( neon_code != NE_OK ) {
         DEBUG_WEBDAV(("Neon error code was %d", neon_code));
@@ -249,7 +373,7 @@ static void set_errno_from_neon_errcode( int neon_code ) {
     switch(neon_code) {
     case NE_OK:     /* Success, but still the possiblity of problems */
     case NE_ERROR:  /* Generic error; use ne_get_error(session) for message */
-        set_errno_from_session(); /* Something wrong with http communication */
+        set_errno_from_session( dav ); /* Something wrong with http communication */
         break;
     case NE_LOOKUP:  /* Server or proxy hostname lookup failed */
         errno = ERRNO_LOOKUP_ERROR;
@@ -320,14 +444,22 @@ static void addSSLWarning( char *ptr, const char *warn, int len )
  * it to the csync callback to ask the user.
  */
 #define LEN 4096
-static int verify_sslcert(void *userdata, int failures,
-                          const ne_ssl_certificate *cert)
+
+static int _verify_sslcert(void *userdata, int failures,
+                           const ne_ssl_certificate *cert)
 {
+    csync_vio_module_ctx_t *dav = userdata;
     char problem[LEN];
     char buf[NE_ABUFSIZ];
+    char digest[NE_SSL_DIGESTLEN];
     int ret = -1;
 
-    (void) cert;
+    /* the sessions of the pool ask only once for the same certificate */
+    if( ne_ssl_cert_digest( cert, digest ) == 0 &&
+        strcmp( digest, dav->acceptedCert ) == 0 ) {
+        return 0;
+    }
+
     memset( problem, 0, LEN );
 
     addSSLWarning( problem, "There are problems with the SSL certificate:\n", LEN );
@@ -354,13 +486,16 @@ static int verify_sslcert(void *userdata, int failures,
 
     addSSLWarning( problem, "Do you want to accept the certificate anyway?\nAnswer yes to do so and take the risk: ", LEN );
 
-    if( _authcb ){
+    if( dav->authcb ){
         /* call the csync callback */
         DEBUG_WEBDAV(("Call the csync callback for SSL problems\n"));
         memset( buf, 0, NE_ABUFSIZ );
-        (*_authcb) ( problem, buf, NE_ABUFSIZ-1, 1, 0, userdata );
+        (*dav->authcb) ( problem, buf, NE_ABUFSIZ-1, 1, 0, dav->userdata );
         if( strcmp( buf, "yes" ) == 0 ) {
             ret = 0;
+            if( ne_ssl_cert_digest( cert, digest ) == 0 ) {
+                strncpy( dav->acceptedCert, digest, NE_SSL_DIGESTLEN );
+            }
         }
     }
     DEBUG_WEBDAV(("## VERIFY_SSL CERT: %d\n", ret  ));
@@ -371,31 +506,44 @@ static int verify_sslcert(void *userdata, int failures,
  * Authentication callback. Is set by ne_set_server_auth to be called
  * from the neon lib to authenticate a request.
  */
-static int ne_auth( void *userdata, const char *realm, int attempt,
-                    char *username, char *password)
+static int verify_sslcert(void *userdata, int failures,
+                          const ne_ssl_certificate *cert)
+{
+    csync_vio_module_ctx_t *dav = userdata;
+    int ret;
+
+    DAV_LOCK(dav);
+    ret = _verify_sslcert( userdata, failures, cert );
+    DAV_UNLOCK(dav);
+
+    return ret;
+}
+
+static int _ne_auth( void *userdata, const char *realm, int attempt,
+                     char *username, char *password)
 {
+    csync_vio_module_ctx_t *dav = userdata;
     char buf[NE_ABUFSIZ];
 
-    (void) userdata;
     (void) realm;
 
     /* DEBUG_WEBDAV(( "Authentication required %s\n", realm )); */
     if( username && password ) {
         DEBUG_WEBDAV(( "Authentication required %s\n", username ));
-        if( dav_session.user ) {
+        if( dav->user ) {
             /* allow user without password */
-            strncpy( username, dav_session.user, NE_ABUFSIZ);
-            if( dav_session.pwd ) {
-                strncpy( password, dav_session.pwd, NE_ABUFSIZ );
+            strncpy( username, dav->user, NE_ABUFSIZ);
+            if( dav->pwd ) {
+                strncpy( password, dav->pwd, NE_ABUFSIZ );
             }
-        } else if( _authcb != NULL ){
+        } else if( dav->authcb != NULL ){
             /* call the csync callback */
             DEBUG_WEBDAV(("Call the csync callback for %s\n", realm ));
             memset( buf, 0, NE_ABUFSIZ );
-            (*_authcb) ("Enter your username: ", buf, NE_ABUFSIZ-1, 1, 0, userdata );
+            (*dav->authcb) ("Enter your username: ", buf, NE_ABUFSIZ-1, 1, 0, dav->userdata );
             strncpy( username, buf, NE_ABUFSIZ );
             memset( buf, 0, NE_ABUFSIZ );
-            (*_authcb) ("Enter your password: ", buf, NE_ABUFSIZ-1, 0, 0, userdata );
+            (*dav->authcb) ("Enter your password: ", buf, NE_ABUFSIZ-1, 0, 0, dav->userdata );
             strncpy( password, buf, NE_ABUFSIZ );
         } else {
             DEBUG_WEBDAV(("I can not authenticate!\n"));
@@ -404,27 +552,37 @@ static int ne_auth( void *userdata, const char *realm, int attempt,
     return attempt;
 }
 
+static int ne_auth( void *userdata, const char *realm, int attempt,
+                    char *username, char *password)
+{
+    csync_vio_module_ctx_t *dav = userdata;
+    int ret;
+
+    DAV_LOCK(dav);
+    ret = _ne_auth( userdata, realm, attempt, username, password );
+    DAV_UNLOCK(dav);
+
+    return ret;
+}
+
 /*
  * Connect to a DAV server
- * This function sets the flag _connected if the connection is established
- * and returns if the flag is set, so calling it frequently is save.
+ * This function sets the flag connected if the server is known and returns
+ * if the flag is set, so calling it frequently is save. The sessions to the
+ * server are created by the pool when they are needed.
  */
-static int dav_connect(const char *base_url) {
-    int timeout = 30;
-    int useSSL = 0;
+static int dav_connect(csync_vio_module_ctx_t *dav, const char *base_url) {
     int rc;
-    char protocol[6];
-    char uaBuf[256];
     char *path = NULL;
     char *scheme = NULL;
     char *host = NULL;
     unsigned int port = 0;
 
-    if (_connected) {
+    if (dav->connected) {
         return 0;
     }
 
-    rc = c_parse_uri( base_url, &scheme, &dav_session.user, &dav_session.pwd, &host, &port, &path );
+    rc = c_parse_uri( base_url, &scheme, &dav->user, &dav->pwd, &host, &port, &path );
     if( rc < 0 ) {
         DEBUG_WEBDAV(("Failed to parse uri %s\n", base_url ));
         goto out;
@@ -436,21 +594,27 @@ static int dav_connect(const char *base_url) {
     DEBUG_WEBDAV(("* path %s\n", path ));
 
     if( strcmp( scheme, "owncloud" ) == 0 ) {
-        strncpy( protocol, "http", 6);
+        strncpy( dav->protocol, "http", 6);
     } else if( strcmp( scheme, "ownclouds" ) == 0 ) {
-        strncpy( protocol, "https", 6 );
-        useSSL = 1;
+        strncpy( dav->protocol, "https", 6 );
+        dav->useSSL = 1;
     } else {
-        strncpy( protocol, "", 6 );
+        strncpy( dav->protocol, "", 6 );
         DEBUG_WEBDAV(("Invalid scheme %s, go outa here!", scheme ));
         rc = -1;
         goto out;
     }
 
-    DEBUG_WEBDAV(("* user %s\n", dav_session.user ? dav_session.user : ""));
+    DEBUG_WEBDAV(("* user %s\n", dav->user ? dav->user : ""));
 
     if (port == 0) {
-        port = ne_uri_defaultport(protocol);
+        port = ne_uri_defaultport(dav->protocol);
+    }
+
+    if( dav->useSSL && !ne_has_support(NE_FEATURE_SSL)) {
+        DEBUG_WEBDAV(("Error: SSL is not enabled.\n"));
+        rc = -1;
+        goto out;
     }
 
     rc = ne_sock_init();
@@ -460,34 +624,338 @@ static int dav_connect(const char *base_url) {
         goto out;
     }
 
-    dav_session.ctx = ne_session_create( protocol, host, port);
+    SAFE_FREE( dav->host );
+    dav->host = host;
+    host = NULL;
+    dav->port = port;
 
-    if (dav_session.ctx == NULL) {
-        DEBUG_WEBDAV(("Session create with protocol %s failed\n", protocol ));
-        rc = -1;
-        goto out;
+    dav->connected = 1;
+    rc = 0;
+out:
+    SAFE_FREE( scheme );
+    SAFE_FREE( host );
+    SAFE_FREE( path );
+    return rc;
+}
+
+/*
+ * Session pool
+ *
+ * Each request or open file handle checks out a session of the pool and
+ * returns it when it is done. A session keeps its connection open, so the
+ * TCP and TLS handshakes are only done for new sessions or if the server
+ * closed the connection. neon reuses the TLS session on a reconnect.
+ */
+
+/* count the new connections, each needs a handshake */
+static void _session_notify( void *userdata, ne_session_status status,
+                             const ne_session_status_info *info )
+{
+    csync_vio_module_ctx_t *dav = userdata;
+
+    (void) info;
+
+    if( status == ne_status_connected ) {
+        DAV_LOCK(dav);
+        dav->stats.connections++;
+        DAV_UNLOCK(dav);
+    }
+}
+
+static void _session_count_request( ne_request *req, void *userdata,
+                                    const char *method, const char *requri )
+{
+    csync_vio_module_ctx_t *dav = userdata;
+
+    (void) req;
+    (void) method;
+    (void) requri;
+
+    DAV_LOCK(dav);
+    dav->stats.requests++;
+    DAV_UNLOCK(dav);
+}
+
+static ne_session *_session_create( csync_vio_module_ctx_t *dav )
+{
+    ne_session *sess = NULL;
+    char uaBuf[256];
+
+    sess = ne_session_create( dav->protocol, dav->host,
+                              dav->port );
+    if( sess == NULL ) {
+        DEBUG_WEBDAV(("Session create with protocol %s failed\n",
+                      dav->protocol ));
+        return NULL;
     }
 
-    ne_set_read_timeout(dav_session.ctx, timeout);
+    ne_set_read_timeout( sess, 30 );
     snprintf( uaBuf, sizeof(uaBuf), "csyncoC/%s",CSYNC_STRINGIFY( LIBCSYNC_VERSION ));
-    ne_set_useragent( dav_session.ctx, c_strdup( uaBuf ));
-    ne_set_server_auth(dav_session.ctx, ne_auth, 0 );
+    ne_set_useragent( sess, uaBuf );
+    ne_set_server_auth( sess, ne_auth, dav );
+    ne_set_notifier( sess, _session_notify, dav );
+    ne_hook_create_request( sess, _session_count_request, dav );
+
+    if( dav->useSSL ) {
+        ne_ssl_trust_default_ca( sess );
+        ne_ssl_set_verify( sess, verify_sslcert, dav );
+    }
+
+    return sess;
+}
 
-    if( useSSL ) {
-        if (!ne_has_support(NE_FEATURE_SSL)) {
-            DEBUG_WEBDAV(("Error: SSL is not enabled.\n"));
-            rc = -1;
-            goto out;
+/* check out a session, an open one is preferred */
+static ne_session *dav_session_checkout( csync_vio_module_ctx_t *dav )
+{
+    struct dav_pool_entry_s *entry = NULL;
+    int i;
+
+    for( i = 0; i < dav->pool_size; i++ ) {
+        if( !dav->pool[i].in_use ) {
+            if( dav->pool[i].sess != NULL ) {
+                entry = &dav->pool[i];
+                break;
+            } else if( entry == NULL ) {
+                entry = &dav->pool[i];
+            }
         }
+    }
 
-        ne_ssl_trust_default_ca( dav_session.ctx );
-        ne_ssl_set_verify( dav_session.ctx, verify_sslcert, 0 );
+    if( entry == NULL ) {
+        DEBUG_WEBDAV(("All %d sessions of the pool are in use\n",
+                      dav->pool_size ));
+        errno = EBUSY;
+        return NULL;
     }
 
-    _connected = 1;
-    rc = 0;
-out:
-    return rc;
+    if( entry->sess == NULL ) {
+        entry->sess = _session_create( dav );
+        if( entry->sess == NULL ) {
+            errno = ERRNO_CONNECT;
+            return NULL;
+        }
+    } else if( time(NULL) - entry->last_used > DAV_POOL_IDLE_TIMEOUT ) {
+        /* don't send the next request into a dead connection */
+        ne_close_connection( entry->sess );
+    }
+
+    entry->in_use = 1;
+
+    return entry->sess;
+}
+
+/* return the session to the pool, a broken connection is closed */
+static void dav_session_checkin( csync_vio_module_ctx_t *dav, ne_session *sess,
+                                 int neon_code )
+{
+    int i;
+
+    if( sess == NULL ) {
+        return;
+    }
+
+    for( i = 0; i < DAV_POOL_MAX; i++ ) {
+        if( dav->pool[i].sess == sess ) {
+            if( neon_code == NE_CONNECT || neon_code == NE_TIMEOUT ||
+                neon_code == NE_ERROR ) {
+                ne_close_connection( sess );
+            }
+            dav->pool[i].in_use = 0;
+            dav->pool[i].last_used = time(NULL);
+            break;
+        }
+    }
+}
+
+/* check out the session for a single request, see dav_request_end */
+static int dav_request_begin( csync_vio_module_ctx_t *dav, const char *uri )
+{
+    if( dav_connect( dav, uri ) < 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    dav->ctx = dav_session_checkout( dav );
+    if( dav->ctx == NULL ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void dav_request_end( csync_vio_module_ctx_t *dav, int neon_code )
+{
+    dav_session_checkin( dav, dav->ctx, neon_code );
+    dav->ctx = NULL;
+}
+
+static void dav_session_pool_destroy( csync_vio_module_ctx_t *dav )
+{
+    int i;
+
+    for( i = 0; i < DAV_POOL_MAX; i++ ) {
+        if( dav->pool[i].sess != NULL ) {
+            ne_session_destroy( dav->pool[i].sess );
+        }
+        dav->pool[i].sess = NULL;
+        dav->pool[i].in_use = 0;
+    }
+}
+
+/*
+ * The stat cache holds the properties of all resources seen in PROPFIND
+ * results of the current sync run, keyed by the decoded path without a
+ * trailing slash. Entries are removed when the resource or its parent
+ * directory is changed, and all are dropped on commit.
+ */
+struct dav_stat_entry_s {
+    char *path;
+    int type;
+    time_t modtime;
+    off_t size;
+};
+
+static int _stat_cache_key_cmp( const void *key, const void *data )
+{
+    const struct dav_stat_entry_s *entry = data;
+
+    return strcmp( (const char *) key, entry->path );
+}
+
+static int _stat_cache_data_cmp( const void *a, const void *b )
+{
+    const struct dav_stat_entry_s *entry = a;
+
+    return _stat_cache_key_cmp( entry->path, b );
+}
+
+static void _stat_cache_destructor( void *data )
+{
+    struct dav_stat_entry_s *entry = data;
+
+    SAFE_FREE( entry->path );
+    SAFE_FREE( entry );
+}
+
+/* the key of an uri or a decoded path */
+static char *_stat_cache_key( const char *uri )
+{
+    char *path = NULL;
+    char *key = NULL;
+    size_t len;
+
+    if( strstr( uri, "://" ) != NULL ) {
+        if( c_parse_uri( uri, NULL, NULL, NULL, NULL, NULL, &path ) < 0 ) {
+            return NULL;
+        }
+        uri = path;
+    }
+
+    len = strlen( uri );
+    while( len > 1 && uri[len-1] == '/' ) {
+        --len;
+    }
+    key = c_strndup( uri, len );
+    SAFE_FREE( path );
+
+    return key;
+}
+
+static struct dav_stat_entry_s *_stat_cache_find( csync_vio_module_ctx_t *dav,
+                                                  const char *key )
+{
+    c_rbnode_t *node = NULL;
+
+    if( dav->statCache == NULL || key == NULL ) {
+        return NULL;
+    }
+    node = c_rbtree_find( dav->statCache, key );
+
+    return node ? c_rbtree_node_data( node ) : NULL;
+}
+
+static void _stat_cache_add( csync_vio_module_ctx_t *dav, const char *path,
+                             int type, time_t modtime, off_t size )
+{
+    struct dav_stat_entry_s *entry = NULL;
+    char *key = NULL;
+
+    if( dav->statCache == NULL &&
+        c_rbtree_create( &dav->statCache, _stat_cache_key_cmp, _stat_cache_data_cmp ) < 0 ) {
+        return;
+    }
+
+    key = _stat_cache_key( path );
+    entry = _stat_cache_find( dav, key );
+    if( entry == NULL ) {
+        entry = c_malloc( sizeof(struct dav_stat_entry_s) );
+        if( entry == NULL ) {
+            SAFE_FREE( key );
+            return;
+        }
+        entry->path = key;
+        if( c_rbtree_insert( dav->statCache, entry ) < 0 ) {
+            _stat_cache_destructor( entry );
+            return;
+        }
+    } else {
+        SAFE_FREE( key );
+    }
+
+    entry->type = type;
+    entry->modtime = modtime;
+    entry->size = size;
+}
+
+static void _stat_cache_clear( csync_vio_module_ctx_t *dav )
+{
+    c_rbtree_destroy( dav->statCache, _stat_cache_destructor );
+    dav->statCache = NULL;
+}
+
+static void _stat_cache_remove_key( csync_vio_module_ctx_t *dav, const char *key )
+{
+    c_rbnode_t *node = NULL;
+    void *data = NULL;
+
+    if( dav->statCache == NULL || key == NULL ) {
+        return;
+    }
+
+    node = c_rbtree_find( dav->statCache, key );
+    if( node ) {
+        data = c_rbtree_node_data( node );
+        c_rbtree_node_delete( node );
+        _stat_cache_destructor( data );
+    }
+}
+
+/*
+ * Forget the resource and its parent directory, whose modification time
+ * changes with it. If the resource is a directory, the entries below it
+ * are stale as well, the whole cache is dropped then.
+ */
+static void _stat_cache_invalidate( csync_vio_module_ctx_t *dav, const char *uri )
+{
+    struct dav_stat_entry_s *entry = NULL;
+    char *key = _stat_cache_key( uri );
+    char *parent = NULL;
+
+    if( key == NULL ) {
+        _stat_cache_clear( dav );
+        return;
+    }
+
+    entry = _stat_cache_find( dav, key );
+    if( entry != NULL && entry->type == resr_collection ) {
+        _stat_cache_clear( dav );
+    } else {
+        _stat_cache_remove_key( dav, key );
+        parent = c_dirname( key );
+        _stat_cache_remove_key( dav, parent );
+        SAFE_FREE( parent );
+    }
+    SAFE_FREE( key );
 }
 
 /*
@@ -520,14 +988,6 @@ static void results(void *userdata,
         return;
     }
 
-    if (ne_path_compare(fetchCtx->target, uri->path) == 0 && !fetchCtx->include_target) {
-        /* This is the target URI */
-        DEBUG_WEBDAV(( "Skipping target resource.\n"));
-        /* Free the private structure. */
-        SAFE_FREE( path );
-        return;
-    }
-
     /* Fill the resource structure with the data about the file */
     newres = c_malloc(sizeof(struct resource));
     newres->uri =  path; /* no need to strdup because ne_path_unescape already allocates */
@@ -554,6 +1014,19 @@ static void results(void *userdata,
         }
     }
 
+    /* every resource of a listing can be stat'ed without a request later */
+    _stat_cache_add( fetchCtx->dav, path, newres->type, newres->modtime, newres->size );
+
+    if (ne_path_compare(fetchCtx->target, uri->path) == 0 && !fetchCtx->include_target) {
+        /* This is the target URI */
+        DEBUG_WEBDAV(( "Skipping target resource.\n"));
+        /* Free the private structure. */
+        SAFE_FREE( newres->name );
+        SAFE_FREE( newres->uri );
+        SAFE_FREE( newres );
+        return;
+    }
+
     /* prepend the new resource to the result list */
     newres->next   = fetchCtx->list;
     fetchCtx->list = newres;
@@ -565,7 +1038,8 @@ static void results(void *userdata,
  * fetches a resource list from the WebDAV server. This is equivalent to list dir.
  */
 
-static int fetch_resource_list( const char *curi,
+static int fetch_resource_list( csync_vio_module_ctx_t *dav,
+                                const char *curi,
                                 int depth,
                                 struct listdir_context *fetchCtx )
 {
@@ -575,7 +1049,8 @@ static int fetch_resource_list( const char *curi,
         return NE_ERROR;
 
     /* do a propfind request and parse the results in the results function, set as callback */
-    ret = ne_simple_propfind( dav_session.ctx, curi, depth, ls_props, results, fetchCtx );
+    fetchCtx->dav = dav;
+    ret = ne_simple_propfind( dav->ctx, curi, depth, ls_props, results, fetchCtx );
 
     if( ret == NE_OK ) {
         DEBUG_WEBDAV(("Simple propfind OK.\n" ));
@@ -644,50 +1119,56 @@ static int _stat_perms( int type ) {
 /*
  * file functions
  */
-static int owncloud_stat(const char *uri, csync_vio_file_stat_t *buf) {
+static void _free_resource_list( struct resource *r )
+{
+    struct resource *rnext = NULL;
+
+    while( r ) {
+        rnext = r->next;
+        SAFE_FREE(r->uri);
+        SAFE_FREE(r->name);
+        SAFE_FREE(r);
+        r = rnext;
+    }
+}
+
+static int owncloud_stat(csync_vio_module_ctx_t *dav, const char *uri,
+                         csync_vio_file_stat_t *buf) {
     /* get props:
      *   modtime
      *   creattime
      *   size
      */
     int rc = 0;
-    csync_vio_file_stat_t *lfs = NULL;
+    struct dav_stat_entry_s *entry = NULL;
     struct listdir_context  *fetchCtx = NULL;
     char *curi = NULL;
-    char *decodedUri = NULL;
-    char strbuf[PATH_MAX +1];
-    int len = 0;
+    char *key = NULL;
 
     DEBUG_WEBDAV(("owncloud_stat %s called\n", uri ));
 
     buf->name = c_basename(uri);
+    key = _stat_cache_key( uri );
 
-    if (buf->name == NULL) {
+    if (buf->name == NULL || key == NULL) {
+        SAFE_FREE( key );
         csync_vio_file_stat_destroy(buf);
         errno = ENOMEM;
         return -1;
     }
 
-    /* check if the data in the static 'cache' fs is for the same file.
-     * The cache is filled by readdir which is often called directly before
-     * stat. If the cache matches, a http call is saved.
-     */
-    if( _fs.name && strcmp( buf->name, _fs.name ) == 0 ) {
-        buf->fields  = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-        buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-        buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-        buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-        buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
-
-        buf->fields = _fs.fields;
-        buf->type   = _fs.type;
-        buf->mtime  = _fs.mtime;
-        buf->size   = _fs.size;
-        buf->mode   = _stat_perms( _fs.type );
+    /* the resource is most likely in the cache from the listing of its
+     * directory, which the update detection did before. */
+    entry = _stat_cache_find( dav, key );
+    if( entry ) {
+        dav->stat_cache_stats.hits++;
     } else {
-        /* fetch data via a propfind call. */
+        dav->stat_cache_stats.misses++;
+
+        /* fetch data via a propfind call, it fills the cache. */
         fetchCtx = c_malloc( sizeof( struct listdir_context ));
         if( ! fetchCtx ) {
+            SAFE_FREE( key );
             errno = ENOMEM;
             csync_vio_file_stat_destroy(buf);
             return -1;
@@ -695,129 +1176,299 @@ static int owncloud_stat(const char *uri, csync_vio_file_stat_t *buf) {
 
         curi = _cleanPath( uri );
 
-        DEBUG_WEBDAV(("I have no stat cache, call propfind for %s.\n", curi ));
+        DEBUG_WEBDAV(("%s is not in the stat cache, call propfind.\n", curi ));
         fetchCtx->list = NULL;
         fetchCtx->target = curi;
         fetchCtx->include_target = 1;
         fetchCtx->currResource = NULL;
 
-        rc = fetch_resource_list( curi, NE_DEPTH_ONE, fetchCtx );
+        if( dav_request_begin( dav, uri ) < 0 ) {
+            SAFE_FREE( fetchCtx );
+            SAFE_FREE( curi );
+            SAFE_FREE( key );
+            return -1;
+        }
+
+        /* only the resource itself, not the members of a directory */
+        rc = fetch_resource_list( dav, curi, NE_DEPTH_ZERO, fetchCtx );
         if( rc != NE_OK ) {
-            set_errno_from_session();
+            set_errno_from_session( dav );
+        }
+        dav_request_end( dav, rc );
+
+        _free_resource_list( fetchCtx->list );
+        SAFE_FREE( fetchCtx );
+        SAFE_FREE( curi );
 
+        if( rc != NE_OK ) {
             DEBUG_WEBDAV(("stat fails with errno %d\n", errno ));
-            SAFE_FREE(fetchCtx);
+            SAFE_FREE( key );
             return -1;
         }
 
-        if( fetchCtx ) {
-            struct resource *res = fetchCtx->list;
-            while( res ) {
-                /* remove trailing slashes */
-                len = strlen(res->uri);
-                while( len > 0 && res->uri[len-1] == '/' ) --len;
-                memset( strbuf, 0, PATH_MAX+1);
-                strncpy( strbuf, res->uri, len < PATH_MAX ? len : PATH_MAX );
-                decodedUri = ne_path_unescape( curi ); /* allocates memory */
-                if( c_streq(strbuf, decodedUri )) {
-                    SAFE_FREE( decodedUri );
-                    break;
-                }
-                res = res->next;
-                SAFE_FREE( decodedUri );
-            }
-            DEBUG_WEBDAV(("Working on file %s\n", res ? res->name : "NULL"));
-
-            lfs = resourceToFileStat( res );
-            if( lfs ) {
-                buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-                buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-                buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-                buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-                buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
-
-                buf->fields = lfs->fields;
-                buf->type   = lfs->type;
-                buf->mtime  = lfs->mtime;
-                buf->size   = lfs->size;
-                buf->mode   = _stat_perms( lfs->type );
-
-                csync_vio_file_stat_destroy( lfs );
-            }
-            SAFE_FREE( fetchCtx );
+        entry = _stat_cache_find( dav, key );
+        if( entry == NULL ) {
+            DEBUG_WEBDAV(("The server did not return %s\n", key ));
+            SAFE_FREE( key );
+            errno = ENOENT;
+            return -1;
         }
     }
+    SAFE_FREE( key );
+
+    buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+    buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+
+    if( entry->type == resr_collection ) {
+        buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+    } else {
+        buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+    }
+    buf->mtime  = entry->modtime;
+    buf->size   = entry->size;
+    buf->mode   = _stat_perms( buf->type );
+
     DEBUG_WEBDAV(("STAT result: %s, type=%d\n", buf->name ? buf->name:"NULL",
                   buf->type ));
     return 0;
 }
 
-static ssize_t owncloud_write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
+struct checksum_context {
+    const char *type;
+    char *buf;
+    size_t len;
+    int found;
+};
+
+/* picks the checksum of the type out of the checksums property */
+static void checksum_result(void *userdata,
+                            const ne_uri *uri,
+                            const ne_prop_result_set *set)
+{
+    struct checksum_context *sumCtx = userdata;
+    size_t tlen = strlen( sumCtx->type );
+    const char *value;
+    const char *p;
+    size_t i, n;
+
+    (void) uri;
+
+    value = ne_propset_value( set, &checksum_props[0] );
+    for( p = value; p != NULL && *p != '\0'; p++ ) {
+        /* a token of its own, not the end of another type's name */
+        if( (p > value && isalnum( (unsigned char) p[-1] )) ||
+            ne_strncasecmp( p, sumCtx->type, tlen ) != 0 || p[tlen] != ':' ) {
+            continue;
+        }
+        p += tlen + 1;
+        n = strspn( p, "0123456789abcdefABCDEF" );
+        if( n == 0 || n >= sumCtx->len ) {
+            return;
+        }
+        for( i = 0; i < n; i++ ) {
+            sumCtx->buf[i] = tolower( (unsigned char) p[i] );
+        }
+        sumCtx->buf[n] = '\0';
+        sumCtx->found = 1;
+        return;
+    }
+}
+
+/*
+ * The checksum the server keeps of a file, fetched with a PROPFIND of the
+ * file, so it is compared without a download. Servers which keep none or
+ * none of the type make csync read the file.
+ */
+static int owncloud_checksum(csync_vio_module_ctx_t *dav, const char *uri,
+                             const char *type, char *buf, size_t len) {
+    struct checksum_context sumCtx;
+    char *curi = NULL;
+    int rc;
+
+    sumCtx.type = type;
+    sumCtx.buf = buf;
+    sumCtx.len = len;
+    sumCtx.found = 0;
+
+    if( dav_request_begin( dav, uri ) < 0 ) {
+        return -1;
+    }
+
+    curi = _cleanPath( uri );
+    rc = ne_simple_propfind( dav->ctx, curi, NE_DEPTH_ZERO, checksum_props,
+                             checksum_result, &sumCtx );
+    if( rc != NE_OK ) {
+        set_errno_from_session( dav );
+    }
+    dav_request_end( dav, rc );
+    SAFE_FREE( curi );
+
+    if( rc != NE_OK ) {
+        return -1;
+    }
+    if( !sumCtx.found ) {
+        DEBUG_WEBDAV(("No %s checksum of %s on the server\n", type, uri ));
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Append data to the body buffer of the context. For a GET the buffer is
+ * drained by owncloud_read before the next block of the response is read,
+ * so it only grows if a block is inflated a lot.
+ */
+static int _transfer_buffer_append(struct transfer_context *writeCtx, const char *buf, size_t len)
+{
+    char *newBuf = NULL;
+    size_t newSize;
+
+    if( writeCtx->skip > 0 ) {
+        /* the server ignored the range request, drop the data before the offset */
+        if( (off_t) len <= writeCtx->skip ) {
+            writeCtx->skip -= len;
+            return NE_OK;
+        }
+        buf += writeCtx->skip;
+        len -= writeCtx->skip;
+        writeCtx->skip = 0;
+    }
+
+    if( writeCtx->bufPos == writeCtx->bufLen ) {
+        writeCtx->bufPos = writeCtx->bufLen = 0;
+    }
+
+    if( writeCtx->bufLen + len > writeCtx->bufSize ) {
+        newSize = writeCtx->bufSize ? writeCtx->bufSize : TRANSFER_BUFFER_SIZE;
+        while( writeCtx->bufLen + len > newSize ) {
+            newSize *= 2;
+        }
+        newBuf = c_realloc( writeCtx->buf, newSize );
+        if( newBuf == NULL ) {
+            return NE_ERROR;
+        }
+        writeCtx->buf = newBuf;
+        writeCtx->bufSize = newSize;
+    }
+
+    memcpy( writeCtx->buf + writeCtx->bufLen, buf, len );
+    writeCtx->bufLen += len;
+
+    return NE_OK;
+}
+
+/* move the data written to a PUT from the buffer to a temporary file */
+static int _transfer_spool_start(struct transfer_context *writeCtx)
+{
+    writeCtx->spool = tmpfile();
+    if( writeCtx->spool == NULL ) {
+        return -1;
+    }
+
+    if( writeCtx->bufLen > 0 &&
+        fwrite( writeCtx->buf, 1, writeCtx->bufLen, writeCtx->spool ) != writeCtx->bufLen ) {
+        errno = EIO;
+        return -1;
+    }
+    SAFE_FREE( writeCtx->buf );
+    writeCtx->bufSize = writeCtx->bufLen = 0;
+
+    return 0;
+}
+
+/* the source of the data written to a PUT, see csync_vio_source_fn */
+static ssize_t _transfer_written_source(void *userdata, char *buf, size_t count)
+{
+    struct transfer_context *writeCtx = userdata;
+    size_t n;
+
+    if( writeCtx->spool != NULL ) {
+        if( count == 0 ) {
+            return fseek( writeCtx->spool, 0L, SEEK_SET ) < 0 ? -1 : 0;
+        }
+        n = fread( buf, 1, count, writeCtx->spool );
+        if( n == 0 && ferror( writeCtx->spool )) {
+            errno = EIO;
+            return -1;
+        }
+        return n;
+    }
+
+    if( count == 0 ) {
+        writeCtx->bufPos = 0;
+        return 0;
+    }
+    n = writeCtx->bufLen - writeCtx->bufPos;
+    if( n > count ) {
+        n = count;
+    }
+    memcpy( buf, writeCtx->buf + writeCtx->bufPos, n );
+    writeCtx->bufPos += n;
+
+    return n;
+}
+
+/*
+ * Data written to a PUT is kept in memory, or in a temporary file once it
+ * is larger than PUT_SPOOL_SIZE, and sent on close like owncloud_sendfile
+ * sends it. The propagation streams the files with owncloud_sendfile.
+ */
+static ssize_t owncloud_write(csync_vio_module_ctx_t *dav,
+                              csync_vio_method_handle_t *fhandle,
+                              const void *buf, size_t count) {
     struct transfer_context *writeCtx = NULL;
-    size_t written = 0;
-    size_t bufWritten = 0;
+
+    (void) dav;
 
     if (fhandle == NULL) {
+        errno = EBADF;
         return -1;
     }
 
     writeCtx = (struct transfer_context*) fhandle;
 
-    /* check if there is space left in the mem buffer */
-    if( writeCtx->bytes_written + count > PUT_BUFFER_SIZE ) {
-        if( writeCtx->fileWritten == 0 ) {
-            DEBUG_WEBDAV(("Remaining Mem Buffer size to small, push to disk "
-                          "(current buf size %lu)\n",
-                          (unsigned long) writeCtx->bytes_written));
-        }
-
-        /* write contents to disk */
-        if( writeCtx->fd > -1 ) {
-            if(  writeCtx->bytes_written > 0 ) {
-                /* there is something in the buffer already. Store to disk */
-
-                written = write( writeCtx->fd, _buffer, writeCtx->bytes_written );
-                if( written != writeCtx->bytes_written ) {
-                    DEBUG_WEBDAV(("WRN: Written bytes from buffer not equal to count\n"));
-                }
-                /* reset the buffer counter */
-                writeCtx->bytes_written = 0;
-            }
-            /* also write the incoming memory buffer content to file */
-            if( count > 0 ) {
-                bufWritten = write( writeCtx->fd, buf, count );
+    if( writeCtx->sent ) {
+        errno = EBADF;
+        return -1;
+    }
 
-                if( bufWritten != count ) {
-                    DEBUG_WEBDAV(("WRN: Written bytes not equal to count\n"));
-                }
-            }
-            /* set a flag that file was used, needed in the close routine */
-            writeCtx->fileWritten = 1;
-        } else {
-            /* problem: the file descriptor is not valid. */
-            DEBUG_WEBDAV(("ERR: Not a valid file descriptor in write\n"));
+    if( count == 0 ) {
+        return 0;
+    }
+
+    if( writeCtx->spool == NULL && writeCtx->bufLen + count > PUT_SPOOL_SIZE ) {
+        DEBUG_WEBDAV(("Spooling the PUT of %s to a temporary file\n", writeCtx->path ));
+        if( _transfer_spool_start( writeCtx ) < 0 ) {
+            return -1;
         }
-    } else {
-        /* still space in the buffer */
-        memcpy( _buffer + writeCtx->bytes_written, buf, count );
-        writeCtx->bytes_written += count;
-        bufWritten = count;
     }
-    return bufWritten;
+
+    if( writeCtx->spool != NULL ) {
+        if( fwrite( buf, 1, count, writeCtx->spool ) != count ) {
+            errno = EIO;
+            return -1;
+        }
+    } else if( _transfer_buffer_append( writeCtx, buf, count ) != NE_OK ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    writeCtx->bytes_written += count;
+
+    return count;
 }
 
 static int uncompress_reader(void *userdata, const char *buf, size_t len)
 {
    struct transfer_context *writeCtx = userdata;
-   size_t written = 0;
-
-   if( buf && writeCtx->fd ) {
-       /* DEBUG_WEBDAV(("Writing NON compressed %d bytes\n", len)); */
-       len = write(writeCtx->fd, buf, len);
-       if( len != written ) {
-           DEBUG_WEBDAV(("WRN: uncompress_reader wrote wrong num of bytes\n"));
-       }
-       return NE_OK;
+
+   if( buf ) {
+       /* DEBUG_WEBDAV(("Reading NON compressed %d bytes\n", len)); */
+       return _transfer_buffer_append( writeCtx, buf, len );
    }
    return NE_ERROR;
 }
@@ -825,15 +1476,10 @@ static int uncompress_reader(void *userdata, const char *buf, size_t len)
 static int compress_reader(void *userdata, const char *buf, size_t len)
 {
    struct transfer_context *writeCtx = userdata;
-   size_t written = 0;
-
-   if( buf && writeCtx->fd ) {
-       /* DEBUG_WEBDAV(("Writing compressed %d bytes\n", len)); */
-       written = write(writeCtx->fd, buf, len);
-       if( written != len ) {
-           DEBUG_WEBDAV(("WRN: compress reader wrote wrong len\n"));
-       }
-       return NE_OK;
+
+   if( buf ) {
+       /* DEBUG_WEBDAV(("Reading compressed %d bytes\n", len)); */
+       return _transfer_buffer_append( writeCtx, buf, len );
    }
    return NE_ERROR;
 }
@@ -855,6 +1501,13 @@ static void install_content_reader( ne_request *req, void *userdata, const ne_st
         return;
     }
 
+    /* the response to a request which gets retried, e.g. for authentication,
+     * has no body for us. The reader is only installed once per request. */
+    if( (status && status->klass != 2) || writeCtx->readerInstalled ) {
+        return;
+    }
+    writeCtx->readerInstalled = 1;
+
     enc = ne_get_response_header( req, "Content-Encoding" );
     DEBUG_WEBDAV(("Content encoding ist <%s> with status %d\n", enc ? enc : "empty",
                   status ? status->code : -1 ));
@@ -871,20 +1524,229 @@ static void install_content_reader( ne_request *req, void *userdata, const ne_st
     }
 }
 
-static char*_lastDir = NULL;
+/*
+ * The directories known to exist in the current sync run, to not check the
+ * parent directory on every open for writing. The keys are the urls without
+ * a trailing slash.
+ */
+static int _known_dir_cmp( const void *key, const void *data )
+{
+    return strcmp( (const char*) key, (const char*) data );
+}
+
+static void _known_dir_destructor( void *data )
+{
+    SAFE_FREE( data );
+}
+
+static char *_known_dir_key( const char *uri )
+{
+    size_t len = strlen( uri );
+
+    while( len > 1 && uri[len-1] == '/' ) {
+        --len;
+    }
+    return c_strndup( uri, len );
+}
+
+static void _known_dir_add( csync_vio_module_ctx_t *dav, const char *uri )
+{
+    char *key = NULL;
+
+    if( dav->knownDirs == NULL &&
+        c_rbtree_create( &dav->knownDirs, _known_dir_cmp, _known_dir_cmp ) < 0 ) {
+        return;
+    }
+
+    key = _known_dir_key( uri );
+    if( key && c_rbtree_insert( dav->knownDirs, key ) != 0 ) {
+        SAFE_FREE( key );
+    }
+}
+
+static int _known_dir( csync_vio_module_ctx_t *dav, const char *uri )
+{
+    char *key = NULL;
+    int found = 0;
+
+    if( dav->knownDirs == NULL ) {
+        return 0;
+    }
+
+    key = _known_dir_key( uri );
+    if( key ) {
+        found = c_rbtree_find( dav->knownDirs, key ) != NULL;
+    }
+    SAFE_FREE( key );
+
+    return found;
+}
+
+static void _known_dir_remove( csync_vio_module_ctx_t *dav, const char *uri )
+{
+    c_rbnode_t *node = NULL;
+    char *key = NULL;
+    char *data = NULL;
+
+    if( dav->knownDirs == NULL ) {
+        return;
+    }
+
+    key = _known_dir_key( uri );
+    if( key ) {
+        node = c_rbtree_find( dav->knownDirs, key );
+        if( node ) {
+            data = c_rbtree_node_data( node );
+            c_rbtree_node_delete( node );
+            SAFE_FREE( data );
+        }
+    }
+    SAFE_FREE( key );
+}
+
+static void _known_dirs_clear( csync_vio_module_ctx_t *dav )
+{
+    c_rbtree_destroy( dav->knownDirs, _known_dir_destructor );
+    dav->knownDirs = NULL;
+}
 
 /* capabilities are currently:
  *  bool atomar_copy_support
+ *  bool recursive_delete_support, DELETE on a collection removes its members
  */
 
-static csync_vio_capabilities_t _owncloud_capabilities = { true };
+/* add the mtime header to a PUT request, if the mtime is to be sent */
+static void _add_mtime_header( struct transfer_context *writeCtx, ne_request *req )
+{
+    char val[32];
+
+    if( writeCtx->mtime == 0 ) {
+        return;
+    }
+    snprintf( val, sizeof(val), "%lld", (long long) writeCtx->mtime );
+    ne_add_request_header( req, DAV_MTIME_HEADER, val );
+}
+
+/* remember if the server has set the mtime sent with the PUT */
+static void _check_mtime_accepted( struct transfer_context *writeCtx, ne_request *req )
+{
+    const char *answer = NULL;
+
+    if( writeCtx->mtime == 0 ) {
+        return;
+    }
+    answer = ne_get_response_header( req, DAV_MTIME_HEADER );
+    if( answer != NULL && c_streq( answer, DAV_MTIME_ACCEPTED ) ) {
+        DEBUG_WEBDAV(("The server has set the mtime of the upload\n"));
+        writeCtx->mtimeAccepted = 1;
+    }
+}
+
+static csync_vio_capabilities_t _owncloud_capabilities = {
+    .atomar_copy_support = true,
+    .recursive_delete_support = true,
+    .upload_mtime_support = true
+};
 
-static csync_vio_capabilities_t *owncloud_get_capabilities(void)
+static csync_vio_capabilities_t *owncloud_get_capabilities(csync_vio_module_ctx_t *dav)
 {
+  (void) dav;
   return &_owncloud_capabilities;
 }
 
-static csync_vio_method_handle_t *owncloud_open(const char *durl,
+/*
+ * Start the GET request, the body is read by owncloud_read as it arrives.
+ * This is deferred to the first read, so that a lseek before turns it into
+ * a range request to resume an interrupted download.
+ */
+static int _owncloud_get( struct transfer_context *writeCtx )
+{
+    char range[64];
+    int rc = NE_OK;
+
+    DEBUG_WEBDAV(("GET request on %s from offset %lld\n", writeCtx->url,
+                  (long long) writeCtx->offset ));
+
+    writeCtx->req = ne_request_create( writeCtx->session, "GET", writeCtx->url );
+
+    if( writeCtx->offset > 0 ) {
+        /* ranges don't go well together with compression */
+        snprintf( range, sizeof(range), "bytes=%lld-", (long long) writeCtx->offset );
+        ne_add_request_header( writeCtx->req, "Range", range );
+    } else {
+        /* Allow compressed content by setting the header */
+        ne_add_request_header( writeCtx->req, "Accept-Encoding", "gzip,deflate" );
+    }
+
+    /* hook called before the content is parsed to set the correct reader,
+     * either the compressed- or uncompressed reader.
+     */
+    ne_hook_post_headers( writeCtx->session, install_content_reader, writeCtx );
+
+    do {
+        rc = ne_begin_request( writeCtx->req );
+        if( rc != NE_OK ) {
+            break;
+        }
+        if( ne_get_status( writeCtx->req )->klass == 2 ) {
+            break;
+        }
+        /* no body for us, e.g. an authentication challenge */
+        rc = ne_discard_response( writeCtx->req );
+        if( rc == NE_OK ) {
+            rc = ne_end_request( writeCtx->req );
+        }
+        if( rc == NE_OK ) {
+            DEBUG_WEBDAV(("GET failed with status %d\n",
+                          ne_get_status( writeCtx->req )->code ));
+            rc = NE_ERROR;
+        }
+    } while( rc == NE_RETRY );
+
+    /* delete the hook again, otherwise they get chained as they are with the session */
+    ne_unhook_post_headers( writeCtx->session, install_content_reader, writeCtx );
+
+    SAFE_FREE( writeCtx->url );
+
+    if( rc != NE_OK ) {
+        DEBUG_WEBDAV(("GET request failed: %d\n", rc ));
+        errno = EACCES;
+        return -1;
+    }
+
+    if( writeCtx->offset > 0 && ne_get_status( writeCtx->req )->code != 206 ) {
+        /* the server ignored the range, the offset is skipped when reading */
+        writeCtx->skip = writeCtx->offset;
+    }
+
+    return 0;
+}
+
+/* finish the GET request and free it */
+static void _owncloud_get_end( struct transfer_context *writeCtx )
+{
+    if( writeCtx->req == NULL ) {
+        return;
+    }
+
+    if( !writeCtx->readDone ) {
+        /* the rest of the body is not read, the connection can't be reused */
+        ne_close_connection( writeCtx->session );
+    }
+
+    /* if the compression handle is set through the post_header hook, delete it. */
+    if( writeCtx->decompress ) {
+        ne_decompress_destroy( writeCtx->decompress );
+        writeCtx->decompress = NULL;
+    }
+
+    /* delete the request in any case */
+    ne_request_destroy( writeCtx->req );
+    writeCtx->req = NULL;
+}
+
+static csync_vio_method_handle_t *owncloud_open(csync_vio_module_ctx_t *dav,
+                                                const char *durl,
                                                 int flags,
                                                 mode_t mode) {
     char *uri = NULL;
@@ -892,14 +1754,6 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
     char getUrl[PATH_MAX];
     int put = 0;
     int rc = NE_OK;
-#ifdef _WIN32
-    int gtp = 0;
-    char tmpname[13];
-    mbchar_t winTmp[PATH_MAX];
-    mbchar_t *winUrlMB = NULL;
-    char *winTmpUtf8 = NULL;
-    csync_stat_t sb;
-#endif
 
     struct transfer_context *writeCtx = NULL;
     csync_stat_t statBuf;
@@ -915,8 +1769,10 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
         rc = NE_ERROR;
     }
 
-    if( rc == NE_OK )
-        dav_connect( durl );
+    if( rc == NE_OK && dav_connect( dav, durl ) < 0 ) {
+        errno = EINVAL;
+        rc = NE_ERROR;
+    }
 
     if (flags & O_WRONLY) {
         put = 1;
@@ -937,13 +1793,12 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
 	    return NULL;
 	}
         DEBUG_WEBDAV(("Stating directory %s\n", dir ));
-        if( c_streq( dir, _lastDir )) {
+        if( _known_dir( dav, dir )) {
             DEBUG_WEBDAV(("Dir %s is there, we know it already.\n", dir));
         } else {
-            if( owncloud_stat( dir, (csync_vio_method_handle_t*)(&statBuf) ) == 0 ) {
+            if( owncloud_stat( dav, dir, (csync_vio_method_handle_t*)(&statBuf) ) == 0 ) {
                 DEBUG_WEBDAV(("Directory of file to open exists.\n"));
-                SAFE_FREE( _lastDir );
-                _lastDir = c_strdup(dir);
+                _known_dir_add( dav, dir );
 
             } else {
                 DEBUG_WEBDAV(("Directory %s of file to open does NOT exist.\n", dir ));
@@ -957,64 +1812,23 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
 
     writeCtx = c_malloc( sizeof(struct transfer_context) );
     writeCtx->bytes_written = 0;
+    writeCtx->mtime = 0;
+    writeCtx->mtimeAccepted = 0;
     if( rc == NE_OK ) {
-        /* open a temp file to store the incoming data */
-#ifdef _WIN32
-        memset( tmpname, '\0', 13 );
-        gtp = GetTempPathW( PATH_MAX, winTmp );
-        winTmpUtf8 = c_utf8_from_locale( winTmp );
-        strcpy( getUrl, winTmpUtf8 );
-        DEBUG_WEBDAV(("win32 tmp path: %s", getUrl));
-
-        if ( gtp > MAX_PATH || (gtp == 0) ) {
-            DEBUG_WEBDAV(("Failed to compute Win32 tmp path, trying /tmp\n"));
-            strcpy( getUrl, "/tmp/");
-        }
-        strcpy( tmpname, "csync.XXXXXX" );
-        if( c_tmpname( tmpname ) == 0 ) {
-            /* Set the windows file mode to Binary. */
-            _fmode = _O_BINARY;
-            /* append the tmp file name to tmp path */
-            strcat( getUrl, tmpname );
-            writeCtx->tmpFileName = c_strdup( getUrl );
-
-            /* Open the file finally. */
-            winUrlMB = c_utf8_to_locale( getUrl );
-
-            /* check if the file exists by chance. */
-            if( _tstat( winUrlMB, &sb ) == 0 ) {
-                /* the file exists. Remove it! */
-                _tunlink( winUrlMB );
-            }
-
-            writeCtx->fd = _topen( winUrlMB, O_RDWR | O_CREAT | O_EXCL, 0600 );
-
-            /* free the extra bytes */
-            c_free_locale_string( winUrlMB );
-            c_free_locale_string( winTmpUtf8 );
-	} else {
-	   writeCtx->fd = -1;
-	}
-#else
-        writeCtx->tmpFileName = c_strdup( "/tmp/csync.XXXXXX" );
-        writeCtx->fd = mkstemp( writeCtx->tmpFileName );
-#endif
-        DEBUG_WEBDAV(("opening temp directory %s: %d\n", writeCtx->tmpFileName, writeCtx->fd ));
-        if( writeCtx->fd == -1 ) {
-	    DEBUG_WEBDAV(("Failed to open temp file, errno = %d\n", errno ));
+        /* the handle keeps the session until it is closed */
+        writeCtx->session = dav_session_checkout( dav );
+        if( writeCtx->session == NULL ) {
             rc = NE_ERROR;
-            /* errno is set by the mkstemp call above. */
         }
     }
-
     if( rc == NE_OK && put) {
         DEBUG_WEBDAV(("PUT request on %s!\n", uri));
         /* reset the write buffer */
         writeCtx->bytes_written = 0;
-        writeCtx->fileWritten = 0;   /* flag to indicate if contents was pushed to file */
 
-        writeCtx->req = ne_request_create(dav_session.ctx, "PUT", uri);
+        writeCtx->req = ne_request_create(writeCtx->session, "PUT", uri);
 	writeCtx->method = "PUT";
+        writeCtx->path = c_strdup( uri );
     }
 
 
@@ -1022,65 +1836,16 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
         writeCtx->req = 0;
         writeCtx->method = "GET";
 
-        /* Download the data into a local temp file. */
         /* the download via the get function requires a full uri */
-        snprintf( getUrl, PATH_MAX, "%s://%s%s", ne_get_scheme( dav_session.ctx),
-                  ne_get_server_hostport( dav_session.ctx ), uri );
-        DEBUG_WEBDAV(("GET request on %s\n", getUrl ));
-
-#define WITH_HTTP_COMPRESSION
-#ifdef WITH_HTTP_COMPRESSION
-        writeCtx->req = ne_request_create( dav_session.ctx, "GET", getUrl );
-
-        /* Allow compressed content by setting the header */
-        ne_add_request_header( writeCtx->req, "Accept-Encoding", "gzip,deflate" );
-
-        /* hook called before the content is parsed to set the correct reader,
-         * either the compressed- or uncompressed reader.
-         */
-        ne_hook_post_headers( dav_session.ctx, install_content_reader, writeCtx );
-
-        /* actually do the request */
-        rc = ne_request_dispatch(writeCtx->req );
-        /* possible return codes are:
-         *  NE_OK, NE_AUTH, NE_CONNECT, NE_TIMEOUT, NE_ERROR (from ne_request.h)
-         */
-
-        if( rc != NE_OK || (rc == NE_OK && ne_get_status(writeCtx->req)->klass != 2) ) {
-            DEBUG_WEBDAV(("request_dispatch failed with rc=%d\n", rc ));
-            if( rc == NE_OK ) rc = NE_ERROR;
-            errno = EACCES;
-        }
-
-        /* delete the hook again, otherwise they get chained as they are with the session */
-        ne_unhook_post_headers( dav_session.ctx, install_content_reader, writeCtx );
-
-        /* if the compression handle is set through the post_header hook, delete it. */
-        if( writeCtx->decompress ) {
-            ne_decompress_destroy( writeCtx->decompress );
-        }
-
-        /* delete the request in any case */
-        ne_request_destroy(writeCtx->req);
-#else
-        DEBUG_WEBDAV(("GET Compression not supported!\n"));
-        rc = ne_get( dav_session.ctx, getUrl, writeCtx->fd );  /* FIX_ESCAPE? */
-#endif
-        if( rc != NE_OK ) {
-            DEBUG_WEBDAV(("Download to local file failed: %d.\n", rc));
-            errno = EACCES;
-        }
-        if( close( writeCtx->fd ) == -1 ) {
-            DEBUG_WEBDAV(("Close of local download file failed.\n"));
-            writeCtx->fd = -1;
-            rc = NE_ERROR;
-            errno = EACCES;
-        }
+        snprintf( getUrl, PATH_MAX, "%s://%s%s", ne_get_scheme( writeCtx->session ),
+                  ne_get_server_hostport( writeCtx->session ), uri );
 
-        writeCtx->fd = -1;
+        /* The download is started on the first read, see _owncloud_get. */
+        writeCtx->url = c_strdup( getUrl );
     }
 
     if( rc != NE_OK ) {
+        dav_session_checkin( dav, writeCtx->session, rc );
         SAFE_FREE( writeCtx );
     }
 
@@ -1090,23 +1855,34 @@ static csync_vio_method_handle_t *owncloud_open(const char *durl,
     return (csync_vio_method_handle_t *) writeCtx;
 }
 
-static csync_vio_method_handle_t *owncloud_creat(const char *durl, mode_t mode) {
+static csync_vio_method_handle_t *owncloud_creat(csync_vio_module_ctx_t *dav,
+                                                 const char *durl, mode_t mode) {
 
-    csync_vio_method_handle_t *handle = owncloud_open(durl, O_CREAT|O_WRONLY|O_TRUNC, mode);
+    csync_vio_method_handle_t *handle = owncloud_open(dav, durl, O_CREAT|O_WRONLY|O_TRUNC, mode);
 
     /* on create, the file needs to be created empty */
-    owncloud_write( handle, NULL, 0 );
+    owncloud_write( dav, handle, NULL, 0 );
 
     return handle;
 }
 
-static int owncloud_close(csync_vio_method_handle_t *fhandle) {
+static int _owncloud_put( csync_vio_module_ctx_t *dav,
+                          struct transfer_context *writeCtx,
+                          csync_vio_source_fn source, void *userdata,
+                          off_t size );
+
+/*
+ * Close the file, a successful upload returns the mtime if the server has
+ * set it. The answer to a PUT doesn't tell the size the server has stored,
+ * so it is left unknown and the caller stats the file to check it.
+ */
+static int owncloud_close_stat(csync_vio_module_ctx_t *dav,
+                               csync_vio_method_handle_t *fhandle,
+                               csync_vio_file_stat_t *buf) {
     struct transfer_context *writeCtx;
-    csync_stat_t st;
-    int rc;
+    char *decodedPath = NULL;
+    int rc = NE_OK;
     int ret = 0;
-    size_t len = 0;
-    mbchar_t *tmpFileName = 0;
 
     writeCtx = (struct transfer_context*) fhandle;
 
@@ -1118,142 +1894,406 @@ static int owncloud_close(csync_vio_method_handle_t *fhandle) {
     /* handle the PUT request, means write to the WebDAV server */
     if( ret != -1 && strcmp( writeCtx->method, "PUT" ) == 0 ) {
 
-        /* if there is a valid file descriptor, close it, reopen in read mode and start the PUT request */
-        if( writeCtx->fd > -1 ) {
-            if( writeCtx->fileWritten && writeCtx->bytes_written > 0 ) { /* was content written to file? */
-                /* push the rest of the buffer to file as well. */
-                DEBUG_WEBDAV(("Write remaining %lu bytes to disk.\n",
-                              (unsigned long) writeCtx->bytes_written ));
-                len = write( writeCtx->fd, _buffer, writeCtx->bytes_written );
-		if( len != writeCtx->bytes_written ) {
-		    DEBUG_WEBDAV(("WRN: write wrote wrong number of remaining bytes\n"));
-		}
-                writeCtx->bytes_written = 0;
-            }
-
-            if( close( writeCtx->fd ) < 0 ) {
-                DEBUG_WEBDAV(("Could not close file %s\n", writeCtx->tmpFileName ));
-                errno = EBADF;
+        /* send the written content unless it was streamed already */
+        if( !writeCtx->sent ) {
+            DEBUG_WEBDAV(("Putting %lu written bytes.\n",
+                          (unsigned long) writeCtx->bytes_written ));
+            writeCtx->sent = 1;
+            if( _transfer_written_source( writeCtx, NULL, 0 ) < 0 ||
+                _owncloud_put( dav, writeCtx, _transfer_written_source, writeCtx,
+                               writeCtx->bytes_written ) < 0 ) {
+                DEBUG_WEBDAV(("Error - put request of the written data failed\n"));
                 ret = -1;
             }
-
-            /* and open it again to read from */
-#ifdef _WIN32
-	    _fmode = _O_BINARY;
-#endif
-            if( writeCtx->fileWritten ) {
-                DEBUG_WEBDAV(("Putting file through file cache.\n"));
-                /* we need to go the slow way and close and open the file and read from fd. */
-                tmpFileName = c_utf8_to_locale( writeCtx->tmpFileName );
-
-                if (( writeCtx->fd = _topen( tmpFileName, O_RDONLY )) < 0) {
-                    errno = EIO;
-                    ret = -1;
-                } else {
-                    if (fstat( writeCtx->fd, &st ) < 0) {
-                        DEBUG_WEBDAV(("Could not stat file %s\n", writeCtx->tmpFileName ));
-                        errno = EIO;
-                        ret = -1;
-                    }
-
-                    /* successfully opened for read. Now start the request via ne_put */
-                    ne_set_request_body_fd( writeCtx->req, writeCtx->fd, 0, st.st_size );
-                    rc = ne_request_dispatch( writeCtx->req );
-                    if( close( writeCtx->fd ) == -1 ) {
-                        errno = EBADF;
-                        ret = -1;
-                    }
-
-                    if (rc == NE_OK) {
-                        if ( ne_get_status( writeCtx->req )->klass != 2 ) {
-                            DEBUG_WEBDAV(("Error - PUT status value no 2xx\n"));
-                            errno = EIO;
-                            ret = -1;
-                        }
-                    } else {
-                        DEBUG_WEBDAV(("Error - put request on close failed: %d!\n", rc ));
-                        errno = EIO;
-                        ret = -1;
-                    }
-                }
-                c_free_locale_string(tmpFileName);
-            } else {
-                /* all content is in the buffer. */
-                DEBUG_WEBDAV(("Putting file through memory cache.\n"));
-                ne_set_request_body_buffer( writeCtx->req, _buffer, writeCtx->bytes_written );
-                rc = ne_request_dispatch( writeCtx->req );
-                if( rc == NE_OK ) {
-                    if ( ne_get_status( writeCtx->req )->klass != 2 ) {
-                        DEBUG_WEBDAV(("Error - PUT status value no 2xx\n"));
-                        errno = EIO;
-                        ret = -1;
-                    }
-                } else {
-                    DEBUG_WEBDAV(("Error - put request from memory failed: %d!\n", rc ));
-                    errno = EIO;
-                    ret = -1;
-                }
-            }
         }
         ne_request_destroy( writeCtx->req );
-    } else  {
-        /* Its a GET request, not much to do in close. */
-        if( writeCtx->fd > -1) {
-            if( close( writeCtx->fd ) == -1 ) {
-                errno = EBADF;
-                ret = -1;
-            }
+        SAFE_FREE( writeCtx->buf );
+        if( writeCtx->spool != NULL ) {
+            fclose( writeCtx->spool );
+            writeCtx->spool = NULL;
+        }
+
+        /* the path is escaped, the cache is keyed by the decoded path */
+        decodedPath = ne_path_unescape( writeCtx->path );
+        if( decodedPath != NULL ) {
+            /* the next stat asks the server for the size it has stored */
+            _stat_cache_invalidate( dav, decodedPath );
+        } else {
+            _stat_cache_clear( dav );
+        }
+        SAFE_FREE( decodedPath );
+        SAFE_FREE( writeCtx->path );
+    } else if( ret != -1 ) {
+        /* Its a GET request, a download which is not read to the end
+         * leaves the connection in an undefined state. */
+        if( writeCtx->req != NULL && !writeCtx->readDone ) {
+            rc = NE_ERROR;
         }
+        _owncloud_get_end( writeCtx );
+        SAFE_FREE( writeCtx->url );
+        SAFE_FREE( writeCtx->buf );
     }
-    /* Remove the local file. */
-    unlink( writeCtx->tmpFileName );
+
+    if( writeCtx == NULL ) {
+        return ret;
+    }
+
+    if( ret == 0 && buf != NULL && strcmp( writeCtx->method, "PUT" ) == 0 &&
+        writeCtx->mtimeAccepted ) {
+        buf->mtime = writeCtx->mtime;
+        buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+    }
+
+    /* the connection may be in an undefined state after a failed request */
+    dav_session_checkin( dav, writeCtx->session, ret == 0 ? rc : NE_ERROR );
 
     /* free mem. Note that the request mem is freed by the ne_request_destroy call */
-    SAFE_FREE( writeCtx->tmpFileName );
     SAFE_FREE( writeCtx );
 
     return ret;
 }
 
-static ssize_t owncloud_read(csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+static int owncloud_close(csync_vio_module_ctx_t *dav,
+                          csync_vio_method_handle_t *fhandle) {
+    return owncloud_close_stat( dav, fhandle, NULL );
+}
+
+/*
+ * Chunked upload of large files. The file is split into chunks which are
+ * PUT to "<path>-chunking-<transfer id>-<chunk count>-<index>" with the
+ * header "OC-Chunked: 1", the server assembles the file once it has all
+ * chunks. The chunks are read from the source in order and sent by up to
+ * chunk_parallel threads, every chunk is retried on its own.
+ */
+struct dav_chunk_s {
+    ne_session  *session;       /* the session the chunk is sent on */
+    char        *path;          /* the path of the chunk */
+    char        *buf;           /* the data of the chunk */
+    size_t      len;
+    int         busy;           /* the chunk is being sent */
+    int         err;            /* the errno of a failed chunk, 0 on success */
+    struct transfer_context *writeCtx; /* the upload the chunk belongs to */
+#ifdef HAVE_PTHREAD
+    pthread_t   thread;
+#endif
+};
+
+static void *_chunk_send( void *userdata )
+{
+    struct dav_chunk_s *chunk = userdata;
+    ne_request *req = NULL;
+    const ne_status *status = NULL;
+    int attempt;
+    int rc = NE_OK;
+
+    chunk->err = EIO;
+    for( attempt = 0; attempt < DAV_CHUNK_RETRIES; attempt++ ) {
+        if( attempt > 0 ) {
+            DEBUG_WEBDAV(("Retrying chunk %s\n", chunk->path ));
+            sleep( attempt );
+        }
+
+        req = ne_request_create( chunk->session, "PUT", chunk->path );
+        ne_add_request_header( req, "OC-Chunked", "1" );
+        _add_mtime_header( chunk->writeCtx, req );
+        ne_set_request_body_buffer( req, chunk->buf, chunk->len );
+
+        rc = ne_request_dispatch( req );
+        status = ne_get_status( req );
+        if( rc == NE_OK && status->klass == 2 ) {
+            chunk->err = 0;
+            /* only the last chunk gets the answer, when the file is assembled */
+            _check_mtime_accepted( chunk->writeCtx, req );
+        } else if( rc == NE_OK && status->klass == 4 && status->code != 408 ) {
+            /* the server refused the chunk, it won't take it next time */
+            set_errno_from_http_errcode( status->code );
+            chunk->err = errno;
+            attempt = DAV_CHUNK_RETRIES;
+        } else if( rc != NE_OK ) {
+            /* the connection may be in an undefined state */
+            ne_close_connection( chunk->session );
+        }
+        ne_request_destroy( req );
+
+        if( chunk->err == 0 ) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* wait until the chunk is sent, returns its result */
+static int _chunk_wait( struct dav_chunk_s *chunk )
+{
+    if( chunk->busy ) {
+#ifdef HAVE_PTHREAD
+        pthread_join( chunk->thread, NULL );
+#endif
+        chunk->busy = 0;
+        SAFE_FREE( chunk->path );
+    }
+    return chunk->err;
+}
+
+static int _chunk_start( struct dav_chunk_s *chunk )
+{
+    chunk->busy = 1;
+#ifdef HAVE_PTHREAD
+    if( pthread_create( &chunk->thread, NULL, _chunk_send, chunk ) == 0 ) {
+        return 0;
+    }
+    DEBUG_WEBDAV(("Could not start a thread, sending the chunk directly\n"));
+    chunk->busy = 0;
+#endif
+    _chunk_send( chunk );
+    SAFE_FREE( chunk->path );
+    return chunk->err;
+}
+
+static int _owncloud_put_chunked( csync_vio_module_ctx_t *dav,
+                                  struct transfer_context *writeCtx,
+                                  csync_vio_source_fn source, void *userdata,
+                                  off_t size )
+{
+    struct dav_chunk_s chunks[DAV_POOL_MAX];
+    unsigned long transferId;
+    off_t chunkSize = dav->chunk_size;
+    off_t count;
+    off_t index;
+    int parallel = dav->chunk_parallel;
+    int err = 0;
+    int i;
+    size_t got;
+    ssize_t n;
+
+    count = ( size + chunkSize - 1 ) / chunkSize;
+    transferId = (unsigned long) c_jhash64( (uint8_t *) writeCtx->path,
+                                            strlen( writeCtx->path ), time( NULL ));
+
+    DEBUG_WEBDAV(("Uploading %s in %lld chunks, %d in parallel\n", writeCtx->path,
+                  (long long) count, parallel ));
+
+    memset( chunks, 0, sizeof(chunks) );
+    if( parallel > count ) {
+        parallel = count;
+    }
+    /* the handle has a session already, the others come from the pool */
+    chunks[0].session = writeCtx->session;
+    for( i = 1; i < parallel; i++ ) {
+        chunks[i].session = dav_session_checkout( dav );
+        if( chunks[i].session == NULL ) {
+            break;
+        }
+    }
+    parallel = i;
+
+    for( index = 0; index < count && err == 0; index++ ) {
+        struct dav_chunk_s *chunk = &chunks[index % parallel];
+
+        err = _chunk_wait( chunk );
+        if( err != 0 ) {
+            break;
+        }
+        chunk->writeCtx = writeCtx;
+
+        chunk->len = chunkSize;
+        if( index == count - 1 ) {
+            chunk->len = size - index * chunkSize;
+        }
+        if( chunk->buf == NULL ) {
+            chunk->buf = c_malloc( chunkSize );
+            if( chunk->buf == NULL ) {
+                err = ENOMEM;
+                break;
+            }
+        }
+
+        /* the source is only read by this thread */
+        for( got = 0; got < chunk->len; got += n ) {
+            n = source( userdata, chunk->buf + got, chunk->len - got );
+            if( n <= 0 ) {
+                DEBUG_WEBDAV(("The source ended before the chunk %lld\n",
+                              (long long) index ));
+                err = n < 0 ? errno : EIO;
+                break;
+            }
+        }
+        if( err != 0 ) {
+            break;
+        }
+
+        if( asprintf( &chunk->path, "%s-chunking-%lu-%lld-%lld", writeCtx->path,
+                      transferId, (long long) count, (long long) index ) < 0 ) {
+            err = ENOMEM;
+            break;
+        }
+
+        err = _chunk_start( chunk );
+    }
+
+    for( i = 0; i < parallel; i++ ) {
+        if( _chunk_wait( &chunks[i] ) != 0 && err == 0 ) {
+            err = chunks[i].err;
+        }
+        SAFE_FREE( chunks[i].buf );
+        if( i > 0 ) {
+            dav_session_checkin( dav, chunks[i].session, err == 0 ? NE_OK : NE_ERROR );
+        }
+    }
+
+    if( err != 0 ) {
+        DEBUG_WEBDAV(("Chunked upload of %s failed: %s\n", writeCtx->path,
+                      strerror( err )));
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Send the PUT request with the data pulled from the source while it is
+ * sent, in chunks if it is large. The source has the same semantics as a
+ * neon body provider, so it is passed on directly.
+ */
+static int _owncloud_put( csync_vio_module_ctx_t *dav,
+                          struct transfer_context *writeCtx,
+                          csync_vio_source_fn source, void *userdata,
+                          off_t size )
+{
+    int rc;
+
+    if( dav->chunk_size > 0 && size > dav->chunk_size ) {
+        return _owncloud_put_chunked( dav, writeCtx, source, userdata, size );
+    }
+
+    DEBUG_WEBDAV(("Streaming %lld bytes to the server.\n", (long long) size ));
+
+    ne_set_request_body_provider( writeCtx->req, size, source, userdata );
+
+    rc = ne_request_dispatch( writeCtx->req );
+    if( rc != NE_OK ) {
+        DEBUG_WEBDAV(("Error - streamed put request failed: %s\n",
+                      ne_get_error( writeCtx->session ) ));
+        set_error_message( dav, ne_get_error( writeCtx->session ) );
+        errno = EIO;
+        return -1;
+    }
+    if( ne_get_status( writeCtx->req )->klass != 2 ) {
+        DEBUG_WEBDAV(("Error - PUT status value no 2xx\n"));
+        set_errno_from_http_errcode( ne_get_status( writeCtx->req )->code );
+        return -1;
+    }
+    _check_mtime_accepted( writeCtx, writeCtx->req );
+
+    return 0;
+}
+
+/*
+ * Send the PUT request with the data pulled from the source while it is
+ * sent, instead of buffering it until the file is closed.
+ */
+static int owncloud_sendfile(csync_vio_module_ctx_t *dav,
+                             csync_vio_method_handle_t *fhandle,
+                             csync_vio_source_fn source, void *userdata, off_t size) {
     struct transfer_context *writeCtx;
+
+    writeCtx = (struct transfer_context*) fhandle;
+
+    if( ! fhandle || strcmp( writeCtx->method, "PUT" ) != 0 ||
+        writeCtx->sent || writeCtx->bytes_written > 0 ) {
+        errno = EBADF;
+        return -1;
+    }
+
+    writeCtx->sent = 1;
+
+    return _owncloud_put( dav, writeCtx, source, userdata, size );
+}
+
+/*
+ * Send the mtime with the PUT in the X-OC-Mtime header. A server which
+ * sets it answers with "X-OC-MTime: accepted", which saves the PROPPATCH
+ * of utimes after the upload. The mtime has to be set before the data.
+ */
+static int owncloud_set_upload_mtime(csync_vio_module_ctx_t *dav,
+                                     csync_vio_method_handle_t *fhandle, time_t mtime) {
+    struct transfer_context *writeCtx;
+
+    (void) dav;
+
+    writeCtx = (struct transfer_context*) fhandle;
+
+    if( ! fhandle || strcmp( writeCtx->method, "PUT" ) != 0 ||
+        writeCtx->sent || writeCtx->bytes_written > 0 ) {
+        errno = EBADF;
+        return -1;
+    }
+
+    writeCtx->mtime = mtime;
+    _add_mtime_header( writeCtx, writeCtx->req );
+
+    return 0;
+}
+
+static ssize_t owncloud_read(csync_vio_module_ctx_t *dav,
+                             csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+    struct transfer_context *writeCtx;
+    char raw[GET_BLOCK_SIZE];
     size_t len = 0;
-    csync_stat_t st;
-    mbchar_t *tmpFileName;
+    ssize_t n;
+
+    (void) dav;
 
     writeCtx = (struct transfer_context*) fhandle;
 
-    DEBUG_WEBDAV(( "read called on %s (fd=%d)!\n", writeCtx->tmpFileName, writeCtx->fd ));
-    if( ! fhandle ) {
+    if( ! fhandle ) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if( writeCtx->url != NULL ) {
+        /* first read, start the download */
+        if( _owncloud_get( writeCtx ) < 0 ) {
+            return -1;
+        }
+    }
+
+    if( writeCtx->req == NULL ) {
         errno = EBADF;
         return -1;
     }
 
-    if( writeCtx->fd == -1 ) {
-        /* open the downloaded file to read from */
-#ifdef _WIN32
-	_fmode = _O_BINARY;
-#endif
-        tmpFileName = c_utf8_to_locale(writeCtx->tmpFileName);
-        if (( writeCtx->fd = _topen( tmpFileName, O_RDONLY )) < 0) {
-            c_free_locale_string(tmpFileName);
-            DEBUG_WEBDAV(("Could not open local file %s", writeCtx->tmpFileName ));
+    /* read blocks of the response until there is data for the caller, the
+     * body readers fill the read buffer. */
+    while( writeCtx->bufPos == writeCtx->bufLen && !writeCtx->readDone ) {
+        n = ne_read_response_block( writeCtx->req, raw, sizeof(raw) );
+        if( n < 0 ) {
+            DEBUG_WEBDAV(("Reading the response failed: %s\n",
+                          ne_get_error( writeCtx->session ) ));
             errno = EIO;
             return -1;
-        } else {
-            c_free_locale_string(tmpFileName);
-            if (fstat( writeCtx->fd, &st ) < 0) {
-                DEBUG_WEBDAV(("Could not stat file %s\n", writeCtx->tmpFileName ));
+        }
+        if( n == 0 ) {
+            /* end of the response body */
+            if( ne_end_request( writeCtx->req ) != NE_OK ) {
+                DEBUG_WEBDAV(("Finishing the response failed: %s\n",
+                              ne_get_error( writeCtx->session ) ));
                 errno = EIO;
                 return -1;
             }
-
-            DEBUG_WEBDAV(("local downlaod file size=%d\n", (int) st.st_size ));
+            writeCtx->readDone = 1;
         }
     }
 
-    if( writeCtx->fd ) {
-        len = read( writeCtx->fd, buf, count );
+    len = writeCtx->bufLen - writeCtx->bufPos;
+    if( len > count ) {
+        len = count;
+    }
+    if( len > 0 ) {
+        memcpy( buf, writeCtx->buf + writeCtx->bufPos, len );
+        writeCtx->bufPos += len;
         writeCtx->bytes_written = writeCtx->bytes_written + len;
     }
 
@@ -1262,18 +2302,36 @@ static ssize_t owncloud_read(csync_vio_method_handle_t *fhandle, void *buf, size
     return len;
 }
 
-static off_t owncloud_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
-    (void) fhandle;
-    (void) offset;
-    (void) whence;
+static off_t owncloud_lseek(csync_vio_module_ctx_t *dav,
+                            csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
+    struct transfer_context *writeCtx;
+
+    (void) dav;
 
-    return -1;
+    writeCtx = (struct transfer_context*) fhandle;
+
+    if( ! fhandle ) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Seeking is only possible before a download started, it is done with a
+     * range request then. */
+    if( writeCtx->url == NULL || whence != SEEK_SET || offset < 0 ) {
+        errno = ESPIPE;
+        return -1;
+    }
+
+    writeCtx->offset = offset;
+
+    return offset;
 }
 
 /*
  * directory functions
  */
-static csync_vio_method_handle_t *owncloud_opendir(const char *uri) {
+static csync_vio_method_handle_t *owncloud_opendir(csync_vio_module_ctx_t *dav,
+                                                   const char *uri) {
     int rc;
     struct listdir_context *fetchCtx = NULL;
     struct resource *reslist = NULL;
@@ -1281,7 +2339,10 @@ static csync_vio_method_handle_t *owncloud_opendir(const char *uri) {
 
     DEBUG_WEBDAV(("opendir method called on %s\n", uri ));
 
-    dav_connect( uri );
+    if( dav_request_begin( dav, uri ) < 0 ) {
+        SAFE_FREE( curi );
+        return NULL;
+    }
 
     fetchCtx = c_malloc( sizeof( struct listdir_context ));
 
@@ -1290,11 +2351,15 @@ static csync_vio_method_handle_t *owncloud_opendir(const char *uri) {
     fetchCtx->include_target = 0;
     fetchCtx->currResource = NULL;
 
-    rc = fetch_resource_list( curi, NE_DEPTH_ONE, fetchCtx );
+    rc = fetch_resource_list( dav, curi, NE_DEPTH_ONE, fetchCtx );
     if( rc != NE_OK ) {
-        set_errno_from_session();
+        set_errno_from_session( dav );
+        dav_request_end( dav, rc );
         return NULL;
     } else {
+        dav_request_end( dav, rc );
+        /* the directory exists, remember it for the parent check on open */
+        _known_dir_add( dav, uri );
         fetchCtx->currResource = fetchCtx->list;
         DEBUG_WEBDAV(("opendir returning handle %p\n", (void*) fetchCtx ));
         return fetchCtx;
@@ -1302,32 +2367,30 @@ static csync_vio_method_handle_t *owncloud_opendir(const char *uri) {
     /* no freeing of curi because its part of the fetchCtx and gets freed later */
 }
 
-static int owncloud_closedir(csync_vio_method_handle_t *dhandle) {
+static int owncloud_closedir(csync_vio_module_ctx_t *dav,
+                             csync_vio_method_handle_t *dhandle) {
 
     struct listdir_context *fetchCtx = dhandle;
-    struct resource *r = fetchCtx->list;
-    struct resource *rnext = NULL;
+
+    (void) dav;
 
     DEBUG_WEBDAV(("closedir method called %p!\n", dhandle));
 
-    while( r ) {
-        rnext = r->next;
-        SAFE_FREE(r->uri);
-        SAFE_FREE(r->name);
-        SAFE_FREE(r);
-        r = rnext;
-    }
+    _free_resource_list( fetchCtx->list );
     SAFE_FREE( fetchCtx->target );
 
     SAFE_FREE( dhandle );
     return 0;
 }
 
-static csync_vio_file_stat_t *owncloud_readdir(csync_vio_method_handle_t *dhandle) {
+static csync_vio_file_stat_t *owncloud_readdir(csync_vio_module_ctx_t *dav,
+                                               csync_vio_method_handle_t *dhandle) {
 
     struct listdir_context *fetchCtx = dhandle;
     csync_vio_file_stat_t *lfs = NULL;
 
+    (void) dav;
+
     if( fetchCtx->currResource ) {
         // DEBUG_WEBDAV(("readdir method called for %s\n", fetchCtx->currResource->uri));
     } else {
@@ -1341,20 +2404,13 @@ static csync_vio_file_stat_t *owncloud_readdir(csync_vio_method_handle_t *dhandl
 
         /* set pointer to next element */
         fetchCtx->currResource = fetchCtx->currResource->next;
-
-        /* fill the static stat buf as input for the stat function */
-        _fs.name   = lfs->name;
-        _fs.mtime  = lfs->mtime;
-        _fs.fields = lfs->fields;
-        _fs.type   = lfs->type;
-        _fs.size   = lfs->size;
     }
 
     // DEBUG_WEBDAV(("LFS fields: %s: %d\n", lfs->name, lfs->type ));
     return lfs;
 }
 
-static int owncloud_mkdir(const char *uri, mode_t mode) {
+static int owncloud_mkdir(csync_vio_module_ctx_t *dav, const char *uri, mode_t mode) {
     int rc = NE_OK;
     char buf[PATH_MAX +1];
     int len = 0;
@@ -1366,9 +2422,8 @@ static int owncloud_mkdir(const char *uri, mode_t mode) {
         errno = EINVAL;
         rc = -1;
     }
-    rc = dav_connect(uri);
-    if (rc < 0) {
-        errno = EINVAL;
+    if( rc >= 0 ) {
+        rc = dav_request_begin( dav, uri );
     }
 
     /* the uri path is required to have a trailing slash */
@@ -1381,10 +2436,14 @@ static int owncloud_mkdir(const char *uri, mode_t mode) {
       }
 
       DEBUG_WEBDAV(("MKdir on %s\n", buf ));
-      rc = ne_mkcol(dav_session.ctx, buf );
+      rc = ne_mkcol(dav->ctx, buf );
       if (rc != NE_OK ) {
-          set_errno_from_session();
+          set_errno_from_session( dav );
+      } else {
+          _known_dir_add( dav, uri );
       }
+      _stat_cache_invalidate( dav, uri );
+      dav_request_end( dav, rc );
     }
     SAFE_FREE( path );
 
@@ -1394,20 +2453,22 @@ static int owncloud_mkdir(const char *uri, mode_t mode) {
     return 0;
 }
 
-static int owncloud_rmdir(const char *uri) {
+static int owncloud_rmdir(csync_vio_module_ctx_t *dav, const char *uri) {
     int rc = NE_OK;
     char* curi = _cleanPath( uri );
 
-    rc = dav_connect(uri);
-    if (rc < 0) {
-        errno = EINVAL;
-    }
+    rc = dav_request_begin( dav, uri );
 
     if( rc >= 0 ) {
-        rc = ne_delete(dav_session.ctx, curi);
+        rc = ne_delete(dav->ctx, curi);
         if ( rc != NE_OK ) {
-          set_errno_from_session();
+          set_errno_from_session( dav );
+        } else {
+          _known_dir_remove( dav, uri );
         }
+        /* the members are gone as well */
+        _stat_cache_clear( dav );
+        dav_request_end( dav, rc );
     }
     SAFE_FREE( curi );
     if( rc < 0 || rc != NE_OK ) {
@@ -1417,27 +2478,30 @@ static int owncloud_rmdir(const char *uri) {
     return 0;
 }
 
-static int owncloud_rename(const char *olduri, const char *newuri) {
+static int owncloud_rename(csync_vio_module_ctx_t *dav, const char *olduri,
+                           const char *newuri) {
     char *src = NULL;
     char *target = NULL;
     int rc = NE_OK;
 
 
-    rc = dav_connect(olduri);
-    if (rc < 0) {
-        errno = EINVAL;
-    }
+    rc = dav_request_begin( dav, olduri );
 
     src    = _cleanPath( olduri );
     target = _cleanPath( newuri );
 
     if( rc >= 0 ) {
         DEBUG_WEBDAV(("MOVE: %s => %s: %d\n", src, target, rc ));
-        rc = ne_move(dav_session.ctx, 1, src, target );
+        rc = ne_move(dav->ctx, 1, src, target );
 
         if (rc != NE_OK ) {
-          set_errno_from_session();
+          set_errno_from_session( dav );
+        } else {
+          _known_dir_remove( dav, olduri );
         }
+        _stat_cache_invalidate( dav, olduri );
+        _stat_cache_invalidate( dav, newuri );
+        dav_request_end( dav, rc );
     }
     SAFE_FREE( src );
     SAFE_FREE( target );
@@ -1447,7 +2511,7 @@ static int owncloud_rename(const char *olduri, const char *newuri) {
     return 0;
 }
 
-static int owncloud_unlink(const char *uri) {
+static int owncloud_unlink(csync_vio_module_ctx_t *dav, const char *uri) {
     int rc = NE_OK;
     char *path = _cleanPath( uri );
 
@@ -1456,29 +2520,31 @@ static int owncloud_unlink(const char *uri) {
         errno = EINVAL;
     }
     if( rc == NE_OK ) {
-        rc = dav_connect(uri);
-        if (rc < 0) {
-            errno = EINVAL;
-        }
+        rc = dav_request_begin( dav, uri );
     }
     if( rc == NE_OK ) {
-        rc = ne_delete( dav_session.ctx, path );
+        rc = ne_delete( dav->ctx, path );
         if ( rc != NE_OK )
-            set_errno_from_session();
+            set_errno_from_session( dav );
+        dav_request_end( dav, rc );
+        _stat_cache_invalidate( dav, uri );
     }
     SAFE_FREE( path );
 
     return 0;
 }
 
-static int owncloud_chmod(const char *uri, mode_t mode) {
+static int owncloud_chmod(csync_vio_module_ctx_t *dav, const char *uri, mode_t mode) {
+    (void) dav;
     (void) uri;
     (void) mode;
 
     return 0;
 }
 
-static int owncloud_chown(const char *uri, uid_t owner, gid_t group) {
+static int owncloud_chown(csync_vio_module_ctx_t *dav, const char *uri,
+                          uid_t owner, gid_t group) {
+    (void) dav;
     (void) uri;
     (void) owner;
     (void) group;
@@ -1486,12 +2552,13 @@ static int owncloud_chown(const char *uri, uid_t owner, gid_t group) {
     return 0;
 }
 
-static char *owncloud_error_string()
+static char *owncloud_error_string(csync_vio_module_ctx_t *dav)
 {
-    return dav_session.error_string;
+    return dav->error_string;
 }
 
-static int owncloud_utimes(const char *uri, const struct timeval *times) {
+static int owncloud_utimes(csync_vio_module_ctx_t *dav, const char *uri,
+                           const struct timeval *times) {
 
     ne_proppatch_operation ops[2];
     ne_propname pname;
@@ -1521,7 +2588,14 @@ static int owncloud_utimes(const char *uri, const struct timeval *times) {
 
     ops[1].name = NULL;
 
-    rc = ne_proppatch( dav_session.ctx, curi, ops );
+    if( dav_request_begin( dav, uri ) < 0 ) {
+        SAFE_FREE( curi );
+        return -1;
+    }
+
+    rc = ne_proppatch( dav->ctx, curi, ops );
+    dav_request_end( dav, rc );
+    _stat_cache_invalidate( dav, uri );
     SAFE_FREE(curi);
 
     if( rc != NE_OK ) {
@@ -1532,6 +2606,500 @@ static int owncloud_utimes(const char *uri, const struct timeval *times) {
     return 0;
 }
 
+/*
+ * The queue of metadata operations, see csync_vio_op_t. The operations are
+ * run by worker threads, each with a session of the pool that it keeps until
+ * the queue is drained by owncloud_complete. The pool and the caches are
+ * only touched by the thread of the caller: the sessions are checked out on
+ * submit, the caches are updated on submit and when the result is reported.
+ */
+#ifdef HAVE_PTHREAD
+/* one of the paths is the other one or below it */
+static int _meta_path_conflict( const char *a, const char *b )
+{
+    size_t la, lb;
+
+    if( a == NULL || b == NULL ) {
+        return 0;
+    }
+    la = strlen( a );
+    lb = strlen( b );
+    if( la > lb ) {
+        const char *t = a;
+        a = b;
+        b = t;
+        la = lb;
+    }
+    if( strncmp( a, b, la ) != 0 ) {
+        return 0;
+    }
+    return b[la] == '\0' || b[la] == '/' || ( la > 0 && a[la-1] == '/' );
+}
+
+static int _meta_op_conflict( const csync_vio_op_t *a, const csync_vio_op_t *b )
+{
+    return _meta_path_conflict( a->uri, b->uri ) ||
+           _meta_path_conflict( a->uri, b->newuri ) ||
+           _meta_path_conflict( a->newuri, b->uri ) ||
+           _meta_path_conflict( a->newuri, b->newuri );
+}
+
+/*
+ * The next operation which can run: it must not touch the path of a running
+ * operation or of one submitted before it. Called with the mutex held.
+ */
+static csync_vio_op_t *_meta_next( struct dav_meta_queue_s *q )
+{
+    csync_vio_op_t *op = NULL;
+    csync_vio_op_t *prev = NULL;
+    csync_vio_op_t *before = NULL;
+    int blocked;
+    int i;
+
+    for( op = q->pending; op != NULL; prev = op, op = op->next ) {
+        blocked = 0;
+        for( i = 0; i < q->workers && !blocked; i++ ) {
+            if( q->worker[i].op != NULL &&
+                _meta_op_conflict( op, q->worker[i].op )) {
+                blocked = 1;
+            }
+        }
+        for( before = q->pending; before != op && !blocked; before = before->next ) {
+            blocked = _meta_op_conflict( op, before );
+        }
+        if( !blocked ) {
+            if( prev != NULL ) {
+                prev->next = op->next;
+            } else {
+                q->pending = op->next;
+            }
+            op->next = NULL;
+            q->pendingCount--;
+            return op;
+        }
+    }
+
+    return NULL;
+}
+
+/* the errno of a failed request on the session of a worker */
+static int _meta_errno( csync_vio_module_ctx_t *dav, ne_session *sess, int neon_code )
+{
+    const char *p = NULL;
+    char *q = NULL;
+    int code;
+
+    if( neon_code != NE_OK && neon_code != NE_ERROR ) {
+        set_errno_from_neon_errcode( dav, neon_code );
+        return errno;
+    }
+
+    p = ne_get_error( sess );
+    code = strtol( p, &q, 10 );
+    if( p == q ) {
+        return EIO;
+    }
+    /* the resource is gone already, which is what a DELETE wants */
+    if( code == 404 ) {
+        return ENOENT;
+    }
+    set_errno_from_http_errcode( code );
+    return errno;
+}
+
+/* run an operation on the session of a worker */
+static void _meta_run( csync_vio_module_ctx_t *dav, ne_session *sess, csync_vio_op_t *op )
+{
+    ne_proppatch_operation ops[2];
+    ne_propname pname;
+    char *path = _cleanPath( op->uri );
+    char *target = NULL;
+    char *buf = NULL;
+    char val[32];
+    int rc = -1;    /* no request sent */
+
+    op->rc = -1;
+    op->err = EINVAL;
+    if( path == NULL ) {
+        return;
+    }
+
+    switch( op->type ) {
+    case CSYNC_VIO_OP_MKDIR:
+        /* the uri path is required to have a trailing slash */
+        if( asprintf( &buf, "%s%s", path,
+                      path[0] && path[strlen(path)-1] == '/' ? "" : "/" ) < 0 ) {
+            break;
+        }
+        DEBUG_WEBDAV(("Queued MKCOL on %s\n", buf ));
+        rc = ne_mkcol( sess, buf );
+        break;
+    case CSYNC_VIO_OP_RMDIR:
+    case CSYNC_VIO_OP_UNLINK:
+        DEBUG_WEBDAV(("Queued DELETE on %s\n", path ));
+        rc = ne_delete( sess, path );
+        break;
+    case CSYNC_VIO_OP_RENAME:
+        target = _cleanPath( op->newuri );
+        if( target == NULL ) {
+            break;
+        }
+        DEBUG_WEBDAV(("Queued MOVE: %s => %s\n", path, target ));
+        rc = ne_move( sess, 1, path, target );
+        break;
+    case CSYNC_VIO_OP_UTIMES:
+        pname.nspace = NULL;
+        pname.name = "lastmodified";
+        snprintf( val, sizeof(val), "%lld", (long long) op->mtime );
+        ops[0].name = &pname;
+        ops[0].type = ne_propset;
+        ops[0].value = val;
+        ops[1].name = NULL;
+        DEBUG_WEBDAV(("Queued PROPPATCH of %s to %s\n", path, val ));
+        rc = ne_proppatch( sess, path, ops );
+        break;
+    default:
+        break;
+    }
+
+    if( rc == NE_OK ) {
+        op->rc = 0;
+        op->err = 0;
+    } else if( rc != -1 ) {
+        op->err = _meta_errno( dav, sess, rc );
+        if( op->err == ENOENT && ( op->type == CSYNC_VIO_OP_RMDIR ||
+                                   op->type == CSYNC_VIO_OP_UNLINK )) {
+            op->rc = 0;
+            op->err = 0;
+        } else if( op->type == CSYNC_VIO_OP_UTIMES ) {
+            op->err = EPERM;
+        }
+        if( rc != NE_ERROR ) {
+            /* the connection may be in an undefined state */
+            ne_close_connection( sess );
+        }
+    }
+
+    SAFE_FREE( path );
+    SAFE_FREE( target );
+    SAFE_FREE( buf );
+}
+
+static void *_meta_worker( void *userdata )
+{
+    struct dav_meta_worker_s *worker = userdata;
+    struct dav_meta_queue_s *q = &worker->dav->meta;
+    csync_vio_op_t *op = NULL;
+    csync_vio_op_t **tail = NULL;
+
+    pthread_mutex_lock( &q->mutex );
+    for(;;) {
+        while( !q->stop && ( op = _meta_next( q ) ) == NULL ) {
+            pthread_cond_wait( &q->work, &q->mutex );
+        }
+        if( op == NULL ) {
+            break;
+        }
+        worker->op = op;
+        pthread_mutex_unlock( &q->mutex );
+
+        _meta_run( worker->dav, worker->sess, op );
+
+        pthread_mutex_lock( &q->mutex );
+        worker->op = NULL;
+        for( tail = &q->done; *tail != NULL; tail = &(*tail)->next );
+        *tail = op;
+        /* operations waiting for this one may run now */
+        pthread_cond_broadcast( &q->work );
+        pthread_cond_broadcast( &q->finished );
+    }
+    pthread_mutex_unlock( &q->mutex );
+
+    return NULL;
+}
+
+/* the sessions of the pool which are not in use */
+static int _meta_sessions_free( csync_vio_module_ctx_t *dav )
+{
+    int n = 0;
+    int i;
+
+    for( i = 0; i < dav->pool_size; i++ ) {
+        if( !dav->pool[i].in_use ) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/* start another worker if the pool has a session for it */
+static void _meta_worker_start( csync_vio_module_ctx_t *dav )
+{
+    struct dav_meta_queue_s *q = &dav->meta;
+    struct dav_meta_worker_s *worker = &q->worker[q->workers];
+
+    if( q->workers >= dav->meta_parallel ||
+        _meta_sessions_free( dav ) <= DAV_META_RESERVED ) {
+        return;
+    }
+
+    worker->sess = dav_session_checkout( dav );
+    if( worker->sess == NULL ) {
+        return;
+    }
+    worker->dav = dav;
+    worker->op = NULL;
+    if( pthread_create( &worker->thread, NULL, _meta_worker, worker ) != 0 ) {
+        dav_session_checkin( dav, worker->sess, NE_OK );
+        worker->sess = NULL;
+        return;
+    }
+    q->workers++;
+}
+
+/* update the caches of the module with an operation, before and after it ran */
+static void _meta_update_caches( csync_vio_module_ctx_t *dav, csync_vio_op_t *op, int ran )
+{
+    switch( op->type ) {
+    case CSYNC_VIO_OP_MKDIR:
+        if( ran && op->rc == 0 ) {
+            _known_dir_add( dav, op->uri );
+        }
+        _stat_cache_invalidate( dav, op->uri );
+        break;
+    case CSYNC_VIO_OP_RMDIR:
+        _known_dir_remove( dav, op->uri );
+        _stat_cache_clear( dav );
+        break;
+    case CSYNC_VIO_OP_RENAME:
+        _known_dir_remove( dav, op->uri );
+        _stat_cache_invalidate( dav, op->uri );
+        _stat_cache_invalidate( dav, op->newuri );
+        break;
+    default:
+        _stat_cache_invalidate( dav, op->uri );
+        break;
+    }
+}
+#endif
+
+/*
+ * Queue a metadata operation. MKCOL, DELETE, MOVE and PROPPATCH cost a
+ * round trip each, with several of them in flight restructuring a large
+ * tree doesn't wait for every single one.
+ */
+static int owncloud_submit(csync_vio_module_ctx_t *dav, csync_vio_op_t *op) {
+#ifdef HAVE_PTHREAD
+    struct dav_meta_queue_s *q = &dav->meta;
+    csync_vio_op_t **tail = NULL;
+
+    if( op == NULL || op->uri == NULL || op->done == NULL ) {
+        errno = EINVAL;
+        return -1;
+    }
+    if( dav->meta_parallel < 1 || dav_connect( dav, op->uri ) < 0 ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    _meta_update_caches( dav, op, 0 );
+
+    pthread_mutex_lock( &q->mutex );
+    if( q->workers < q->pendingCount + 1 ) {
+        _meta_worker_start( dav );
+    }
+    if( q->workers == 0 ) {
+        pthread_mutex_unlock( &q->mutex );
+        DEBUG_WEBDAV(("No session for the queue, running %s directly\n", op->uri ));
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    while( q->pendingCount >= DAV_META_QUEUE_MAX ) {
+        pthread_cond_wait( &q->finished, &q->mutex );
+    }
+
+    op->next = NULL;
+    op->rc = -1;
+    op->err = 0;
+    for( tail = &q->pending; *tail != NULL; tail = &(*tail)->next );
+    *tail = op;
+    q->pendingCount++;
+
+    pthread_cond_signal( &q->work );
+    pthread_mutex_unlock( &q->mutex );
+
+    return 0;
+#else
+    (void) dav;
+    (void) op;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/*
+ * Report the finished operations. With wait set, this returns once the
+ * queue is empty, the workers are stopped and their sessions are back in
+ * the pool then.
+ */
+static int owncloud_complete(csync_vio_module_ctx_t *dav, int wait) {
+#ifdef HAVE_PTHREAD
+    struct dav_meta_queue_s *q = &dav->meta;
+    csync_vio_op_t *done = NULL;
+    csync_vio_op_t *next = NULL;
+    int running;
+    int count = 0;
+    int i;
+
+    pthread_mutex_lock( &q->mutex );
+    for(;;) {
+        done = q->done;
+        q->done = NULL;
+
+        /* the callbacks may submit again */
+        pthread_mutex_unlock( &q->mutex );
+        for( ; done != NULL; done = next ) {
+            next = done->next;
+            done->next = NULL;
+            _meta_update_caches( dav, done, 1 );
+            done->done( done );
+            count++;
+        }
+        pthread_mutex_lock( &q->mutex );
+
+        running = 0;
+        for( i = 0; i < q->workers; i++ ) {
+            if( q->worker[i].op != NULL ) {
+                running = 1;
+            }
+        }
+        if( !wait || ( q->pending == NULL && !running &&
+                       q->done == NULL )) {
+            break;
+        }
+        if( q->done == NULL ) {
+            pthread_cond_wait( &q->finished, &q->mutex );
+        }
+    }
+
+    if( !wait || q->workers == 0 ) {
+        pthread_mutex_unlock( &q->mutex );
+        return count;
+    }
+
+    q->stop = 1;
+    pthread_cond_broadcast( &q->work );
+    pthread_mutex_unlock( &q->mutex );
+
+    for( i = 0; i < q->workers; i++ ) {
+        pthread_join( q->worker[i].thread, NULL );
+        dav_session_checkin( dav, q->worker[i].sess, NE_OK );
+        q->worker[i].sess = NULL;
+    }
+    q->workers = 0;
+    q->stop = 0;
+
+    return count;
+#else
+    (void) dav;
+    (void) wait;
+    return 0;
+#endif
+}
+
+/*
+ * Properties of the module:
+ *  connection_pool_size  int *, the number of sessions to the server
+ *  connection_stats      struct csync_connection_stats_s *, gets filled in
+ *  chunk_size            int *, upload larger files in chunks, 0 disables it
+ *  chunk_parallel        int *, the number of chunks sent at the same time
+ *  meta_parallel         int *, the number of queued metadata operations run
+ *                        at the same time, 0 runs them one by one
+ *  stat_cache_stats      struct csync_stat_cache_stats_s *, gets filled in
+ */
+static int owncloud_set_property(csync_vio_module_ctx_t *dav, const char *key, void *data) {
+    struct csync_connection_stats_s *stats = NULL;
+    int size;
+    int i;
+
+    if( c_streq( key, "connection_pool_size" )) {
+        size = *(int *) data;
+        if( size < 1 || size > DAV_POOL_MAX ) {
+            errno = EINVAL;
+            return -1;
+        }
+        /* sessions above the size are closed once they are idle */
+        for( i = size; i < DAV_POOL_MAX; i++ ) {
+            if( dav->pool[i].sess && !dav->pool[i].in_use ) {
+                ne_session_destroy( dav->pool[i].sess );
+                dav->pool[i].sess = NULL;
+            }
+        }
+        dav->pool_size = size;
+        return 0;
+    }
+
+    if( c_streq( key, "chunk_size" )) {
+        size = *(int *) data;
+        if( size < 0 ) {
+            errno = EINVAL;
+            return -1;
+        }
+        dav->chunk_size = size;
+        return 0;
+    }
+
+    if( c_streq( key, "chunk_parallel" )) {
+        size = *(int *) data;
+        if( size < 1 || size > DAV_POOL_MAX ) {
+            errno = EINVAL;
+            return -1;
+        }
+        dav->chunk_parallel = size;
+        return 0;
+    }
+
+    if( c_streq( key, "meta_parallel" )) {
+        size = *(int *) data;
+        if( size < 0 || size > DAV_POOL_MAX ) {
+            errno = EINVAL;
+            return -1;
+        }
+        dav->meta_parallel = size;
+        return 0;
+    }
+
+    if( c_streq( key, "stat_cache_stats" )) {
+        *(struct csync_stat_cache_stats_s *) data = dav->stat_cache_stats;
+        return 0;
+    }
+
+    if( c_streq( key, "connection_stats" )) {
+        stats = (struct csync_connection_stats_s *) data;
+        *stats = dav->stats;
+        if( stats->requests > stats->connections ) {
+            stats->reused = stats->requests - stats->connections;
+        } else {
+            stats->reused = 0;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+static int owncloud_commit(csync_vio_module_ctx_t *dav) {
+    /* the queue is drained by the propagation, this is just to be safe */
+    owncloud_complete( dav, 1 );
+
+    /* the directories have to be checked again in the next run */
+    _known_dirs_clear( dav );
+    _stat_cache_clear( dav );
+
+    return 0;
+}
+
 csync_vio_method_t _method = {
     .method_table_size = sizeof(csync_vio_method_t),
     .get_capabilities = owncloud_get_capabilities,
@@ -1552,31 +3120,81 @@ csync_vio_method_t _method = {
     .chmod = owncloud_chmod,
     .chown = owncloud_chown,
     .utimes = owncloud_utimes,
-    .get_error_string = owncloud_error_string
+    .set_property = owncloud_set_property,
+    .get_error_string = owncloud_error_string,
+    .commit = owncloud_commit,
+    .sendfile = owncloud_sendfile,
+    .set_upload_mtime = owncloud_set_upload_mtime,
+    .close_stat = owncloud_close_stat,
+    .submit = owncloud_submit,
+    .complete = owncloud_complete,
+    .checksum = owncloud_checksum
 };
 
 csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
-                                    csync_auth_callback cb, void *userdata) {
+                                    csync_auth_callback cb, void *userdata,
+                                    csync_vio_module_ctx_t **mctx) {
+    csync_vio_module_ctx_t *dav = NULL;
+
     (void) method_name;
     (void) args;
-    _authcb = cb;
-    _userdata = userdata;
+
+    dav = c_malloc( sizeof(csync_vio_module_ctx_t) );
+    if( dav == NULL ) {
+        return NULL;
+    }
+
+    dav->pool_size = DAV_POOL_SIZE;
+    dav->chunk_size = DAV_CHUNK_SIZE;
+    dav->chunk_parallel = DAV_CHUNK_PARALLEL;
+    dav->meta_parallel = DAV_META_PARALLEL;
+
+    dav->authcb = cb;
+    dav->userdata = userdata;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init( &dav->mutex, NULL );
+    pthread_mutex_init( &dav->meta.mutex, NULL );
+    pthread_cond_init( &dav->meta.work, NULL );
+    pthread_cond_init( &dav->meta.finished, NULL );
+#endif
+
+    *mctx = dav;
 
     return &_method;
 }
 
-void vio_module_shutdown(csync_vio_method_t *method) {
+void vio_module_shutdown(csync_vio_method_t *method, csync_vio_module_ctx_t *dav) {
     (void) method;
 
-    SAFE_FREE( dav_session.user );
-    SAFE_FREE( dav_session.pwd );
+    if( dav == NULL ) {
+        return;
+    }
+
+    owncloud_complete( dav, 1 );
+
+    SAFE_FREE( dav->user );
+    SAFE_FREE( dav->pwd );
 
-    SAFE_FREE( dav_session.error_string );
+    SAFE_FREE( dav->error_string );
 
-    SAFE_FREE( _lastDir );
+    _known_dirs_clear( dav );
+    _stat_cache_clear( dav );
+
+    DEBUG_WEBDAV(("Sessions: %lu requests, %lu connections\n",
+                  dav->stats.requests, dav->stats.connections ));
+
+    dav_session_pool_destroy( dav );
+    SAFE_FREE( dav->host );
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy( &dav->mutex );
+    pthread_mutex_destroy( &dav->meta.mutex );
+    pthread_cond_destroy( &dav->meta.work );
+    pthread_cond_destroy( &dav->meta.finished );
+#endif
 
-    if( dav_session.ctx )
-        ne_session_destroy( dav_session.ctx );
+    SAFE_FREE( dav );
 }
 
 
@@ -0,0 +1,895 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * The replay module serves a trace written with the vio_trace option back
+ * to csync, to reproduce a sync with a remote offline. Every call takes as
+ * long as it took when it was recorded and returns the recorded result: the
+ * stats, the directory listings and the errors. Reads return zeros, the
+ * content is not in the trace.
+ *
+ * The settings are given as module arguments "key=value,key=value" or in the
+ * environment variable CSYNC_REPLAY_ARGS if csync passes no arguments:
+ *
+ *  trace   the file of the trace
+ *  speed   the durations in percent of the recorded ones, 0 doesn't wait
+ *
+ * The speed can also be set with csync_set_module_property(), the key is
+ * replay_speed, a pointer to an int.
+ *
+ * The calls are matched by operation and path relative to the remote
+ * replica, the first directory opened is taken as its root, like when the
+ * trace was recorded. The calls on a file or directory follow the recorded
+ * calls on the handle it got. A call which is not in the trace, e.g. because
+ * the local replica differs, succeeds at once; a stat or opendir of an
+ * unknown path fails with ENOENT. Queued operations are done at the time
+ * they were done when recorded.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "c_lib.h"
+#include "csync_time.h"
+#include "vio/csync_vio_module.h"
+#include "vio/csync_vio_file_stat.h"
+#include "vio/csync_vio_trace.h"
+
+#ifdef NDEBUG
+#define DEBUG_REPLAY(x)
+#else
+#define DEBUG_REPLAY(x) printf x
+#endif
+
+/* the records of a path or a handle, in the order of the trace */
+struct replay_queue_s {
+  char *key;
+  size_t *idx;
+  size_t count;
+  size_t size;
+  size_t pos;                   /* the next one to serve */
+};
+
+/* a queued operation, done at the time it was done when recorded */
+struct replay_op_s {
+  csync_vio_op_t *op;
+  struct timespec due;
+  struct replay_op_s *next;
+};
+
+struct csync_vio_module_ctx_s {
+  csync_vio_trace_record_t *recs;
+  size_t nrecs;
+  c_rbtree_t *queues;
+
+  char *root;                   /* the remote replica, see opendir */
+  int speed;
+  csync_vio_capabilities_t caps;
+
+  struct replay_op_s *ops;      /* submitted, by due time */
+  size_t missed;                /* calls which were not in the trace */
+};
+
+/* an open file or directory */
+struct replay_handle_s {
+  struct replay_queue_s *queue; /* of the recorded handle, NULL if unknown */
+  off_t offset;
+};
+
+/*
+ * the trace
+ */
+
+static int replay_key_cmp(const void *key, const void *data) {
+  const struct replay_queue_s *q = data;
+
+  return strcmp((const char *) key, q->key);
+}
+
+static int replay_data_cmp(const void *key, const void *data) {
+  const struct replay_queue_s *a = key;
+  const struct replay_queue_s *b = data;
+
+  return strcmp(a->key, b->key);
+}
+
+static void replay_queue_free(void *data) {
+  struct replay_queue_s *q = data;
+
+  SAFE_FREE(q->key);
+  SAFE_FREE(q->idx);
+  SAFE_FREE(q);
+}
+
+static struct replay_queue_s *replay_queue(csync_vio_module_ctx_t *mctx,
+    const char *key) {
+  c_rbnode_t *node;
+
+  node = c_rbtree_find(mctx->queues, key);
+
+  return node != NULL ? node->data : NULL;
+}
+
+static int replay_queue_add(csync_vio_module_ctx_t *mctx, const char *key,
+    size_t i) {
+  struct replay_queue_s *q;
+  size_t *idx;
+
+  q = replay_queue(mctx, key);
+  if (q == NULL) {
+    q = c_malloc(sizeof(struct replay_queue_s));
+    if (q == NULL) {
+      return -1;
+    }
+    q->key = c_strdup(key);
+    if (q->key == NULL || c_rbtree_insert(mctx->queues, q) < 0) {
+      replay_queue_free(q);
+      return -1;
+    }
+  }
+
+  if (q->count == q->size) {
+    idx = c_realloc(q->idx, MAX(q->size * 2, 4) * sizeof(size_t));
+    if (idx == NULL) {
+      return -1;
+    }
+    q->idx = idx;
+    q->size = MAX(q->size * 2, 4);
+  }
+  q->idx[q->count++] = i;
+
+  return 0;
+}
+
+/* the key of the calls on a path */
+static void replay_path_key(char *key, size_t len, int op, const char *path) {
+  snprintf(key, len, "%d %s", op, path != NULL ? path : "");
+}
+
+/* the key of the calls on a handle */
+static void replay_handle_key(char *key, size_t len, unsigned long handle) {
+  snprintf(key, len, "#%lu", handle);
+}
+
+static int replay_load(csync_vio_module_ctx_t *mctx, const char *file) {
+  csync_vio_trace_record_t *recs;
+  csync_vio_trace_record_t *rec;
+  size_t size = 0;
+  char key[4096];
+  FILE *fp;
+  int rc;
+
+  fp = fopen(file, "rb");
+  if (fp == NULL) {
+    return -1;
+  }
+  if (csync_vio_trace_read_header(fp) < 0) {
+    fclose(fp);
+    return -1;
+  }
+
+  for (;;) {
+    if (mctx->nrecs == size) {
+      size = MAX(size * 2, 1024);
+      recs = c_realloc(mctx->recs, size * sizeof(csync_vio_trace_record_t));
+      if (recs == NULL) {
+        rc = -1;
+        break;
+      }
+      mctx->recs = recs;
+    }
+
+    rec = &mctx->recs[mctx->nrecs];
+    rc = csync_vio_trace_read(fp, rec);
+    if (rc <= 0) {
+      break;
+    }
+    mctx->nrecs++;
+
+    if (rec->op == CSYNC_VIO_TRACE_CAPABILITIES && rec->nargs == 4) {
+      mctx->caps.atomar_copy_support = rec->args[0];
+      mctx->caps.delta_transfer_support = rec->args[1];
+      mctx->caps.recursive_delete_support = rec->args[2];
+      mctx->caps.upload_mtime_support = rec->args[3];
+      continue;
+    }
+
+    /* the calls which open a handle are found by the path */
+    if (rec->handle != 0 && rec->op != CSYNC_VIO_TRACE_OPEN &&
+        rec->op != CSYNC_VIO_TRACE_CREAT && rec->op != CSYNC_VIO_TRACE_OPENDIR) {
+      replay_handle_key(key, sizeof(key), rec->handle);
+    } else {
+      replay_path_key(key, sizeof(key), rec->op, rec->path);
+    }
+    if (replay_queue_add(mctx, key, mctx->nrecs - 1) < 0) {
+      rc = -1;
+      break;
+    }
+  }
+  fclose(fp);
+
+  DEBUG_REPLAY(("csync_replay - %lu calls in %s\n",
+        (unsigned long) mctx->nrecs, file));
+
+  return rc;
+}
+
+/*
+ * The next record of an operation on a path. The last one is served again
+ * if the path is used more often than recorded.
+ */
+static csync_vio_trace_record_t *replay_path_next(csync_vio_module_ctx_t *mctx,
+    int op, const char *uri) {
+  struct replay_queue_s *q;
+  char key[4096];
+
+  replay_path_key(key, sizeof(key), op,
+      uri != NULL ? csync_vio_trace_path(mctx->root, uri) : NULL);
+  q = replay_queue(mctx, key);
+  if (q == NULL) {
+    mctx->missed++;
+    return NULL;
+  }
+
+  if (q->pos < q->count) {
+    return &mctx->recs[q->idx[q->pos++]];
+  }
+
+  return &mctx->recs[q->idx[q->count - 1]];
+}
+
+/* the next record of an operation on the handle, NULL if there is none */
+static csync_vio_trace_record_t *replay_handle_next(csync_vio_module_ctx_t *mctx,
+    struct replay_handle_s *h, int op) {
+  struct replay_queue_s *q = h->queue;
+  csync_vio_trace_record_t *rec;
+  size_t i;
+
+  if (q == NULL) {
+    return NULL;
+  }
+
+  for (i = q->pos; i < q->count; i++) {
+    rec = &mctx->recs[q->idx[i]];
+    if ((int) rec->op == op) {
+      q->pos = i + 1;
+      return rec;
+    }
+  }
+
+  mctx->missed++;
+  return NULL;
+}
+
+static csync_vio_method_handle_t *replay_handle_new(csync_vio_module_ctx_t *mctx,
+    csync_vio_trace_record_t *rec) {
+  struct replay_handle_s *h;
+  char key[64];
+
+  h = c_malloc(sizeof(struct replay_handle_s));
+  if (h == NULL) {
+    return NULL;
+  }
+  if (rec != NULL && rec->handle != 0) {
+    replay_handle_key(key, sizeof(key), rec->handle);
+    h->queue = replay_queue(mctx, key);
+  }
+
+  return (csync_vio_method_handle_t *) h;
+}
+
+#define HANDLE(h) ((struct replay_handle_s *) (h))
+
+/* takes as long as the recorded call and returns its result */
+static int replay_result(csync_vio_module_ctx_t *mctx,
+    csync_vio_trace_record_t *rec) {
+  uint64_t wait;
+
+  wait = rec->duration * mctx->speed / 100;
+  if (wait > 0) {
+    usleep(wait);
+  }
+
+  if (rec->result < 0) {
+    errno = rec->err;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void replay_stat(csync_vio_trace_record_t *rec,
+    csync_vio_file_stat_t *buf) {
+  char *name = buf->name;
+
+  if (rec->st == NULL) {
+    buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+    return;
+  }
+
+  *buf = *rec->st;
+  buf->name = name;
+}
+
+/*
+ * file functions
+ */
+
+static csync_vio_method_handle_t *replay_open(csync_vio_module_ctx_t *mctx,
+    const char *durl, int flags, mode_t mode) {
+  csync_vio_trace_record_t *rec;
+
+  (void) mode;
+
+  rec = replay_path_next(mctx, CSYNC_VIO_TRACE_OPEN, durl);
+  if (rec == NULL && !(flags & O_CREAT)) {
+    errno = ENOENT;
+    return NULL;
+  }
+  if (rec != NULL && replay_result(mctx, rec) < 0) {
+    return NULL;
+  }
+
+  return replay_handle_new(mctx, rec);
+}
+
+static csync_vio_method_handle_t *replay_creat(csync_vio_module_ctx_t *mctx,
+    const char *durl, mode_t mode) {
+  csync_vio_trace_record_t *rec;
+
+  (void) mode;
+
+  rec = replay_path_next(mctx, CSYNC_VIO_TRACE_CREAT, durl);
+  if (rec != NULL && replay_result(mctx, rec) < 0) {
+    return NULL;
+  }
+
+  return replay_handle_new(mctx, rec);
+}
+
+static int replay_close(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle) {
+  csync_vio_trace_record_t *rec;
+  int rc = 0;
+
+  rec = replay_handle_next(mctx, HANDLE(fhandle), CSYNC_VIO_TRACE_CLOSE);
+  if (rec != NULL) {
+    rc = replay_result(mctx, rec);
+  }
+  SAFE_FREE(fhandle);
+
+  return rc;
+}
+
+static ssize_t replay_read(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+  csync_vio_trace_record_t *rec;
+  size_t len;
+
+  rec = replay_handle_next(mctx, HANDLE(fhandle), CSYNC_VIO_TRACE_READ);
+  if (rec == NULL) {
+    return 0;
+  }
+  if (replay_result(mctx, rec) < 0) {
+    return -1;
+  }
+
+  len = MIN(count, (size_t) rec->result);
+  memset(buf, 0, len);
+  HANDLE(fhandle)->offset += len;
+
+  return len;
+}
+
+static ssize_t replay_write(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
+  csync_vio_trace_record_t *rec;
+
+  (void) buf;
+
+  rec = replay_handle_next(mctx, HANDLE(fhandle), CSYNC_VIO_TRACE_WRITE);
+  if (rec != NULL && replay_result(mctx, rec) < 0) {
+    return -1;
+  }
+  HANDLE(fhandle)->offset += count;
+
+  return count;
+}
+
+static off_t replay_lseek(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
+  csync_vio_trace_record_t *rec;
+
+  rec = replay_handle_next(mctx, HANDLE(fhandle), CSYNC_VIO_TRACE_LSEEK);
+  if (rec != NULL) {
+    if (replay_result(mctx, rec) < 0) {
+      return (off_t) -1;
+    }
+    HANDLE(fhandle)->offset = rec->result;
+  } else if (whence == SEEK_SET) {
+    HANDLE(fhandle)->offset = offset;
+  } else if (whence == SEEK_CUR) {
+    HANDLE(fhandle)->offset += offset;
+  } else {
+    errno = EINVAL;
+    return (off_t) -1;
+  }
+
+  return HANDLE(fhandle)->offset;
+}
+
+static int replay_close_stat(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_file_stat_t *buf) {
+  csync_vio_trace_record_t *rec;
+  int rc = 0;
+
+  rec = replay_handle_next(mctx, HANDLE(fhandle), CSYNC_VIO_TRACE_CLOSE_STAT);
+  if (rec != NULL) {
+    rc = replay_result(mctx, rec);
+    if (rc == 0) {
+      replay_stat(rec, buf);
+    }
+  }
+  SAFE_FREE(fhandle);
+
+  return rc;
+}
+
+static int replay_sendfile(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_source_fn source,
+    void *userdata, off_t size) {
+  csync_vio_trace_record_t *rec;
+  char buf[16384];
+  ssize_t rs;
+
+  (void) size;
+
+  /* the source is read like it was when recorded */
+  do {
+    rs = source(userdata, buf, sizeof(buf));
+  } while (rs > 0);
+  if (rs < 0) {
+    return -1;
+  }
+
+  rec = replay_handle_next(mctx, HANDLE(fhandle), CSYNC_VIO_TRACE_SENDFILE);
+  if (rec != NULL) {
+    return replay_result(mctx, rec);
+  }
+
+  return 0;
+}
+
+static int replay_set_upload_mtime(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, time_t mtime) {
+  csync_vio_trace_record_t *rec;
+
+  (void) mtime;
+
+  rec = replay_handle_next(mctx, HANDLE(fhandle),
+                           CSYNC_VIO_TRACE_SET_UPLOAD_MTIME);
+  if (rec != NULL) {
+    return replay_result(mctx, rec);
+  }
+
+  return 0;
+}
+
+/*
+ * directory functions
+ */
+
+static csync_vio_method_handle_t *replay_opendir(csync_vio_module_ctx_t *mctx,
+    const char *name) {
+  csync_vio_trace_record_t *rec;
+
+  if (mctx->root == NULL) {
+    mctx->root = c_strdup(name);
+    if (mctx->root == NULL) {
+      return NULL;
+    }
+  }
+
+  rec = replay_path_next(mctx, CSYNC_VIO_TRACE_OPENDIR, name);
+  if (rec == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+  if (replay_result(mctx, rec) < 0) {
+    return NULL;
+  }
+
+  return replay_handle_new(mctx, rec);
+}
+
+static int replay_closedir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
+  csync_vio_trace_record_t *rec;
+  int rc = 0;
+
+  rec = replay_handle_next(mctx, HANDLE(dhandle), CSYNC_VIO_TRACE_CLOSEDIR);
+  if (rec != NULL) {
+    rc = replay_result(mctx, rec);
+  }
+  SAFE_FREE(dhandle);
+
+  return rc;
+}
+
+static csync_vio_file_stat_t *replay_readdir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
+  csync_vio_trace_record_t *rec;
+  csync_vio_file_stat_t *fs;
+
+  rec = replay_handle_next(mctx, HANDLE(dhandle), CSYNC_VIO_TRACE_READDIR);
+  if (rec == NULL || replay_result(mctx, rec) < 0 || rec->st == NULL) {
+    return NULL;
+  }
+
+  fs = csync_vio_file_stat_new();
+  if (fs == NULL) {
+    return NULL;
+  }
+  replay_stat(rec, fs);
+  fs->name = c_strdup(rec->st->name != NULL ? rec->st->name : "");
+  if (fs->name == NULL) {
+    csync_vio_file_stat_destroy(fs);
+    return NULL;
+  }
+
+  return fs;
+}
+
+/* an operation on a path which succeeds if it is not in the trace */
+static int replay_path_op(csync_vio_module_ctx_t *mctx, int op,
+    const char *uri) {
+  csync_vio_trace_record_t *rec;
+
+  rec = replay_path_next(mctx, op, uri);
+  if (rec == NULL) {
+    return 0;
+  }
+
+  return replay_result(mctx, rec);
+}
+
+static int replay_mkdir(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
+  (void) mode;
+
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_MKDIR, uri);
+}
+
+static int replay_rmdir(csync_vio_module_ctx_t *mctx, const char *uri) {
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_RMDIR, uri);
+}
+
+static int replay_stat_fn(csync_vio_module_ctx_t *mctx, const char *uri,
+    csync_vio_file_stat_t *buf) {
+  csync_vio_trace_record_t *rec;
+
+  rec = replay_path_next(mctx, CSYNC_VIO_TRACE_STAT, uri);
+  if (rec == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (replay_result(mctx, rec) < 0) {
+    return -1;
+  }
+
+  replay_stat(rec, buf);
+  buf->name = c_basename(uri);
+  if (buf->name == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static int replay_rename(csync_vio_module_ctx_t *mctx, const char *olduri,
+    const char *newuri) {
+  (void) newuri;
+
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_RENAME, olduri);
+}
+
+static int replay_unlink(csync_vio_module_ctx_t *mctx, const char *uri) {
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_UNLINK, uri);
+}
+
+static int replay_chmod(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
+  (void) mode;
+
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_CHMOD, uri);
+}
+
+static int replay_chown(csync_vio_module_ctx_t *mctx, const char *uri,
+    uid_t owner, gid_t group) {
+  (void) owner;
+  (void) group;
+
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_CHOWN, uri);
+}
+
+static int replay_utimes(csync_vio_module_ctx_t *mctx, const char *uri,
+    const struct timeval *times) {
+  (void) times;
+
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_UTIMES, uri);
+}
+
+static int replay_setattr(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode, uid_t owner, gid_t group, time_t mtime) {
+  (void) mode;
+  (void) owner;
+  (void) group;
+  (void) mtime;
+
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_SETATTR, uri);
+}
+
+static int replay_commit(csync_vio_module_ctx_t *mctx) {
+  return replay_path_op(mctx, CSYNC_VIO_TRACE_COMMIT, NULL);
+}
+
+static csync_vio_capabilities_t *replay_get_capabilities(csync_vio_module_ctx_t *mctx) {
+  return &mctx->caps;
+}
+
+/*
+ * Queued operations get their result at once, they are reported by
+ * complete when their recorded duration has passed. So operations which
+ * overlapped when recorded overlap again, without threads.
+ */
+static const int replay_op_types[] = {
+  [CSYNC_VIO_OP_MKDIR] = CSYNC_VIO_TRACE_MKDIR,
+  [CSYNC_VIO_OP_RMDIR] = CSYNC_VIO_TRACE_RMDIR,
+  [CSYNC_VIO_OP_UNLINK] = CSYNC_VIO_TRACE_UNLINK,
+  [CSYNC_VIO_OP_RENAME] = CSYNC_VIO_TRACE_RENAME,
+  [CSYNC_VIO_OP_UTIMES] = CSYNC_VIO_TRACE_UTIMES
+};
+
+static int replay_submit(csync_vio_module_ctx_t *mctx, csync_vio_op_t *op) {
+  csync_vio_trace_record_t *rec;
+  struct replay_op_s *rop;
+  struct replay_op_s **p;
+  uint64_t wait = 0;
+
+  if (op == NULL || op->done == NULL ||
+      (unsigned int) op->type > CSYNC_VIO_OP_UTIMES) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  rop = c_malloc(sizeof(struct replay_op_s));
+  if (rop == NULL) {
+    return -1;
+  }
+  rop->op = op;
+
+  op->rc = 0;
+  op->err = 0;
+  rec = replay_path_next(mctx, replay_op_types[op->type], op->uri);
+  if (rec != NULL) {
+    wait = rec->duration * mctx->speed / 100;
+    if (rec->result < 0) {
+      op->rc = -1;
+      op->err = rec->err;
+    }
+  }
+
+  csync_gettime(&rop->due);
+  rop->due.tv_sec += wait / 1000000;
+  rop->due.tv_nsec += (wait % 1000000) * 1000;
+  if (rop->due.tv_nsec >= 1000000000) {
+    rop->due.tv_sec++;
+    rop->due.tv_nsec -= 1000000000;
+  }
+
+  for (p = &mctx->ops; *p != NULL && c_secdiff(rop->due, (*p)->due) >= 0;
+       p = &(*p)->next);
+  rop->next = *p;
+  *p = rop;
+
+  return 0;
+}
+
+static int replay_complete(csync_vio_module_ctx_t *mctx, int wait) {
+  struct replay_op_s *rop;
+  struct timespec now;
+  double left;
+  int count = 0;
+
+  while (mctx->ops != NULL) {
+    rop = mctx->ops;
+    csync_gettime(&now);
+    left = c_secdiff(rop->due, now);
+    if (left > 0) {
+      if (!wait) {
+        break;
+      }
+      usleep((useconds_t) (left * 1000000));
+    }
+
+    mctx->ops = rop->next;
+    rop->op->next = NULL;
+    rop->op->done(rop->op);
+    SAFE_FREE(rop);
+    count++;
+  }
+
+  return count;
+}
+
+/*
+ * settings
+ */
+
+static void replay_parse_args(const char *args, char **trace, int *speed) {
+  char *buf = NULL;
+  char *key = NULL;
+  char *value = NULL;
+  char *save = NULL;
+
+  if (args == NULL || *args == '\0') {
+    return;
+  }
+
+  buf = c_strdup(args);
+  if (buf == NULL) {
+    return;
+  }
+
+  for (key = strtok_r(buf, ",", &save); key != NULL;
+       key = strtok_r(NULL, ",", &save)) {
+    value = strchr(key, '=');
+    if (value == NULL) {
+      continue;
+    }
+    *value++ = '\0';
+    if (c_streq(key, "trace")) {
+      SAFE_FREE(*trace);
+      *trace = c_strdup(value);
+    } else if (c_streq(key, "speed")) {
+      *speed = atoi(value);
+    }
+  }
+
+  SAFE_FREE(buf);
+}
+
+static int replay_set_property(csync_vio_module_ctx_t *mctx, const char *key,
+    void *data) {
+  if (c_streq(key, "replay_speed")) {
+    if (data == NULL || *(int *) data < 0) {
+      errno = EINVAL;
+      return -1;
+    }
+    mctx->speed = *(int *) data;
+    return 0;
+  }
+
+  return -1;
+}
+
+csync_vio_method_t replay_method = {
+  .method_table_size = sizeof(csync_vio_method_t),
+  .get_capabilities = replay_get_capabilities,
+  .open = replay_open,
+  .creat = replay_creat,
+  .close = replay_close,
+  .read = replay_read,
+  .write = replay_write,
+  .lseek = replay_lseek,
+  .opendir = replay_opendir,
+  .closedir = replay_closedir,
+  .readdir = replay_readdir,
+  .mkdir = replay_mkdir,
+  .rmdir = replay_rmdir,
+  .stat = replay_stat_fn,
+  .rename = replay_rename,
+  .unlink = replay_unlink,
+  .chmod = replay_chmod,
+  .chown = replay_chown,
+  .utimes = replay_utimes,
+  .set_property = replay_set_property,
+  .commit = replay_commit,
+  .setattr = replay_setattr,
+  .close_stat = replay_close_stat,
+  .sendfile = replay_sendfile,
+  .set_upload_mtime = replay_set_upload_mtime,
+  .submit = replay_submit,
+  .complete = replay_complete
+};
+
+void vio_module_shutdown(csync_vio_method_t *method,
+    csync_vio_module_ctx_t *mctx);
+
+csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
+    csync_auth_callback cb, void *userdata, csync_vio_module_ctx_t **mctx) {
+  char *trace = NULL;
+  int speed = 100;
+
+  (void) method_name;
+  (void) cb;
+  (void) userdata;
+
+  if (args == NULL) {
+    args = getenv("CSYNC_REPLAY_ARGS");
+  }
+  replay_parse_args(args, &trace, &speed);
+  if (trace == NULL) {
+    DEBUG_REPLAY(("csync_replay - no trace given\n"));
+    return NULL;
+  }
+
+  *mctx = c_malloc(sizeof(csync_vio_module_ctx_t));
+  if (*mctx == NULL) {
+    SAFE_FREE(trace);
+    return NULL;
+  }
+  (*mctx)->speed = speed < 0 ? 100 : speed;
+
+  if (c_rbtree_create(&(*mctx)->queues, replay_key_cmp, replay_data_cmp) < 0 ||
+      replay_load(*mctx, trace) < 0) {
+    DEBUG_REPLAY(("csync_replay - can't load the trace %s\n", trace));
+    SAFE_FREE(trace);
+    vio_module_shutdown(&replay_method, *mctx);
+    *mctx = NULL;
+    return NULL;
+  }
+  SAFE_FREE(trace);
+
+  return &replay_method;
+}
+
+void vio_module_shutdown(csync_vio_method_t *method,
+    csync_vio_module_ctx_t *mctx) {
+  size_t i;
+
+  (void) method;
+
+  if (mctx == NULL) {
+    return;
+  }
+
+  replay_complete(mctx, 1);
+
+  if (mctx->missed > 0) {
+    DEBUG_REPLAY(("csync_replay - %lu calls were not in the trace\n",
+          (unsigned long) mctx->missed));
+  }
+
+  if (mctx->queues != NULL) {
+    c_rbtree_destroy(mctx->queues, replay_queue_free);
+  }
+  for (i = 0; i < mctx->nrecs; i++) {
+    csync_vio_trace_record_clear(&mctx->recs[i]);
+  }
+  SAFE_FREE(mctx->recs);
+  SAFE_FREE(mctx->root);
+  SAFE_FREE(mctx);
+}
+
+/* vim: set ts=8 sw=2 et cindent: */
@@ -25,6 +25,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <libssh/sftp.h>
 #include <libssh/callbacks.h>
 
@@ -38,25 +42,115 @@
 #define DEBUG_SFTP(x) printf x
 #endif
 
-ssh_callbacks _ssh_callbacks;
-ssh_session _ssh_session;
-sftp_session _sftp_session;
+/*
+ * Every read and write request costs a round trip to the server. Reads are
+ * therefore requested ahead, a window of requests of SFTP_BLOCK_SIZE bytes
+ * is kept in flight. libssh has no asynchronous writes, so the writes are
+ * collected and sent in requests of up to the window size instead.
+ */
+#define SFTP_BLOCK_SIZE (16 * 1024)
+#define SFTP_WINDOW_DEFAULT 16
+#define SFTP_WINDOW_MAX 64
+/* the largest write request, the OpenSSH server accepts 256 KB packets */
+#define SFTP_WRITE_MAX (128 * 1024)
+
+/*
+ * Queued metadata operations are run by threads, each on a connection of its
+ * own, so they don't wait behind the transfer on the connection of the
+ * caller. The connections are kept until the instance is shut down.
+ */
+#define SFTP_META_PARALLEL 2
+#define SFTP_META_MAX 8
+#define SFTP_META_QUEUE_MAX 256
+
+#ifdef HAVE_PTHREAD
+/* a thread running queued metadata operations, see _sftp_submit */
+struct sftp_meta_worker_s {
+  csync_vio_module_ctx_t *mctx;
+  ssh_session ssh_session;
+  sftp_session sftp_session;
+  csync_vio_op_t *op;           /* the operation being run */
+  pthread_t thread;
+};
+
+struct sftp_meta_queue_s {
+  csync_vio_op_t *pending;      /* submitted, in the order of submission */
+  csync_vio_op_t *done;         /* run, not yet reported */
+  int pending_count;
+  int stop;
+  int workers;
+  struct sftp_meta_worker_s worker[SFTP_META_MAX];
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+  pthread_cond_t finished;
+};
+#endif
 
-csync_auth_callback _authcb;
-void *_userdata;
-int _connected;
+/* the state of an instance of the module */
+struct csync_vio_module_ctx_s {
+  ssh_callbacks callbacks;
+  ssh_session ssh_session;
+  sftp_session sftp_session;
+  char *uri;                    /* the uri the connection was opened with */
+
+  csync_auth_callback authcb;
+  void *userdata;
+  int connected;
+
+  int window;
+  int meta_parallel;            /* 0 disables the queue */
+#ifdef HAVE_PTHREAD
+  struct sftp_meta_queue_s meta;
+#endif
+};
+
+/* a read request in flight */
+struct sftp_request_s {
+  uint32_t id;
+  uint64_t offset;
+};
+
+/* an open file */
+typedef struct sftp_fhandle_s {
+  sftp_file file;
+  int window;
+  uint64_t offset;              /* the position of the caller */
+
+  /* the read requests in flight, a ring starting at req_first */
+  struct sftp_request_s req[SFTP_WINDOW_MAX];
+  int req_first;
+  int req_count;
+  uint64_t req_offset;          /* the offset of the next request */
+  int eof;
+
+  /* the answer to the oldest request, as far as it is not read yet */
+  char *rbuf;
+  size_t rbuf_len;
+  size_t rbuf_pos;
+
+  /* the data written since the last write request */
+  char *wbuf;
+  size_t wbuf_len;
+  size_t wbuf_size;
+} sftp_fhandle_t;
+
+/* libssh is initialized once for all instances */
+static int _sftp_instances;
 
 static int _ssh_auth_callback(const char *prompt, char *buf, size_t len,
     int echo, int verify, void *userdata) {
-  if (_authcb != NULL) {
-    return (*_authcb) (prompt, buf, len, echo, verify, userdata);
+  csync_vio_module_ctx_t *mctx = userdata;
+
+  if (mctx->authcb != NULL) {
+    return (*mctx->authcb) (prompt, buf, len, echo, verify, mctx->userdata);
   }
 
   return -1;
 }
 
-static int auth_kbdint(ssh_session session, const char *user,
-    const char *passwd) {
+static int auth_kbdint(csync_vio_module_ctx_t *mctx, ssh_session session,
+    const char *user, const char *passwd) {
   const char *name = NULL;
   const char *instruction = NULL;
   const char *prompt = NULL;
@@ -86,7 +180,7 @@ static int auth_kbdint(ssh_session session, const char *user,
 
       prompt = ssh_userauth_kbdint_getprompt(session, i, &echo);
       if (echo) {
-        (*_authcb) (prompt, buffer, sizeof(buffer), 1, 0, NULL);
+        (*mctx->authcb) (prompt, buffer, sizeof(buffer), 1, 0, mctx->userdata);
         rc = ssh_userauth_kbdint_setanswer(session, i, buffer);
         if (rc < 0) {
           return SSH_AUTH_ERROR;
@@ -99,7 +193,8 @@ static int auth_kbdint(ssh_session session, const char *user,
             return SSH_AUTH_ERROR;
           }
         } else {
-          (*_authcb) ("Password:", buffer, sizeof(buffer), 0, 0, NULL);
+          (*mctx->authcb) ("Password:", buffer, sizeof(buffer), 0, 0,
+              mctx->userdata);
           rc = ssh_userauth_kbdint_setanswer(session, i, buffer);
           if (rc < 0) {
             return SSH_AUTH_ERROR;
@@ -148,7 +243,14 @@ static int _sftp_portable_to_errno(int sftp_errno) {
   return rc;
 }
 
-static int _sftp_connect(const char *uri) {
+/*
+ * Open a connection with a sftp session to the server of the uri. The
+ * callbacks of libssh and the host key check are those of the instance.
+ */
+static int _sftp_new_session(csync_vio_module_ctx_t *mctx, const char *uri,
+    ssh_session *ssh, sftp_session *sftp) {
+  ssh_session session = NULL;
+  sftp_session sftp_s = NULL;
   char *scheme = NULL;
   char *user = NULL;
   char *passwd = NULL;
@@ -163,10 +265,6 @@ static int _sftp_connect(const char *uri) {
   int method;
   char *verbosity;
 
-  if (_connected) {
-    return 0;
-  }
-
   rc = c_parse_uri(uri, &scheme, &user, &passwd, &host, &port, &path);
   if (rc < 0) {
     goto out;
@@ -175,36 +273,36 @@ static int _sftp_connect(const char *uri) {
   DEBUG_SFTP(("csync_sftp - conntecting to: %s\n", host));
 
   /* create the session */
-  _ssh_session = ssh_new();
-  if (_ssh_session == NULL) {
+  session = ssh_new();
+  if (session == NULL) {
     fprintf(stderr, "csync_sftp - error creating new connection: %s\n",
         strerror(errno));
     rc = -1;
     goto out;
   }
 
-  rc = ssh_options_set(_ssh_session, SSH_OPTIONS_TIMEOUT, &timeout);
+  rc = ssh_options_set(session, SSH_OPTIONS_TIMEOUT, &timeout);
   if (rc < 0) {
     fprintf(stderr, "csync_sftp - error setting options: %s\n",
         strerror(errno));
     goto out;
   }
 
-  rc = ssh_options_set(_ssh_session, SSH_OPTIONS_COMPRESSION_C_S, "none");
+  rc = ssh_options_set(session, SSH_OPTIONS_COMPRESSION_C_S, "none");
   if (rc < 0) {
     fprintf(stderr, "csync_sftp - error setting options: %s\n",
         strerror(errno));
     goto out;
   }
 
-  rc = ssh_options_set(_ssh_session, SSH_OPTIONS_COMPRESSION_S_C, "none");
+  rc = ssh_options_set(session, SSH_OPTIONS_COMPRESSION_S_C, "none");
   if (rc < 0) {
     fprintf(stderr, "csync_sftp - error setting options: %s\n",
         strerror(errno));
     goto out;
   }
 
-  ssh_options_set(_ssh_session, SSH_OPTIONS_HOST, host);
+  ssh_options_set(session, SSH_OPTIONS_HOST, host);
   if (rc < 0) {
     fprintf(stderr, "csync_sftp - error setting options: %s\n",
         strerror(errno));
@@ -212,7 +310,7 @@ static int _sftp_connect(const char *uri) {
   }
 
   if (port) {
-    ssh_options_set(_ssh_session, SSH_OPTIONS_PORT, &port);
+    ssh_options_set(session, SSH_OPTIONS_PORT, &port);
     if (rc < 0) {
       fprintf(stderr, "csync_sftp - error setting options: %s\n",
           strerror(errno));
@@ -222,7 +320,7 @@ static int _sftp_connect(const char *uri) {
   }
 
   if (user && *user) {
-    ssh_options_set(_ssh_session, SSH_OPTIONS_USER, user);
+    ssh_options_set(session, SSH_OPTIONS_USER, user);
     if (rc < 0) {
       fprintf(stderr, "csync_sftp - error setting options: %s\n",
           strerror(errno));
@@ -233,53 +331,53 @@ static int _sftp_connect(const char *uri) {
 
   verbosity = getenv("CSYNC_SFTP_LOG_VERBOSITY");
   if (verbosity) {
-    rc = ssh_options_set(_ssh_session, SSH_OPTIONS_LOG_VERBOSITY_STR, verbosity);
+    rc = ssh_options_set(session, SSH_OPTIONS_LOG_VERBOSITY_STR, verbosity);
     if (rc < 0) {
       goto out;
     }
   }
 
   /* read ~/.ssh/config */
-  rc = ssh_options_parse_config(_ssh_session, NULL);
+  rc = ssh_options_parse_config(session, NULL);
   if (rc < 0) {
     goto out;
   }
 
-  _ssh_callbacks = (ssh_callbacks) c_malloc(sizeof(struct ssh_callbacks_struct));
-  if (_ssh_callbacks == NULL) {
-    rc = -1;
-    goto out;
-  }
-  ZERO_STRUCTP(_ssh_callbacks);
+  if (mctx->callbacks == NULL) {
+    mctx->callbacks = (ssh_callbacks) c_malloc(sizeof(struct ssh_callbacks_struct));
+    if (mctx->callbacks == NULL) {
+      rc = -1;
+      goto out;
+    }
+    ZERO_STRUCTP(mctx->callbacks);
 
-  _ssh_callbacks->userdata = _userdata;
-  _ssh_callbacks->auth_function = _ssh_auth_callback;
+    mctx->callbacks->userdata = mctx;
+    mctx->callbacks->auth_function = _ssh_auth_callback;
 
-  ssh_callbacks_init(_ssh_callbacks);
+    ssh_callbacks_init(mctx->callbacks);
+  }
 
-  ssh_set_callbacks(_ssh_session, _ssh_callbacks);
+  ssh_set_callbacks(session, mctx->callbacks);
 
-  rc = ssh_connect(_ssh_session);
+  rc = ssh_connect(session);
   if (rc < 0) {
-    fprintf(stderr, "csync_sftp - error connecting to the server: %s\n", ssh_get_error(_ssh_session));
-    ssh_disconnect(_ssh_session);
-    _ssh_session = NULL;
-    ssh_finalize();
+    fprintf(stderr, "csync_sftp - error connecting to the server: %s\n", ssh_get_error(session));
+    ssh_disconnect(session);
+    session = NULL;
     goto out;
   }
 
-  hlen = ssh_get_pubkey_hash(_ssh_session, &hash);
+  hlen = ssh_get_pubkey_hash(session, &hash);
   if (hlen < 0) {
     fprintf(stderr, "csync_sftp - error connecting to the server: %s\n",
-        ssh_get_error(_ssh_session));
-    ssh_disconnect(_ssh_session);
-    _ssh_session = NULL;
-    ssh_finalize();
+        ssh_get_error(session));
+    ssh_disconnect(session);
+    session = NULL;
     goto out;
   }
 
   /* check the server public key hash */
-  state = ssh_is_server_known(_ssh_session);
+  state = ssh_is_server_known(session);
   switch (state) {
     case SSH_SERVER_KNOWN_OK:
       break;
@@ -289,12 +387,11 @@ static int _sftp_connect(const char *uri) {
             "An attacker might change the default server key to confuse your "
             "client into thinking the key does not exist.\n"
             "Please contact your system administrator.\n"
-            "%s\n", ssh_get_error(_ssh_session));
+            "%s\n", ssh_get_error(session));
       ssh_print_hexa("csync_sftp - public key hash", hash, hlen);
 
-      ssh_disconnect(_ssh_session);
-      _ssh_session = NULL;
-      ssh_finalize();
+      ssh_disconnect(session);
+      session = NULL;
       rc = -1;
       goto out;
       break;
@@ -310,25 +407,23 @@ static int _sftp_connect(const char *uri) {
           "The fingerprint for the key sent by the remote host is:\n", host);
           ssh_print_hexa("", hash, hlen);
           fprintf(stderr, "Please contact your system administrator.\n"
-          "%s\n", ssh_get_error(_ssh_session));
+          "%s\n", ssh_get_error(session));
 
-      ssh_disconnect(_ssh_session);
-      _ssh_session = NULL;
-      ssh_finalize();
+      ssh_disconnect(session);
+      session = NULL;
       rc = -1;
       goto out;
       break;
     case SSH_SERVER_NOT_KNOWN:
-      if (_authcb) {
+      if (mctx->authcb) {
         char *hexa;
         char *prompt;
         char buf[4] = {0};
 
         hexa = ssh_get_hexa(hash, hlen);
         if (hexa == NULL) {
-          ssh_disconnect(_ssh_session);
-          _ssh_session = NULL;
-          ssh_finalize();
+          ssh_disconnect(session);
+          session = NULL;
           rc = -1;
           goto out;
         }
@@ -339,20 +434,18 @@ static int _sftp_connect(const char *uri) {
               "Are you sure you want to continue connecting (yes/no)?",
               host, hexa) < 0 ) {
           free(hexa);
-          ssh_disconnect(_ssh_session);
-          _ssh_session = NULL;
-          ssh_finalize();
+          ssh_disconnect(session);
+          session = NULL;
           rc = -1;
           goto out;
         }
 
         free(hexa);
 
-        if ((*_authcb)(prompt, buf, sizeof(buf), 1, 0, _userdata) < 0) {
+        if ((*mctx->authcb)(prompt, buf, sizeof(buf), 1, 0, mctx->userdata) < 0) {
           free(prompt);
-          ssh_disconnect(_ssh_session);
-          _ssh_session = NULL;
-          ssh_finalize();
+          ssh_disconnect(session);
+          session = NULL;
           rc = -1;
           goto out;
         }
@@ -360,17 +453,15 @@ static int _sftp_connect(const char *uri) {
         free(prompt);
 
         if (strncasecmp(buf, "yes", 3) != 0) {
-          ssh_disconnect(_ssh_session);
-          _ssh_session = NULL;
-          ssh_finalize();
+          ssh_disconnect(session);
+          session = NULL;
           rc = -1;
           goto out;
         }
 
-        if (ssh_write_knownhost(_ssh_session) < 0) {
-          ssh_disconnect(_ssh_session);
-          _ssh_session = NULL;
-          ssh_finalize();
+        if (ssh_write_knownhost(session) < 0) {
+          ssh_disconnect(session);
+          session = NULL;
           rc = -1;
           goto out;
         }
@@ -378,18 +469,16 @@ static int _sftp_connect(const char *uri) {
         fprintf(stderr,"csync_sftp - the server is unknown. Connect manually to "
             "the host to retrieve the public key hash, then try again.\n");
       }
-      ssh_disconnect(_ssh_session);
-      _ssh_session = NULL;
-      ssh_finalize();
+      ssh_disconnect(session);
+      session = NULL;
       rc = -1;
       goto out;
       break;
     case SSH_SERVER_ERROR:
-      fprintf(stderr, "%s\n", ssh_get_error(_ssh_session));
+      fprintf(stderr, "%s\n", ssh_get_error(session));
 
-      ssh_disconnect(_ssh_session);
-      _ssh_session = NULL;
-      ssh_finalize();
+      ssh_disconnect(session);
+      session = NULL;
       rc = -1;
       goto out;
       break;
@@ -398,11 +487,10 @@ static int _sftp_connect(const char *uri) {
   }
 
   /* Try to authenticate */
-  rc = ssh_userauth_none(_ssh_session, NULL);
+  rc = ssh_userauth_none(session, NULL);
   if (rc == SSH_AUTH_ERROR) {
-      ssh_disconnect(_ssh_session);
-      _ssh_session = NULL;
-      ssh_finalize();
+      ssh_disconnect(session);
+      session = NULL;
       rc = -1;
       goto out;
   }
@@ -415,38 +503,35 @@ static int _sftp_connect(const char *uri) {
      * This is tunneled cleartext password authentication and possibly needs
      * to be allowed by the ssh server. Set 'PasswordAuthentication yes'
      */
-    auth = ssh_userauth_password(_ssh_session, user, passwd);
+    auth = ssh_userauth_password(session, user, passwd);
   } else {
     DEBUG_SFTP(("csync_sftp - authenticating with pubkey\n"));
-    auth = ssh_userauth_autopubkey(_ssh_session, NULL);
+    auth = ssh_userauth_autopubkey(session, NULL);
   }
 
   if (auth == SSH_AUTH_ERROR) {
     fprintf(stderr, "csync_sftp - authenticating with pubkey: %s\n",
-        ssh_get_error(_ssh_session));
-    ssh_disconnect(_ssh_session);
-    _ssh_session = NULL;
-    ssh_finalize();
+        ssh_get_error(session));
+    ssh_disconnect(session);
+    session = NULL;
     rc = -1;
     goto out;
   }
 
   if (auth != SSH_AUTH_SUCCESS) {
-    if (_authcb != NULL) {
-      auth = auth_kbdint(_ssh_session);
+    if (mctx->authcb != NULL) {
+      auth = auth_kbdint(mctx, session, user, passwd);
       if (auth == SSH_AUTH_ERROR) {
         fprintf(stderr,"csync_sftp - authentication failed: %s\n",
-            ssh_get_error(_ssh_session));
-        ssh_disconnect(_ssh_session);
-        _ssh_session = NULL;
-        ssh_finalize();
+            ssh_get_error(session));
+        ssh_disconnect(session);
+        session = NULL;
         rc = -1;
         goto out;
       }
     } else {
-      ssh_disconnect(_ssh_session);
-      _ssh_session = NULL;
-      ssh_finalize();
+      ssh_disconnect(session);
+      session = NULL;
       rc = -1;
       goto out;
     }
@@ -454,16 +539,15 @@ static int _sftp_connect(const char *uri) {
 
 
 #endif
-  method = ssh_auth_list(_ssh_session);
+  method = ssh_auth_list(session);
 
   while (rc != SSH_AUTH_SUCCESS) {
     /* Try to authenticate with public key first */
     if (method & SSH_AUTH_METHOD_PUBLICKEY) {
-      rc = ssh_userauth_autopubkey(_ssh_session, NULL);
+      rc = ssh_userauth_autopubkey(session, NULL);
       if (rc == SSH_AUTH_ERROR) {
-        ssh_disconnect(_ssh_session);
-        _ssh_session = NULL;
-        ssh_finalize();
+        ssh_disconnect(session);
+        session = NULL;
         rc = -1;
         goto out;
       } else if (rc == SSH_AUTH_SUCCESS) {
@@ -473,11 +557,10 @@ static int _sftp_connect(const char *uri) {
 
     /* Try to authenticate with keyboard interactive */
     if (method & SSH_AUTH_METHOD_INTERACTIVE) {
-      rc = auth_kbdint(_ssh_session, user, passwd);
+      rc = auth_kbdint(mctx, session, user, passwd);
       if (rc == SSH_AUTH_ERROR) {
-        ssh_disconnect(_ssh_session);
-        _ssh_session = NULL;
-        ssh_finalize();
+        ssh_disconnect(session);
+        session = NULL;
         rc = -1;
         goto out;
       } else if (rc == SSH_AUTH_SUCCESS) {
@@ -487,11 +570,10 @@ static int _sftp_connect(const char *uri) {
 
     /* Try to authenticate with password */
     if ((method & SSH_AUTH_METHOD_PASSWORD) && passwd && *passwd) {
-      rc = ssh_userauth_password(_ssh_session, user, passwd);
+      rc = ssh_userauth_password(session, user, passwd);
       if (rc == SSH_AUTH_ERROR) {
-        ssh_disconnect(_ssh_session);
-        _ssh_session = NULL;
-        ssh_finalize();
+        ssh_disconnect(session);
+        session = NULL;
         rc = -1;
         goto out;
       } else if (rc == SSH_AUTH_SUCCESS) {
@@ -502,23 +584,33 @@ static int _sftp_connect(const char *uri) {
 
   DEBUG_SFTP(("csync_sftp - creating sftp channel...\n"));
   /* start the sftp session */
-  _sftp_session = sftp_new(_ssh_session);
-  if (_sftp_session == NULL) {
-    fprintf(stderr, "csync_sftp - sftp error initialising channel: %s\n", ssh_get_error(_ssh_session));
+  sftp_s = sftp_new(session);
+  if (sftp_s == NULL) {
+    fprintf(stderr, "csync_sftp - sftp error initialising channel: %s\n", ssh_get_error(session));
     rc = -1;
     goto out;
   }
 
-  rc = sftp_init(_sftp_session);
+  rc = sftp_init(sftp_s);
   if (rc < 0) {
-    fprintf(stderr, "csync_sftp - error initialising sftp: %s\n", ssh_get_error(_ssh_session));
+    fprintf(stderr, "csync_sftp - error initialising sftp: %s\n", ssh_get_error(session));
     goto out;
   }
 
   DEBUG_SFTP(("csync_sftp - connection established...\n"));
-  _connected = 1;
+  *ssh = session;
+  *sftp = sftp_s;
   rc = 0;
 out:
+  if (rc < 0) {
+    if (sftp_s != NULL) {
+      sftp_free(sftp_s);
+    }
+    if (session != NULL) {
+      ssh_disconnect(session);
+      ssh_free(session);
+    }
+  }
   SAFE_FREE(scheme);
   SAFE_FREE(user);
   SAFE_FREE(passwd);
@@ -529,15 +621,183 @@ out:
   return rc;
 }
 
+static int _sftp_connect(csync_vio_module_ctx_t *mctx, const char *uri) {
+  if (mctx->connected) {
+    return 0;
+  }
+
+  if (_sftp_new_session(mctx, uri, &mctx->ssh_session, &mctx->sftp_session) < 0) {
+    return -1;
+  }
+
+  /* the connections of the queue are opened with it */
+  mctx->uri = c_strdup(uri);
+  if (mctx->uri == NULL) {
+    return -1;
+  }
+  mctx->connected = 1;
+
+  return 0;
+}
+
 /*
  * file functions
  */
 
-static csync_vio_method_handle_t *_sftp_open(const char *uri, int flags, mode_t mode) {
+static sftp_fhandle_t *_sftp_fhandle_new(csync_vio_module_ctx_t *mctx,
+    sftp_file file) {
+  sftp_fhandle_t *fh;
+
+  fh = c_malloc(sizeof(sftp_fhandle_t));
+  if (fh == NULL) {
+    sftp_close(file);
+    return NULL;
+  }
+  fh->file = file;
+  fh->window = mctx->window;
+
+  return fh;
+}
+
+/* wait for the answers of the read requests in flight and drop them */
+static void _sftp_drop_reads(sftp_fhandle_t *fh) {
+  char buf[SFTP_BLOCK_SIZE];
+  struct sftp_request_s *req;
+
+  while (fh->req_count > 0) {
+    req = &fh->req[fh->req_first];
+    /* libssh answers nothing but 0 once it saw the end, a seek resets it */
+    sftp_seek64(fh->file, req->offset);
+    sftp_async_read(fh->file, buf, SFTP_BLOCK_SIZE, req->id);
+    fh->req_first = (fh->req_first + 1) % SFTP_WINDOW_MAX;
+    fh->req_count--;
+  }
+  fh->req_first = 0;
+}
+
+/* forget the data read ahead, the next read starts at the offset */
+static void _sftp_reset_reads(sftp_fhandle_t *fh) {
+  _sftp_drop_reads(fh);
+  fh->rbuf_len = fh->rbuf_pos = 0;
+  fh->req_offset = fh->offset;
+  fh->eof = 0;
+}
+
+/* send the collected writes */
+static int _sftp_flush_writes(csync_vio_module_ctx_t *mctx,
+    sftp_fhandle_t *fh) {
+  uint64_t offset = fh->offset - fh->wbuf_len;
+  size_t done = 0;
+  ssize_t n;
+
+  if (fh->wbuf_len == 0) {
+    return 0;
+  }
+
+  if (sftp_seek64(fh->file, offset) < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  while (done < fh->wbuf_len) {
+    n = sftp_write(fh->file, fh->wbuf + done, fh->wbuf_len - done);
+    if (n <= 0) {
+      errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+      if (errno == 0) {
+        errno = EIO;
+      }
+      return -1;
+    }
+    done += n;
+  }
+  fh->wbuf_len = 0;
+
+  return 0;
+}
+
+/* keep the window of read requests filled */
+static int _sftp_request_reads(csync_vio_module_ctx_t *mctx,
+    sftp_fhandle_t *fh) {
+  int id;
+  int i;
+
+  while (!fh->eof && fh->req_count < fh->window) {
+    if (sftp_seek64(fh->file, fh->req_offset) < 0) {
+      errno = EINVAL;
+      return -1;
+    }
+    id = sftp_async_read_begin(fh->file, SFTP_BLOCK_SIZE);
+    if (id < 0) {
+      errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+      return -1;
+    }
+
+    i = (fh->req_first + fh->req_count) % SFTP_WINDOW_MAX;
+    fh->req[i].id = id;
+    fh->req[i].offset = fh->req_offset;
+    fh->req_count++;
+    fh->req_offset += SFTP_BLOCK_SIZE;
+  }
+
+  return 0;
+}
+
+/*
+ * Wait for the answer to the oldest read request. The server answers short
+ * only at the end of the file, if it does so elsewhere the requests after it
+ * are dropped and requested again from there.
+ */
+static int _sftp_receive_read(csync_vio_module_ctx_t *mctx,
+    sftp_fhandle_t *fh) {
+  uint64_t offset;
+  uint32_t id;
+  int n;
+
+  if (fh->rbuf == NULL) {
+    fh->rbuf = c_malloc(SFTP_BLOCK_SIZE);
+    if (fh->rbuf == NULL) {
+      return -1;
+    }
+  }
+
+  offset = fh->req[fh->req_first].offset;
+  id = fh->req[fh->req_first].id;
+  fh->req_first = (fh->req_first + 1) % SFTP_WINDOW_MAX;
+  fh->req_count--;
+
+  n = sftp_async_read(fh->file, fh->rbuf, SFTP_BLOCK_SIZE, id);
+  if (n < 0) {
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+    if (errno == 0) {
+      errno = EIO;
+    }
+    return -1;
+  }
+  fh->rbuf_len = n;
+  fh->rbuf_pos = 0;
+
+  if (n < SFTP_BLOCK_SIZE) {
+    _sftp_drop_reads(fh);
+    fh->req_offset = offset + n;
+    fh->eof = (n == 0);
+  }
+
+  return 0;
+}
+
+static void _sftp_fhandle_free(sftp_fhandle_t *fh) {
+  SAFE_FREE(fh->rbuf);
+  SAFE_FREE(fh->wbuf);
+  SAFE_FREE(fh);
+}
+
+static csync_vio_method_handle_t *_sftp_open(csync_vio_module_ctx_t *mctx,
+    const char *uri, int flags, mode_t mode) {
   csync_vio_method_handle_t *mh = NULL;
+  sftp_file file;
   char *path = NULL;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return NULL;
   }
 
@@ -545,20 +805,24 @@ static csync_vio_method_handle_t *_sftp_open(const char *uri, int flags, mode_t
     return NULL;
   }
 
-  mh = (csync_vio_method_handle_t *) sftp_open(_sftp_session, path, flags, mode);
-  if (mh == NULL) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+  file = sftp_open(mctx->sftp_session, path, flags, mode);
+  if (file == NULL) {
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+  } else {
+    mh = (csync_vio_method_handle_t *) _sftp_fhandle_new(mctx, file);
   }
 
   SAFE_FREE(path);
   return mh;
 }
 
-static csync_vio_method_handle_t *_sftp_creat(const char *uri, mode_t mode) {
+static csync_vio_method_handle_t *_sftp_creat(csync_vio_module_ctx_t *mctx,
+    const char *uri, mode_t mode) {
   csync_vio_method_handle_t *mh = NULL;
+  sftp_file file;
   char *path = NULL;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return NULL;
   }
 
@@ -566,64 +830,245 @@ static csync_vio_method_handle_t *_sftp_creat(const char *uri, mode_t mode) {
     return NULL;
   }
 
-  mh = (csync_vio_method_handle_t *) sftp_open(_sftp_session, path, O_CREAT|O_WRONLY|O_TRUNC, mode);
-  if (mh == NULL) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+  file = sftp_open(mctx->sftp_session, path, O_CREAT|O_WRONLY|O_TRUNC, mode);
+  if (file == NULL) {
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+  } else {
+    mh = (csync_vio_method_handle_t *) _sftp_fhandle_new(mctx, file);
   }
 
   SAFE_FREE(path);
   return mh;
 }
 
-static int _sftp_close(csync_vio_method_handle_t *fhandle) {
-  int rc = -1;
+static void _sftp_attributes_to_stat(sftp_attributes attrs,
+    csync_vio_file_stat_t *buf) {
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
 
-  rc = sftp_close(fhandle);
-  if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+  switch (attrs->type) {
+    case SSH_FILEXFER_TYPE_REGULAR:
+      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+      break;
+    case SSH_FILEXFER_TYPE_DIRECTORY:
+      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      break;
+    case SSH_FILEXFER_TYPE_SYMLINK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    case SSH_FILEXFER_TYPE_SPECIAL:
+    case SSH_FILEXFER_TYPE_UNKNOWN:
+      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
+      break;
   }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
 
-  return rc;
+  buf->mode = attrs->permissions;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+
+  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+    /* FIXME: handle symlink */
+    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
+  } else {
+    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
+
+  buf->uid = attrs->uid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
+
+  buf->gid = attrs->gid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
+
+  buf->size = attrs->size;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+
+  buf->atime = attrs->atime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
+
+  buf->mtime = attrs->mtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  buf->ctime = attrs->createtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
 }
 
-static ssize_t _sftp_read(csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+static int _sftp_close(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle) {
+  sftp_fhandle_t *fh = (sftp_fhandle_t *) fhandle;
   int rc = -1;
 
-  rc = sftp_read(fhandle, buf, count);
+  int err = 0;
+
+  /* a failed write shows up here, the data was not written */
+  rc = _sftp_flush_writes(mctx, fh);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    err = errno;
+  }
+  _sftp_drop_reads(fh);
+
+  if (sftp_close(fh->file) < 0 && rc == 0) {
+    err = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+    rc = -1;
+  }
+  _sftp_fhandle_free(fh);
+
+  if (rc < 0) {
+    errno = err;
   }
 
   return rc;
 }
 
-static ssize_t _sftp_write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
-  int rc = -1;
+static int _sftp_close_stat(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_file_stat_t *buf) {
+  sftp_fhandle_t *fh = (sftp_fhandle_t *) fhandle;
+  sftp_attributes attrs;
 
-  rc = sftp_write(fhandle, (void *) buf, count);
-  if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+  if (_sftp_flush_writes(mctx, fh) < 0) {
+    int err = errno;
+
+    _sftp_close(mctx, fhandle);
+    errno = err;
+    return -1;
   }
 
-  return rc;
+  /* the stat of the open file, this saves a stat of the path afterwards */
+  attrs = sftp_fstat(fh->file);
+  if (attrs != NULL) {
+    _sftp_attributes_to_stat(attrs, buf);
+    sftp_attributes_free(attrs);
+  }
+
+  return _sftp_close(mctx, fhandle);
 }
 
-static off_t _sftp_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
-  /* FIXME: really implement seek for lseek? */
-  (void) whence;
-  sftp_seek(fhandle, offset);
-  return 0;
+static ssize_t _sftp_read(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+  sftp_fhandle_t *fh = (sftp_fhandle_t *) fhandle;
+  size_t done = 0;
+  size_t len;
+
+  if (fh->wbuf_len > 0) {
+    if (_sftp_flush_writes(mctx, fh) < 0) {
+      return -1;
+    }
+    _sftp_reset_reads(fh);
+  }
+
+  while (done < count) {
+    if (fh->rbuf_pos == fh->rbuf_len) {
+      if (_sftp_request_reads(mctx, fh) < 0) {
+        return done > 0 ? (ssize_t) done : -1;
+      }
+      if (fh->req_count == 0) {
+        break;
+      }
+      if (_sftp_receive_read(mctx, fh) < 0) {
+        return done > 0 ? (ssize_t) done : -1;
+      }
+      if (fh->rbuf_len == 0) {
+        break;
+      }
+    }
+
+    len = MIN(count - done, fh->rbuf_len - fh->rbuf_pos);
+    memcpy((char *) buf + done, fh->rbuf + fh->rbuf_pos, len);
+    fh->rbuf_pos += len;
+    fh->offset += len;
+    done += len;
+  }
+
+  return done;
+}
+
+static ssize_t _sftp_write(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
+  sftp_fhandle_t *fh = (sftp_fhandle_t *) fhandle;
+  size_t done = 0;
+  size_t len;
+
+  if (fh->req_count > 0 || fh->rbuf_len > 0) {
+    _sftp_reset_reads(fh);
+  }
+
+  if (fh->wbuf == NULL) {
+    fh->wbuf_size = MIN((size_t) fh->window * SFTP_BLOCK_SIZE, SFTP_WRITE_MAX);
+    fh->wbuf = c_malloc(fh->wbuf_size);
+    if (fh->wbuf == NULL) {
+      return -1;
+    }
+  }
+
+  while (done < count) {
+    len = MIN(count - done, fh->wbuf_size - fh->wbuf_len);
+    memcpy(fh->wbuf + fh->wbuf_len, (const char *) buf + done, len);
+    fh->wbuf_len += len;
+    fh->offset += len;
+    done += len;
+
+    if (fh->wbuf_len == fh->wbuf_size && _sftp_flush_writes(mctx, fh) < 0) {
+      return -1;
+    }
+  }
+
+  return done;
+}
+
+static off_t _sftp_lseek(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
+  sftp_fhandle_t *fh = (sftp_fhandle_t *) fhandle;
+  sftp_attributes attrs = NULL;
+  uint64_t pos = 0;
+
+  if (_sftp_flush_writes(mctx, fh) < 0) {
+    return (off_t) -1;
+  }
+
+  switch (whence) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = fh->offset + offset;
+      break;
+    case SEEK_END:
+      attrs = sftp_fstat(fh->file);
+      if (attrs == NULL) {
+        errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+        return (off_t) -1;
+      }
+      pos = attrs->size + offset;
+      sftp_attributes_free(attrs);
+      break;
+    default:
+      errno = EINVAL;
+      return (off_t) -1;
+  }
+
+  if (sftp_seek64(fh->file, pos) < 0) {
+    errno = EINVAL;
+    return (off_t) -1;
+  }
+
+  /* the data read ahead is kept when seeking to where the caller is */
+  if (pos != fh->offset) {
+    fh->offset = pos;
+    _sftp_reset_reads(fh);
+  }
+
+  return (off_t) pos;
 }
 
 /*
  * directory functions
  */
 
-static csync_vio_method_handle_t *_sftp_opendir(const char *uri) {
+static csync_vio_method_handle_t *_sftp_opendir(csync_vio_module_ctx_t *mctx,
+    const char *uri) {
   csync_vio_method_handle_t *mh = NULL;
   char *path = NULL;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return NULL;
   }
 
@@ -631,34 +1076,36 @@ static csync_vio_method_handle_t *_sftp_opendir(const char *uri) {
     return NULL;
   }
 
-  mh = (csync_vio_method_handle_t *) sftp_opendir(_sftp_session, path);
+  mh = (csync_vio_method_handle_t *) sftp_opendir(mctx->sftp_session, path);
   if (mh == NULL) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   SAFE_FREE(path);
   return mh;
 }
 
-static int _sftp_closedir(csync_vio_method_handle_t *dhandle) {
+static int _sftp_closedir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
   int rc = -1;
 
   rc = sftp_closedir(dhandle);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   return rc;
 }
 
-static csync_vio_file_stat_t *_sftp_readdir(csync_vio_method_handle_t *dhandle) {
+static csync_vio_file_stat_t *_sftp_readdir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
   sftp_attributes dirent = NULL;
   csync_vio_file_stat_t *fs = NULL;
 
   /* TODO: consider adding the _sftp_connect function */
-  dirent = sftp_readdir(_sftp_session, dhandle);
+  dirent = sftp_readdir(mctx->sftp_session, dhandle);
   if (dirent == NULL) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
     return NULL;
   }
 
@@ -690,11 +1137,12 @@ static csync_vio_file_stat_t *_sftp_readdir(csync_vio_method_handle_t *dhandle)
   return fs;
 }
 
-static int _sftp_mkdir(const char *uri, mode_t mode) {
+static int _sftp_mkdir(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
   char *path = NULL;
   int rc = -1;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return -1;
   }
 
@@ -702,20 +1150,20 @@ static int _sftp_mkdir(const char *uri, mode_t mode) {
     return -1;
   }
 
-  rc = sftp_mkdir(_sftp_session, path, mode);
+  rc = sftp_mkdir(mctx->sftp_session, path, mode);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   SAFE_FREE(path);
   return rc;
 }
 
-static int _sftp_rmdir(const char *uri) {
+static int _sftp_rmdir(csync_vio_module_ctx_t *mctx, const char *uri) {
   char *path = NULL;
   int rc = -1;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return -1;
   }
 
@@ -723,21 +1171,22 @@ static int _sftp_rmdir(const char *uri) {
     return -1;
   }
 
-  rc = sftp_rmdir(_sftp_session, path);
+  rc = sftp_rmdir(mctx->sftp_session, path);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   SAFE_FREE(path);
   return rc;
 }
 
-static int _sftp_stat(const char *uri, csync_vio_file_stat_t *buf) {
+static int _sftp_stat(csync_vio_module_ctx_t *mctx,
+    const char *uri, csync_vio_file_stat_t *buf) {
   sftp_attributes attrs;
   char *path = NULL;
   int rc = -1;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return -1;
   }
 
@@ -745,7 +1194,7 @@ static int _sftp_stat(const char *uri, csync_vio_file_stat_t *buf) {
     return -1;
   }
 
-  attrs = sftp_lstat(_sftp_session, path);
+  attrs = sftp_lstat(mctx->sftp_session, path);
   if (attrs == NULL) {
     rc = -1;
     goto out;
@@ -756,58 +1205,12 @@ static int _sftp_stat(const char *uri, csync_vio_file_stat_t *buf) {
     csync_vio_file_stat_destroy(buf);
     goto out;
   }
-  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-
-  switch (attrs->type) {
-    case SSH_FILEXFER_TYPE_REGULAR:
-      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      break;
-    case SSH_FILEXFER_TYPE_DIRECTORY:
-      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      break;
-    case SSH_FILEXFER_TYPE_SYMLINK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-    case SSH_FILEXFER_TYPE_SPECIAL:
-    case SSH_FILEXFER_TYPE_UNKNOWN:
-      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-      break;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-
-  buf->mode = attrs->permissions;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
-
-  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
-    /* FIXME: handle symlink */
-    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
-  } else {
-    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
-
-  buf->uid = attrs->uid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
-
-  buf->uid = attrs->gid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
-
-  buf->size = attrs->size;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-
-  buf->atime = attrs->atime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
-
-  buf->mtime = attrs->mtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-
-  buf->ctime = attrs->createtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+  _sftp_attributes_to_stat(attrs, buf);
 
   rc = 0;
 out:
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
   SAFE_FREE(path);
   sftp_attributes_free(attrs);
@@ -815,12 +1218,13 @@ out:
   return rc;
 }
 
-static int _sftp_rename(const char *olduri, const char *newuri) {
+static int _sftp_rename(csync_vio_module_ctx_t *mctx,
+    const char *olduri, const char *newuri) {
   char *oldpath = NULL;
   char *newpath = NULL;
   int rc = -1;
 
-  if (_sftp_connect(olduri) < 0) {
+  if (_sftp_connect(mctx, olduri) < 0) {
     return -1;
   }
 
@@ -835,10 +1239,10 @@ static int _sftp_rename(const char *olduri, const char *newuri) {
   }
 
   /* FIXME: workaround cause, sftp_rename can't overwrite */
-  sftp_unlink(_sftp_session, newpath);
-  rc = sftp_rename(_sftp_session, oldpath, newpath);
+  sftp_unlink(mctx->sftp_session, newpath);
+  rc = sftp_rename(mctx->sftp_session, oldpath, newpath);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
 out:
@@ -848,11 +1252,11 @@ out:
   return rc;
 }
 
-static int _sftp_unlink(const char *uri) {
+static int _sftp_unlink(csync_vio_module_ctx_t *mctx, const char *uri) {
   char *path = NULL;
   int rc = -1;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return -1;
   }
 
@@ -860,21 +1264,22 @@ static int _sftp_unlink(const char *uri) {
     return -1;
   }
 
-  rc = sftp_unlink(_sftp_session, path);
+  rc = sftp_unlink(mctx->sftp_session, path);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   SAFE_FREE(path);
   return rc;
 }
 
-static int _sftp_chmod(const char *uri, mode_t mode) {
+static int _sftp_chmod(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
   struct sftp_attributes_struct attrs;
   char *path = NULL;
   int rc = -1;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return -1;
   }
 
@@ -886,21 +1291,22 @@ static int _sftp_chmod(const char *uri, mode_t mode) {
   attrs.permissions = mode;
   attrs.flags |= SSH_FILEXFER_ATTR_PERMISSIONS;
 
-  rc = sftp_setstat(_sftp_session, path, &attrs);
+  rc = sftp_setstat(mctx->sftp_session, path, &attrs);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   SAFE_FREE(path);
   return rc;
 }
 
-static int _sftp_chown(const char *uri, uid_t owner, gid_t group) {
+static int _sftp_chown(csync_vio_module_ctx_t *mctx,
+    const char *uri, uid_t owner, gid_t group) {
   struct sftp_attributes_struct attrs;
   char *path = NULL;
   int rc = -1;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return -1;
   }
 
@@ -913,21 +1319,22 @@ static int _sftp_chown(const char *uri, uid_t owner, gid_t group) {
   attrs.gid = group;
   attrs.flags |= SSH_FILEXFER_ATTR_OWNERGROUP;
 
-  rc = sftp_setstat(_sftp_session, path, &attrs);
+  rc = sftp_setstat(mctx->sftp_session, path, &attrs);
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   SAFE_FREE(path);
   return rc;
 }
 
-static int _sftp_utimes(const char *uri, const struct timeval *times) {
+static int _sftp_utimes(csync_vio_module_ctx_t *mctx,
+    const char *uri, const struct timeval *times) {
   struct sftp_attributes_struct attrs;
   char *path = NULL;
   int rc = -1;
 
-  if (_sftp_connect(uri) < 0) {
+  if (_sftp_connect(mctx, uri) < 0) {
     return -1;
   }
 
@@ -943,21 +1350,417 @@ static int _sftp_utimes(const char *uri, const struct timeval *times) {
   attrs.mtime_nseconds = times[1].tv_usec;
   attrs.flags |= SSH_FILEXFER_ATTR_ACCESSTIME | SSH_FILEXFER_ATTR_MODIFYTIME;
 
-  rc = sftp_setstat(_sftp_session, path, &attrs);
+  rc = sftp_setstat(mctx->sftp_session, path, &attrs);
+  if (rc < 0) {
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
+  }
+
+  SAFE_FREE(path);
+  return rc;
+}
+
+/* set mode, owner and times with a single request */
+static int _sftp_setattr(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode, uid_t owner, gid_t group, time_t mtime) {
+  struct sftp_attributes_struct attrs;
+  char *path = NULL;
+  int rc = -1;
+
+  if (_sftp_connect(mctx, uri) < 0) {
+    return -1;
+  }
+
+  if (c_parse_uri(uri, NULL, NULL, NULL, NULL, NULL, &path) < 0) {
+    return -1;
+  }
+
+  ZERO_STRUCT(attrs);
+  if (mode != 0) {
+    attrs.permissions = mode;
+    attrs.flags |= SSH_FILEXFER_ATTR_PERMISSIONS;
+  }
+
+  if (owner != (uid_t) -1 && group != (gid_t) -1) {
+    attrs.uid = owner;
+    attrs.gid = group;
+    attrs.flags |= SSH_FILEXFER_ATTR_OWNERGROUP;
+  }
+
+  attrs.atime = attrs.mtime = mtime;
+  attrs.flags |= SSH_FILEXFER_ATTR_ACCESSTIME | SSH_FILEXFER_ATTR_MODIFYTIME;
+
+  rc = sftp_setstat(mctx->sftp_session, path, &attrs);
+  if (rc < 0 && (attrs.flags & SSH_FILEXFER_ATTR_OWNERGROUP)) {
+    /* changing the owner is not allowed everywhere, like chown it is optional */
+    attrs.flags &= ~SSH_FILEXFER_ATTR_OWNERGROUP;
+    rc = sftp_setstat(mctx->sftp_session, path, &attrs);
+  }
   if (rc < 0) {
-    errno = _sftp_portable_to_errno(sftp_get_error(_sftp_session));
+    errno = _sftp_portable_to_errno(sftp_get_error(mctx->sftp_session));
   }
 
   SAFE_FREE(path);
   return rc;
 }
 
+/*
+ * The queue of metadata operations, see csync_vio_op_t. The connections of
+ * the workers are opened by the thread of the caller, which also answers
+ * the questions of the host key check and the authentication.
+ */
+#ifdef HAVE_PTHREAD
+/* one of the paths is the other one or below it */
+static int _sftp_meta_path_conflict(const char *a, const char *b) {
+  size_t la, lb;
+
+  if (a == NULL || b == NULL) {
+    return 0;
+  }
+  la = strlen(a);
+  lb = strlen(b);
+  if (la > lb) {
+    const char *t = a;
+    a = b;
+    b = t;
+    la = lb;
+  }
+  if (strncmp(a, b, la) != 0) {
+    return 0;
+  }
+  return b[la] == '\0' || b[la] == '/' || (la > 0 && a[la - 1] == '/');
+}
+
+static int _sftp_meta_op_conflict(const csync_vio_op_t *a,
+    const csync_vio_op_t *b) {
+  return _sftp_meta_path_conflict(a->uri, b->uri) ||
+         _sftp_meta_path_conflict(a->uri, b->newuri) ||
+         _sftp_meta_path_conflict(a->newuri, b->uri) ||
+         _sftp_meta_path_conflict(a->newuri, b->newuri);
+}
+
+/*
+ * The next operation which can run: it must not touch the path of a running
+ * operation or of one submitted before it. Called with the mutex held.
+ */
+static csync_vio_op_t *_sftp_meta_next(struct sftp_meta_queue_s *q) {
+  csync_vio_op_t *op = NULL;
+  csync_vio_op_t *prev = NULL;
+  csync_vio_op_t *before = NULL;
+  int blocked;
+  int i;
+
+  for (op = q->pending; op != NULL; prev = op, op = op->next) {
+    blocked = 0;
+    for (i = 0; i < q->workers && !blocked; i++) {
+      if (q->worker[i].op != NULL &&
+          _sftp_meta_op_conflict(op, q->worker[i].op)) {
+        blocked = 1;
+      }
+    }
+    for (before = q->pending; before != op && !blocked; before = before->next) {
+      blocked = _sftp_meta_op_conflict(op, before);
+    }
+    if (!blocked) {
+      if (prev != NULL) {
+        prev->next = op->next;
+      } else {
+        q->pending = op->next;
+      }
+      op->next = NULL;
+      q->pending_count--;
+      return op;
+    }
+  }
+
+  return NULL;
+}
+
+/* run an operation on the session of a worker */
+static void _sftp_meta_run(sftp_session sftp, csync_vio_op_t *op) {
+  struct sftp_attributes_struct attrs;
+  char *path = NULL;
+  char *newpath = NULL;
+  int rc = -1;
+
+  op->rc = -1;
+  op->err = EINVAL;
+
+  if (c_parse_uri(op->uri, NULL, NULL, NULL, NULL, NULL, &path) < 0) {
+    return;
+  }
+
+  switch (op->type) {
+    case CSYNC_VIO_OP_MKDIR:
+      rc = sftp_mkdir(sftp, path, op->mode);
+      break;
+    case CSYNC_VIO_OP_RMDIR:
+      rc = sftp_rmdir(sftp, path);
+      break;
+    case CSYNC_VIO_OP_UNLINK:
+      rc = sftp_unlink(sftp, path);
+      break;
+    case CSYNC_VIO_OP_RENAME:
+      if (c_parse_uri(op->newuri, NULL, NULL, NULL, NULL, NULL, &newpath) < 0) {
+        SAFE_FREE(path);
+        return;
+      }
+      /* FIXME: workaround cause, sftp_rename can't overwrite */
+      sftp_unlink(sftp, newpath);
+      rc = sftp_rename(sftp, path, newpath);
+      break;
+    case CSYNC_VIO_OP_UTIMES:
+      ZERO_STRUCT(attrs);
+      attrs.atime = attrs.mtime = op->mtime;
+      attrs.flags |= SSH_FILEXFER_ATTR_ACCESSTIME | SSH_FILEXFER_ATTR_MODIFYTIME;
+      rc = sftp_setstat(sftp, path, &attrs);
+      break;
+    default:
+      SAFE_FREE(path);
+      return;
+  }
+
+  if (rc < 0) {
+    op->err = _sftp_portable_to_errno(sftp_get_error(sftp));
+  } else {
+    op->rc = 0;
+    op->err = 0;
+  }
+
+  SAFE_FREE(path);
+  SAFE_FREE(newpath);
+}
+
+static void *_sftp_meta_worker(void *userdata) {
+  struct sftp_meta_worker_s *worker = userdata;
+  struct sftp_meta_queue_s *q = &worker->mctx->meta;
+  csync_vio_op_t *op = NULL;
+  csync_vio_op_t **tail = NULL;
+
+  pthread_mutex_lock(&q->mutex);
+  for (;;) {
+    while (!q->stop && (op = _sftp_meta_next(q)) == NULL) {
+      pthread_cond_wait(&q->work, &q->mutex);
+    }
+    if (op == NULL) {
+      break;
+    }
+    worker->op = op;
+    pthread_mutex_unlock(&q->mutex);
+
+    _sftp_meta_run(worker->sftp_session, op);
+
+    pthread_mutex_lock(&q->mutex);
+    worker->op = NULL;
+    for (tail = &q->done; *tail != NULL; tail = &(*tail)->next);
+    *tail = op;
+    /* operations waiting for this one may run now */
+    pthread_cond_broadcast(&q->work);
+    pthread_cond_broadcast(&q->finished);
+  }
+  pthread_mutex_unlock(&q->mutex);
+
+  return NULL;
+}
+
+/*
+ * Start another worker, on the connection it had before or on a new one.
+ * Only the thread of the caller changes the number of workers, the
+ * connection is opened without holding the mutex.
+ */
+static void _sftp_meta_worker_start(csync_vio_module_ctx_t *mctx) {
+  struct sftp_meta_queue_s *q = &mctx->meta;
+  struct sftp_meta_worker_s *worker = &q->worker[q->workers];
+
+  if (worker->sftp_session == NULL) {
+    DEBUG_SFTP(("csync_sftp - opening connection %d of the queue\n",
+          q->workers + 1));
+    if (_sftp_new_session(mctx, mctx->uri, &worker->ssh_session,
+          &worker->sftp_session) < 0) {
+      worker->ssh_session = NULL;
+      worker->sftp_session = NULL;
+      return;
+    }
+  }
+  worker->mctx = mctx;
+  worker->op = NULL;
+
+  pthread_mutex_lock(&q->mutex);
+  if (pthread_create(&worker->thread, NULL, _sftp_meta_worker, worker) == 0) {
+    q->workers++;
+  }
+  pthread_mutex_unlock(&q->mutex);
+}
+#endif
+
+/*
+ * Queue a metadata operation. It runs on a connection of its own, so it
+ * neither waits for the transfer of the caller nor one round trip for every
+ * other operation.
+ */
+static int _sftp_submit(csync_vio_module_ctx_t *mctx, csync_vio_op_t *op) {
+#ifdef HAVE_PTHREAD
+  struct sftp_meta_queue_s *q = &mctx->meta;
+  csync_vio_op_t **tail = NULL;
+  int start;
+
+  if (op == NULL || op->uri == NULL || op->done == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (mctx->meta_parallel < 1 || _sftp_connect(mctx, op->uri) < 0) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  pthread_mutex_lock(&q->mutex);
+  start = q->workers < q->pending_count + 1 && q->workers < mctx->meta_parallel;
+  pthread_mutex_unlock(&q->mutex);
+  if (start) {
+    _sftp_meta_worker_start(mctx);
+  }
+
+  pthread_mutex_lock(&q->mutex);
+  if (q->workers == 0) {
+    pthread_mutex_unlock(&q->mutex);
+    DEBUG_SFTP(("csync_sftp - no connection for the queue, running %s directly\n",
+          op->uri));
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  while (q->pending_count >= SFTP_META_QUEUE_MAX) {
+    pthread_cond_wait(&q->finished, &q->mutex);
+  }
+
+  op->next = NULL;
+  op->rc = -1;
+  op->err = 0;
+  for (tail = &q->pending; *tail != NULL; tail = &(*tail)->next);
+  *tail = op;
+  q->pending_count++;
+
+  pthread_cond_signal(&q->work);
+  pthread_mutex_unlock(&q->mutex);
+
+  return 0;
+#else
+  (void) mctx;
+  (void) op;
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+/*
+ * Report the finished operations. With wait set, this returns once the
+ * queue is empty and the workers are stopped, their connections stay open.
+ */
+static int _sftp_complete(csync_vio_module_ctx_t *mctx, int wait) {
+#ifdef HAVE_PTHREAD
+  struct sftp_meta_queue_s *q = &mctx->meta;
+  csync_vio_op_t *done = NULL;
+  csync_vio_op_t *next = NULL;
+  int running;
+  int count = 0;
+  int i;
+
+  pthread_mutex_lock(&q->mutex);
+  for (;;) {
+    done = q->done;
+    q->done = NULL;
+
+    /* the callbacks may submit again */
+    pthread_mutex_unlock(&q->mutex);
+    for (; done != NULL; done = next) {
+      next = done->next;
+      done->next = NULL;
+      done->done(done);
+      count++;
+    }
+    pthread_mutex_lock(&q->mutex);
+
+    running = 0;
+    for (i = 0; i < q->workers; i++) {
+      if (q->worker[i].op != NULL) {
+        running = 1;
+      }
+    }
+    if (!wait || (q->pending == NULL && !running && q->done == NULL)) {
+      break;
+    }
+    if (q->done == NULL) {
+      pthread_cond_wait(&q->finished, &q->mutex);
+    }
+  }
+
+  if (!wait || q->workers == 0) {
+    pthread_mutex_unlock(&q->mutex);
+    return count;
+  }
+
+  q->stop = 1;
+  pthread_cond_broadcast(&q->work);
+  pthread_mutex_unlock(&q->mutex);
+
+  for (i = 0; i < q->workers; i++) {
+    pthread_join(q->worker[i].thread, NULL);
+  }
+  q->workers = 0;
+  q->stop = 0;
+
+  return count;
+#else
+  (void) mctx;
+  (void) wait;
+  return 0;
+#endif
+}
+
+/*
+ * Properties of the module:
+ *  transfer_window  int *, the number of read requests of a file in flight,
+ *                   writes are sent in requests of as many blocks
+ *  meta_parallel    int *, the number of queued metadata operations run at
+ *                   the same time, each on a connection of its own, 0 runs
+ *                   them one by one
+ */
+static int _sftp_set_property(csync_vio_module_ctx_t *mctx, const char *key,
+    void *data) {
+  int window;
+  int size;
+
+  if (c_streq(key, "transfer_window")) {
+    window = *(int *) data;
+    if (window < 1 || window > SFTP_WINDOW_MAX) {
+      errno = EINVAL;
+      return -1;
+    }
+    /* files opened from now on use it */
+    mctx->window = window;
+    return 0;
+  }
+
+  if (c_streq(key, "meta_parallel")) {
+    size = *(int *) data;
+    if (size < 0 || size > SFTP_META_MAX) {
+      errno = EINVAL;
+      return -1;
+    }
+    mctx->meta_parallel = size;
+    return 0;
+  }
+
+  return -1;
+}
+
 static struct csync_vio_capabilities_s _sftp_capabilities = {
-    .atomar_copy_support = false
+    .atomar_copy_support = false,
+    .delta_transfer_support = true
 };
 
-static struct csync_vio_capabilities_s *_sftp_get_capabilities(void)
+static struct csync_vio_capabilities_s *_sftp_get_capabilities(csync_vio_module_ctx_t *mctx)
 {
+    (void) mctx;
     return &_sftp_capabilities;
 }
 
@@ -980,37 +1783,91 @@ csync_vio_method_t _method = {
   .unlink = _sftp_unlink,
   .chmod = _sftp_chmod,
   .chown = _sftp_chown,
-  .utimes = _sftp_utimes
+  .utimes = _sftp_utimes,
+  .setattr = _sftp_setattr,
+  .close_stat = _sftp_close_stat,
+  .set_property = _sftp_set_property,
+  .submit = _sftp_submit,
+  .complete = _sftp_complete
 };
 
 csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
-    csync_auth_callback cb, void *userdata) {
+    csync_auth_callback cb, void *userdata, csync_vio_module_ctx_t **mctx) {
   DEBUG_SFTP(("csync_sftp - method_name: %s\n", method_name));
   DEBUG_SFTP(("csync_sftp - args: %s\n", args));
 
   (void) method_name;
   (void) args;
 
-  _authcb = cb;
-  _userdata = userdata;
+  *mctx = c_malloc(sizeof(csync_vio_module_ctx_t));
+  if (*mctx == NULL) {
+    return NULL;
+  }
+
+  (*mctx)->authcb = cb;
+  (*mctx)->userdata = userdata;
+  (*mctx)->window = SFTP_WINDOW_DEFAULT;
+  (*mctx)->meta_parallel = SFTP_META_PARALLEL;
+
+#ifdef HAVE_PTHREAD
+  /* the workers use libssh from several threads */
+  if (_sftp_instances == 0) {
+    ssh_threads_set_callbacks(ssh_threads_get_pthread());
+    ssh_init();
+  }
+  pthread_mutex_init(&(*mctx)->meta.mutex, NULL);
+  pthread_cond_init(&(*mctx)->meta.work, NULL);
+  pthread_cond_init(&(*mctx)->meta.finished, NULL);
+#endif
+  _sftp_instances++;
 
   return &_method;
 }
 
-void vio_module_shutdown(csync_vio_method_t *method) {
+void vio_module_shutdown(csync_vio_method_t *method,
+    csync_vio_module_ctx_t *mctx) {
+#ifdef HAVE_PTHREAD
+  int i;
+#endif
+
   (void) method;
 
-  if (_sftp_session) {
-    sftp_free(_sftp_session);
+  if (mctx == NULL) {
+    return;
   }
-  if (_ssh_session) {
-    ssh_disconnect(_ssh_session);
+
+  _sftp_complete(mctx, 1);
+
+#ifdef HAVE_PTHREAD
+  for (i = 0; i < SFTP_META_MAX; i++) {
+    if (mctx->meta.worker[i].sftp_session) {
+      sftp_free(mctx->meta.worker[i].sftp_session);
+    }
+    if (mctx->meta.worker[i].ssh_session) {
+      ssh_disconnect(mctx->meta.worker[i].ssh_session);
+      ssh_free(mctx->meta.worker[i].ssh_session);
+    }
   }
-  if (_ssh_callbacks) {
-    free(_ssh_callbacks);
+  pthread_mutex_destroy(&mctx->meta.mutex);
+  pthread_cond_destroy(&mctx->meta.work);
+  pthread_cond_destroy(&mctx->meta.finished);
+#endif
+
+  if (mctx->sftp_session) {
+    sftp_free(mctx->sftp_session);
+  }
+  if (mctx->ssh_session) {
+    ssh_disconnect(mctx->ssh_session);
   }
+  if (mctx->callbacks) {
+    free(mctx->callbacks);
+  }
+  SAFE_FREE(mctx->uri);
+  SAFE_FREE(mctx);
 
-  ssh_finalize();
+  if (--_sftp_instances == 0) {
+    ssh_finalize();
+  }
 }
 
 /* vim: set ts=8 sw=2 et cindent: */
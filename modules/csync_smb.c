@@ -34,9 +34,13 @@
 #define DEBUG_SMB(x) printf x
 #endif
 
-SMBCCTX *smb_context = NULL;
-csync_auth_callback _authcb = NULL;
-void *_userdata;
+/* the state of an instance of the module */
+struct csync_vio_module_ctx_s {
+  SMBCCTX *smb_context;
+  csync_auth_callback authcb;
+  void *userdata;
+  int try_krb5;
+};
 
 /*
  * Authentication callback for libsmbclient
@@ -48,9 +52,8 @@ static void get_auth_data_with_context_fn(SMBCCTX *c,
     char *un, int unlen,
     char *pw, int pwlen) {
 
-  static int try_krb5 = 1;
+  csync_vio_module_ctx_t *mctx = smbc_getOptionUserData(c);
 
-  (void) c;
   (void) shr;
   (void) wg;
   (void) wglen;
@@ -65,29 +68,29 @@ static void get_auth_data_with_context_fn(SMBCCTX *c,
   }
 
   /* Try kerberos authentication if available */
-  if (try_krb5 && getenv("KRB5CCNAME")) {
-    try_krb5 = 0;
+  if (mctx->try_krb5 && getenv("KRB5CCNAME")) {
+    mctx->try_krb5 = 0;
 
     return;
   }
 
   /* Call the passwort prompt */
-  if (_authcb != NULL) {
+  if (mctx->authcb != NULL) {
     DEBUG_SMB(("csync_smb - execute authentication callback\n"));
-    (*_authcb) ("Username:", un, unlen, 1, 0, smbc_getOptionUserData(c));
-    (*_authcb) ("Password:", pw, pwlen, 0, 0, smbc_getOptionUserData(c));
+    (*mctx->authcb) ("Username:", un, unlen, 1, 0, mctx->userdata);
+    (*mctx->authcb) ("Password:", pw, pwlen, 0, 0, mctx->userdata);
   }
 
   DEBUG_SMB(("csync_smb - user=%s, workgroup=%s, server=%s, share=%s\n",
         un, wg, srv, shr));
 
-  try_krb5 = 1;
+  mctx->try_krb5 = 1;
 
   return;
 }
 
 typedef struct smb_fhandle_s {
-  int fd;
+  SMBCFILE *fd;
 } smb_fhandle_t;
 
 
@@ -95,11 +98,13 @@ typedef struct smb_fhandle_s {
  * file functions
  */
 
-static csync_vio_method_handle_t *_open(const char *durl, int flags, mode_t mode) {
+static csync_vio_method_handle_t *_open(csync_vio_module_ctx_t *mctx,
+    const char *durl, int flags, mode_t mode) {
   smb_fhandle_t *handle = NULL;
-  int fd = -1;
+  SMBCFILE *fd = NULL;
 
-  if ((fd = smbc_open(durl, flags, mode)) < 0) {
+  fd = smbc_getFunctionOpen(mctx->smb_context)(mctx->smb_context, durl, flags, mode);
+  if (fd == NULL) {
     return NULL;
   }
 
@@ -112,11 +117,13 @@ static csync_vio_method_handle_t *_open(const char *durl, int flags, mode_t mode
   return (csync_vio_method_handle_t *) handle;
 }
 
-static csync_vio_method_handle_t *_creat(const char *durl, mode_t mode) {
+static csync_vio_method_handle_t *_creat(csync_vio_module_ctx_t *mctx,
+    const char *durl, mode_t mode) {
   smb_fhandle_t *handle = NULL;
-  int fd = -1;
+  SMBCFILE *fd = NULL;
 
-  if ((fd = smbc_creat(durl, mode)) < 0) {
+  fd = smbc_getFunctionCreat(mctx->smb_context)(mctx->smb_context, durl, mode);
+  if (fd == NULL) {
     return NULL;
   }
 
@@ -129,7 +136,8 @@ static csync_vio_method_handle_t *_creat(const char *durl, mode_t mode) {
   return (csync_vio_method_handle_t *) handle;
 }
 
-static int _close(csync_vio_method_handle_t *fhandle) {
+static int _close(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle) {
   int rc = -1;
   smb_fhandle_t *handle = NULL;
 
@@ -140,14 +148,15 @@ static int _close(csync_vio_method_handle_t *fhandle) {
 
   handle = (smb_fhandle_t *) fhandle;
 
-  rc = smbc_close(handle->fd);
+  rc = smbc_getFunctionClose(mctx->smb_context)(mctx->smb_context, handle->fd);
 
   SAFE_FREE(handle);
 
   return rc;
 }
 
-static ssize_t _read(csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+static ssize_t _read(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
   smb_fhandle_t *handle = NULL;
 
   if (fhandle == NULL) {
@@ -157,10 +166,12 @@ static ssize_t _read(csync_vio_method_handle_t *fhandle, void *buf, size_t count
 
   handle = (smb_fhandle_t *) fhandle;
 
-  return smbc_read(handle->fd, buf, count);
+  return smbc_getFunctionRead(mctx->smb_context)(mctx->smb_context,
+      handle->fd, buf, count);
 }
 
-static ssize_t _write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
+static ssize_t _write(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
   smb_fhandle_t *handle = NULL;
 
   if (fhandle == NULL) {
@@ -170,10 +181,12 @@ static ssize_t _write(csync_vio_method_handle_t *fhandle, const void *buf, size_
 
   handle = (smb_fhandle_t *) fhandle;
 
-  return smbc_write(handle->fd, (char *) buf, count);
+  return smbc_getFunctionWrite(mctx->smb_context)(mctx->smb_context,
+      handle->fd, buf, count);
 }
 
-static off_t _lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
+static off_t _lseek(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
   smb_fhandle_t *handle = NULL;
 
   if (fhandle == NULL) {
@@ -183,7 +196,8 @@ static off_t _lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence
 
   handle = (smb_fhandle_t *) fhandle;
 
-  return smbc_lseek(handle->fd, offset, whence);
+  return smbc_getFunctionLseek(mctx->smb_context)(mctx->smb_context,
+      handle->fd, offset, whence);
 }
 
 /*
@@ -191,11 +205,12 @@ static off_t _lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence
  */
 
 typedef struct smb_dhandle_s {
-  int dh;
+  SMBCFILE *dh;
   char *path;
 } smb_dhandle_t;
 
-static csync_vio_method_handle_t *_opendir(const char *name) {
+static csync_vio_method_handle_t *_opendir(csync_vio_module_ctx_t *mctx,
+    const char *name) {
   smb_dhandle_t *handle = NULL;
 
   handle = c_malloc(sizeof(smb_dhandle_t));
@@ -203,8 +218,9 @@ static csync_vio_method_handle_t *_opendir(const char *name) {
     return NULL;
   }
 
-  handle->dh = smbc_opendir(name);
-  if (handle->dh < 0) {
+  handle->dh = smbc_getFunctionOpendir(mctx->smb_context)(mctx->smb_context,
+      name);
+  if (handle->dh == NULL) {
     SAFE_FREE(handle);
     return NULL;
   }
@@ -213,7 +229,8 @@ static csync_vio_method_handle_t *_opendir(const char *name) {
   return (csync_vio_method_handle_t *) handle;
 }
 
-static int _closedir(csync_vio_method_handle_t *dhandle) {
+static int _closedir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
   smb_dhandle_t *handle = NULL;
   int rc = -1;
 
@@ -224,7 +241,8 @@ static int _closedir(csync_vio_method_handle_t *dhandle) {
 
   handle = (smb_dhandle_t *) dhandle;
 
-  rc = smbc_closedir(handle->dh);
+  rc = smbc_getFunctionClosedir(mctx->smb_context)(mctx->smb_context,
+      handle->dh);
 
   SAFE_FREE(handle->path);
   SAFE_FREE(handle);
@@ -232,7 +250,8 @@ static int _closedir(csync_vio_method_handle_t *dhandle) {
   return rc;
 }
 
-static csync_vio_file_stat_t *_readdir(csync_vio_method_handle_t *dhandle) {
+static csync_vio_file_stat_t *_readdir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
   struct smbc_dirent *dirent = NULL;
   smb_dhandle_t *handle = NULL;
   csync_vio_file_stat_t *file_stat = NULL;
@@ -240,7 +259,8 @@ static csync_vio_file_stat_t *_readdir(csync_vio_method_handle_t *dhandle) {
   handle = (smb_dhandle_t *) dhandle;
 
   errno = 0;
-  dirent = smbc_readdir(handle->dh);
+  dirent = smbc_getFunctionReaddir(mctx->smb_context)(mctx->smb_context,
+      handle->dh);
   if (dirent == NULL) {
     return NULL;
   }
@@ -279,18 +299,19 @@ static csync_vio_file_stat_t *_readdir(csync_vio_method_handle_t *dhandle) {
   return file_stat;
 }
 
-static int _mkdir(const char *uri, mode_t mode) {
-  return smbc_mkdir(uri, mode);
+static int _mkdir(csync_vio_module_ctx_t *mctx, const char *uri, mode_t mode) {
+  return smbc_getFunctionMkdir(mctx->smb_context)(mctx->smb_context, uri, mode);
 }
 
-static int _rmdir(const char *uri) {
-  return smbc_rmdir(uri);
+static int _rmdir(csync_vio_module_ctx_t *mctx, const char *uri) {
+  return smbc_getFunctionRmdir(mctx->smb_context)(mctx->smb_context, uri);
 }
 
-static int _stat(const char *uri, csync_vio_file_stat_t *buf) {
+static int _stat(csync_vio_module_ctx_t *mctx, const char *uri,
+    csync_vio_file_stat_t *buf) {
   csync_stat_t sb;
 
-  if (smbc_stat(uri, &sb) < 0) {
+  if (smbc_getFunctionStat(mctx->smb_context)(mctx->smb_context, uri, &sb) < 0) {
     return -1;
   }
 
@@ -375,19 +396,23 @@ static int _stat(const char *uri, csync_vio_file_stat_t *buf) {
   return 0;
 }
 
-static int _rename(const char *olduri, const char *newuri) {
-  return smbc_rename(olduri, newuri);
+static int _rename(csync_vio_module_ctx_t *mctx, const char *olduri,
+    const char *newuri) {
+  return smbc_getFunctionRename(mctx->smb_context)(mctx->smb_context, olduri,
+      mctx->smb_context, newuri);
 }
 
-static int _unlink(const char *uri) {
-  return smbc_unlink(uri);
+static int _unlink(csync_vio_module_ctx_t *mctx, const char *uri) {
+  return smbc_getFunctionUnlink(mctx->smb_context)(mctx->smb_context, uri);
 }
 
-static int _chmod(const char *uri, mode_t mode) {
-  return smbc_chmod(uri, mode);
+static int _chmod(csync_vio_module_ctx_t *mctx, const char *uri, mode_t mode) {
+  return smbc_getFunctionChmod(mctx->smb_context)(mctx->smb_context, uri, mode);
 }
 
-static int _chown(const char *uri, uid_t owner, gid_t group) {
+static int _chown(csync_vio_module_ctx_t *mctx, const char *uri, uid_t owner,
+    gid_t group) {
+  (void) mctx;
   (void) uri;
   (void) owner;
   (void) group;
@@ -397,16 +422,19 @@ static int _chown(const char *uri, uid_t owner, gid_t group) {
   return 0;
 }
 
-static int _utimes(const char *uri, const struct timeval *times) {
-  return smbc_utimes(uri, (struct timeval *) times);
+static int _utimes(csync_vio_module_ctx_t *mctx, const char *uri,
+    const struct timeval *times) {
+  return smbc_getFunctionUtimes(mctx->smb_context)(mctx->smb_context, uri,
+      (struct timeval *) times);
 }
 
 static struct csync_vio_capabilities_s _smb_capabilities = {
     .atomar_copy_support = false
 };
 
-static struct csync_vio_capabilities_s *_smb_get_capabilities(void)
+static struct csync_vio_capabilities_s *_smb_get_capabilities(csync_vio_module_ctx_t *mctx)
 {
+    (void) mctx;
     return &_smb_capabilities;
 }
 
@@ -433,42 +461,48 @@ csync_vio_method_t _method = {
 };
 
 csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
-    csync_auth_callback cb, void *userdata) {
-  smb_context = smbc_new_context();
+    csync_auth_callback cb, void *userdata, csync_vio_module_ctx_t **mctx) {
+  csync_vio_module_ctx_t *smb = NULL;
 
   DEBUG_SMB(("csync_smb - method_name: %s\n", method_name));
   DEBUG_SMB(("csync_smb - args: %s\n", args));
   (void) method_name;
   (void) args;
-  (void) cb;
 
-  if (smb_context == NULL) {
-    fprintf(stderr, "csync_smb - failed to create new smbc context\n");
+  smb = c_malloc(sizeof(csync_vio_module_ctx_t));
+  if (smb == NULL) {
     return NULL;
   }
+  smb->authcb = cb;
+  smb->userdata = userdata;
+  smb->try_krb5 = 1;
 
-  if (cb != NULL) {
-    _authcb = cb;
+  smb->smb_context = smbc_new_context();
+  if (smb->smb_context == NULL) {
+    fprintf(stderr, "csync_smb - failed to create new smbc context\n");
+    SAFE_FREE(smb);
+    return NULL;
   }
 
   /* set debug level and authentication function callback */
-  smbc_setDebug(smb_context, 0);
-  smbc_setOptionUserData(smb_context, userdata);
-  smbc_setFunctionAuthDataWithContext(smb_context, get_auth_data_with_context_fn);
+  smbc_setDebug(smb->smb_context, 0);
+  smbc_setOptionUserData(smb->smb_context, smb);
+  smbc_setFunctionAuthDataWithContext(smb->smb_context,
+      get_auth_data_with_context_fn);
 
   /* Kerberos support */
-  smbc_setOptionUseKerberos(smb_context, 1);
-  smbc_setOptionFallbackAfterKerberos(smb_context, 1);
+  smbc_setOptionUseKerberos(smb->smb_context, 1);
+  smbc_setOptionFallbackAfterKerberos(smb->smb_context, 1);
 
   DEBUG_SMB(("csync_smb - use kerberos = %d\n",
-        smbc_getOptionUseKerberos(smb_context)));
+        smbc_getOptionUseKerberos(smb->smb_context)));
   DEBUG_SMB(("csync_smb - use fallback after kerberos = %d\n",
-        smbc_getOptionFallbackAfterKerberos(smb_context)));
+        smbc_getOptionFallbackAfterKerberos(smb->smb_context)));
 
-  if (smbc_init_context(smb_context) == NULL) {
+  if (smbc_init_context(smb->smb_context) == NULL) {
     fprintf(stderr, "csync_smb - failed to initialize the smbc context");
-    smbc_free_context(smb_context, 0);
-    smb_context = NULL;
+    smbc_free_context(smb->smb_context, 0);
+    SAFE_FREE(smb);
 
     return NULL;
   }
@@ -476,22 +510,28 @@ csync_vio_method_t *vio_module_init(const char *method_name, const char *args,
   DEBUG_SMB(("csync_smb - KRB5CCNAME = %s\n", getenv("KRB5CCNAME") != NULL ?
         getenv("KRB5CCNAME") : "not set"));
 
-  smbc_set_context(smb_context);
+  *mctx = smb;
 
   return &_method;
 }
 
-void vio_module_shutdown(csync_vio_method_t *method) {
+void vio_module_shutdown(csync_vio_method_t *method,
+    csync_vio_module_ctx_t *mctx) {
   (void) method;
 
-  if (smb_context != NULL) {
+  if (mctx == NULL) {
+    return;
+  }
+
+  if (mctx->smb_context != NULL) {
     /*
      * If we have a context, all connections and files will be closed even
      * if they are busy.
      */
-    smbc_free_context(smb_context, 1);
-    smb_context = NULL;
+    smbc_free_context(mctx->smb_context, 1);
   }
+
+  SAFE_FREE(mctx);
 }
 
 /* vim: set ts=8 sw=2 et cindent: */
@@ -124,6 +124,11 @@ int csync_create(CSYNC **csync, const char *local, const char *remote) {
   ctx->options.unix_extensions = 0;
   ctx->options.with_conflict_copys=false;
   ctx->options.local_only_mode = false;
+  ctx->options.delta_transfer = false;
+  ctx->options.propagation_order = CSYNC_PROPAGATION_ORDER_TREE;
+  ctx->options.metric_first_files = CSYNC_METRIC_FIRST_FILES;
+  ctx->options.durability = CSYNC_DURABILITY_BATCH;
+  ctx->options.compare_content = true;
 
   ctx->pwd.uid = getuid();
   ctx->pwd.euid = geteuid();
@@ -466,6 +471,14 @@ int csync_propagate(CSYNC *ctx) {
 
   ctx->status_code = CSYNC_STATUS_OK;
 
+  csync_gettime(&ctx->propagation.start);
+  ctx->propagation.files = 0;
+  ctx->propagation.first_files_time = -1;
+
+  if (ctx->callbacks.progress_function != NULL) {
+    csync_propagate_progress_init(ctx);
+  }
+
   /* Reconciliation for local replica */
   csync_gettime(&start);
 
@@ -508,6 +521,17 @@ int csync_propagate(CSYNC *ctx) {
       return -1;
   }
 
+  csync_gettime(&finish);
+
+  if (ctx->propagation.first_files_time >= 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO,
+        "Propagation: first %d files consistent after %.2f seconds",
+        ctx->options.metric_first_files, ctx->propagation.first_files_time);
+  }
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO,
+      "Propagation: %zu files consistent after %.2f seconds",
+      ctx->propagation.files, c_secdiff(finish, ctx->propagation.start));
+
   ctx->status |= CSYNC_STATUS_PROPAGATE;
 
   return 0;
@@ -626,6 +650,45 @@ static void _tree_destructor(void *data) {
   SAFE_FREE(freedata);
 }
 
+/*
+ * Flush the changes of the local replicas to the disk. The statedb must not
+ * be written before, it would refer to data which can still get lost.
+ */
+static int _csync_sync_local_replicas(CSYNC *ctx) {
+  struct timespec start, finish;
+  enum csync_replica_e rep_bak;
+  int rc = 0;
+
+  if (!ctx->propagation.unsynced) {
+    return 0;
+  }
+
+  rep_bak = ctx->replica;
+  ctx->replica = LOCAL_REPLICA;
+
+  csync_gettime(&start);
+
+  if (ctx->local.type == LOCAL_REPLICA) {
+    rc = csync_vio_syncfs(ctx, ctx->local.uri);
+  }
+  if (rc == 0 && ctx->remote.type == LOCAL_REPLICA) {
+    rc = csync_vio_syncfs(ctx, ctx->remote.uri);
+  }
+
+  csync_gettime(&finish);
+
+  ctx->replica = rep_bak;
+
+  if (rc == 0) {
+    ctx->propagation.unsynced = false;
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "Syncing the local replicas took %.2f seconds",
+        c_secdiff(finish, start));
+  }
+
+  return rc;
+}
+
 static int  _merge_and_write_statedb(CSYNC *ctx) {
   struct timespec start, finish;
   char errbuf[256] = {0};
@@ -636,8 +699,15 @@ static int  _merge_and_write_statedb(CSYNC *ctx) {
   if (ctx->statedb.db != NULL) {
     /* and we have successfully synchronized */
     if (ctx->status >= CSYNC_STATUS_DONE) {
+      /* the propagated data has to be durable first */
+      if (_csync_sync_local_replicas(ctx) < 0) {
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+                  "Unable to sync the local replicas: %s", errbuf);
+        ctx->status_code = CSYNC_STATUS_STATEDB_WRITE_ERROR;
+        rc = -1;
       /* merge trees */
-      if (csync_merge_file_trees(ctx) < 0) {
+      } else if (csync_merge_file_trees(ctx) < 0) {
         strerror_r(errno, errbuf, sizeof(errbuf));
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Unable to merge trees: %s",
                   errbuf);
@@ -678,6 +748,8 @@ int csync_commit(CSYNC *ctx) {
 
   ctx->status_code = CSYNC_STATUS_OK;
 
+  csync_propagate_sweep_tmp_files(ctx);
+
   rc = _merge_and_write_statedb(ctx);
   if (rc < 0) {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Merge and Write database failed!");
@@ -768,6 +840,7 @@ int csync_destroy(CSYNC *ctx) {
   }
   ctx->status_code = CSYNC_STATUS_OK;
 
+  csync_propagate_sweep_tmp_files(ctx);
   csync_vio_shutdown(ctx);
 
   rc = _merge_and_write_statedb(ctx);
@@ -809,6 +882,7 @@ int csync_destroy(CSYNC *ctx) {
   SAFE_FREE(ctx->local.uri);
   SAFE_FREE(ctx->remote.uri);
   SAFE_FREE(ctx->options.config_dir);
+  SAFE_FREE(ctx->options.vio_trace);
   SAFE_FREE(ctx->statedb.file);
   SAFE_FREE(ctx->error_string);
 
@@ -961,6 +1035,26 @@ csync_auth_callback csync_get_auth_callback(CSYNC *ctx) {
   return ctx->callbacks.auth_function;
 }
 
+csync_progress_callback csync_get_progress_callback(CSYNC *ctx) {
+  if (ctx == NULL) {
+    return NULL;
+  }
+  ctx->status_code = CSYNC_STATUS_OK;
+
+  return ctx->callbacks.progress_function;
+}
+
+int csync_set_progress_callback(CSYNC *ctx, csync_progress_callback cb) {
+  if (ctx == NULL) {
+    return -1;
+  }
+  ctx->status_code = CSYNC_STATUS_OK;
+
+  ctx->callbacks.progress_function = cb;
+
+  return 0;
+}
+
 int csync_set_status(CSYNC *ctx, int status) {
   if (ctx == NULL || status < 0) {
     return -1;
@@ -1047,4 +1141,59 @@ int csync_set_module_property(CSYNC* ctx, const char* key, void* value)
     return csync_vio_set_property(ctx, key, value);
 }
 
+int csync_get_vio_stats(CSYNC *ctx, struct csync_vio_stats_s *stats) {
+  if (ctx == NULL || stats == NULL) {
+    return -1;
+  }
+  ctx->status_code = CSYNC_STATUS_OK;
+
+  *stats = ctx->vio_stats;
+
+  return 0;
+}
+
+int csync_reset_vio_stats(CSYNC *ctx) {
+  if (ctx == NULL) {
+    return -1;
+  }
+  ctx->status_code = CSYNC_STATUS_OK;
+
+  ZERO_STRUCT(ctx->vio_stats);
+
+  return 0;
+}
+
+static const char *_csync_vio_stats_op_names[CSYNC_VIO_STATS_OP_MAX] = {
+  [CSYNC_VIO_STATS_OPEN] = "open",
+  [CSYNC_VIO_STATS_CREAT] = "creat",
+  [CSYNC_VIO_STATS_CLOSE] = "close",
+  [CSYNC_VIO_STATS_READ] = "read",
+  [CSYNC_VIO_STATS_WRITE] = "write",
+  [CSYNC_VIO_STATS_SENDFILE] = "sendfile",
+  [CSYNC_VIO_STATS_LSEEK] = "lseek",
+  [CSYNC_VIO_STATS_FSYNC] = "fsync",
+  [CSYNC_VIO_STATS_OPENDIR] = "opendir",
+  [CSYNC_VIO_STATS_CLOSEDIR] = "closedir",
+  [CSYNC_VIO_STATS_READDIR] = "readdir",
+  [CSYNC_VIO_STATS_MKDIR] = "mkdir",
+  [CSYNC_VIO_STATS_RMDIR] = "rmdir",
+  [CSYNC_VIO_STATS_STAT] = "stat",
+  [CSYNC_VIO_STATS_RENAME] = "rename",
+  [CSYNC_VIO_STATS_UNLINK] = "unlink",
+  [CSYNC_VIO_STATS_CHMOD] = "chmod",
+  [CSYNC_VIO_STATS_CHOWN] = "chown",
+  [CSYNC_VIO_STATS_UTIMES] = "utimes",
+  [CSYNC_VIO_STATS_SETATTR] = "setattr",
+  [CSYNC_VIO_STATS_CHECKSUM] = "checksum",
+  [CSYNC_VIO_STATS_SUBMIT] = "submit"
+};
+
+const char *csync_vio_stats_op_name(enum csync_vio_stats_op_e op) {
+  if ((unsigned int) op >= CSYNC_VIO_STATS_OP_MAX) {
+    return NULL;
+  }
+
+  return _csync_vio_stats_op_names[op];
+}
+
 /* vim: set ts=8 sw=2 et cindent: */
@@ -189,6 +189,38 @@ typedef void (*csync_log_callback) (int verbosity,
                                     const char *buffer,
                                     void *userdata);
 
+/**
+ * The phase of a file transfer reported to the progress callback.
+ */
+enum csync_progress_phase_e {
+  CSYNC_PROGRESS_START,     /* the transfer of a file starts */
+  CSYNC_PROGRESS_TRANSFER,  /* data of the file has been transferred */
+  CSYNC_PROGRESS_DONE,      /* the file has been transferred */
+  CSYNC_PROGRESS_ERROR      /* the transfer of the file failed */
+};
+
+/**
+ * The progress of a file transfer and of the whole propagation.
+ *
+ * The overall totals are the files and bytes to transfer in this run, they
+ * are calculated when the propagation starts.
+ */
+struct csync_progress_s {
+    enum csync_progress_phase_e phase;
+    const char *path;             /* the path relative to the replica */
+    int64_t bytes_done;           /* bytes of the file transferred */
+    int64_t bytes_total;          /* the size of the file */
+
+    int64_t overall_files_done;
+    int64_t overall_files_total;
+    int64_t overall_bytes_done;
+    int64_t overall_bytes_total;
+};
+typedef struct csync_progress_s CSYNC_PROGRESS;
+
+typedef void (*csync_progress_callback) (const CSYNC_PROGRESS *progress,
+                                         void *userdata);
+
 /**
  * @brief Check internal csync status.
  *
@@ -433,6 +465,30 @@ csync_log_callback csync_get_log_callback(void);
  */
 int csync_set_log_callback(csync_log_callback cb);
 
+/**
+ * @brief Get the progress callback set.
+ *
+ * @param ctx           The csync context.
+ *
+ * @return              The progress callback set or NULL.
+ */
+csync_progress_callback csync_get_progress_callback(CSYNC *ctx);
+
+/**
+ * @brief Set the progress callback.
+ *
+ * The callback is called during the propagation for every file transferred
+ * with the userdata of the context. It is called from the transfer loop, so
+ * it should return quickly.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param cb            The progress callback, NULL to disable it.
+ *
+ * @return              0 on success, less than 0 if an error occured.
+ */
+int csync_set_progress_callback(CSYNC *ctx, csync_progress_callback cb);
+
 /**
  * @brief get the userdata set for the logging callback.
  *
@@ -533,9 +589,137 @@ const char *csync_get_status_string(CSYNC *ctx);
 int csync_set_iconv_codec(const char *from);
 #endif
 
+/**
+ * The statistics about the connections of a module to its server. Modules
+ * which keep their connections open fill it in on csync_set_module_property()
+ * with the key "connection_stats".
+ */
+struct csync_connection_stats_s {
+  unsigned long requests;     /* requests sent to the server */
+  unsigned long connections;  /* connections opened, each with a handshake */
+  unsigned long reused;       /* requests sent on an open connection */
+};
+
+/**
+ * The statistics of the stat cache of a module, filled in on
+ * csync_set_module_property() with the key "stat_cache_stats".
+ */
+struct csync_stat_cache_stats_s {
+  unsigned long hits;         /* stat calls answered from the cache */
+  unsigned long misses;       /* stat calls which needed a request */
+};
+
+/**
+ * The operations of the replicas counted by csync, see csync_get_vio_stats().
+ * Operations queued on the remote module count as submit.
+ */
+enum csync_vio_stats_op_e {
+  CSYNC_VIO_STATS_OPEN,
+  CSYNC_VIO_STATS_CREAT,
+  CSYNC_VIO_STATS_CLOSE,
+  CSYNC_VIO_STATS_READ,
+  CSYNC_VIO_STATS_WRITE,
+  CSYNC_VIO_STATS_SENDFILE,
+  CSYNC_VIO_STATS_LSEEK,
+  CSYNC_VIO_STATS_FSYNC,
+  CSYNC_VIO_STATS_OPENDIR,
+  CSYNC_VIO_STATS_CLOSEDIR,
+  CSYNC_VIO_STATS_READDIR,
+  CSYNC_VIO_STATS_MKDIR,
+  CSYNC_VIO_STATS_RMDIR,
+  CSYNC_VIO_STATS_STAT,
+  CSYNC_VIO_STATS_RENAME,
+  CSYNC_VIO_STATS_UNLINK,
+  CSYNC_VIO_STATS_CHMOD,
+  CSYNC_VIO_STATS_CHOWN,
+  CSYNC_VIO_STATS_UTIMES,
+  CSYNC_VIO_STATS_SETATTR,
+  CSYNC_VIO_STATS_CHECKSUM,
+  CSYNC_VIO_STATS_SUBMIT,
+  CSYNC_VIO_STATS_OP_MAX
+};
+
+/*
+ * The latency histogram has a bucket per power of two microseconds: bucket 0
+ * counts the calls below 2us, bucket i those from 2^i to 2^(i+1) us. The last
+ * bucket counts all calls from about 8 seconds on.
+ */
+#define CSYNC_VIO_STATS_BUCKETS 24
+
+struct csync_vio_op_stats_s {
+  unsigned long calls;
+  unsigned long errors;         /* calls which failed */
+  unsigned long long bytes;     /* read, written or sent */
+  unsigned long long usecs;     /* time spent in the calls */
+  unsigned long histogram[CSYNC_VIO_STATS_BUCKETS];
+};
+
+/**
+ * The statistics of the calls to the replicas, per operation.
+ */
+struct csync_vio_stats_s {
+  struct csync_vio_op_stats_s local[CSYNC_VIO_STATS_OP_MAX];
+  struct csync_vio_op_stats_s remote[CSYNC_VIO_STATS_OP_MAX];
+};
+
+/**
+ * @brief Get the statistics of the calls to the replicas.
+ *
+ * They are counted from the creation of the context or the last reset.
+ *
+ * @param ctx           The csync context.
+ *
+ * @param stats         The struct to fill in.
+ *
+ * @return              0 on success, less than 0 if an error occured.
+ */
+int csync_get_vio_stats(CSYNC *ctx, struct csync_vio_stats_s *stats);
+
+/**
+ * @brief Reset the statistics of the calls to the replicas, e.g. to get
+ * them per phase of the sync.
+ *
+ * @param ctx           The csync context.
+ *
+ * @return              0 on success, less than 0 if an error occured.
+ */
+int csync_reset_vio_stats(CSYNC *ctx);
+
+/**
+ * @brief The name of an operation of the statistics, e.g. "stat".
+ *
+ * @param op            The operation.
+ *
+ * @return              The name, NULL for an unknown operation.
+ */
+const char *csync_vio_stats_op_name(enum csync_vio_stats_op_e op);
+
 /**
  * @brief Set a property to module
  *
+ * The rate limits local_bandwidth_limit, remote_bandwidth_limit,
+ * local_ops_limit and remote_ops_limit are handled by csync for all modules.
+ * Their value is a pointer to an int with the bytes or calls per second.
+ *
+ * The owncloud module keeps a pool of connections to the server. Its size is
+ * set with connection_pool_size, a pointer to an int. The key
+ * connection_stats fills in the struct csync_connection_stats_s the value
+ * points to. Large files are uploaded in chunks of chunk_size bytes, of which
+ * chunk_parallel are sent at the same time, both pointers to an int. The
+ * key stat_cache_stats fills in the struct csync_stat_cache_stats_s. Up to
+ * meta_parallel directory operations and deletes run at the same time, a
+ * pointer to an int, 0 runs them one after the other.
+ *
+ * The sftp module keeps transfer_window read requests of a file in flight and
+ * sends the writes in requests of as many blocks, a pointer to an int. It
+ * runs meta_parallel directory operations and deletes at the same time, each
+ * on a connection of its own, also a pointer to an int.
+ *
+ * The dummy module keeps the remote replica in memory. Its keys latency (in
+ * milliseconds), bandwidth (in bytes per second), error_rate (failures in
+ * 1000 operations), seed, max_parallel and keep_data, all pointers to an
+ * int, make it behave like a server on a slow or broken line.
+ *
  * @param ctx           The csync context.
  *
  * @param key           The property key
@@ -26,6 +26,7 @@
 #include "c_private.h"
 #include "csync_private.h"
 #include "csync_config.h"
+#include "vio/csync_vio.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.config"
 #include "csync_log.h"
@@ -70,6 +71,9 @@ static int _csync_config_copy_default (const char *config) {
 
 int csync_config_load(CSYNC *ctx, const char *config) {
   dictionary *dict;
+  const char *order = NULL;
+  const char *durability = NULL;
+  const char *trace = NULL;
 
   /* copy default config, if no config exists */
   if (! c_isfile(config)) {
@@ -97,6 +101,67 @@ int csync_config_load(CSYNC *ctx, const char *config) {
   CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: sync_symbolic_links = %d",
       ctx->options.sync_symbolic_links);
 
+  ctx->options.delta_transfer = iniparser_getboolean(dict,
+      "global:delta_transfer", 0);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: delta_transfer = %d",
+      ctx->options.delta_transfer);
+
+  ctx->options.compare_content = iniparser_getboolean(dict,
+      "global:compare_content", 1);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: compare_content = %d",
+      ctx->options.compare_content);
+
+  order = iniparser_getstring(dict, "global:propagation_order", "tree");
+  if (c_streq(order, "smallest")) {
+    ctx->options.propagation_order = CSYNC_PROPAGATION_ORDER_SMALLEST;
+  } else if (c_streq(order, "newest")) {
+    ctx->options.propagation_order = CSYNC_PROPAGATION_ORDER_NEWEST;
+  } else if (c_streq(order, "directory")) {
+    ctx->options.propagation_order = CSYNC_PROPAGATION_ORDER_DIRECTORY;
+  } else {
+    ctx->options.propagation_order = CSYNC_PROPAGATION_ORDER_TREE;
+  }
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: propagation_order = %s",
+      order);
+
+  ctx->options.metric_first_files = iniparser_getint(dict,
+      "global:metric_first_files", CSYNC_METRIC_FIRST_FILES);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: metric_first_files = %d",
+      ctx->options.metric_first_files);
+
+  durability = iniparser_getstring(dict, "global:durability", "batch");
+  if (c_streq(durability, "none")) {
+    ctx->options.durability = CSYNC_DURABILITY_NONE;
+  } else if (c_streq(durability, "full")) {
+    ctx->options.durability = CSYNC_DURABILITY_FULL;
+  } else {
+    ctx->options.durability = CSYNC_DURABILITY_BATCH;
+  }
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: durability = %s",
+      durability);
+
+  SAFE_FREE(ctx->options.vio_trace);
+  trace = iniparser_getstring(dict, "global:vio_trace", NULL);
+  if (trace != NULL && *trace != '\0') {
+    ctx->options.vio_trace = c_strdup(trace);
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Config: vio_trace = %s", trace);
+  }
+
+  csync_vio_set_limit(&ctx->limit[LOCAL_REPLICA].bytes,
+      iniparser_getint(dict, "global:local_bandwidth_limit", 0));
+  csync_vio_set_limit(&ctx->limit[REMOTE_REPLICA].bytes,
+      iniparser_getint(dict, "global:remote_bandwidth_limit", 0));
+  csync_vio_set_limit(&ctx->limit[LOCAL_REPLICA].ops,
+      iniparser_getint(dict, "global:local_ops_limit", 0));
+  csync_vio_set_limit(&ctx->limit[REMOTE_REPLICA].ops,
+      iniparser_getint(dict, "global:remote_ops_limit", 0));
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+      "Config: bandwidth_limit = %.0f/%.0f, ops_limit = %.0f/%.0f",
+      ctx->limit[LOCAL_REPLICA].bytes.rate,
+      ctx->limit[REMOTE_REPLICA].bytes.rate,
+      ctx->limit[LOCAL_REPLICA].ops.rate,
+      ctx->limit[REMOTE_REPLICA].ops.rate);
+
   iniparser_freedict(dict);
 
   return 0;
@@ -0,0 +1,704 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2013      by the csync authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "config.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "c_lib.h"
+
+#include "csync_private.h"
+#include "csync_misc.h"
+#include "csync_delta.h"
+#include "vio/csync_vio.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.delta"
+#include "csync_log.h"
+
+static size_t _csync_delta_block_len(csync_delta_signature_t *sig, size_t idx) {
+  off_t offset = (off_t) idx * sig->block_size;
+
+  if (sig->size - offset < (off_t) sig->block_size) {
+    return sig->size - offset;
+  }
+
+  return sig->block_size;
+}
+
+size_t csync_delta_block_size(off_t size) {
+  size_t block_size = CSYNC_DELTA_MIN_BLOCK_SIZE;
+
+  /* about the square root of the file size like rsync does it */
+  while ((off_t) (block_size * block_size) < size &&
+         block_size < CSYNC_DELTA_MAX_BLOCK_SIZE) {
+    block_size <<= 1;
+  }
+
+  return block_size;
+}
+
+void csync_delta_checksum(const unsigned char *buf, size_t len,
+    csync_delta_sum_t *sum) {
+  c_sha1_t sha1;
+  uint32_t a = 0;
+  uint32_t b = 0;
+  size_t i;
+
+  /* the weak rsync checksum */
+  for (i = 0; i < len; i++) {
+    a += buf[i];
+    b += (len - i) * buf[i];
+  }
+  sum->weak = (a & 0xffff) | (b << 16);
+
+  c_sha1_init(&sha1);
+  c_sha1_update(&sha1, buf, len);
+  c_sha1_digest(&sha1, sum->strong);
+}
+
+csync_delta_signature_t *csync_delta_signature(CSYNC *ctx,
+    csync_vio_handle_t *fp, off_t size) {
+  csync_delta_signature_t *sig = NULL;
+  unsigned char *buf = NULL;
+  ssize_t bread = 0;
+  size_t len = 0;
+  size_t i;
+
+  sig = c_malloc(sizeof(csync_delta_signature_t));
+  if (sig == NULL) {
+    return NULL;
+  }
+
+  sig->size = size;
+  sig->block_size = csync_delta_block_size(size);
+  sig->count = (size + sig->block_size - 1) / sig->block_size;
+
+  sig->sums = c_malloc(sig->count * sizeof(csync_delta_sum_t));
+  buf = c_malloc(sig->block_size);
+  if (sig->sums == NULL || buf == NULL) {
+    goto err;
+  }
+
+  for (i = 0; i < sig->count; i++) {
+    len = _csync_delta_block_len(sig, i);
+
+    bread = csync_vio_read_full(ctx, fp, buf, len);
+    if (bread < 0) {
+      goto err;
+    }
+    if ((size_t) bread != len) {
+      /* the file has been changed in the meantime */
+      errno = EIO;
+      goto err;
+    }
+
+    csync_delta_checksum(buf, len, &sig->sums[i]);
+  }
+
+  SAFE_FREE(buf);
+
+  return sig;
+err:
+  SAFE_FREE(buf);
+  csync_delta_signature_free(sig);
+
+  return NULL;
+}
+
+void csync_delta_signature_free(csync_delta_signature_t *sig) {
+  if (sig == NULL) {
+    return;
+  }
+
+  SAFE_FREE(sig->sums);
+  SAFE_FREE(sig);
+}
+
+/* the blocks of the old version by their weak sum */
+struct _csync_delta_index_s {
+  size_t mask;
+  size_t *heads;                /* block index + 1, 0 is empty */
+  size_t *next;
+};
+
+static size_t _csync_delta_slot(struct _csync_delta_index_s *index,
+    uint32_t weak) {
+  return (weak ^ (weak >> 16)) & index->mask;
+}
+
+static int _csync_delta_index_init(struct _csync_delta_index_s *index,
+    csync_delta_signature_t *sig) {
+  size_t slots = 16;
+  size_t slot;
+  size_t i;
+
+  while (slots < 2 * sig->count) {
+    slots <<= 1;
+  }
+
+  index->mask = slots - 1;
+  index->heads = c_malloc(slots * sizeof(size_t));
+  index->next = c_malloc((sig->count + 1) * sizeof(size_t));
+  if (index->heads == NULL || index->next == NULL) {
+    return -1;
+  }
+
+  /* backwards, so the chains start with the lowest offset */
+  for (i = sig->count; i > 0; i--) {
+    slot = _csync_delta_slot(index, sig->sums[i - 1].weak);
+    index->next[i - 1] = index->heads[slot];
+    index->heads[slot] = i;
+  }
+
+  return 0;
+}
+
+static void _csync_delta_index_free(struct _csync_delta_index_s *index) {
+  SAFE_FREE(index->heads);
+  SAFE_FREE(index->next);
+}
+
+/* the block of the old version with the same content, -1 if there is none */
+static ssize_t _csync_delta_find(struct _csync_delta_index_s *index,
+    csync_delta_signature_t *sig, uint32_t weak, const unsigned char *buf,
+    size_t len) {
+  csync_delta_sum_t sum;
+  bool strong = false;
+  size_t i;
+
+  for (i = index->heads[_csync_delta_slot(index, weak)]; i > 0;
+       i = index->next[i - 1]) {
+    if (sig->sums[i - 1].weak != weak ||
+        _csync_delta_block_len(sig, i - 1) != len) {
+      continue;
+    }
+
+    /* the strong sum is only calculated if the weak one matches */
+    if (!strong) {
+      csync_delta_checksum(buf, len, &sum);
+      strong = true;
+    }
+    if (memcmp(sum.strong, sig->sums[i - 1].strong, C_SHA1_DIGEST_LEN) == 0) {
+      return i - 1;
+    }
+  }
+
+  return -1;
+}
+
+/* writing the new version */
+struct _csync_delta_out_s {
+  CSYNC *ctx;
+  enum csync_replica_e drep;
+  const char *duri;
+  csync_vio_handle_t *ofp;      /* the old version */
+  csync_vio_handle_t *tfp;      /* the new one */
+  unsigned char *block;
+  c_sha1_t sha1;
+  off_t matched;
+  off_t literal;
+};
+
+static int _csync_delta_write(struct _csync_delta_out_s *out,
+    const unsigned char *buf, size_t len) {
+  CSYNC *ctx = out->ctx;
+  char errbuf[256] = {0};
+  ssize_t bwritten;
+
+  if (len == 0) {
+    return 0;
+  }
+
+  ctx->replica = out->drep;
+  bwritten = csync_vio_write(ctx, out->tfp, buf, len);
+  if (bwritten < 0 || (size_t) bwritten != len) {
+    ctx->status_code = csync_errno_to_status(errno,
+                                             CSYNC_STATUS_PROPAGATE_ERROR);
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, command: write, error: len = %zu, bwritten = %zd - %s",
+        out->duri, len, bwritten, errbuf);
+    return -1;
+  }
+
+  c_sha1_update(&out->sha1, buf, len);
+
+  return 0;
+}
+
+static int _csync_delta_copy_block(struct _csync_delta_out_s *out,
+    csync_delta_signature_t *sig, size_t idx) {
+  CSYNC *ctx = out->ctx;
+  char errbuf[256] = {0};
+  off_t offset = (off_t) idx * sig->block_size;
+  size_t len = _csync_delta_block_len(sig, idx);
+  ssize_t bread;
+
+  ctx->replica = out->drep;
+  if (csync_vio_lseek(ctx, out->ofp, offset, SEEK_SET) != offset) {
+    ctx->status_code = csync_errno_to_status(errno,
+                                             CSYNC_STATUS_PROPAGATE_ERROR);
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, command: lseek(%jd), error: %s",
+        out->duri, (intmax_t) offset, errbuf);
+    return -1;
+  }
+
+  bread = csync_vio_read_full(ctx, out->ofp, out->block, len);
+  if (bread < 0 || (size_t) bread != len) {
+    /* the file has been changed in the meantime */
+    if (bread >= 0) {
+      errno = EIO;
+    }
+    ctx->status_code = csync_errno_to_status(errno,
+                                             CSYNC_STATUS_PROPAGATE_ERROR);
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, command: read, error: %s", out->duri, errbuf);
+    return -1;
+  }
+
+  if (_csync_delta_write(out, out->block, len) < 0) {
+    return -1;
+  }
+  out->matched += len;
+
+  return 0;
+}
+
+static int _csync_delta_literal(struct _csync_delta_out_s *out,
+    const unsigned char *buf, size_t len) {
+  if (_csync_delta_write(out, buf, len) < 0) {
+    return -1;
+  }
+  out->literal += len;
+
+  return 0;
+}
+
+int csync_delta_patch(CSYNC *ctx, csync_vio_handle_t *sfp,
+    enum csync_replica_e srep, const char *duri, csync_vio_handle_t *tfp,
+    enum csync_replica_e drep, off_t size, csync_delta_stats_t *stats) {
+  enum csync_replica_e rep_bak = -1;
+
+  csync_vio_file_stat_t *dstat = NULL;
+  csync_delta_signature_t *sig = NULL;
+  struct _csync_delta_index_s index;
+  struct _csync_delta_out_s out;
+  c_sha1_t in;
+  csync_delta_sum_t sum;
+  uint8_t in_digest[C_SHA1_DIGEST_LEN];
+  uint8_t out_digest[C_SHA1_DIGEST_LEN];
+
+  unsigned char *buf = NULL;
+  char errbuf[256] = {0};
+  size_t bs = 0;
+  size_t cap = 0;
+  size_t fill = 0;
+  size_t win = 0;
+  size_t lit = 0;
+  ssize_t bread = 0;
+  ssize_t idx = 0;
+  size_t len = 0;
+  off_t total = 0;
+  uint32_t a = 0;
+  uint32_t b = 0;
+  bool rolling = false;
+  bool eof = false;
+  size_t i;
+
+  int rc = 1;
+
+  rep_bak = ctx->replica;
+
+  ZERO_STRUCT(index);
+  ZERO_STRUCT(out);
+
+  if (size < CSYNC_DELTA_MIN_SIZE) {
+    goto out;
+  }
+
+  ctx->replica = drep;
+  dstat = csync_vio_file_stat_new();
+  if (dstat == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    rc = -1;
+    goto out;
+  }
+
+  if (csync_vio_stat(ctx, duri, dstat) < 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        "file: %s, no delta transfer, destination can't be stat'd", duri);
+    goto out;
+  }
+
+  if (dstat->size == 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        "file: %s, no delta transfer, the destination is empty", duri);
+    goto out;
+  }
+
+  out.ctx = ctx;
+  out.drep = drep;
+  out.duri = duri;
+  out.tfp = tfp;
+  out.ofp = csync_vio_open(ctx, duri, O_RDONLY|O_NOCTTY, 0);
+  if (out.ofp == NULL) {
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        "file: %s, no delta transfer, command: open(O_RDONLY), error: %s",
+        duri, errbuf);
+    goto out;
+  }
+
+  sig = csync_delta_signature(ctx, out.ofp, dstat->size);
+  if (sig == NULL) {
+    if (errno == ENOMEM) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        "file: %s, no delta transfer, signature failed: %s",
+        duri, errbuf);
+    goto out;
+  }
+
+  bs = sig->block_size;
+  cap = 4 * bs;
+  buf = c_malloc(cap);
+  out.block = c_malloc(bs);
+  if (buf == NULL || out.block == NULL ||
+      _csync_delta_index_init(&index, sig) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    rc = -1;
+    goto out;
+  }
+
+  c_sha1_init(&in);
+  c_sha1_init(&out.sha1);
+
+  /* From here on the handles are read and written, errors are fatal. */
+  rc = -1;
+
+  /*
+   * A window of a block is moved over the source. Where its weak sum
+   * matches a block of the old version and the strong sum confirms it, the
+   * block is copied from the old version. Otherwise the window moves on by
+   * a byte, the bytes it leaves behind are written as they are.
+   */
+  for (;;) {
+    /* the byte after the window is needed to move it */
+    if (fill - win <= bs && !eof) {
+      if (_csync_delta_literal(&out, buf + lit, win - lit) < 0) {
+        goto out;
+      }
+      memmove(buf, buf + win, fill - win);
+      fill -= win;
+      win = lit = 0;
+
+      ctx->replica = srep;
+      bread = csync_vio_read_full(ctx, sfp, buf + fill, cap - fill);
+      if (bread < 0) {
+        ctx->status_code = csync_errno_to_status(errno,
+                                                 CSYNC_STATUS_PROPAGATE_ERROR);
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+            "file: %s, command: read, error: %s", duri, errbuf);
+        goto out;
+      }
+      if ((size_t) bread < cap - fill) {
+        eof = true;
+      }
+      c_sha1_update(&in, buf + fill, bread);
+      total += bread;
+      fill += bread;
+    }
+
+    if (fill - win >= bs) {
+      if (!rolling) {
+        a = b = 0;
+        for (i = 0; i < bs; i++) {
+          a += buf[win + i];
+          b += (bs - i) * buf[win + i];
+        }
+        rolling = true;
+      }
+
+      idx = _csync_delta_find(&index, sig, (a & 0xffff) | (b << 16),
+                              buf + win, bs);
+      if (idx >= 0) {
+        if (_csync_delta_literal(&out, buf + lit, win - lit) < 0 ||
+            _csync_delta_copy_block(&out, sig, idx) < 0) {
+          goto out;
+        }
+        win += bs;
+        lit = win;
+        rolling = false;
+        continue;
+      }
+
+      if (fill - win > bs) {
+        a += buf[win + bs] - buf[win];
+        b += a - bs * buf[win];
+        win++;
+        continue;
+      }
+    }
+
+    /*
+     * The end of the source. A shorter last block of the old version can
+     * only match the bytes at the very end.
+     */
+    len = _csync_delta_block_len(sig, sig->count - 1);
+    if (len < bs && fill - win >= len) {
+      csync_delta_checksum(buf + fill - len, len, &sum);
+      if (sum.weak == sig->sums[sig->count - 1].weak &&
+          memcmp(sum.strong, sig->sums[sig->count - 1].strong,
+                 C_SHA1_DIGEST_LEN) == 0) {
+        if (_csync_delta_literal(&out, buf + lit, fill - len - lit) < 0 ||
+            _csync_delta_copy_block(&out, sig, sig->count - 1) < 0) {
+          goto out;
+        }
+        lit = fill;
+      }
+    }
+    break;
+  }
+
+  if (_csync_delta_literal(&out, buf + lit, fill - lit) < 0) {
+    goto out;
+  }
+
+  if (total != size) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, error: incorrect filesize (size: %jd should be %jd)",
+        duri, (intmax_t) total, (intmax_t) size);
+    ctx->status_code = CSYNC_STATUS_FILE_SIZE_ERROR;
+    errno = EIO;
+    goto out;
+  }
+
+  /* a block matched by a colliding sum, the whole file is sent instead */
+  c_sha1_digest(&in, in_digest);
+  c_sha1_digest(&out.sha1, out_digest);
+  if (memcmp(in_digest, out_digest, C_SHA1_DIGEST_LEN) != 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "file: %s, delta transfer doesn't match the source, "
+        "transferring the whole file", duri);
+
+    ctx->replica = srep;
+    if (csync_vio_lseek(ctx, sfp, 0, SEEK_SET) != 0) {
+      goto rewind_failed;
+    }
+    ctx->replica = drep;
+    if (csync_vio_lseek(ctx, tfp, 0, SEEK_SET) != 0) {
+      goto rewind_failed;
+    }
+
+    rc = 1;
+    goto out;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "DELTA   file: %s, matched: %jd, written: %jd",
+      duri, (intmax_t) out.matched, (intmax_t) out.literal);
+
+  if (stats != NULL) {
+    stats->matched = out.matched;
+    stats->literal = out.literal;
+  }
+
+  rc = 0;
+  goto out;
+
+rewind_failed:
+  ctx->status_code = csync_errno_to_status(errno,
+                                           CSYNC_STATUS_PROPAGATE_ERROR);
+  strerror_r(errno, errbuf, sizeof(errbuf));
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+      "file: %s, command: lseek(0), error: %s", duri, errbuf);
+out:
+  ctx->replica = drep;
+  csync_vio_close(ctx, out.ofp);
+
+  csync_vio_file_stat_destroy(dstat);
+  csync_delta_signature_free(sig);
+  _csync_delta_index_free(&index);
+  SAFE_FREE(out.block);
+  SAFE_FREE(buf);
+
+  ctx->replica = rep_bak;
+
+  return rc;
+}
+
+int csync_delta_patch_inplace(CSYNC *ctx, csync_vio_handle_t *sfp,
+    enum csync_replica_e srep, const char *duri, csync_vio_handle_t *dfp,
+    enum csync_replica_e drep, off_t size, csync_delta_stats_t *stats) {
+  enum csync_replica_e rep_bak = -1;
+
+  csync_vio_file_stat_t *dstat = NULL;
+  unsigned char *sbuf = NULL;
+  unsigned char *dbuf = NULL;
+  char errbuf[256] = {0};
+  const char *cmd = NULL;
+  size_t bs = 0;
+  size_t slen = 0;
+  size_t dlen = 0;
+  ssize_t bread = 0;
+  ssize_t bwritten = 0;
+  off_t offset = 0;
+  off_t matched = 0;
+  off_t literal = 0;
+
+  int rc = 1;
+
+  rep_bak = ctx->replica;
+
+  if (size < CSYNC_DELTA_MIN_SIZE) {
+    goto out;
+  }
+
+  ctx->replica = drep;
+  dstat = csync_vio_file_stat_new();
+  if (dstat == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    rc = -1;
+    goto out;
+  }
+
+  if (csync_vio_stat(ctx, duri, dstat) < 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        "file: %s, no delta transfer, destination can't be stat'd", duri);
+    goto out;
+  }
+
+  /* the destination can't be truncated through the modules */
+  if (dstat->size == 0 || dstat->size > size) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+        "file: %s, no delta transfer, the destination is empty or longer",
+        duri);
+    goto out;
+  }
+
+  bs = csync_delta_block_size(dstat->size);
+  sbuf = c_malloc(bs);
+  dbuf = c_malloc(bs);
+  if (sbuf == NULL || dbuf == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    rc = -1;
+    goto out;
+  }
+
+  /* From here on the destination is written, errors are fatal. */
+  rc = -1;
+
+  /*
+   * The blocks are compared at the same offset, only the ones which differ
+   * and the data after the end of the old version are written. A block
+   * moved to another offset is written again.
+   */
+  while (offset < size) {
+    slen = MIN((off_t) bs, size - offset);
+
+    ctx->replica = srep;
+    bread = csync_vio_read_full(ctx, sfp, sbuf, slen);
+    if (bread < 0 || (size_t) bread != slen) {
+      /* the file has been changed in the meantime */
+      if (bread >= 0) {
+        errno = EIO;
+      }
+      cmd = "read";
+      goto err;
+    }
+
+    ctx->replica = drep;
+    if (offset < dstat->size) {
+      dlen = MIN((off_t) bs, dstat->size - offset);
+      bread = csync_vio_read_full(ctx, dfp, dbuf, dlen);
+      if (bread < 0 || (size_t) bread != dlen) {
+        if (bread >= 0) {
+          errno = EIO;
+        }
+        cmd = "read";
+        goto err;
+      }
+
+      if (dlen == slen && memcmp(sbuf, dbuf, slen) == 0) {
+        matched += slen;
+        offset += slen;
+        continue;
+      }
+
+      if (csync_vio_lseek(ctx, dfp, offset, SEEK_SET) != offset) {
+        cmd = "lseek";
+        goto err;
+      }
+    }
+
+    bwritten = csync_vio_write(ctx, dfp, sbuf, slen);
+    if (bwritten < 0 || (size_t) bwritten != slen) {
+      if (bwritten >= 0) {
+        errno = EIO;
+      }
+      cmd = "write";
+      goto err;
+    }
+    literal += slen;
+    offset += slen;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "DELTA   file: %s, matched: %jd, written: %jd",
+      duri, (intmax_t) matched, (intmax_t) literal);
+
+  if (stats != NULL) {
+    stats->matched = matched;
+    stats->literal = literal;
+  }
+
+  rc = 0;
+  goto out;
+
+err:
+  ctx->status_code = csync_errno_to_status(errno,
+                                           CSYNC_STATUS_PROPAGATE_ERROR);
+  strerror_r(errno, errbuf, sizeof(errbuf));
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+      "file: %s, command: %s, error: %s", duri, cmd, errbuf);
+out:
+  csync_vio_file_stat_destroy(dstat);
+  SAFE_FREE(sbuf);
+  SAFE_FREE(dbuf);
+
+  ctx->replica = rep_bak;
+
+  return rc;
+}
+
+/* vim: set ts=8 sw=2 et cindent: */
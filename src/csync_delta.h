@@ -0,0 +1,179 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2013      by the csync authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _CSYNC_DELTA_H
+#define _CSYNC_DELTA_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "c_sha1.h"
+#include "csync_private.h"
+#include "vio/csync_vio.h"
+
+/**
+ * @file csync_delta.h
+ *
+ * @brief Delta transfer of modified files
+ *
+ * Instead of copying a modified file as a whole, the old version on the
+ * destination is split into blocks and a signature (a weak rsync style sum
+ * and a strong hash) is calculated for every block. A window of a block is
+ * then moved over the source with a rolling weak sum, so the blocks of the
+ * old version are found at any offset, e.g. after an insertion. The new
+ * version is written to the temporary file of the transfer from the blocks
+ * found and the literal data in between, the caller renames it over the
+ * destination as with a full transfer.
+ *
+ * The result is checked with a SHA1 of the whole file, if it doesn't match
+ * the source the file is transferred as a whole.
+ *
+ * A module can't copy the blocks of the old version into a temporary file
+ * without transferring them. If it writes at any offset of an existing file,
+ * see delta_transfer_support in the capabilities, the destination is patched
+ * in place instead: the old version is read and only the blocks which
+ * differ at the same offset are written. This trades a download of the old
+ * version for the upload of the unchanged blocks, it pays off for appended
+ * and edited files on a line which is slower upstream.
+ *
+ * @defgroup csyncDeltaInternals csync delta transfer internals
+ * @ingroup csyncInternalAPI
+ *
+ * @{
+ */
+
+/**
+ * Files smaller than this are always transferred as a whole.
+ */
+#define CSYNC_DELTA_MIN_SIZE (1024 * 1024)
+
+#define CSYNC_DELTA_MIN_BLOCK_SIZE (4 * 1024)
+#define CSYNC_DELTA_MAX_BLOCK_SIZE (128 * 1024)
+
+typedef struct csync_delta_sum_s {
+  uint32_t weak;
+  uint8_t strong[C_SHA1_DIGEST_LEN];
+} csync_delta_sum_t;
+
+typedef struct csync_delta_signature_s {
+  size_t block_size;
+  size_t count;
+  off_t size;
+  csync_delta_sum_t *sums;
+} csync_delta_signature_t;
+
+typedef struct csync_delta_stats_s {
+  off_t matched;
+  off_t literal;
+} csync_delta_stats_t;
+
+/**
+ * @brief Calculate the block size to use for a file of the given size.
+ *
+ * @param size          The size of the destination file.
+ *
+ * @return The block size, a power of two.
+ */
+size_t csync_delta_block_size(off_t size);
+
+/**
+ * @brief Calculate the weak and the strong sum of a block.
+ *
+ * @param buf           The data of the block.
+ * @param len           The length of the block.
+ * @param sum           The sum to fill.
+ */
+void csync_delta_checksum(const unsigned char *buf, size_t len,
+    csync_delta_sum_t *sum);
+
+/**
+ * @brief Read a file and calculate the signature of its blocks.
+ *
+ * The file is read on the replica set in ctx->replica.
+ *
+ * @param ctx           The csync context.
+ * @param fp            The open file handle, positioned at offset 0.
+ * @param size          The size of the file.
+ *
+ * @return The signature, NULL on error.
+ */
+csync_delta_signature_t *csync_delta_signature(CSYNC *ctx,
+    csync_vio_handle_t *fp, off_t size);
+
+/**
+ * @brief Free a signature.
+ *
+ * @param sig           The signature to free.
+ */
+void csync_delta_signature_free(csync_delta_signature_t *sig);
+
+/**
+ * @brief Write the new version of a file from the blocks of the old one.
+ *
+ * The handles of the source and the temporary file have to be positioned at
+ * offset 0, the temporary file has to be empty. If the delta transfer can't
+ * be used, or its result doesn't match the source, both are at offset 0
+ * again on return, so the caller can fall back to a full transfer.
+ *
+ * @param ctx           The csync context.
+ * @param sfp           The open source file handle.
+ * @param srep          The replica of the source file.
+ * @param duri          The uri of the old version of the file.
+ * @param tfp           The open handle of the temporary file.
+ * @param drep          The replica of the destination file.
+ * @param size          The size of the source file.
+ * @param stats         Filled with the number of matched and written bytes,
+ *                      can be NULL.
+ *
+ * @return 0 on success, 1 if a full transfer has to be done, < 0 on error.
+ */
+int csync_delta_patch(CSYNC *ctx, csync_vio_handle_t *sfp,
+    enum csync_replica_e srep, const char *duri, csync_vio_handle_t *tfp,
+    enum csync_replica_e drep, off_t size, csync_delta_stats_t *stats);
+
+/**
+ * @brief Patch the blocks of a destination which differ from the source.
+ *
+ * The destination is changed in place, it is not replaced atomically. If it
+ * is empty or longer than the source, nothing is written and the caller has
+ * to do a full transfer. Both handles have to be positioned at offset 0.
+ *
+ * @param ctx           The csync context.
+ * @param sfp           The open source file handle.
+ * @param srep          The replica of the source file.
+ * @param duri          The uri of the destination file.
+ * @param dfp           The handle of the destination, opened with O_RDWR.
+ * @param drep          The replica of the destination file.
+ * @param size          The size of the source file.
+ * @param stats         Filled with the number of matched and written bytes,
+ *                      can be NULL.
+ *
+ * @return 0 on success, 1 if a full transfer has to be done, < 0 on error.
+ */
+int csync_delta_patch_inplace(CSYNC *ctx, csync_vio_handle_t *sfp,
+    enum csync_replica_e srep, const char *duri, csync_vio_handle_t *dfp,
+    enum csync_replica_e drep, off_t size, csync_delta_stats_t *stats);
+
+/**
+ * }@
+ */
+#endif /* _CSYNC_DELTA_H */
+
+/* vim: set ft=c.doxygen ts=8 sw=2 et cindent: */
@@ -159,6 +159,12 @@ int csync_excluded(CSYNC *ctx, const char *path) {
       goto out;
   }
 
+  rc = csync_fnmatch(CSYNC_TMP_PATTERN, bname, 0);
+  if (rc == 0) {
+      match = 1;
+      goto out;
+  }
+
   if (ctx->excludes == NULL) {
       goto out;
   }
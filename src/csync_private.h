@@ -33,6 +33,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 #include <sqlite3.h>
 
 #include "config.h"
@@ -64,6 +65,19 @@
 #define MAX_XFER_BUF_SIZE (16 * 1024)
 #endif
 
+/**
+ * Suffix of the temporary files used for the transfer, c_tmpname() replaces
+ * the X characters. Temporary files of interrupted transfers are kept, so
+ * they have to be excluded from the update detection.
+ */
+#define CSYNC_TMP_SUFFIX ".~csync.XXXXXX"
+#define CSYNC_TMP_PATTERN "*.~csync.??????"
+
+/**
+ * Number of files for the time to first files consistent metric
+ */
+#define CSYNC_METRIC_FIRST_FILES 10
+
 #define CSYNC_STATUS_INIT 1 << 0
 #define CSYNC_STATUS_UPDATE 1 << 1
 #define CSYNC_STATUS_RECONCILE 1 << 2
@@ -79,14 +93,49 @@ enum csync_replica_e {
   REMOTE_REPLICA
 };
 
+/**
+ * The order files are propagated in.
+ */
+enum csync_propagation_order_e {
+  CSYNC_PROPAGATION_ORDER_TREE,       /* order of the path hash */
+  CSYNC_PROPAGATION_ORDER_SMALLEST,   /* smallest files first */
+  CSYNC_PROPAGATION_ORDER_NEWEST,     /* most recently modified files first */
+  CSYNC_PROPAGATION_ORDER_DIRECTORY   /* files of a directory together */
+};
+
+/**
+ * When the propagated data of the local replicas gets flushed to the disk.
+ * The statedb is only written after the data is durable.
+ */
+enum csync_durability_e {
+  CSYNC_DURABILITY_NONE,    /* leave it to the operating system */
+  CSYNC_DURABILITY_BATCH,   /* one sync of the file system before the statedb */
+  CSYNC_DURABILITY_FULL     /* every file and its directory after the push */
+};
+
+/**
+ * A token bucket to limit the rate of bytes or operations.
+ */
+typedef struct csync_vio_bucket_s {
+  double rate;            /* tokens per second, 0 is unlimited */
+  double tokens;          /* available tokens, negative if in debt */
+  struct timespec last;   /* time of the last refill */
+} csync_vio_bucket_t;
+
 /**
  * @brief csync public structure
  */
 struct csync_s {
   struct {
       csync_auth_callback auth_function;
+      csync_progress_callback progress_function;
       void *userdata;
   } callbacks;
+
+  /* the progress reported to the progress callback */
+  CSYNC_PROGRESS progress;
+  /* the temporary files kept in this run to resume the transfer */
+  c_list_t *tmpfiles;
   c_strlist_t *excludes;
 
   struct {
@@ -94,6 +143,7 @@ struct csync_s {
     sqlite3 *db;
     int exists;
     int disabled;
+    unsigned long statements;   /* executed, each row inserted counts */
   } statedb;
 
   struct {
@@ -110,11 +160,33 @@ struct csync_s {
     enum csync_replica_e type;
   } remote;
 
+  struct {
+    struct timespec start;
+    size_t files;                 /* files consistent so far */
+    double first_files_time;      /* seconds until metric_first_files files */
+    bool unsynced;                /* local replica changed, not yet synced */
+    bool queue_failed;            /* a queued operation failed fatally */
+  } propagation;
+
+  /* rate limits of the backends, indexed by enum csync_replica_e */
+  struct {
+    csync_vio_bucket_t bytes;   /* bytes read and written */
+    csync_vio_bucket_t ops;     /* stat and readdir calls */
+  } limit[2];
+
+  /* the calls to the replicas, see csync_get_vio_stats() */
+  struct csync_vio_stats_s vio_stats;
+
+  /* directories known to exist in this run, see csync_vio_dircache_add() */
+  c_rbtree_t *dircache;
+
   struct {
     void *handle;
     csync_vio_method_t *method;
+    csync_vio_module_ctx_t *mctx;       /* the instance of the module */
     csync_vio_method_finish_fn finish_fn;
     csync_vio_capabilities_t capabilities;
+    struct csync_vio_trace_s *trace;    /* the calls are traced, see vio_trace */
   } module;
 
   struct {
@@ -125,6 +197,12 @@ struct csync_s {
     char *config_dir;
     bool with_conflict_copys;
     bool local_only_mode;
+    bool delta_transfer;
+    bool compare_content;
+    enum csync_propagation_order_e propagation_order;
+    int metric_first_files;
+    enum csync_durability_e durability;
+    char *vio_trace;                    /* the file the remote calls are traced to */
 #ifdef WITH_ICONV
     iconv_t iconv_cd;
 #endif
@@ -170,6 +248,9 @@ struct csync_file_stat_s {
   int nlink;        /* u32 */
   int type;         /* u32 */
   enum csync_instructions_e instruction; /* u32 */
+  ino_t dst_inode;  /* u64, inode on the other replica after propagation */
+  int remove_tree;  /* u32, removed directory with all its content removed */
+  int untracked;    /* u32, directory with content the update skipped */
   char path[1]; /* u8 */
 }
 #if !defined(__SUNPRO_C) && !defined(_MSC_VER)
@@ -32,7 +32,10 @@
 #include "csync_private.h"
 #include "csync_misc.h"
 #include "csync_propagate.h"
+#include "csync_delta.h"
 #include "csync_statedb.h"
+#include "csync_time.h"
+#include "c_jhash.h"
 #include "vio/csync_vio_local.h"
 #include "vio/csync_vio.h"
 
@@ -49,6 +52,54 @@ static int _csync_cleanup_cmp(const void *a, const void *b) {
   return strcmp(st_a->path, st_b->path);
 }
 
+static int _csync_path_cmp(const csync_file_stat_t *a,
+    const csync_file_stat_t *b) {
+  return strcmp(a->path, b->path);
+}
+
+static int _csync_order_smallest_cmp(const void *a, const void *b) {
+  const csync_file_stat_t *st_a = a;
+  const csync_file_stat_t *st_b = b;
+
+  if (st_a->size != st_b->size) {
+    return st_a->size < st_b->size ? -1 : 1;
+  }
+
+  return _csync_path_cmp(st_a, st_b);
+}
+
+static int _csync_order_newest_cmp(const void *a, const void *b) {
+  const csync_file_stat_t *st_a = a;
+  const csync_file_stat_t *st_b = b;
+
+  if (st_a->modtime != st_b->modtime) {
+    return st_a->modtime > st_b->modtime ? -1 : 1;
+  }
+
+  return _csync_path_cmp(st_a, st_b);
+}
+
+/* compare the directory first, so the files of a directory are together */
+static int _csync_order_directory_cmp(const void *a, const void *b) {
+  const csync_file_stat_t *st_a = a;
+  const csync_file_stat_t *st_b = b;
+  const char *name_a = strrchr(st_a->path, '/');
+  const char *name_b = strrchr(st_b->path, '/');
+  size_t len_a = name_a ? (size_t) (name_a - st_a->path) : 0;
+  size_t len_b = name_b ? (size_t) (name_b - st_b->path) : 0;
+  int rc;
+
+  rc = strncmp(st_a->path, st_b->path, len_a < len_b ? len_a : len_b);
+  if (rc != 0) {
+    return rc;
+  }
+  if (len_a != len_b) {
+    return len_a < len_b ? -1 : 1;
+  }
+
+  return _csync_path_cmp(st_a, st_b);
+}
+
 static bool _push_to_tmp_first(CSYNC *ctx)
 {
     if( ctx->current == REMOTE_REPLICA ) return true; /* Always push to tmp for destination local file system */
@@ -59,6 +110,253 @@ static bool _push_to_tmp_first(CSYNC *ctx)
     return false;
 }
 
+static bool _use_delta_transfer(CSYNC *ctx, csync_file_stat_t *st)
+{
+    if( !ctx->options.delta_transfer ) return false;
+
+    /* Only files which already exist on the destination can be patched. */
+    return st->instruction == CSYNC_INSTRUCTION_SYNC;
+}
+
+/* the module writes the changed blocks into the existing file */
+static bool _use_delta_inplace(CSYNC *ctx, csync_file_stat_t *st)
+{
+    if( ctx->current != LOCAL_REPLICA ) return false;
+
+    if( !ctx->module.capabilities.delta_transfer_support ) return false;
+
+    return _use_delta_transfer(ctx, st);
+}
+
+/* the replica of the uri of a temporary file, -1 if it is on neither */
+static int _csync_tmp_file_replica(CSYNC *ctx, const char *turi) {
+  size_t len;
+
+  len = strlen(ctx->remote.uri);
+  if (strncmp(turi, ctx->remote.uri, len) == 0 && turi[len] == '/') {
+    return ctx->remote.type;
+  }
+
+  len = strlen(ctx->local.uri);
+  if (strncmp(turi, ctx->local.uri, len) == 0 && turi[len] == '/') {
+    return ctx->local.type;
+  }
+
+  return -1;
+}
+
+static void _csync_unlink_tmp_file(CSYNC *ctx, const char *turi) {
+  enum csync_replica_e replica = ctx->replica;
+  int rep;
+
+  rep = _csync_tmp_file_replica(ctx, turi);
+  if (rep < 0) {
+    return;
+  }
+
+  ctx->replica = rep;
+  if (csync_vio_unlink(ctx, turi) < 0 && errno != ENOENT) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "file: %s, unable to remove the kept temporary file: %s",
+        turi, strerror(errno));
+  }
+  ctx->replica = replica;
+}
+
+/* the interrupted transfer won't be resumed */
+static void _csync_drop_tmp_file(CSYNC *ctx, csync_progressinfo_t *pi) {
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "file: %s, dropping the kept temporary file", pi->tmpfile);
+
+  _csync_unlink_tmp_file(ctx, pi->tmpfile);
+  csync_statedb_delete_progressinfo(ctx, pi->phash);
+}
+
+/*
+ * Reopen the temporary file of an interrupted transfer. The checksum of the
+ * already transferred part is verified and both files are positioned behind
+ * it. Returns NULL if the transfer has to start from the beginning.
+ */
+static csync_vio_handle_t *_csync_resume_tmp_file(CSYNC *ctx,
+    csync_file_stat_t *st, const char *duri, csync_vio_handle_t *sfp,
+    enum csync_replica_e srep, enum csync_replica_e drep,
+    char **turi, off_t *transferred, uint64_t *checksum) {
+  csync_progressinfo_t *pi = NULL;
+  csync_vio_handle_t *tfp = NULL;
+  char buf[MAX_XFER_BUF_SIZE] = {0};
+  uint64_t sum = 0;
+  off_t done = 0;
+  ssize_t bread = 0;
+  size_t len = strlen(duri);
+
+  pi = csync_statedb_get_progressinfo(ctx, st->phash);
+  if (pi == NULL) {
+    return NULL;
+  }
+
+  /* the temporary file belongs to a transfer in the other direction */
+  if (strncmp(pi->tmpfile, duri, len) != 0 || pi->tmpfile[len] != '.') {
+    _csync_drop_tmp_file(ctx, pi);
+    csync_statedb_free_progressinfo(pi);
+    return NULL;
+  }
+
+  /* the progress info is only used once */
+  csync_statedb_delete_progressinfo(ctx, st->phash);
+
+  ctx->replica = drep;
+  if (pi->modtime != st->modtime || pi->size != st->size) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, source changed since the transfer was interrupted", duri);
+    goto err;
+  }
+
+  tfp = csync_vio_open(ctx, pi->tmpfile, O_RDWR|O_NOCTTY, 0);
+  if (tfp == NULL) {
+    goto err;
+  }
+
+  /* verify the transferred part, it is checksummed in blocks of the buffer size */
+  while (done < pi->transferred) {
+    bread = csync_vio_read_full(ctx, tfp, buf, MAX_XFER_BUF_SIZE);
+    if (bread != MAX_XFER_BUF_SIZE) {
+      goto err;
+    }
+    sum = c_jhash64((uint8_t *) buf, bread, sum);
+    done += bread;
+  }
+
+  if (done != pi->transferred || sum != pi->checksum) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "file: %s, checksum mismatch of the transferred part", pi->tmpfile);
+    goto err;
+  }
+
+  if (csync_vio_lseek(ctx, tfp, done, SEEK_SET) != done) {
+    goto err;
+  }
+
+  ctx->replica = srep;
+  if (csync_vio_lseek(ctx, sfp, done, SEEK_SET) != done) {
+    /* make sure we start at the beginning */
+    csync_vio_lseek(ctx, sfp, 0, SEEK_SET);
+    goto err;
+  }
+
+  *turi = pi->tmpfile;
+  pi->tmpfile = NULL;
+  *transferred = done;
+  *checksum = sum;
+
+  csync_statedb_free_progressinfo(pi);
+  ctx->replica = drep;
+
+  return tfp;
+err:
+  ctx->replica = drep;
+  csync_vio_close(ctx, tfp);
+  csync_vio_unlink(ctx, pi->tmpfile);
+  csync_statedb_free_progressinfo(pi);
+
+  return NULL;
+}
+
+/*
+ * Keep the temporary file of an interrupted transfer and record it in the
+ * statedb, so that the next run can resume it.
+ */
+static int _csync_keep_tmp_file(CSYNC *ctx, csync_file_stat_t *st,
+    const char *turi, off_t transferred, uint64_t checksum) {
+  csync_progressinfo_t pi;
+
+  pi.phash = st->phash;
+  pi.tmpfile = (char *) turi;
+  pi.size = st->size;
+  pi.modtime = st->modtime;
+  pi.transferred = transferred;
+  pi.checksum = checksum;
+
+  if (csync_statedb_write_progressinfo(ctx, &pi) < 0) {
+    return -1;
+  }
+
+  /* the record is lost if the journal isn't written */
+  ctx->tmpfiles = c_list_prepend(ctx->tmpfiles, c_strdup(turi));
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "file: %s, kept %jd transferred bytes to resume",
+      turi, (intmax_t) transferred);
+
+  return 0;
+}
+
+/* report the progress of a file transfer, nothing is done without a callback */
+static void _csync_progress(CSYNC *ctx, enum csync_progress_phase_e phase,
+    csync_file_stat_t *st, off_t done) {
+  if (ctx->callbacks.progress_function == NULL) {
+    return;
+  }
+
+  if (phase == CSYNC_PROGRESS_START) {
+    ctx->progress.bytes_done = 0;
+  }
+  ctx->progress.overall_bytes_done += done - ctx->progress.bytes_done;
+  if (phase == CSYNC_PROGRESS_DONE) {
+    ctx->progress.overall_files_done++;
+  }
+
+  ctx->progress.phase = phase;
+  ctx->progress.path = st->path;
+  ctx->progress.bytes_done = done;
+  ctx->progress.bytes_total = st->size;
+
+  ctx->callbacks.progress_function(&ctx->progress, ctx->callbacks.userdata);
+}
+
+/* the source file of a transfer streamed with csync_vio_sendfile */
+struct _csync_push_source_s {
+  CSYNC *ctx;
+  csync_file_stat_t *st;
+  csync_vio_handle_t *sfp;
+  enum csync_replica_e srep;
+  off_t transferred;
+  uint64_t checksum;
+  int error;
+};
+
+static ssize_t _csync_push_source(void *userdata, char *buf, size_t count) {
+  struct _csync_push_source_s *source = userdata;
+  CSYNC *ctx = source->ctx;
+  ssize_t bread = 0;
+
+  ctx->replica = source->srep;
+
+  if (count == 0) {
+    /* the request is sent again, start over */
+    if (csync_vio_lseek(ctx, source->sfp, 0, SEEK_SET) < 0) {
+      source->error = errno;
+      return -1;
+    }
+    source->transferred = 0;
+    source->checksum = 0;
+    return 0;
+  }
+
+  bread = csync_vio_read_full(ctx, source->sfp, buf, count);
+  if (bread < 0) {
+    source->error = errno;
+    return -1;
+  }
+
+  source->checksum = c_jhash64((uint8_t *) buf, bread, source->checksum);
+  source->transferred += bread;
+
+  _csync_progress(ctx, CSYNC_PROGRESS_TRANSFER, source->st,
+                  source->transferred);
+
+  return bread;
+}
+
 static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   enum csync_replica_e srep = -1;
   enum csync_replica_e drep = -1;
@@ -78,7 +376,14 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   char buf[MAX_XFER_BUF_SIZE] = {0};
   ssize_t bread = 0;
   ssize_t bwritten = 0;
-  struct timeval times[2];
+
+  struct _csync_push_source_s source;
+  off_t transferred = 0;
+  uint64_t checksum = 0;
+  bool resumable = false;
+  bool streamed = false;
+  bool mtime_set = false;
+  bool inplace = false;
 
   int rc = -1;
   int count = 0;
@@ -146,9 +451,55 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     goto out;
   }
 
-  if (_push_to_tmp_first(ctx)) {
+  _csync_progress(ctx, CSYNC_PROGRESS_START, st, 0);
+
+  /* only send the blocks which changed, into the destination itself */
+  if (_use_delta_inplace(ctx, st)) {
+    ctx->replica = drep;
+    dfp = csync_vio_open(ctx, duri, O_RDWR|O_NOCTTY, 0);
+    if (dfp != NULL) {
+      rc = csync_delta_patch_inplace(ctx, sfp, srep, duri, dfp, drep,
+                                     st->size, NULL);
+      if (rc == 0) {
+        inplace = true;
+      } else if (rc < 0) {
+        /* the destination may be written partly, it is not removed */
+        if (ctx->status_code != CSYNC_STATUS_MEMORY_ERROR) {
+          rc = 1;
+        }
+        goto out;
+      } else {
+        /* rc == 1, fall back to a full transfer */
+        csync_vio_close(ctx, dfp);
+        dfp = NULL;
+      }
+    }
+  }
+
+  if (inplace) {
+    if (asprintf(&turi, "%s", duri) < 0) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+      goto out;
+    }
+    streamed = true;
+    transferred = st->size;
+    _csync_progress(ctx, CSYNC_PROGRESS_TRANSFER, st, transferred);
+  } else if (_push_to_tmp_first(ctx)) {
+    dfp = _csync_resume_tmp_file(ctx, st, duri, sfp, srep, drep,
+                                 &turi, &transferred, &checksum);
+  }
+
+  if (inplace) {
+    /* the destination is open, it is not renamed */
+  } else if (dfp != NULL) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+              "file: %s, resuming transfer at %jd of %jd bytes",
+              turi, (intmax_t) transferred, (intmax_t) st->size);
+    _csync_progress(ctx, CSYNC_PROGRESS_TRANSFER, st, transferred);
+  } else if (_push_to_tmp_first(ctx)) {
     /* create the temporary file name */
-    if (asprintf(&turi, "%s.XXXXXX", duri) < 0) {
+    if (asprintf(&turi, "%s" CSYNC_TMP_SUFFIX, duri) < 0) {
       ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
       rc = -1;
       goto out;
@@ -173,7 +524,8 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   /* Create the destination file */
   ctx->replica = drep;
-  while ((dfp = csync_vio_open(ctx, turi, O_CREAT|O_EXCL|O_WRONLY|O_NOCTTY,
+  while (dfp == NULL &&
+         (dfp = csync_vio_open(ctx, turi, O_CREAT|O_EXCL|O_WRONLY|O_NOCTTY,
           C_FILE_MODE)) == NULL) {
     ctx->status_code = csync_errno_to_status(errno,
                                              CSYNC_STATUS_PROPAGATE_ERROR);
@@ -203,6 +555,9 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
           goto out;
         }
 
+        /* the directory is gone, even if it has been seen in this run */
+        csync_vio_dircache_remove(ctx, tdir);
+
         if (csync_vio_mkdirs(ctx, tdir, C_DIR_MODE) < 0) {
           ctx->status_code = csync_errno_to_status(errno,
                                                    CSYNC_STATUS_PROPAGATE_ERROR);
@@ -232,10 +587,68 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
 
   }
 
+  /* send the mtime with the upload, this saves the utimes afterwards */
+  if (transferred == 0 && ctx->module.capabilities.upload_mtime_support) {
+    ctx->replica = drep;
+    if (csync_vio_set_upload_mtime(ctx, dfp, st->modtime) < 0) {
+      strerror_r(errno, errbuf, sizeof(errbuf));
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,
+          "file: %s, command: set_upload_mtime, error: %s",
+          turi, errbuf);
+    }
+  }
+
+  /* write the new version from the blocks of the old one */
+  if (transferred == 0 && _push_to_tmp_first(ctx) &&
+      drep == LOCAL_REPLICA && _use_delta_transfer(ctx, st)) {
+    rc = csync_delta_patch(ctx, sfp, srep, duri, dfp, drep, st->size, NULL);
+    if (rc < 0) {
+      if (ctx->status_code != CSYNC_STATUS_MEMORY_ERROR) {
+        rc = 1;
+      }
+      goto out;
+    } else if (rc == 0) {
+      streamed = true;
+      transferred = st->size;
+      _csync_progress(ctx, CSYNC_PROGRESS_TRANSFER, st, transferred);
+    }
+    /* rc == 1, fall back to a full transfer */
+  }
+
+  /* stream the file if the destination pulls the data while sending it */
+  if (!streamed && transferred == 0) {
+    ZERO_STRUCT(source);
+    source.ctx = ctx;
+    source.st = st;
+    source.sfp = sfp;
+    source.srep = srep;
+
+    ctx->replica = drep;
+    if (csync_vio_sendfile(ctx, dfp, _csync_push_source, &source, st->size) == 0) {
+      streamed = true;
+      transferred = source.transferred;
+      checksum = source.checksum;
+    } else if (errno != ENOTSUP) {
+      transferred = source.transferred;
+      if (source.error != 0) {
+        errno = source.error;
+      }
+      ctx->status_code = csync_errno_to_status(errno,
+                                               CSYNC_STATUS_PROPAGATE_ERROR);
+      strerror_r(errno, errbuf, sizeof(errbuf));
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+          "file: %s, command: sendfile, error: %s",
+          duri,
+          errbuf);
+      rc = 1;
+      goto out;
+    }
+  }
+
   /* copy file */
-  for (;;) {
+  while (!streamed) {
     ctx->replica = srep;
-    bread = csync_vio_read(ctx, sfp, buf, MAX_XFER_BUF_SIZE);
+    bread = csync_vio_read_full(ctx, sfp, buf, MAX_XFER_BUF_SIZE);
 
     if (bread < 0) {
       /* read error */
@@ -245,6 +658,7 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
           "file: %s, command: read, error: %s",
           suri, errbuf);
+      resumable = true;
       rc = 1;
       goto out;
     } else if (bread == 0) {
@@ -265,9 +679,16 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
           bread,
           bwritten,
           errbuf);
+      resumable = true;
       rc = 1;
       goto out;
     }
+
+    /* only full blocks are written before the end of the file */
+    checksum = c_jhash64((uint8_t *) buf, bwritten, checksum);
+    transferred += bwritten;
+
+    _csync_progress(ctx, CSYNC_PROGRESS_TRANSFER, st, transferred);
   }
 
   ctx->replica = srep;
@@ -282,8 +703,38 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   }
   sfp = NULL;
 
+  tstat = csync_vio_file_stat_new();
+  if (tstat == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    rc = -1;
+    goto out;
+  }
+
+  ctx->replica = drep;
+  if (ctx->options.durability == CSYNC_DURABILITY_FULL &&
+      csync_vio_fsync(ctx, dfp) < 0) {
+    ctx->status_code = csync_errno_to_status(errno,
+                                             CSYNC_STATUS_PROPAGATE_ERROR);
+    switch (errno) {
+      /* stop if no space left or quota exceeded */
+      case ENOSPC:
+      case EDQUOT:
+        rc = -1;
+        break;
+      default:
+        rc = 1;
+        break;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, command: fsync, error: %s",
+        turi,
+        errbuf);
+    goto out;
+  }
+
   ctx->replica = drep;
-  if (csync_vio_close(ctx, dfp) < 0) {
+  if (csync_vio_close_stat(ctx, dfp, tstat) < 0) {
     dfp = NULL;
     ctx->status_code = csync_errno_to_status(errno,
                                              CSYNC_STATUS_PROPAGATE_ERROR);
@@ -309,18 +760,18 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
   }
   dfp = NULL;
 
+  /* the destination has confirmed the mtime sent with the upload */
+  if ((tstat->fields & CSYNC_VIO_FILE_STAT_FIELDS_MTIME) &&
+      tstat->mtime == st->modtime) {
+    mtime_set = true;
+  }
+
   /*
-   * Check filesize
+   * Check filesize, stat the file if close didn't return it
    */
   ctx->replica = drep;
-  tstat = csync_vio_file_stat_new();
-  if (tstat == NULL) {
-    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-    rc = -1;
-    goto out;
-  }
-
-  if (csync_vio_stat(ctx, turi, tstat) < 0) {
+  if (!(tstat->fields & CSYNC_VIO_FILE_STAT_FIELDS_SIZE) &&
+      csync_vio_stat(ctx, turi, tstat) < 0) {
     ctx->status_code = csync_errno_to_status(errno,
                                              CSYNC_STATUS_PROPAGATE_ERROR);
     switch (errno) {
@@ -348,7 +799,7 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     goto out;
   }
 
-  if (_push_to_tmp_first(ctx)) {
+  if (!inplace && _push_to_tmp_first(ctx)) {
     /* override original file */
     ctx->replica = drep;
     if (csync_vio_rename(ctx, turi, duri) < 0) {
@@ -371,45 +822,69 @@ static int _csync_push_file(CSYNC *ctx, csync_file_stat_t *st) {
     }
   }
 
-  /* set mode only if it is not the default mode */
-  if ((st->mode & 07777) != C_FILE_MODE) {
-    if (csync_vio_chmod(ctx, duri, st->mode) < 0) {
+  /* the new directory entry has to be durable as well */
+  if (ctx->options.durability == CSYNC_DURABILITY_FULL) {
+    SAFE_FREE(tdir);
+    tdir = c_dirname(duri);
+    if (tdir == NULL) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      rc = -1;
+      goto out;
+    }
+
+    ctx->replica = drep;
+    if (csync_vio_fsync_dir(ctx, tdir) < 0) {
       ctx->status_code = csync_errno_to_status(errno,
                                                CSYNC_STATUS_PROPAGATE_ERROR);
-      switch (errno) {
-        case ENOMEM:
-          rc = -1;
-          break;
-        default:
-          rc = 1;
-          break;
-      }
       strerror_r(errno, errbuf, sizeof(errbuf));
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-          "file: %s, command: chmod, error: %s",
-          duri,
-          errbuf);
+                "dir: %s, command: fsync, error: %s",
+                tdir,
+                errbuf);
+      rc = 1;
       goto out;
     }
+    SAFE_FREE(tdir);
   }
 
-  /* set owner and group if possible */
-  if (ctx->pwd.euid == 0) {
-    csync_vio_chown(ctx, duri, st->uid, st->gid);
+  /* set mode only if it is not the default mode, owner and group if possible */
+  ctx->replica = drep;
+  if (!(mtime_set && (st->mode & 07777) == C_FILE_MODE && ctx->pwd.euid != 0) &&
+      csync_vio_setattr(ctx, duri,
+                        (st->mode & 07777) != C_FILE_MODE ? st->mode : 0,
+                        ctx->pwd.euid == 0 ? st->uid : (uid_t) -1,
+                        ctx->pwd.euid == 0 ? st->gid : (gid_t) -1,
+                        st->modtime) < 0) {
+    ctx->status_code = csync_errno_to_status(errno,
+                                             CSYNC_STATUS_PROPAGATE_ERROR);
+    switch (errno) {
+      case ENOMEM:
+        rc = -1;
+        break;
+      default:
+        rc = 1;
+        break;
+    }
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, command: setattr, error: %s",
+        duri,
+        errbuf);
+    goto out;
   }
 
-  /* sync time */
-  times[0].tv_sec = times[1].tv_sec = st->modtime;
-  times[0].tv_usec = times[1].tv_usec = 0;
-
-  ctx->replica = drep;
-  csync_vio_utimes(ctx, duri, times);
+  /* the merger doesn't need to stat the file if the inode is known */
+  if (tstat != NULL && (tstat->fields & CSYNC_VIO_FILE_STAT_FIELDS_INODE)) {
+    st->dst_inode = tstat->inode;
+  }
 
   /* set instruction for the statedb merger */
   st->instruction = CSYNC_INSTRUCTION_UPDATED;
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "PUSHED  file: %s", duri);
 
+  _csync_progress(ctx, CSYNC_PROGRESS_DONE, st, st->size);
+
   rc = 0;
 
 out:
@@ -424,8 +899,12 @@ out:
   /* set instruction for the statedb merger */
   if (rc != 0) {
     st->instruction = CSYNC_INSTRUCTION_ERROR;
-    if (turi != NULL) {
-      csync_vio_unlink(ctx, turi);
+    _csync_progress(ctx, CSYNC_PROGRESS_ERROR, st, transferred);
+    if (turi != NULL && !inplace) {
+      if (!resumable || transferred == 0 || !_push_to_tmp_first(ctx) ||
+          _csync_keep_tmp_file(ctx, st, turi, transferred, checksum) < 0) {
+        csync_vio_unlink(ctx, turi);
+      }
     }
   }
 
@@ -620,86 +1099,184 @@ static int _csync_conflict_file(CSYNC *ctx, csync_file_stat_t *st) {
   return rc;
 }
 
-static int _csync_remove_file(CSYNC *ctx, csync_file_stat_t *st) {
-  char errbuf[256] = {0};
-  char *uri = NULL;
-  int rc = -1;
+/*
+ * Remember a change of a local replica, it gets flushed to the disk before
+ * the statedb is written. Removals happen on the replica of the tree, all
+ * other changes on the other replica.
+ */
+static void _csync_propagation_unsynced(CSYNC *ctx, csync_file_stat_t *st) {
+  enum csync_replica_e type;
 
-  switch (ctx->current) {
-    case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
-        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-        return -1;
-      }
+  if (ctx->options.durability != CSYNC_DURABILITY_BATCH) {
+    return;
+  }
+
+  switch (st->instruction) {
+    case CSYNC_INSTRUCTION_DELETED:
+      type = ctx->current == LOCAL_REPLICA ? ctx->local.type : ctx->remote.type;
       break;
-    case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
-        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-        return -1;
-      }
+    case CSYNC_INSTRUCTION_UPDATED:
+      type = ctx->current == LOCAL_REPLICA ? ctx->remote.type : ctx->local.type;
       break;
     default:
-      break;
+      return;
   }
 
-  if (csync_vio_unlink(ctx, uri) < 0) {
-    ctx->status_code = csync_errno_to_status(errno,
-                                             CSYNC_STATUS_PROPAGATE_ERROR);
-    switch (errno) {
-      case ENOMEM:
-        rc = -1;
-        break;
-      default:
-        rc = 1;
-        break;
-    }
-    strerror_r(errno, errbuf, sizeof(errbuf));
-    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
-        "file: %s, command: unlink, error: %s",
-        uri,
-        errbuf);
-    goto out;
+  if (type == LOCAL_REPLICA) {
+    ctx->propagation.unsynced = true;
   }
+}
 
-  /* set instruction for the statedb merger */
-  st->instruction = CSYNC_INSTRUCTION_DELETED;
+/* count the files which are consistent for the time to first files metric */
+static void _csync_propagation_file_done(CSYNC *ctx, csync_file_stat_t *st) {
+  struct timespec now;
 
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "REMOVED file: %s", uri);
+  if (st->instruction != CSYNC_INSTRUCTION_UPDATED &&
+      st->instruction != CSYNC_INSTRUCTION_DELETED) {
+    return;
+  }
 
-  rc = 0;
-out:
-  SAFE_FREE(uri);
+  ctx->propagation.files++;
+  if (ctx->propagation.files == (size_t) ctx->options.metric_first_files) {
+    csync_gettime(&now);
+    ctx->propagation.first_files_time = c_secdiff(now, ctx->propagation.start);
+  }
+}
 
-  /* set instruction for the statedb merger */
-  if (rc != 0) {
+/*
+ * A metadata operation of the propagation, see csync_vio_submit(). The
+ * result is handled by the done callback, which runs when the backend has
+ * run it. That may be later, while other entries are propagated.
+ */
+struct _csync_meta_op_s {
+  csync_vio_op_t op;                /* first, done gets a pointer to it */
+  CSYNC *ctx;
+  csync_file_stat_t *st;
+  enum csync_replica_e current;     /* the tree of the entry */
+  enum csync_replica_e replica;     /* the replica the operation runs on */
+};
+
+static void _csync_meta_op_free(csync_vio_op_t *op) {
+  if (op == NULL) {
+    return;
+  }
+  SAFE_FREE(op->uri);
+  SAFE_FREE(op->newuri);
+  SAFE_FREE(op);
+}
+
+/* a new operation on the uri of the entry, on the replica of ctx */
+static struct _csync_meta_op_s *_csync_meta_op_new(CSYNC *ctx,
+    csync_file_stat_t *st, enum csync_vio_op_type_e type, const char *uri,
+    time_t mtime, csync_vio_op_done_fn done) {
+  struct _csync_meta_op_s *meta = NULL;
+
+  meta = c_malloc(sizeof(struct _csync_meta_op_s));
+  if (meta == NULL) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return NULL;
+  }
+  meta->op.uri = c_strdup(uri);
+  if (meta->op.uri == NULL) {
+    SAFE_FREE(meta);
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return NULL;
+  }
+  meta->op.type = type;
+  meta->op.mode = C_DIR_MODE;
+  meta->op.mtime = mtime;
+  meta->op.done = done;
+  meta->ctx = ctx;
+  meta->st = st;
+  meta->current = ctx->current;
+  meta->replica = ctx->replica;
+
+  return meta;
+}
+
+/*
+ * Submit an operation on the uri to ctx->replica. The done callback is
+ * always called, if the operation can't be submitted with its error.
+ * Returns -1 if there is no memory for the operation.
+ */
+static int _csync_meta_submit(CSYNC *ctx, csync_file_stat_t *st,
+    enum csync_vio_op_type_e type, const char *uri, time_t mtime,
+    csync_vio_op_done_fn done) {
+  struct _csync_meta_op_s *meta = NULL;
+
+  meta = _csync_meta_op_new(ctx, st, type, uri, mtime, done);
+  if (meta == NULL) {
+    return -1;
+  }
+
+  if (csync_vio_submit(ctx, &meta->op) < 0) {
+    meta->op.rc = -1;
+    meta->op.err = errno;
+    done(&meta->op);
+  }
+
+  return 0;
+}
+
+/* the result of an operation which is ignored, like the utimes of a dir */
+static void _csync_meta_ignore(csync_vio_op_t *op) {
+  _csync_meta_op_free(op);
+}
+
+/* an error of a queued operation which stops the propagation */
+static void _csync_meta_fatal(CSYNC *ctx, int err) {
+  if (err == ENOMEM) {
+    ctx->propagation.queue_failed = true;
+  }
+}
+
+static void _csync_remove_file_done(csync_vio_op_t *op) {
+  struct _csync_meta_op_s *meta = (struct _csync_meta_op_s *) op;
+  CSYNC *ctx = meta->ctx;
+  csync_file_stat_t *st = meta->st;
+  enum csync_replica_e current = ctx->current;
+  char errbuf[256] = {0};
+
+  if (op->rc < 0) {
+    ctx->status_code = csync_errno_to_status(op->err,
+                                             CSYNC_STATUS_PROPAGATE_ERROR);
+    _csync_meta_fatal(ctx, op->err);
+    strerror_r(op->err, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
+        "file: %s, command: unlink, error: %s",
+        op->uri,
+        errbuf);
     /* Write file to statedb, to try to sync again on the next run. */
     st->instruction = CSYNC_INSTRUCTION_NONE;
+  } else {
+    /* set instruction for the statedb merger */
+    st->instruction = CSYNC_INSTRUCTION_DELETED;
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "REMOVED file: %s", op->uri);
   }
 
-  return rc;
+  ctx->current = meta->current;
+  _csync_propagation_unsynced(ctx, st);
+  _csync_propagation_file_done(ctx, st);
+  ctx->current = current;
+
+  _csync_meta_op_free(op);
 }
 
-static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
-  enum csync_replica_e dest = -1;
-  enum csync_replica_e replica_bak;
-  char errbuf[256] = {0};
+/* the result is handled by _csync_remove_file_done */
+static int _csync_remove_file(CSYNC *ctx, csync_file_stat_t *st) {
   char *uri = NULL;
-  struct timeval times[2];
   int rc = -1;
 
-  replica_bak = ctx->replica;
-
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      dest = ctx->remote.type;
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      dest = ctx->local.type;
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
         ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
         return -1;
       }
@@ -708,43 +1285,60 @@ static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
       break;
   }
 
-  ctx->replica = dest;
-  if (csync_vio_mkdirs(ctx, uri, C_DIR_MODE) < 0) {
-    ctx->status_code = csync_errno_to_status(errno,
-                                             CSYNC_STATUS_PROPAGATE_ERROR);
-    switch (errno) {
-      case ENOMEM:
-        rc = -1;
-        break;
-      default:
-        rc = 1;
-        break;
+  rc = _csync_meta_submit(ctx, st, CSYNC_VIO_OP_UNLINK, uri, 0,
+                          _csync_remove_file_done);
+  SAFE_FREE(uri);
+
+  return rc;
+}
+
+static void _csync_new_dir_done(csync_vio_op_t *op) {
+  struct _csync_meta_op_s *meta = (struct _csync_meta_op_s *) op;
+  CSYNC *ctx = meta->ctx;
+  csync_file_stat_t *st = meta->st;
+  enum csync_replica_e replica_bak = ctx->replica;
+  enum csync_replica_e current = ctx->current;
+  char errbuf[256] = {0};
+  struct timeval times[2];
+  int err = op->err;
+  int rc = op->rc;
+
+  times[0].tv_sec = times[1].tv_sec = st->modtime;
+  times[0].tv_usec = times[1].tv_usec = 0;
+
+  ctx->replica = meta->replica;
+  if (rc < 0 && err != EEXIST && err != ENOMEM) {
+    /* the parent may be missing, it is created as well then */
+    rc = csync_vio_mkdirs(ctx, op->uri, C_DIR_MODE);
+    err = errno;
+    if (rc == 0) {
+      csync_vio_utimes(ctx, op->uri, times);
     }
-    strerror_r(errno, errbuf, sizeof(errbuf));
+  }
+
+  if (rc < 0 && err != EEXIST) {
+    ctx->status_code = csync_errno_to_status(err,
+                                             CSYNC_STATUS_PROPAGATE_ERROR);
+    _csync_meta_fatal(ctx, err);
+    strerror_r(err, errbuf, sizeof(errbuf));
     CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
         "dir: %s, command: mkdirs, error: %s",
-        uri,
+        op->uri,
         errbuf);
     goto out;
   }
+  csync_vio_dircache_add(ctx, op->uri);
 
   /* chmod is if it is not the default mode */
   if ((st->mode & 07777) != C_DIR_MODE) {
-    if (csync_vio_chmod(ctx, uri, st->mode) < 0) {
+    if (csync_vio_chmod(ctx, op->uri, st->mode) < 0) {
       ctx->status_code = csync_errno_to_status(errno,
                                                CSYNC_STATUS_PROPAGATE_ERROR);
-      switch (errno) {
-        case ENOMEM:
-          rc = -1;
-          break;
-        default:
-          rc = 1;
-          break;
-      }
+      _csync_meta_fatal(ctx, errno);
       strerror_r(errno, errbuf, sizeof(errbuf));
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
           "dir: %s, command: chmod, error: %s",
-          uri,
+          op->uri,
           errbuf);
       goto out;
     }
@@ -752,29 +1346,84 @@ static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
 
   /* set owner and group if possible */
   if (ctx->pwd.euid == 0) {
-    csync_vio_chown(ctx, uri, st->uid, st->gid);
+    csync_vio_chown(ctx, op->uri, st->uid, st->gid);
   }
 
-  times[0].tv_sec = times[1].tv_sec = st->modtime;
-  times[0].tv_usec = times[1].tv_usec = 0;
-
-  csync_vio_utimes(ctx, uri, times);
-
   /* set instruction for the statedb merger */
   st->instruction = CSYNC_INSTRUCTION_UPDATED;
 
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "CREATED  dir: %s", uri);
-  ctx->replica = replica_bak;
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "CREATED  dir: %s", op->uri);
 
   rc = 0;
 out:
-  SAFE_FREE(uri);
-
   /* set instruction for the statedb merger */
   if (rc != 0) {
     st->instruction = CSYNC_INSTRUCTION_ERROR;
   }
 
+  ctx->current = meta->current;
+  _csync_propagation_unsynced(ctx, st);
+  ctx->current = current;
+  ctx->replica = replica_bak;
+
+  _csync_meta_op_free(op);
+}
+
+/*
+ * Create the directory and set its mtime, the result is handled by
+ * _csync_new_dir_done. The utimes is submitted right away, so it is sent
+ * after the mkdir without waiting for it.
+ */
+static int _csync_new_dir(CSYNC *ctx, csync_file_stat_t *st) {
+  struct _csync_meta_op_s *meta = NULL;
+  enum csync_replica_e dest = -1;
+  enum csync_replica_e replica_bak;
+  char *uri = NULL;
+  int rc = -1;
+
+  replica_bak = ctx->replica;
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      dest = ctx->remote.type;
+      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+      }
+      break;
+    case REMOTE_REPLICA:
+      dest = ctx->local.type;
+      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+      }
+      break;
+    default:
+      break;
+  }
+
+  ctx->replica = dest;
+  if (csync_vio_dircache_contains(ctx, uri)) {
+    /* it has been created for a file in it already */
+    meta = _csync_meta_op_new(ctx, st, CSYNC_VIO_OP_MKDIR, uri, 0,
+                              _csync_new_dir_done);
+    if (meta != NULL) {
+      meta->op.rc = 0;
+      _csync_new_dir_done(&meta->op);
+      rc = 0;
+    }
+  } else {
+    rc = _csync_meta_submit(ctx, st, CSYNC_VIO_OP_MKDIR, uri, 0,
+                            _csync_new_dir_done);
+  }
+  if (rc == 0) {
+    rc = _csync_meta_submit(ctx, st, CSYNC_VIO_OP_UTIMES, uri, st->modtime,
+                            _csync_meta_ignore);
+  }
+  ctx->replica = replica_bak;
+
+  SAFE_FREE(uri);
+
   return rc;
 }
 
@@ -783,7 +1432,6 @@ static int _csync_sync_dir(CSYNC *ctx, csync_file_stat_t *st) {
   enum csync_replica_e replica_bak;
   char errbuf[256] = {0};
   char *uri = NULL;
-  struct timeval times[2];
   int rc = -1;
 
   replica_bak = ctx->replica;
@@ -836,10 +1484,12 @@ static int _csync_sync_dir(CSYNC *ctx, csync_file_stat_t *st) {
     csync_vio_chown(ctx, uri, st->uid, st->gid);
   }
 
-  times[0].tv_sec = times[1].tv_sec = st->modtime;
-  times[0].tv_usec = times[1].tv_usec = 0;
-
-  csync_vio_utimes(ctx, uri, times);
+  /* a failing utimes is ignored, it doesn't need to be waited for */
+  if (_csync_meta_submit(ctx, st, CSYNC_VIO_OP_UTIMES, uri, st->modtime,
+                         _csync_meta_ignore) < 0) {
+    rc = -1;
+    goto out;
+  }
 
   /* set instruction for the statedb merger */
   st->instruction = CSYNC_INSTRUCTION_UPDATED;
@@ -859,71 +1509,58 @@ out:
   return rc;
 }
 
-static int _csync_remove_dir(CSYNC *ctx, csync_file_stat_t *st) {
+static void _csync_remove_dir_done(csync_vio_op_t *op) {
+  struct _csync_meta_op_s *meta = (struct _csync_meta_op_s *) op;
+  CSYNC *ctx = meta->ctx;
+  csync_file_stat_t *st = meta->st;
+  enum csync_replica_e current = ctx->current;
   c_list_t *list = NULL;
   char errbuf[256] = {0};
-  char *uri = NULL;
   int rc = -1;
 
-  switch (ctx->current) {
-    case LOCAL_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
-        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-        return -1;
-      }
-      break;
-    case REMOTE_REPLICA:
-      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
-        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-        return -1;
-      }
-      break;
-    default:
-      break;
-  }
-
-  if (csync_vio_rmdir(ctx, uri) < 0) {
-    ctx->status_code = csync_errno_to_status(errno,
+  if (op->rc < 0) {
+    ctx->status_code = csync_errno_to_status(op->err,
                                              CSYNC_STATUS_PROPAGATE_ERROR);
-    switch (errno) {
+    switch (op->err) {
       case ENOMEM:
-        strerror_r(errno, errbuf, sizeof(errbuf));
+        strerror_r(op->err, errbuf, sizeof(errbuf));
         CSYNC_LOG(CSYNC_LOG_PRIORITY_FATAL,
             "dir: %s, command: rmdir, error: %s",
-            uri,
+            op->uri,
             errbuf);
-        rc = -1;
+        _csync_meta_fatal(ctx, op->err);
         break;
       case ENOTEMPTY:
-        switch (ctx->current) {
+        /* try again after the propagation, see _csync_propagation_cleanup */
+        switch (meta->current) {
           case LOCAL_REPLICA:
             list = c_list_prepend(ctx->local.list, (void *) st);
-            if (list == NULL) {
-              ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-              return -1;
+            if (list != NULL) {
+              ctx->local.list = list;
             }
-            ctx->local.list = list;
             break;
           case REMOTE_REPLICA:
             list = c_list_prepend(ctx->remote.list, (void *) st);
-            if (list == NULL) {
-              ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
-              return -1;
+            if (list != NULL) {
+              ctx->remote.list = list;
             }
-            ctx->remote.list = list;
             break;
           default:
             break;
         }
+        if (list == NULL) {
+          ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+          _csync_meta_fatal(ctx, ENOMEM);
+          break;
+        }
         rc = 0;
         break;
       default:
-        strerror_r(errno, errbuf, sizeof(errbuf));
+        strerror_r(op->err, errbuf, sizeof(errbuf));
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR,
             "dir: %s, command: rmdir, error: %s",
-            uri,
+            op->uri,
             errbuf);
-        rc = 1;
         break;
     }
     goto out;
@@ -932,17 +1569,48 @@ static int _csync_remove_dir(CSYNC *ctx, csync_file_stat_t *st) {
   /* set instruction for the statedb merger */
   st->instruction = CSYNC_INSTRUCTION_DELETED;
 
-  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "REMOVED  dir: %s", uri);
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "REMOVED  dir: %s", op->uri);
 
   rc = 0;
 out:
-  SAFE_FREE(uri);
-
   /* set instruction for the statedb merger */
   if (rc != 0) {
     st->instruction = CSYNC_INSTRUCTION_NONE;
   }
 
+  ctx->current = meta->current;
+  _csync_propagation_unsynced(ctx, st);
+  ctx->current = current;
+
+  _csync_meta_op_free(op);
+}
+
+/* the result is handled by _csync_remove_dir_done */
+static int _csync_remove_dir(CSYNC *ctx, csync_file_stat_t *st) {
+  char *uri = NULL;
+  int rc = -1;
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+      }
+      break;
+    case REMOTE_REPLICA:
+      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+      }
+      break;
+    default:
+      break;
+  }
+
+  rc = _csync_meta_submit(ctx, st, CSYNC_VIO_OP_RMDIR, uri, 0,
+                          _csync_remove_dir_done);
+  SAFE_FREE(uri);
+
   return rc;
 }
 
@@ -1024,10 +1692,11 @@ static int _csync_propagation_file_visitor(void *obj, void *data) {
           }
           break;
         case CSYNC_INSTRUCTION_REMOVE:
+          /* the result is counted by _csync_remove_file_done */
           if (_csync_remove_file(ctx, st) < 0) {
             goto err;
           }
-          break;
+          return csync_vio_complete(ctx, false) < 0 ? -1 : 0;
         case CSYNC_INSTRUCTION_CONFLICT:
           CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE,"case CSYNC_INSTRUCTION_CONFLICT: %s",st->path);
           if (_csync_conflict_file(ctx, st) < 0) {
@@ -1037,6 +1706,8 @@ static int _csync_propagation_file_visitor(void *obj, void *data) {
         default:
           break;
       }
+      _csync_propagation_unsynced(ctx, st);
+      _csync_propagation_file_done(ctx, st);
       break;
     case CSYNC_FTW_TYPE_DIR:
       /*
@@ -1069,11 +1740,12 @@ static int _csync_propagation_dir_visitor(void *obj, void *data) {
       break;
     case CSYNC_FTW_TYPE_DIR:
       switch (st->instruction) {
+        /* new and removed directories are handled by the done callbacks */
         case CSYNC_INSTRUCTION_NEW:
           if (_csync_new_dir(ctx, st) < 0) {
             goto err;
           }
-          break;
+          return 0;
         case CSYNC_INSTRUCTION_SYNC:
           if (_csync_sync_dir(ctx, st) < 0) {
             goto err;
@@ -1089,10 +1761,11 @@ static int _csync_propagation_dir_visitor(void *obj, void *data) {
           if (_csync_remove_dir(ctx, st) < 0) {
             goto err;
           }
-          break;
+          return 0;
         default:
           break;
       }
+      _csync_propagation_unsynced(ctx, st);
       break;
     default:
       break;
@@ -1103,6 +1776,281 @@ err:
   return -1;
 }
 
+static int _csync_propagation_collect_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = obj;
+  c_list_t **list = data;
+  c_list_t *tmp = NULL;
+
+  if (st->type != CSYNC_FTW_TYPE_FILE ||
+      st->instruction == CSYNC_INSTRUCTION_NONE) {
+    return 0;
+  }
+
+  tmp = c_list_prepend(*list, st);
+  if (tmp == NULL) {
+    return -1;
+  }
+  *list = tmp;
+
+  return 0;
+}
+
+/*
+ * Propagate the files in the order of the configured policy. The files are
+ * collected from the tree into a list which gets sorted.
+ */
+static int _csync_propagate_files_ordered(CSYNC *ctx, c_rbtree_t *tree) {
+  c_list_compare_fn cmp = NULL;
+  c_list_t *list = NULL;
+  c_list_t *walk = NULL;
+  int rc = -1;
+
+  switch (ctx->options.propagation_order) {
+    case CSYNC_PROPAGATION_ORDER_SMALLEST:
+      cmp = _csync_order_smallest_cmp;
+      break;
+    case CSYNC_PROPAGATION_ORDER_NEWEST:
+      cmp = _csync_order_newest_cmp;
+      break;
+    case CSYNC_PROPAGATION_ORDER_DIRECTORY:
+      cmp = _csync_order_directory_cmp;
+      break;
+    default:
+      return c_rbtree_walk(tree, (void *) ctx, _csync_propagation_file_visitor);
+  }
+
+  if (c_rbtree_walk(tree, &list, _csync_propagation_collect_visitor) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
+  }
+
+  list = c_list_sort(list, cmp);
+
+  for (walk = c_list_first(list); walk != NULL; walk = c_list_next(walk)) {
+    if (_csync_propagation_file_visitor(walk->data, ctx) < 0) {
+      goto out;
+    }
+  }
+
+  rc = 0;
+out:
+  c_list_free(list);
+
+  return rc;
+}
+
+static int _csync_propagation_collect_dirs_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = obj;
+  c_list_t **list = data;
+  c_list_t *tmp = NULL;
+
+  if (st->type != CSYNC_FTW_TYPE_DIR ||
+      st->instruction == CSYNC_INSTRUCTION_NONE) {
+    return 0;
+  }
+
+  tmp = c_list_prepend(*list, st);
+  if (tmp == NULL) {
+    return -1;
+  }
+  *list = tmp;
+
+  return 0;
+}
+
+/*
+ * Propagate the directories in the order of their paths, the operations on
+ * them may run in parallel and out of order otherwise. Directories are
+ * created parents first and removed children first.
+ */
+static int _csync_propagate_dirs(CSYNC *ctx, c_rbtree_t *tree) {
+  csync_file_stat_t *st = NULL;
+  c_list_t *list = NULL;
+  c_list_t *walk = NULL;
+  int rc = -1;
+
+  if (c_rbtree_walk(tree, &list, _csync_propagation_collect_dirs_visitor) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    goto out;
+  }
+
+  list = c_list_sort(list, _csync_cleanup_cmp);
+
+  for (walk = c_list_first(list); walk != NULL; walk = c_list_next(walk)) {
+    st = walk->data;
+    if (st->instruction != CSYNC_INSTRUCTION_REMOVE &&
+        _csync_propagation_dir_visitor(st, ctx) < 0) {
+      goto out;
+    }
+  }
+
+  for (walk = c_list_last(list); walk != NULL; walk = c_list_prev(walk)) {
+    st = walk->data;
+    if (st->instruction == CSYNC_INSTRUCTION_REMOVE &&
+        _csync_propagation_dir_visitor(st, ctx) < 0) {
+      goto out;
+    }
+  }
+
+  rc = 0;
+out:
+  c_list_free(list);
+
+  return rc;
+}
+
+static int _csync_progress_total_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = obj;
+  CSYNC *ctx = data;
+
+  if (st->type != CSYNC_FTW_TYPE_FILE) {
+    return 0;
+  }
+
+  switch (st->instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_CONFLICT:
+      ctx->progress.overall_files_total++;
+      ctx->progress.overall_bytes_total += st->size;
+      break;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+void csync_propagate_progress_init(CSYNC *ctx) {
+  memset(&ctx->progress, 0, sizeof(CSYNC_PROGRESS));
+
+  c_rbtree_walk(ctx->local.tree, ctx, _csync_progress_total_visitor);
+  c_rbtree_walk(ctx->remote.tree, ctx, _csync_progress_total_visitor);
+}
+
+/*
+ * The topmost directory above the entry which is removed with its content.
+ * The directories in between are marked as well, but only the topmost one
+ * is removed, so the nearest one says nothing about the entry.
+ */
+static csync_file_stat_t *_csync_removed_tree_of(c_rbtree_t *tree,
+    csync_file_stat_t *st) {
+  csync_file_stat_t *dir = NULL;
+  c_rbnode_t *node = NULL;
+  char *path = NULL;
+  char *p = NULL;
+  uint64_t h;
+
+  path = c_strdup(st->path);
+  if (path == NULL) {
+    return NULL;
+  }
+
+  while ((p = strrchr(path, '/')) != NULL) {
+    *p = '\0';
+
+    h = c_jhash64((uint8_t *) path, strlen(path), 0);
+    node = c_rbtree_find(tree, &h);
+    if (node != NULL && ((csync_file_stat_t *) node->data)->remove_tree) {
+      dir = (csync_file_stat_t *) node->data;
+    }
+  }
+
+  SAFE_FREE(path);
+
+  return dir;
+}
+
+static int _csync_remove_tree_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = (csync_file_stat_t *) obj;
+  CSYNC *ctx = (CSYNC *) data;
+  c_rbtree_t *tree = NULL;
+  char errbuf[256] = {0};
+  char *uri = NULL;
+
+  if (!st->remove_tree || st->instruction != CSYNC_INSTRUCTION_REMOVE) {
+    return 0;
+  }
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      tree = ctx->local.tree;
+      if (asprintf(&uri, "%s/%s", ctx->local.uri, st->path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+      }
+      break;
+    case REMOTE_REPLICA:
+      tree = ctx->remote.tree;
+      if (asprintf(&uri, "%s/%s", ctx->remote.uri, st->path) < 0) {
+        ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+        return -1;
+      }
+      break;
+    default:
+      return 0;
+  }
+
+  /* only the topmost directory is removed */
+  if (_csync_removed_tree_of(tree, st) != NULL) {
+    SAFE_FREE(uri);
+    return 0;
+  }
+
+  if (csync_vio_rmdir(ctx, uri) < 0) {
+    /* remove the content one by one */
+    st->remove_tree = 0;
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN,
+        "dir: %s, command: rmdir (recursive), error: %s",
+        uri,
+        errbuf);
+  } else {
+    st->instruction = CSYNC_INSTRUCTION_DELETED;
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "REMOVED  dir: %s (recursive)", uri);
+  }
+
+  SAFE_FREE(uri);
+
+  return 0;
+}
+
+/* the entries in a removed directory are gone as well */
+static int _csync_removed_with_tree_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = (csync_file_stat_t *) obj;
+  c_rbtree_t *tree = (c_rbtree_t *) data;
+  csync_file_stat_t *dir = NULL;
+
+  if (st->instruction != CSYNC_INSTRUCTION_REMOVE) {
+    return 0;
+  }
+
+  dir = _csync_removed_tree_of(tree, st);
+  if (dir != NULL && dir->instruction == CSYNC_INSTRUCTION_DELETED) {
+    st->instruction = CSYNC_INSTRUCTION_DELETED;
+  }
+
+  return 0;
+}
+
+/*
+ * Remove the directories which are removed with all their content at once,
+ * see _csync_reconcile_removed_trees(). The entries in them are marked as
+ * deleted, if it fails they are removed one by one.
+ */
+static int _csync_propagate_removed_trees(CSYNC *ctx, c_rbtree_t *tree) {
+  if (ctx->replica != REMOTE_REPLICA ||
+      !ctx->module.capabilities.recursive_delete_support) {
+    return 0;
+  }
+
+  if (c_rbtree_walk(tree, (void *) ctx, _csync_remove_tree_visitor) < 0) {
+    return -1;
+  }
+
+  return c_rbtree_walk(tree, (void *) tree, _csync_removed_with_tree_visitor);
+}
+
 int csync_propagate_files(CSYNC *ctx) {
   c_rbtree_t *tree = NULL;
 
@@ -1117,11 +2065,24 @@ int csync_propagate_files(CSYNC *ctx) {
       break;
   }
 
-  if (c_rbtree_walk(tree, (void *) ctx, _csync_propagation_file_visitor) < 0) {
+  if (_csync_propagate_removed_trees(ctx, tree) < 0) {
+    return -1;
+  }
+
+  ctx->propagation.queue_failed = false;
+
+  if (_csync_propagate_files_ordered(ctx, tree) < 0) {
+    csync_vio_complete(ctx, true);
+    return -1;
+  }
+
+  if (_csync_propagate_dirs(ctx, tree) < 0) {
+    csync_vio_complete(ctx, true);
     return -1;
   }
 
-  if (c_rbtree_walk(tree, (void *) ctx, _csync_propagation_dir_visitor) < 0) {
+  /* the removed directories which were not empty are tried again below */
+  if (csync_vio_complete(ctx, true) < 0 || ctx->propagation.queue_failed) {
     return -1;
   }
 
@@ -1133,3 +2094,68 @@ int csync_propagate_files(CSYNC *ctx) {
 }
 
 /* vim: set ts=8 sw=2 et cindent: */
+
+/* the file was to be transferred in this run */
+static bool _csync_transfer_planned(CSYNC *ctx, uint64_t phash) {
+  c_rbtree_t *trees[2];
+  c_rbnode_t *node;
+  csync_file_stat_t *st;
+  int i;
+
+  trees[0] = ctx->local.tree;
+  trees[1] = ctx->remote.tree;
+
+  for (i = 0; i < 2; i++) {
+    node = trees[i] ? c_rbtree_find(trees[i], &phash) : NULL;
+    if (node == NULL) {
+      continue;
+    }
+
+    st = c_rbtree_node_data(node);
+    switch (st->instruction) {
+      case CSYNC_INSTRUCTION_NEW:
+      case CSYNC_INSTRUCTION_SYNC:
+      case CSYNC_INSTRUCTION_CONFLICT:
+      /* a failed transfer, it may have kept its temporary file */
+      case CSYNC_INSTRUCTION_ERROR:
+        return true;
+      default:
+        break;
+    }
+  }
+
+  return false;
+}
+
+void csync_propagate_sweep_tmp_files(CSYNC *ctx) {
+  c_list_t *list = NULL;
+  c_list_t *walk = NULL;
+  csync_progressinfo_t *pi = NULL;
+
+  if (ctx->statedb.db != NULL && ctx->status >= CSYNC_STATUS_DONE) {
+    /*
+     * The journal is written. A kept file is only resumed by a transfer of
+     * the same file, the source was removed, renamed or is synced already.
+     */
+    list = csync_statedb_get_all_progressinfo(ctx);
+    for (walk = list; walk != NULL; walk = c_list_next(walk)) {
+      pi = walk->data;
+      if (!_csync_transfer_planned(ctx, pi->phash)) {
+        _csync_drop_tmp_file(ctx, pi);
+      }
+      csync_statedb_free_progressinfo(pi);
+    }
+    c_list_free(list);
+  } else {
+    /* the records of this run are lost with the journal */
+    for (walk = ctx->tmpfiles; walk != NULL; walk = c_list_next(walk)) {
+      _csync_unlink_tmp_file(ctx, walk->data);
+    }
+  }
+
+  for (walk = ctx->tmpfiles; walk != NULL; walk = c_list_next(walk)) {
+    SAFE_FREE(walk->data);
+  }
+  c_list_free(ctx->tmpfiles);
+  ctx->tmpfiles = NULL;
+}
@@ -65,6 +65,28 @@
  */
 int csync_propagate_files(CSYNC *ctx);
 
+/**
+ * @brief Calculate the overall totals of the progress.
+ *
+ * Counts the files and bytes to transfer on both replicas. This is only
+ * done if a progress callback is set.
+ *
+ * @param  ctx          The csync context to use for propagation.
+ */
+void csync_propagate_progress_init(CSYNC *ctx);
+
+/**
+ * @brief Remove the temporary files kept for transfers which won't resume.
+ *
+ * If the journal is written, the records of the files which were not to be
+ * transferred in this run are dropped with their temporary files. If it is
+ * not, the temporary files kept in this run are removed, their records are
+ * lost. This has to run before the module is shut down.
+ *
+ * @param  ctx          The csync context.
+ */
+void csync_propagate_sweep_tmp_files(CSYNC *ctx);
+
 /**
  * }@
  */
@@ -20,6 +20,14 @@
 
 #include "config.h"
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "c_jhash.h"
 #include "csync_private.h"
 #include "csync_reconcile.h"
 #include "csync_util.h"
@@ -27,6 +35,80 @@
 #define CSYNC_LOG_CATEGORY_NAME "csync.reconciler"
 #include "csync_log.h"
 
+static int _csync_checksum(CSYNC *ctx, enum csync_replica_e replica,
+    const char *path, char checksum[C_SHA1_HEX_LEN]) {
+  enum csync_replica_e rep_bak;
+  char *uri = NULL;
+  int rc;
+
+  if (replica == LOCAL_REPLICA) {
+    rc = asprintf(&uri, "%s/%s", ctx->local.uri, path);
+    replica = ctx->local.type;
+  } else {
+    rc = asprintf(&uri, "%s/%s", ctx->remote.uri, path);
+    replica = ctx->remote.type;
+  }
+  if (rc < 0) {
+    return -1;
+  }
+
+  rep_bak = ctx->replica;
+  ctx->replica = replica;
+
+  rc = csync_file_checksum(ctx, uri, checksum);
+
+  ctx->replica = rep_bak;
+  SAFE_FREE(uri);
+
+  return rc;
+}
+
+/*
+ * A file which is new on both replicas may have the same content, e.g. if
+ * a replica has been seeded again. Compare the size and the checksums, an
+ * identical file doesn't need a transfer or a conflict copy.
+ */
+static bool _csync_same_content(CSYNC *ctx, csync_file_stat_t *cur,
+    csync_file_stat_t *other) {
+  enum csync_replica_e opposite;
+  char cur_sum[C_SHA1_HEX_LEN];
+  char other_sum[C_SHA1_HEX_LEN];
+
+  if (!ctx->options.compare_content ||
+      cur->type != CSYNC_FTW_TYPE_FILE ||
+      cur->size != other->size) {
+    return false;
+  }
+
+  opposite = ctx->current == LOCAL_REPLICA ? REMOTE_REPLICA : LOCAL_REPLICA;
+
+  if (_csync_checksum(ctx, ctx->current, cur->path, cur_sum) < 0 ||
+      _csync_checksum(ctx, opposite, other->path, other_sum) < 0) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+        "file: %s, unable to compare the content", cur->path);
+    return false;
+  }
+
+  if (strcmp(cur_sum, other_sum) != 0) {
+    return false;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
+      "file: %s, same content on both replicas", cur->path);
+
+  /*
+   * The statedb is written from the local tree, record the newer time so
+   * the file isn't detected as modified on either replica next time.
+   */
+  if (cur->modtime > other->modtime) {
+    other->modtime = cur->modtime;
+  } else {
+    cur->modtime = other->modtime;
+  }
+
+  return true;
+}
+
 /*
  * We merge replicas at the file level. The merged replica contains the
  * superset of files that are on the local machine and server copies of
@@ -92,7 +174,11 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         switch (other->instruction) {
           /* file on other replica is new too */
           case CSYNC_INSTRUCTION_NEW:
-            if (cur->modtime > other->modtime) {
+            if (cur->modtime != other->modtime &&
+                _csync_same_content(ctx, cur, other)) {
+              cur->instruction = CSYNC_INSTRUCTION_NONE;
+              other->instruction = CSYNC_INSTRUCTION_NONE;
+            } else if (cur->modtime > other->modtime) {
               
 			  if(ctx->options.with_conflict_copys)
 			  {
@@ -278,6 +364,89 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
   return 0;
 }
 
+static int _csync_remove_tree_mark_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = (csync_file_stat_t *) obj;
+
+  (void) data;
+
+  st->remove_tree = st->type == CSYNC_FTW_TYPE_DIR &&
+                    st->instruction == CSYNC_INSTRUCTION_REMOVE;
+
+  return 0;
+}
+
+/*
+ * An entry which isn't removed keeps all the directories above it, so does
+ * a directory with content which isn't in the tree, e.g. excluded files.
+ */
+static int _csync_remove_tree_keep_visitor(void *obj, void *data) {
+  csync_file_stat_t *st = (csync_file_stat_t *) obj;
+  c_rbtree_t *tree = (c_rbtree_t *) data;
+  csync_file_stat_t *dir = NULL;
+  c_rbnode_t *node = NULL;
+  char *path = NULL;
+  char *p = NULL;
+  uint64_t h;
+
+  if (st->untracked) {
+    st->remove_tree = 0;
+  } else if (st->instruction == CSYNC_INSTRUCTION_REMOVE) {
+    return 0;
+  }
+
+  path = c_strdup(st->path);
+  if (path == NULL) {
+    return -1;
+  }
+
+  while ((p = strrchr(path, '/')) != NULL) {
+    *p = '\0';
+
+    h = c_jhash64((uint8_t *) path, strlen(path), 0);
+    node = c_rbtree_find(tree, &h);
+    if (node == NULL) {
+      continue;
+    }
+
+    dir = (csync_file_stat_t *) node->data;
+    if (!dir->remove_tree) {
+      /* the directories above have been handled already */
+      break;
+    }
+    dir->remove_tree = 0;
+  }
+
+  SAFE_FREE(path);
+
+  return 0;
+}
+
+/*
+ * Find the directories which are removed together with all their content.
+ * If the backend can remove such a directory at once, the files in it
+ * don't need to be removed one by one.
+ */
+static int _csync_reconcile_removed_trees(CSYNC *ctx, c_rbtree_t *tree) {
+  enum csync_replica_e type;
+
+  type = ctx->current == LOCAL_REPLICA ? ctx->local.type : ctx->remote.type;
+  if (type != REMOTE_REPLICA ||
+      !ctx->module.capabilities.recursive_delete_support) {
+    return 0;
+  }
+
+  if (c_rbtree_walk(tree, (void *) ctx, _csync_remove_tree_mark_visitor) < 0) {
+    return -1;
+  }
+
+  if (c_rbtree_walk(tree, tree, _csync_remove_tree_keep_visitor) < 0) {
+    ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+    return -1;
+  }
+
+  return 0;
+}
+
 int csync_reconcile_updates(CSYNC *ctx) {
   int rc;
   c_rbtree_t *tree = NULL;
@@ -296,6 +465,12 @@ int csync_reconcile_updates(CSYNC *ctx) {
   rc = c_rbtree_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
   if( rc < 0 ) {
     ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
+    return rc;
+  }
+
+  rc = _csync_reconcile_removed_trees(ctx, tree);
+  if (rc < 0 && CSYNC_STATUS_IS_OK(ctx->status_code)) {
+    ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
   }
   return rc;
 }
@@ -150,6 +150,23 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb) {
   result = csync_statedb_query(ctx, "PRAGMA default_synchronous = OFF;");
   c_strlist_destroy(result);
 
+  /*
+   * The progress table isn't recreated with the metadata, it keeps the
+   * interrupted transfers across runs.
+   */
+  result = csync_statedb_query(ctx,
+      "CREATE TABLE IF NOT EXISTS progress("
+      "phash INTEGER(8),"
+      "tmpfile VARCHAR(4096),"
+      "size INTEGER(8),"
+      "modtime INTEGER(8),"
+      "transferred INTEGER(8),"
+      "checksum INTEGER(8),"
+      "PRIMARY KEY(phash)"
+      ");"
+      );
+  c_strlist_destroy(result);
+
   rc = 0;
 out:
   SAFE_FREE(statedb_tmp);
@@ -328,6 +345,7 @@ static int _insert_metadata_visitor(void *obj, void *data) {
     sqlite3_bind_int64(stmt, 8, fs->modtime);
 
     rc = 0;
+    ctx->statedb.statements++;
     if (sqlite3_step(stmt) != SQLITE_DONE) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "sqlite insert failed!");
       rc = -1;
@@ -355,6 +373,7 @@ int csync_statedb_insert_metadata(CSYNC *ctx) {
 
   /* start a transaction */
   sqlite3_exec(ctx->statedb.db, "BEGIN TRANSACTION", NULL, NULL, &errorMessage);
+  ctx->statedb.statements++;
 
   /* prepare the INSERT statement */
   if( ! sqlite3_prepare_v2(ctx->statedb.db, buffer, strlen(buffer), &stmt, NULL) == SQLITE_OK ) {
@@ -369,6 +388,7 @@ int csync_statedb_insert_metadata(CSYNC *ctx) {
   }
 
   sqlite3_exec(ctx->statedb.db, "COMMIT TRANSACTION", NULL, NULL, &errorMessage);
+  ctx->statedb.statements++;
   sqlite3_finalize(stmt);
 
   result = csync_statedb_query(ctx, "ALTER TABLE metadata RENAME TO metadata_wait;");
@@ -390,8 +410,9 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash) {
   char *stmt = NULL;
   size_t len = 0;
 
-  stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE phash='%llu'",
-      (long long unsigned int) phash);
+  /* the phash is stored signed, see _insert_metadata_visitor() */
+  stmt = sqlite3_mprintf("SELECT * FROM metadata WHERE phash='%lld'",
+      (long long signed int) phash);
   if (stmt == NULL) {
     return NULL;
   }
@@ -490,6 +511,162 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx, ino_t inode) {
   return st;
 }
 
+/* caller must free the memory */
+csync_progressinfo_t *csync_statedb_get_progressinfo(CSYNC *ctx, uint64_t phash) {
+  csync_progressinfo_t *pi = NULL;
+  c_strlist_t *result = NULL;
+  char *stmt = NULL;
+
+  if (ctx->statedb.db == NULL) {
+    return NULL;
+  }
+
+  stmt = sqlite3_mprintf("SELECT tmpfile, size, modtime, transferred, checksum "
+                         "FROM progress WHERE phash='%lld'",
+                         (long long signed int) phash);
+  if (stmt == NULL) {
+    return NULL;
+  }
+
+  result = csync_statedb_query(ctx, stmt);
+  sqlite3_free(stmt);
+  if (result == NULL) {
+    return NULL;
+  }
+
+  if (result->count < 5) {
+    c_strlist_destroy(result);
+    return NULL;
+  }
+
+  pi = c_malloc(sizeof(csync_progressinfo_t));
+  if (pi == NULL) {
+    c_strlist_destroy(result);
+    return NULL;
+  }
+
+  /* tmpfile, size, modtime, transferred, checksum */
+  pi->phash = phash;
+  pi->tmpfile = c_strdup(result->vector[0]);
+  pi->size = strtoll(result->vector[1], NULL, 10);
+  pi->modtime = strtoul(result->vector[2], NULL, 10);
+  pi->transferred = strtoll(result->vector[3], NULL, 10);
+  pi->checksum = (uint64_t) strtoll(result->vector[4], NULL, 10);
+
+  c_strlist_destroy(result);
+
+  if (pi->tmpfile == NULL) {
+    SAFE_FREE(pi);
+  }
+
+  return pi;
+}
+
+/* all rows, csync_statedb_query() only returns the last one */
+c_list_t *csync_statedb_get_all_progressinfo(CSYNC *ctx) {
+  const char *text;
+  csync_progressinfo_t *pi = NULL;
+  c_list_t *list = NULL;
+  sqlite3_stmt *stmt = NULL;
+
+  if (ctx->statedb.db == NULL) {
+    return NULL;
+  }
+
+  if (sqlite3_prepare_v2(ctx->statedb.db,
+        "SELECT phash, tmpfile, size, modtime, transferred, checksum "
+        "FROM progress;", -1, &stmt, NULL) != SQLITE_OK) {
+    return NULL;
+  }
+  ctx->statedb.statements++;
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    text = (const char *) sqlite3_column_text(stmt, 1);
+    if (text == NULL) {
+      continue;
+    }
+
+    pi = c_malloc(sizeof(csync_progressinfo_t));
+    if (pi == NULL) {
+      break;
+    }
+
+    pi->phash = (uint64_t) sqlite3_column_int64(stmt, 0);
+    pi->tmpfile = c_strdup(text);
+    pi->size = sqlite3_column_int64(stmt, 2);
+    pi->modtime = sqlite3_column_int64(stmt, 3);
+    pi->transferred = sqlite3_column_int64(stmt, 4);
+    pi->checksum = (uint64_t) sqlite3_column_int64(stmt, 5);
+
+    if (pi->tmpfile == NULL) {
+      SAFE_FREE(pi);
+      break;
+    }
+
+    list = c_list_prepend(list, pi);
+  }
+
+  sqlite3_finalize(stmt);
+
+  return list;
+}
+
+int csync_statedb_write_progressinfo(CSYNC *ctx, csync_progressinfo_t *pi) {
+  char *stmt = NULL;
+
+  if (ctx->statedb.db == NULL) {
+    return -1;
+  }
+
+  stmt = sqlite3_mprintf("INSERT OR REPLACE INTO progress "
+                         "(phash, tmpfile, size, modtime, transferred, checksum) "
+                         "VALUES ('%lld', '%q', '%lld', '%lld', '%lld', '%lld');",
+                         (long long signed int) pi->phash,
+                         pi->tmpfile,
+                         (long long signed int) pi->size,
+                         (long long signed int) pi->modtime,
+                         (long long signed int) pi->transferred,
+                         (long long signed int) pi->checksum);
+  if (stmt == NULL) {
+    return -1;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "SQL statement: %s", stmt);
+
+  csync_statedb_insert(ctx, stmt);
+  sqlite3_free(stmt);
+
+  return 0;
+}
+
+int csync_statedb_delete_progressinfo(CSYNC *ctx, uint64_t phash) {
+  char *stmt = NULL;
+
+  if (ctx->statedb.db == NULL) {
+    return -1;
+  }
+
+  stmt = sqlite3_mprintf("DELETE FROM progress WHERE phash='%lld';",
+                         (long long signed int) phash);
+  if (stmt == NULL) {
+    return -1;
+  }
+
+  csync_statedb_insert(ctx, stmt);
+  sqlite3_free(stmt);
+
+  return 0;
+}
+
+void csync_statedb_free_progressinfo(csync_progressinfo_t *pi) {
+  if (pi == NULL) {
+    return;
+  }
+
+  SAFE_FREE(pi->tmpfile);
+  SAFE_FREE(pi);
+}
+
 /* query the statedb, caller must free the memory */
 c_strlist_t *csync_statedb_query(CSYNC *ctx, const char *statement) {
   int err = SQLITE_OK;
@@ -521,6 +698,7 @@ c_strlist_t *csync_statedb_query(CSYNC *ctx, const char *statement) {
       break;
     } else {
       busy_count = 0;
+      ctx->statedb.statements++;
       column_count = sqlite3_column_count(stmt);
 
       /* execute virtual machine by iterating over rows */
@@ -633,6 +811,7 @@ int csync_statedb_insert(CSYNC *ctx, const char *statement) {
       break;
     } else {
       busy_count = 0;
+      ctx->statedb.statements++;
 
       /* execute virtual machine by iterating over rows */
       for(;;) {
@@ -61,6 +61,48 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash);
 
 csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx, ino_t inode);
 
+/**
+ * @brief A partially transferred file.
+ *
+ * The temporary file of an interrupted transfer is kept and the transfer can
+ * be resumed if the source file didn't change.
+ */
+typedef struct csync_progressinfo_s {
+  uint64_t phash;
+  char *tmpfile;        /* the uri of the temporary file */
+  off_t size;           /* the size of the source file */
+  time_t modtime;       /* the modification time of the source file */
+  off_t transferred;    /* the number of bytes already in the temporary file */
+  uint64_t checksum;    /* the checksum of the transferred bytes */
+} csync_progressinfo_t;
+
+/**
+ * @brief Get the progress info of an interrupted transfer.
+ *
+ * @param ctx      The csync context.
+ * @param phash    The hash of the path of the file.
+ *
+ * @return The progress info, NULL if there is none. Free it with
+ *         csync_statedb_free_progressinfo().
+ */
+csync_progressinfo_t *csync_statedb_get_progressinfo(CSYNC *ctx, uint64_t phash);
+
+/**
+ * @brief Get the progress info of all interrupted transfers.
+ *
+ * @param ctx      The csync context.
+ *
+ * @return A list of progress infos, free each of them with
+ *         csync_statedb_free_progressinfo() and the list with c_list_free().
+ */
+c_list_t *csync_statedb_get_all_progressinfo(CSYNC *ctx);
+
+int csync_statedb_write_progressinfo(CSYNC *ctx, csync_progressinfo_t *pi);
+
+int csync_statedb_delete_progressinfo(CSYNC *ctx, uint64_t phash);
+
+void csync_statedb_free_progressinfo(csync_progressinfo_t *pi);
+
 /**
  * @brief A generic statedb query.
  *
@@ -207,6 +207,45 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
   return 0;
 }
 
+/*
+ * The directory holds entries which aren't in the tree: excluded ones,
+ * ones the walker skips or ones below the maximum depth. It must not be
+ * removed with all its content, see _csync_reconcile_removed_trees().
+ */
+static void _csync_mark_untracked(CSYNC *ctx, const char *uri) {
+  c_rbtree_t *tree = NULL;
+  c_rbnode_t *node = NULL;
+  const char *root = NULL;
+  size_t len;
+  uint64_t h;
+
+  switch (ctx->current) {
+    case LOCAL_REPLICA:
+      tree = ctx->local.tree;
+      root = ctx->local.uri;
+      break;
+    case REMOTE_REPLICA:
+      tree = ctx->remote.tree;
+      root = ctx->remote.uri;
+      break;
+    default:
+      return;
+  }
+
+  /* the root itself is never removed */
+  len = root != NULL ? strlen(root) : 0;
+  if (tree == NULL || len == 0 || strncmp(uri, root, len) != 0 ||
+      uri[len] != '/') {
+    return;
+  }
+
+  h = c_jhash64((uint8_t *) uri + len + 1, strlen(uri + len + 1), 0);
+  node = c_rbtree_find(tree, &h);
+  if (node != NULL) {
+    ((csync_file_stat_t *) node->data)->untracked = 1;
+  }
+}
+
 /* File tree walker */
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth) {
@@ -228,6 +267,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     /* permission denied */
     ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_OPENDIR_ERROR);
     if (errno == EACCES) {
+      _csync_mark_untracked(ctx, uri);
       return 0;
     } else {
       strerror_r(errno, errbuf, sizeof(errbuf));
@@ -239,6 +279,9 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     }
   }
 
+  /* the directory exists, propagation doesn't need to check it again */
+  csync_vio_dircache_add(ctx, uri);
+
   while ((dirent = csync_vio_readdir(ctx, dh))) {
     const char *path = NULL;
     int flag;
@@ -279,6 +322,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     /* Check if file is excluded */
     if (csync_excluded(ctx, path)) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded", path);
+      _csync_mark_untracked(ctx, uri);
       SAFE_FREE(filename);
       csync_vio_file_stat_destroy(dirent);
       dirent = NULL;
@@ -325,12 +369,19 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto done;
     }
 
+    /* the walker only keeps files and directories */
+    if (flag != CSYNC_FTW_FLAG_FILE && flag != CSYNC_FTW_FLAG_DIR) {
+      _csync_mark_untracked(ctx, uri);
+    }
+
     if (flag == CSYNC_FTW_FLAG_DIR && depth) {
       rc = csync_ftw(ctx, filename, fn, depth - 1);
       if (rc < 0) {
         csync_vio_closedir(ctx, dh);
         goto done;
       }
+    } else if (flag == CSYNC_FTW_FLAG_DIR) {
+      _csync_mark_untracked(ctx, filename);
     }
     SAFE_FREE(filename);
     csync_vio_file_stat_destroy(dirent);
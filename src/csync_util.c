@@ -28,7 +28,6 @@
 #include <limits.h>
 #include <stdio.h>
 
-#include "c_jhash.h"
 #include "csync_util.h"
 #include "vio/csync_vio.h"
 
@@ -113,6 +112,8 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
 
   char errbuf[256] = {0};
   char *uri = NULL;
+  ino_t inode = 0;
+  time_t modtime = 0;
   int rc = -1;
 
   fs = (csync_file_stat_t *) obj;
@@ -124,6 +125,10 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
     goto out;
   }
 
+  /* inode and mtime may be known from the propagation already */
+  inode = fs->dst_inode;
+  modtime = fs->modtime;
+
   switch (ctx->current) {
     case LOCAL_REPLICA:
       tree = ctx->local.tree;
@@ -172,6 +177,18 @@ static int _merge_file_trees_visitor(void *obj, void *data) {
   }
   fs = c_rbtree_node_data(node);
 
+  if (inode != 0) {
+    fs->inode = inode;
+    fs->modtime = modtime;
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "file: %s, instruction: UPDATED", fs->path);
+
+    fs->instruction = CSYNC_INSTRUCTION_NONE;
+
+    rc = 0;
+    goto out;
+  }
+
   switch (ctx->current) {
     case LOCAL_REPLICA:
       if (asprintf(&uri, "%s/%s", ctx->local.uri, fs->path) < 0) {
@@ -260,6 +277,50 @@ out:
   return rc;
 }
 
+/*
+ * The SHA1 of the content of the file on the current replica. A module
+ * which knows it, e.g. from the server, saves the transfer. Otherwise the
+ * data is streamed through the vio layer, so it works with every module.
+ */
+int csync_file_checksum(CSYNC *ctx, const char *uri,
+    char checksum[C_SHA1_HEX_LEN]) {
+  csync_vio_handle_t *fp = NULL;
+  char buf[MAX_XFER_BUF_SIZE];
+  ssize_t bread = 0;
+  c_sha1_t sha1;
+  int rc = -1;
+
+  if (csync_vio_checksum(ctx, uri, "SHA1", checksum, C_SHA1_HEX_LEN) == 0) {
+    return 0;
+  } else if (errno != ENOTSUP) {
+    return -1;
+  }
+
+  c_sha1_init(&sha1);
+
+  fp = csync_vio_open(ctx, uri, O_RDONLY, 0);
+  if (fp == NULL) {
+    return -1;
+  }
+
+  for (;;) {
+    bread = csync_vio_read_full(ctx, fp, buf, sizeof(buf));
+    if (bread < 0) {
+      goto out;
+    } else if (bread == 0) {
+      break;
+    }
+    c_sha1_update(&sha1, buf, bread);
+  }
+
+  c_sha1_final(&sha1, checksum);
+  rc = 0;
+out:
+  csync_vio_close(ctx, fp);
+
+  return rc;
+}
+
 int csync_unix_extensions(CSYNC *ctx) {
   int rc = -1;
   char *uri = NULL;
@@ -23,6 +23,7 @@
 
 #include <stdint.h>
 
+#include "c_sha1.h"
 #include "csync_private.h"
 
 const char *csync_instruction_str(enum csync_instructions_e instr);
@@ -33,4 +34,7 @@ int csync_merge_file_trees(CSYNC *ctx);
 
 int csync_unix_extensions(CSYNC *ctx);
 
+int csync_file_checksum(CSYNC *ctx, const char *uri,
+    char checksum[C_SHA1_HEX_LEN]);
+
 #endif /* _CSYNC_UTIL_H */
@@ -476,10 +476,23 @@ int c_rbtree_insert(c_rbtree_t *tree, void *data) {
   return 0;
 }
 
+/* puts v in the place of u in the tree */
+static void _rbtree_transplant(c_rbtree_t *tree, c_rbnode_t *u, c_rbnode_t *v) {
+  if (u->parent == NULL) {
+    tree->root = v;
+  } else if (u == u->parent->left) {
+    u->parent->left = v;
+  } else {
+    u->parent->right = v;
+  }
+  v->parent = u->parent;
+}
+
 int c_rbtree_node_delete(c_rbnode_t *node) {
   c_rbtree_t *tree;
   c_rbnode_t *y;
   c_rbnode_t *x;
+  xrbcolor_t color;
 
   if (node == NULL || node == NIL) {
     errno = EINVAL;
@@ -488,70 +501,45 @@ int c_rbtree_node_delete(c_rbnode_t *node) {
 
   tree = node->tree;
 
-  if (node->left == NIL || node->right == NIL) {
-    /* y has a NIL node as a child */
-    y = node;
+  /*
+   * The node itself is freed, its successor is moved into its place instead
+   * of copying the data. There might be external references to the other
+   * nodes and we must preserve their addresses.
+   */
+  y = node;
+  color = y->color;
+
+  if (node->left == NIL) {
+    x = node->right;
+    _rbtree_transplant(tree, node, node->right);
+  } else if (node->right == NIL) {
+    x = node->left;
+    _rbtree_transplant(tree, node, node->left);
   } else {
-    /* find tree successor with a NIL node as a child */
-    y = node;
-    while(y->left != NIL) {
+    /* the successor has no left child */
+    y = node->right;
+    while (y->left != NIL) {
       y = y->left;
     }
-  }
-
-  /* x is y's only child */
-  if (y->left != NIL) {
-    x = y->left;
-  } else {
+    color = y->color;
     x = y->right;
-  }
-
-  /* remove y from the parent chain */
-  x->parent = y->parent;
 
-  if (y->parent) {
-    if (y == y->parent->left) {
-        y->parent->left = x;
+    if (y->parent == node) {
+      x->parent = y;
     } else {
-      y->parent->right = x;
+      _rbtree_transplant(tree, y, y->right);
+      y->right = node->right;
+      y->right->parent = y;
     }
-  } else {
-    y->tree->root = x;
-  }
 
-  /* If y is not the node we're deleting, splice it in place of that
-   * node
-   *
-   * The traditional code would call for us to simply copy y->data, but
-   * that would invalidate the wrong pointer - there might be external
-   * references to this node, and we must preserve its address.
-   */
-  if (y != node) {
-    /* Update y */
-    y->parent = node->parent;
+    _rbtree_transplant(tree, node, y);
     y->left = node->left;
-    y->right = node->right;
-
-    /* Update the children and the parent */
-    if (y->left != NIL) {
-        y->left->parent = y;
-    }
-    if (y->right != NIL) {
-      y->right->parent = y;
-    }
-    if (y->parent != NULL) {
-      if (node == y->parent->left) {
-        y->parent->left = y;
-      } else {
-        y->parent->right = y;
-      }
-    } else {
-      y->tree->root = y;
-    }
+    y->left->parent = y;
+    y->color = node->color;
   }
 
-  if (y->color == BLACK) {
-    while (x != y->tree->root && x->color == BLACK) {
+  if (color == BLACK) {
+    while (x != tree->root && x->color == BLACK) {
       if (x == x->parent->left) {
         c_rbnode_t *w = NULL;
 
@@ -578,7 +566,7 @@ int c_rbtree_node_delete(c_rbnode_t *node) {
           x->parent->color = BLACK;
           w->right->color = BLACK;
           _rbtree_subtree_left_rotate(x->parent);
-          x = y->tree->root;
+          x = tree->root;
         }
       } else {
         c_rbnode_t *w = NULL;
@@ -605,15 +593,15 @@ int c_rbtree_node_delete(c_rbnode_t *node) {
           x->parent->color = BLACK;
           w->left->color = BLACK;
           _rbtree_subtree_right_rotate(x->parent);
-          x = y->tree->root;
+          x = tree->root;
         }
       }
     }
     x->color = BLACK;
-  } /* end if: y->color == BLACK */
+  } /* end if: color == BLACK */
 
   /* node has now been spliced out of the tree */
-  SAFE_FREE(y);
+  SAFE_FREE(node);
   tree->size--;
 
   return 0;
@@ -0,0 +1,150 @@
+/*
+ * c_sha1 - the SHA-1 message digest
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ts=2 sw=2 et cindent
+ */
+
+#include <string.h>
+
+#include "c_sha1.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void _c_sha1_block(c_sha1_t *sha1, const uint8_t *p) {
+  uint32_t w[80];
+  uint32_t a, b, c, d, e, f, k, t;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16 |
+           (uint32_t) p[4 * i + 2] << 8 | (uint32_t) p[4 * i + 3];
+  }
+  for (i = 16; i < 80; i++) {
+    w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  a = sha1->state[0];
+  b = sha1->state[1];
+  c = sha1->state[2];
+  d = sha1->state[3];
+  e = sha1->state[4];
+
+  for (i = 0; i < 80; i++) {
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+
+    t = ROL(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROL(b, 30);
+    b = a;
+    a = t;
+  }
+
+  sha1->state[0] += a;
+  sha1->state[1] += b;
+  sha1->state[2] += c;
+  sha1->state[3] += d;
+  sha1->state[4] += e;
+}
+
+void c_sha1_init(c_sha1_t *sha1) {
+  sha1->state[0] = 0x67452301;
+  sha1->state[1] = 0xefcdab89;
+  sha1->state[2] = 0x98badcfe;
+  sha1->state[3] = 0x10325476;
+  sha1->state[4] = 0xc3d2e1f0;
+  sha1->count = 0;
+}
+
+void c_sha1_update(c_sha1_t *sha1, const void *data, size_t len) {
+  const uint8_t *p = data;
+  size_t used = sha1->count % 64;
+  size_t n;
+
+  sha1->count += len;
+
+  if (used > 0) {
+    n = 64 - used;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(sha1->block + used, p, n);
+    p += n;
+    len -= n;
+    if (used + n < 64) {
+      return;
+    }
+    _c_sha1_block(sha1, sha1->block);
+  }
+
+  while (len >= 64) {
+    _c_sha1_block(sha1, p);
+    p += 64;
+    len -= 64;
+  }
+
+  memcpy(sha1->block, p, len);
+}
+
+void c_sha1_digest(c_sha1_t *sha1, uint8_t digest[C_SHA1_DIGEST_LEN]) {
+  uint64_t bits = sha1->count * 8;
+  size_t used = sha1->count % 64;
+  int i;
+
+  /* a 1 bit, zeros up to 56 bytes of the block and the length in bits */
+  sha1->block[used++] = 0x80;
+  if (used > 56) {
+    memset(sha1->block + used, 0, 64 - used);
+    _c_sha1_block(sha1, sha1->block);
+    used = 0;
+  }
+  memset(sha1->block + used, 0, 56 - used);
+  for (i = 0; i < 8; i++) {
+    sha1->block[56 + i] = (uint8_t) (bits >> (56 - 8 * i));
+  }
+  _c_sha1_block(sha1, sha1->block);
+
+  for (i = 0; i < C_SHA1_DIGEST_LEN; i++) {
+    digest[i] = (uint8_t) (sha1->state[i / 4] >> (24 - 8 * (i % 4)));
+  }
+}
+
+void c_sha1_final(c_sha1_t *sha1, char hex[C_SHA1_HEX_LEN]) {
+  static const char digits[] = "0123456789abcdef";
+  uint8_t digest[C_SHA1_DIGEST_LEN];
+  int i;
+
+  c_sha1_digest(sha1, digest);
+
+  for (i = 0; i < C_SHA1_DIGEST_LEN; i++) {
+    hex[2 * i] = digits[digest[i] >> 4];
+    hex[2 * i + 1] = digits[digest[i] & 0xf];
+  }
+  hex[2 * C_SHA1_DIGEST_LEN] = '\0';
+}
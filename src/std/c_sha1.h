@@ -0,0 +1,85 @@
+/*
+ * c_sha1 - the SHA-1 message digest
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ft=c.doxygen ts=2 sw=2 et cindent
+ */
+
+#ifndef _C_SHA1_H
+#define _C_SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file c_sha1.h
+ *
+ * @brief SHA-1 as in FIPS 180-4, to compare the content of files with the
+ * checksums servers keep of them.
+ *
+ * @defgroup cSha1Internals c_sha1
+ * @ingroup cInternalAPI
+ *
+ * @{
+ */
+
+#define C_SHA1_DIGEST_LEN 20
+
+/* the digest as a string of lower case hex digits */
+#define C_SHA1_HEX_LEN (2 * C_SHA1_DIGEST_LEN + 1)
+
+typedef struct c_sha1_s {
+  uint32_t state[5];
+  uint64_t count;               /* bytes hashed */
+  uint8_t block[64];
+} c_sha1_t;
+
+/**
+ * @brief Start a new digest.
+ *
+ * @param sha1  The state to initialize.
+ */
+void c_sha1_init(c_sha1_t *sha1);
+
+/**
+ * @brief Add data to the digest.
+ *
+ * @param sha1  The state.
+ * @param data  The data.
+ * @param len   The length of the data.
+ */
+void c_sha1_update(c_sha1_t *sha1, const void *data, size_t len);
+
+/**
+ * @brief Finish the digest as bytes.
+ *
+ * @param sha1    The state, it has to be initialized again to be reused.
+ * @param digest  Filled with the digest.
+ */
+void c_sha1_digest(c_sha1_t *sha1, uint8_t digest[C_SHA1_DIGEST_LEN]);
+
+/**
+ * @brief Finish the digest.
+ *
+ * @param sha1  The state, it has to be initialized again to be reused.
+ * @param hex   Filled with the digest as a string of hex digits.
+ */
+void c_sha1_final(c_sha1_t *sha1, char hex[C_SHA1_HEX_LEN]);
+
+/**
+ * }@
+ */
+#endif /* _C_SHA1_H */
@@ -26,12 +26,15 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <dlfcn.h> /* dlopen(), dlclose(), dlsym() ... */
 
 #include "csync_private.h"
 #include "vio/csync_vio.h"
 #include "vio/csync_vio_handle_private.h"
 #include "vio/csync_vio_local.h"
+#include "vio/csync_vio_trace.h"
+#include "csync_time.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.vio.main"
 
@@ -43,6 +46,112 @@
 
 #include "csync_log.h"
 
+/*
+ * Take the amount of tokens from the bucket and sleep if there are not
+ * enough. The bucket holds the tokens of one second at most, so this allows
+ * short bursts. Tokens can't be taken in advance, the bucket gets into debt
+ * instead which is paid back by the sleep.
+ */
+static void _csync_vio_throttle(csync_vio_bucket_t *bucket, double amount) {
+  struct timespec now;
+  double wait;
+
+  if (bucket->rate <= 0) {
+    return;
+  }
+
+  csync_gettime(&now);
+  if (bucket->last.tv_sec == 0 && bucket->last.tv_nsec == 0) {
+    bucket->tokens = bucket->rate;
+  } else {
+    bucket->tokens += c_secdiff(now, bucket->last) * bucket->rate;
+    if (bucket->tokens > bucket->rate) {
+      bucket->tokens = bucket->rate;
+    }
+  }
+  bucket->last = now;
+
+  bucket->tokens -= amount;
+  if (bucket->tokens >= 0) {
+    return;
+  }
+
+  wait = -bucket->tokens / bucket->rate;
+  if (wait >= 1) {
+    sleep((unsigned int) wait);
+    wait -= (unsigned int) wait;
+  }
+  usleep((useconds_t) (wait * 1000000));
+}
+
+static void _csync_vio_throttle_bytes(CSYNC *ctx, ssize_t bytes) {
+  if (bytes > 0) {
+    _csync_vio_throttle(&ctx->limit[ctx->replica].bytes, bytes);
+  }
+}
+
+static void _csync_vio_throttle_ops(CSYNC *ctx) {
+  _csync_vio_throttle(&ctx->limit[ctx->replica].ops, 1);
+}
+
+/*
+ * Count a call to the current replica which started at start. It costs a
+ * clock read and a few additions, so the stats are always on.
+ */
+static void _csync_vio_stats(CSYNC *ctx, enum csync_vio_stats_op_e op,
+    const struct timespec *start, bool failed, ssize_t bytes) {
+  struct csync_vio_op_stats_s *stats;
+  struct timespec now;
+  unsigned long long usecs;
+  int saved_errno = errno;
+  int bucket = 0;
+
+  if (ctx->replica == LOCAL_REPLICA) {
+    stats = &ctx->vio_stats.local[op];
+  } else {
+    stats = &ctx->vio_stats.remote[op];
+  }
+
+  csync_gettime(&now);
+  now = c_tspecdiff(now, *start);
+  usecs = (unsigned long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+  stats->calls++;
+  if (failed) {
+    stats->errors++;
+  } else if (bytes > 0) {
+    stats->bytes += bytes;
+  }
+  stats->usecs += usecs;
+
+  while (usecs >= 2 && bucket < CSYNC_VIO_STATS_BUCKETS - 1) {
+    usecs >>= 1;
+    bucket++;
+  }
+  stats->histogram[bucket]++;
+
+  errno = saved_errno;
+}
+
+static int _dircache_cmp(const void *key, const void *data) {
+  return strcmp((const char *) key, (const char *) data);
+}
+
+static void _dircache_destructor(void *data) {
+  SAFE_FREE(data);
+}
+
+/* the key of a directory is the uri without trailing slashes */
+static char *_dircache_key(const char *uri) {
+  size_t len = strlen(uri);
+
+  while (len > 1 && uri[len - 1] == '/') {
+    --len;
+  }
+
+  return c_strndup(uri, len);
+}
+
 int csync_vio_init(CSYNC *ctx, const char *module, const char *args) {
   csync_stat_t sb;
   char *path = NULL;
@@ -123,7 +232,7 @@ int csync_vio_init(CSYNC *ctx, const char *module, const char *args) {
 
   /* get the method struct */
   m = (*init_fn)(module, args, csync_get_auth_callback(ctx),
-      csync_get_userdata(ctx));
+      csync_get_userdata(ctx), &ctx->module.mctx);
   if (m == NULL) {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "module %s returned a NULL method", module);
     return -1;
@@ -147,9 +256,12 @@ int csync_vio_init(CSYNC *ctx, const char *module, const char *args) {
 
   /* Useful defaults to the module capabilities */
   ctx->module.capabilities.atomar_copy_support = false;
+  ctx->module.capabilities.delta_transfer_support = false;
+  ctx->module.capabilities.recursive_delete_support = false;
+  ctx->module.capabilities.upload_mtime_support = false;
   /* Load the module capabilities from the module if it implements the it. */
   if( VIO_METHOD_HAS_FUNC(m, get_capabilities)) {
-    ctx->module.capabilities = *(m->get_capabilities());
+    ctx->module.capabilities = *(m->get_capabilities(ctx->module.mctx));
   } else {
     CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "module %s has no capabilities fn", module);
   }
@@ -161,14 +273,23 @@ int csync_vio_init(CSYNC *ctx, const char *module, const char *args) {
 
   ctx->module.method = m;
 
+  /* a failing trace is reported, the sync goes on without it */
+  if (ctx->options.vio_trace != NULL) {
+    csync_vio_trace_start(ctx, ctx->options.vio_trace);
+  }
+
   return 0;
 }
 
 void csync_vio_shutdown(CSYNC *ctx) {
+  csync_vio_dircache_clear(ctx);
+
   if (ctx->module.handle != NULL) {
+    csync_vio_trace_stop(ctx);
+
     /* shutdown the plugin */
     if (ctx->module.finish_fn != NULL) {
-      (*ctx->module.finish_fn)(ctx->module.method);
+      (*ctx->module.finish_fn)(ctx->module.method, ctx->module.mctx);
     }
 
     /* close the plugin */
@@ -176,17 +297,20 @@ void csync_vio_shutdown(CSYNC *ctx) {
     ctx->module.handle = NULL;
 
     ctx->module.method = NULL;
+    ctx->module.mctx = NULL;
     ctx->module.finish_fn = NULL;
   }
 }
 
 csync_vio_handle_t *csync_vio_open(CSYNC *ctx, const char *uri, int flags, mode_t mode) {
+  struct timespec start;
   csync_vio_handle_t *h = NULL;
   csync_vio_method_handle_t *mh = NULL;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      mh = ctx->module.method->open(uri, flags, mode);
+      mh = ctx->module.method->open(ctx->module.mctx, uri, flags, mode);
       break;
     case LOCAL_REPLICA:
       mh = csync_vio_local_open(uri, flags, mode);
@@ -195,6 +319,8 @@ csync_vio_handle_t *csync_vio_open(CSYNC *ctx, const char *uri, int flags, mode_
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_OPEN, &start, mh == NULL, 0);
+
   h = csync_vio_handle_new(uri, mh);
   if (h == NULL) {
     return NULL;
@@ -204,12 +330,14 @@ csync_vio_handle_t *csync_vio_open(CSYNC *ctx, const char *uri, int flags, mode_
 }
 
 csync_vio_handle_t *csync_vio_creat(CSYNC *ctx, const char *uri, mode_t mode) {
+  struct timespec start;
   csync_vio_handle_t *h = NULL;
   csync_vio_method_handle_t *mh = NULL;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      mh = ctx->module.method->creat(uri, mode);
+      mh = ctx->module.method->creat(ctx->module.mctx, uri, mode);
       break;
     case LOCAL_REPLICA:
       mh = csync_vio_local_creat(uri, mode);
@@ -218,6 +346,8 @@ csync_vio_handle_t *csync_vio_creat(CSYNC *ctx, const char *uri, mode_t mode) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_CREAT, &start, mh == NULL, 0);
+
   h = csync_vio_handle_new(uri, mh);
   if (h == NULL) {
     return NULL;
@@ -227,6 +357,7 @@ csync_vio_handle_t *csync_vio_creat(CSYNC *ctx, const char *uri, mode_t mode) {
 }
 
 int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *fhandle) {
+  struct timespec start;
   int rc = -1;
 
   if (fhandle == NULL) {
@@ -234,9 +365,10 @@ int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *fhandle) {
     return -1;
   }
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->close(fhandle->method_handle);
+      rc = ctx->module.method->close(ctx->module.mctx, fhandle->method_handle);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_close(fhandle->method_handle);
@@ -245,6 +377,50 @@ int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *fhandle) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_CLOSE, &start, rc < 0, 0);
+
+  /* handle->method_handle is free'd by the above close */
+  SAFE_FREE(fhandle->uri);
+  SAFE_FREE(fhandle);
+
+  return rc;
+}
+
+/*
+ * Close the file and return the stat of it as written. Only the fields the
+ * backend knows for sure are set, NONE if it can't provide any. A caller
+ * which needs another one has to stat the file.
+ */
+int csync_vio_close_stat(CSYNC *ctx, csync_vio_handle_t *fhandle, csync_vio_file_stat_t *buf) {
+  struct timespec start;
+  int rc = -1;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  csync_gettime(&start);
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      if (VIO_METHOD_HAS_FUNC(ctx->module.method, close_stat)) {
+        rc = ctx->module.method->close_stat(ctx->module.mctx,
+                                            fhandle->method_handle, buf);
+      } else {
+        rc = ctx->module.method->close(ctx->module.mctx, fhandle->method_handle);
+      }
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_close_stat(fhandle->method_handle, buf);
+      break;
+    default:
+      break;
+  }
+
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_CLOSE, &start, rc < 0, 0);
+
   /* handle->method_handle is free'd by the above close */
   SAFE_FREE(fhandle->uri);
   SAFE_FREE(fhandle);
@@ -252,7 +428,82 @@ int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *fhandle) {
   return rc;
 }
 
+/*
+ * Flush the written data of the file to the disk. The remote backends
+ * store the data when the file is closed, there is nothing to do.
+ */
+int csync_vio_fsync(CSYNC *ctx, csync_vio_handle_t *fhandle) {
+  struct timespec start;
+  int rc = -1;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  csync_gettime(&start);
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      rc = 0;
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_fsync(fhandle->method_handle);
+      break;
+    default:
+      break;
+  }
+
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_FSYNC, &start, rc < 0, 0);
+
+  return rc;
+}
+
+/* Flush the entries of a directory, e.g. after a rename into it. */
+int csync_vio_fsync_dir(CSYNC *ctx, const char *uri) {
+  struct timespec start;
+  int rc = -1;
+
+  csync_gettime(&start);
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      rc = 0;
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_fsync_dir(uri);
+      break;
+    default:
+      break;
+  }
+
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_FSYNC, &start, rc < 0, 0);
+
+  return rc;
+}
+
+/* Flush all the data of the file system the uri is located on. */
+int csync_vio_syncfs(CSYNC *ctx, const char *uri) {
+  struct timespec start;
+  int rc = -1;
+
+  csync_gettime(&start);
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      rc = 0;
+      break;
+    case LOCAL_REPLICA:
+      rc = csync_vio_local_syncfs(uri);
+      break;
+    default:
+      break;
+  }
+
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_FSYNC, &start, rc < 0, 0);
+
+  return rc;
+}
+
 ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_t count) {
+  struct timespec start;
   ssize_t rs = 0;
 
   if (fhandle == NULL) {
@@ -260,9 +511,10 @@ ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_
     return -1;
   }
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rs = ctx->module.method->read(fhandle->method_handle, buf, count);
+      rs = ctx->module.method->read(ctx->module.mctx, fhandle->method_handle, buf, count);
       break;
     case LOCAL_REPLICA:
       rs = csync_vio_local_read(fhandle->method_handle, buf, count);
@@ -271,10 +523,33 @@ ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_READ, &start, rs < 0, rs);
+
+  _csync_vio_throttle_bytes(ctx, rs);
+
   return rs;
 }
 
+/* read until the buffer is full or the end of the file is reached */
+ssize_t csync_vio_read_full(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_t count) {
+  size_t done = 0;
+  ssize_t rs = 0;
+
+  while (done < count) {
+    rs = csync_vio_read(ctx, fhandle, (char *) buf + done, count - done);
+    if (rs < 0) {
+      return -1;
+    } else if (rs == 0) {
+      break;
+    }
+    done += rs;
+  }
+
+  return done;
+}
+
 ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf, size_t count) {
+  struct timespec start;
   ssize_t rs = 0;
 
   if (fhandle == NULL) {
@@ -282,9 +557,10 @@ ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf
     return -1;
   }
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rs = ctx->module.method->write(fhandle->method_handle, buf, count);
+      rs = ctx->module.method->write(ctx->module.mctx, fhandle->method_handle, buf, count);
       break;
     case LOCAL_REPLICA:
       rs = csync_vio_local_write(fhandle->method_handle, buf, count);
@@ -293,15 +569,112 @@ ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_WRITE, &start, rs < 0, rs);
+
+  _csync_vio_throttle_bytes(ctx, rs);
+
+  return rs;
+}
+
+/* the source of csync_vio_sendfile, throttled like the writes */
+struct _csync_vio_source_s {
+  CSYNC *ctx;
+  enum csync_replica_e replica;
+  csync_vio_source_fn source;
+  void *userdata;
+};
+
+static ssize_t _csync_vio_source(void *userdata, char *buf, size_t count) {
+  struct _csync_vio_source_s *s = userdata;
+  ssize_t rs;
+
+  rs = s->source(s->userdata, buf, count);
+
+  /* the source reads from the other replica */
+  s->ctx->replica = s->replica;
+  _csync_vio_throttle_bytes(s->ctx, rs);
+
   return rs;
 }
 
+/*
+ * Send the file with the data pulled from the source while it is sent,
+ * instead of writing it. This fails with ENOTSUP before anything is sent
+ * if the backend can't do it, the data has to be written then.
+ */
+int csync_vio_sendfile(CSYNC *ctx, csync_vio_handle_t *fhandle,
+    csync_vio_source_fn source, void *userdata, off_t size) {
+  struct timespec start;
+  struct _csync_vio_source_s s;
+  int rc = -1;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  s.ctx = ctx;
+  s.replica = ctx->replica;
+  s.source = source;
+  s.userdata = userdata;
+
+  csync_gettime(&start);
+  switch(ctx->replica) {
+    case REMOTE_REPLICA:
+      if (VIO_METHOD_HAS_FUNC(ctx->module.method, sendfile)) {
+        rc = ctx->module.method->sendfile(ctx->module.mctx, fhandle->method_handle,
+            _csync_vio_source, &s, size);
+      } else {
+        errno = ENOTSUP;
+      }
+      break;
+    case LOCAL_REPLICA:
+      errno = ENOTSUP;
+      break;
+    default:
+      break;
+  }
+
+  ctx->replica = s.replica;
+
+  /* not counted if the data has to be written instead */
+  if (rc == 0 || errno != ENOTSUP) {
+    _csync_vio_stats(ctx, CSYNC_VIO_STATS_SENDFILE, &start, rc < 0,
+                     rc == 0 ? size : 0);
+  }
+
+  return rc;
+}
+
+/*
+ * Send the modification time with the data of the file, before anything is
+ * written. The close_stat of the file returns the mtime if it was set, a
+ * separate utimes is not needed then. Local files get it with utimes.
+ */
+int csync_vio_set_upload_mtime(CSYNC *ctx, csync_vio_handle_t *fhandle, time_t mtime) {
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (ctx->replica == REMOTE_REPLICA &&
+      VIO_METHOD_HAS_FUNC(ctx->module.method, set_upload_mtime)) {
+    return ctx->module.method->set_upload_mtime(ctx->module.mctx,
+                                                fhandle->method_handle, mtime);
+  }
+
+  errno = ENOTSUP;
+  return -1;
+}
+
 off_t csync_vio_lseek(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t offset, int whence) {
+  struct timespec start;
   off_t ro = 0;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      ro = ctx->module.method->lseek(fhandle->method_handle, offset, whence);
+      ro = ctx->module.method->lseek(ctx->module.mctx, fhandle->method_handle, offset, whence);
       break;
     case LOCAL_REPLICA:
       ro = csync_vio_local_lseek(fhandle->method_handle, offset, whence);
@@ -310,16 +683,20 @@ off_t csync_vio_lseek(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t offset, int
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_LSEEK, &start, ro < 0, 0);
+
   return ro;
 }
 
 csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
+  struct timespec start;
   csync_vio_handle_t *h = NULL;
   csync_vio_method_handle_t *mh = NULL;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      mh = ctx->module.method->opendir(name);
+      mh = ctx->module.method->opendir(ctx->module.mctx, name);
       break;
     case LOCAL_REPLICA:
       mh = csync_vio_local_opendir(name);
@@ -328,6 +705,8 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_OPENDIR, &start, mh == NULL, 0);
+
   h = csync_vio_handle_new(name, mh);
   if (h == NULL) {
     return NULL;
@@ -337,6 +716,7 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
 }
 
 int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+  struct timespec start;
   int rc = -1;
 
   if (dhandle == NULL) {
@@ -344,9 +724,10 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
     return -1;
   }
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->closedir(dhandle->method_handle);
+      rc = ctx->module.method->closedir(ctx->module.mctx, dhandle->method_handle);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_closedir(dhandle->method_handle);
@@ -355,6 +736,8 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_CLOSEDIR, &start, rc < 0, 0);
+
   SAFE_FREE(dhandle->uri);
   SAFE_FREE(dhandle);
 
@@ -362,11 +745,15 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
 }
 
 csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
+  struct timespec start;
   csync_vio_file_stat_t *fs = NULL;
 
+  _csync_vio_throttle_ops(ctx);
+
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      fs = ctx->module.method->readdir(dhandle->method_handle);
+      fs = ctx->module.method->readdir(ctx->module.mctx, dhandle->method_handle);
       break;
     case LOCAL_REPLICA:
       fs = csync_vio_local_readdir(dhandle->method_handle);
@@ -375,15 +762,19 @@ csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_READDIR, &start, false, 0);
+
   return fs;
 }
 
 int csync_vio_mkdir(CSYNC *ctx, const char *uri, mode_t mode) {
+  struct timespec start;
   int rc = -1;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->mkdir(uri, mode);
+      rc = ctx->module.method->mkdir(ctx->module.mctx, uri, mode);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_mkdir(uri, mode);
@@ -392,6 +783,12 @@ int csync_vio_mkdir(CSYNC *ctx, const char *uri, mode_t mode) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_MKDIR, &start, rc < 0, 0);
+
+  if (rc == 0) {
+    csync_vio_dircache_add(ctx, uri);
+  }
+
   return rc;
 }
 
@@ -405,6 +802,11 @@ int csync_vio_mkdirs(CSYNC *ctx, const char *uri, mode_t mode) {
     return -1;
   }
 
+  /* the directory has been seen in this run already */
+  if (csync_vio_dircache_contains(ctx, uri)) {
+    return 0;
+  }
+
   st = csync_vio_file_stat_new();
   if (st == NULL) {
     return -1;
@@ -412,9 +814,13 @@ int csync_vio_mkdirs(CSYNC *ctx, const char *uri, mode_t mode) {
 
   if (csync_vio_stat(ctx, uri, st) == 0) {
     if (! S_ISDIR(st->mode)) {
+      csync_vio_file_stat_destroy(st);
       errno = ENOTDIR;
       return -1;
     }
+    csync_vio_file_stat_destroy(st);
+    csync_vio_dircache_add(ctx, uri);
+    return 0;
   }
   csync_vio_file_stat_destroy(st);
   st = NULL;
@@ -429,28 +835,32 @@ int csync_vio_mkdirs(CSYNC *ctx, const char *uri, mode_t mode) {
     memcpy(suburi, uri, tmp);
     suburi[tmp] = '\0';
 
-    st = csync_vio_file_stat_new();
-    if (csync_vio_stat(ctx, suburi, st) == 0) {
-      if (! S_ISDIR(st->mode)) {
+    if (! csync_vio_dircache_contains(ctx, suburi)) {
+      st = csync_vio_file_stat_new();
+      if (csync_vio_stat(ctx, suburi, st) == 0) {
+        if (! S_ISDIR(st->mode)) {
+          csync_vio_file_stat_destroy(st);
+          errno = ENOTDIR;
+          return -1;
+        }
+        csync_vio_dircache_add(ctx, suburi);
+      } else if (errno != ENOENT) {
+        strerror_r(errno, errbuf, sizeof(errbuf));
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "csync_vio_mkdirs stat failed: %s",
+            errbuf);
+        csync_vio_file_stat_destroy(st);
+        return -1;
+      } else if (csync_vio_mkdirs(ctx, suburi, mode) < 0) {
         csync_vio_file_stat_destroy(st);
-        errno = ENOTDIR;
         return -1;
       }
-    } else if (errno != ENOENT) {
-      strerror_r(errno, errbuf, sizeof(errbuf));
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "csync_vio_mkdirs stat failed: %s",
-          errbuf);
-      csync_vio_file_stat_destroy(st);
-      return -1;
-    } else if (csync_vio_mkdirs(ctx, suburi, mode) < 0) {
       csync_vio_file_stat_destroy(st);
-      return -1;
     }
-    csync_vio_file_stat_destroy(st);
   }
 
   tmp = csync_vio_mkdir(ctx, uri, mode);
   if ((tmp < 0) && (errno == EEXIST)) {
+    csync_vio_dircache_add(ctx, uri);
     return 0;
   }
 
@@ -458,11 +868,13 @@ int csync_vio_mkdirs(CSYNC *ctx, const char *uri, mode_t mode) {
 }
 
 int csync_vio_rmdir(CSYNC *ctx, const char *uri) {
+  struct timespec start;
   int rc = -1;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->rmdir(uri);
+      rc = ctx->module.method->rmdir(ctx->module.mctx, uri);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_rmdir(uri);
@@ -471,15 +883,25 @@ int csync_vio_rmdir(CSYNC *ctx, const char *uri) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_RMDIR, &start, rc < 0, 0);
+
+  if (rc == 0) {
+    csync_vio_dircache_remove(ctx, uri);
+  }
+
   return rc;
 }
 
 int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf) {
+  struct timespec start;
   int rc = -1;
 
+  _csync_vio_throttle_ops(ctx);
+
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->stat(uri, buf);
+      rc = ctx->module.method->stat(ctx->module.mctx, uri, buf);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_stat(uri, buf);
@@ -488,15 +910,19 @@ int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_STAT, &start, rc < 0, 0);
+
   return rc;
 }
 
 int csync_vio_rename(CSYNC *ctx, const char *olduri, const char *newuri) {
+  struct timespec start;
   int rc = -1;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->rename(olduri, newuri);
+      rc = ctx->module.method->rename(ctx->module.mctx, olduri, newuri);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_rename(olduri, newuri);
@@ -505,15 +931,24 @@ int csync_vio_rename(CSYNC *ctx, const char *olduri, const char *newuri) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_RENAME, &start, rc < 0, 0);
+
+  /* a renamed directory doesn't exist under the old name anymore */
+  if (rc == 0) {
+    csync_vio_dircache_remove(ctx, olduri);
+  }
+
   return rc;
 }
 
 int csync_vio_unlink(CSYNC *ctx, const char *uri) {
+  struct timespec start;
   int rc = -1;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->unlink(uri);
+      rc = ctx->module.method->unlink(ctx->module.mctx, uri);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_unlink(uri);
@@ -522,15 +957,19 @@ int csync_vio_unlink(CSYNC *ctx, const char *uri) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_UNLINK, &start, rc < 0, 0);
+
   return rc;
 }
 
 int csync_vio_chmod(CSYNC *ctx, const char *uri, mode_t mode) {
+  struct timespec start;
   int rc = -1;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->chmod(uri, mode);
+      rc = ctx->module.method->chmod(ctx->module.mctx, uri, mode);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_chmod(uri, mode);
@@ -539,15 +978,19 @@ int csync_vio_chmod(CSYNC *ctx, const char *uri, mode_t mode) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_CHMOD, &start, rc < 0, 0);
+
   return rc;
 }
 
 int csync_vio_chown(CSYNC *ctx, const char *uri, uid_t owner, gid_t group) {
+  struct timespec start;
   int rc = -1;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->chown(uri, owner, group);
+      rc = ctx->module.method->chown(ctx->module.mctx, uri, owner, group);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_chown(uri, owner, group);
@@ -556,15 +999,19 @@ int csync_vio_chown(CSYNC *ctx, const char *uri, uid_t owner, gid_t group) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_CHOWN, &start, rc < 0, 0);
+
   return rc;
 }
 
 int csync_vio_utimes(CSYNC *ctx, const char *uri, const struct timeval *times) {
+  struct timespec start;
   int rc = -1;
 
+  csync_gettime(&start);
   switch(ctx->replica) {
     case REMOTE_REPLICA:
-      rc = ctx->module.method->utimes(uri, times);
+      rc = ctx->module.method->utimes(ctx->module.mctx, uri, times);
       break;
     case LOCAL_REPLICA:
       rc = csync_vio_local_utimes(uri, times);
@@ -573,32 +1020,306 @@ int csync_vio_utimes(CSYNC *ctx, const char *uri, const struct timeval *times) {
       break;
   }
 
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_UTIMES, &start, rc < 0, 0);
+
+  return rc;
+}
+
+/*
+ * Set mode, owner and modification time in one call if the backend supports
+ * it. A mode of 0 or an owner and group of -1 are not changed. Without
+ * support of the backend, this falls back to chmod, chown and utimes, where
+ * a failing chown is ignored.
+ */
+int csync_vio_setattr(CSYNC *ctx, const char *uri, mode_t mode, uid_t owner, gid_t group, time_t mtime) {
+  struct timespec start;
+  struct timeval times[2];
+  int rc = -1;
+
+  if (ctx->replica == REMOTE_REPLICA &&
+      VIO_METHOD_HAS_FUNC(ctx->module.method, setattr)) {
+    csync_gettime(&start);
+    rc = ctx->module.method->setattr(ctx->module.mctx, uri, mode,
+                                     owner, group, mtime);
+    _csync_vio_stats(ctx, CSYNC_VIO_STATS_SETATTR, &start, rc < 0, 0);
+    return rc;
+  }
+
+  if (mode != 0) {
+    rc = csync_vio_chmod(ctx, uri, mode);
+    if (rc < 0) {
+      return rc;
+    }
+  }
+
+  if (owner != (uid_t) -1 || group != (gid_t) -1) {
+    csync_vio_chown(ctx, uri, owner, group);
+  }
+
+  times[0].tv_sec = times[1].tv_sec = mtime;
+  times[0].tv_usec = times[1].tv_usec = 0;
+
+  return csync_vio_utimes(ctx, uri, times);
+}
+
+/*
+ * The checksum of a file if the module knows it without a transfer, -1 with
+ * ENOTSUP otherwise and on the local replica. The caller reads the file then.
+ */
+int csync_vio_checksum(CSYNC *ctx, const char *uri, const char *type,
+    char *buf, size_t len) {
+  struct timespec start;
+  int rc = -1;
+
+  if (ctx->replica != REMOTE_REPLICA ||
+      !VIO_METHOD_HAS_FUNC(ctx->module.method, checksum)) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  _csync_vio_throttle_ops(ctx);
+
+  csync_gettime(&start);
+  rc = ctx->module.method->checksum(ctx->module.mctx, uri, type, buf, len);
+  _csync_vio_stats(ctx, CSYNC_VIO_STATS_CHECKSUM, &start,
+                   rc < 0 && errno != ENOTSUP, 0);
+
   return rc;
 }
 
+/*
+ * Queue a metadata operation, the done callback of it is called from
+ * csync_vio_complete() once it has run. If the backend can't queue it, the
+ * operation is run right away and done is called before this returns.
+ */
+int csync_vio_submit(CSYNC *ctx, csync_vio_op_t *op) {
+  struct timespec start;
+  struct timeval times[2];
+  int rc = -1;
+
+  if (ctx->replica == REMOTE_REPLICA &&
+      VIO_METHOD_HAS_FUNC(ctx->module.method, submit)) {
+    csync_gettime(&start);
+    rc = ctx->module.method->submit(ctx->module.mctx, op);
+    if (rc == 0 || errno != ENOTSUP) {
+      _csync_vio_stats(ctx, CSYNC_VIO_STATS_SUBMIT, &start, rc < 0, 0);
+      return rc;
+    }
+  }
+
+  switch (op->type) {
+    case CSYNC_VIO_OP_MKDIR:
+      rc = csync_vio_mkdir(ctx, op->uri, op->mode);
+      break;
+    case CSYNC_VIO_OP_RMDIR:
+      rc = csync_vio_rmdir(ctx, op->uri);
+      break;
+    case CSYNC_VIO_OP_UNLINK:
+      rc = csync_vio_unlink(ctx, op->uri);
+      break;
+    case CSYNC_VIO_OP_RENAME:
+      rc = csync_vio_rename(ctx, op->uri, op->newuri);
+      break;
+    case CSYNC_VIO_OP_UTIMES:
+      times[0].tv_sec = times[1].tv_sec = op->mtime;
+      times[0].tv_usec = times[1].tv_usec = 0;
+      rc = csync_vio_utimes(ctx, op->uri, times);
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  op->rc = rc < 0 ? -1 : 0;
+  op->err = rc < 0 ? errno : 0;
+  op->done(op);
+
+  return 0;
+}
+
+/*
+ * Report the queued operations which have finished by calling their done
+ * callback. With wait set, this returns when all operations are done.
+ */
+int csync_vio_complete(CSYNC *ctx, bool wait) {
+  if (VIO_METHOD_HAS_FUNC(ctx->module.method, complete)) {
+    return ctx->module.method->complete(ctx->module.mctx, wait ? 1 : 0);
+  }
+
+  return 0;
+}
+
 char *csync_vio_get_status_string(CSYNC *ctx) {
     if(ctx->error_string) {
         return ctx->error_string;
     }
     if(VIO_METHOD_HAS_FUNC(ctx->module.method, get_error_string)) {
-        return ctx->module.method->get_error_string();
+        return ctx->module.method->get_error_string(ctx->module.mctx);
     }
     return NULL;
 }
 
+/*
+ * Set a rate limit, the keys are the same as in the config file. The data is
+ * a pointer to an int with the bytes or operations per second, 0 disables
+ * the limit.
+ */
+static int _csync_vio_set_limit(CSYNC *ctx, const char *key, void *data) {
+  csync_vio_bucket_t *bucket = NULL;
+
+  if (c_streq(key, "local_bandwidth_limit")) {
+    bucket = &ctx->limit[LOCAL_REPLICA].bytes;
+  } else if (c_streq(key, "remote_bandwidth_limit")) {
+    bucket = &ctx->limit[REMOTE_REPLICA].bytes;
+  } else if (c_streq(key, "local_ops_limit")) {
+    bucket = &ctx->limit[LOCAL_REPLICA].ops;
+  } else if (c_streq(key, "remote_ops_limit")) {
+    bucket = &ctx->limit[REMOTE_REPLICA].ops;
+  } else {
+    return 1;
+  }
+
+  if (data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  csync_vio_set_limit(bucket, *(int *) data);
+
+  return 0;
+}
+
+void csync_vio_set_limit(csync_vio_bucket_t *bucket, int rate) {
+  bucket->rate = rate > 0 ? rate : 0;
+  bucket->tokens = 0;
+  bucket->last.tv_sec = 0;
+  bucket->last.tv_nsec = 0;
+}
+
 int csync_vio_set_property(CSYNC* ctx, const char* key, void* data) {
   int rc = -1;
+
+  /* the rate limits are handled here for all backends */
+  rc = _csync_vio_set_limit(ctx, key, data);
+  if (rc <= 0) {
+    return rc;
+  }
+  rc = -1;
+
   if(VIO_METHOD_HAS_FUNC(ctx->module.method, set_property))
-    rc = ctx->module.method->set_property(key, data);
+    rc = ctx->module.method->set_property(ctx->module.mctx, key, data);
   return rc;
 }
 
 int csync_vio_commit(CSYNC *ctx) {
   int rc = 0;
 
+  /* the directories have to be checked again in the next run */
+  csync_vio_dircache_clear(ctx);
+
   if (VIO_METHOD_HAS_FUNC(ctx->module.method, commit)) {
-      rc = ctx->module.method->commit();
+      rc = ctx->module.method->commit(ctx->module.mctx);
   }
 
   return rc;
 }
+
+int csync_vio_dircache_add(CSYNC *ctx, const char *uri) {
+  char *key = NULL;
+  int rc;
+
+  if (ctx->dircache == NULL &&
+      c_rbtree_create(&ctx->dircache, _dircache_cmp, _dircache_cmp) < 0) {
+    return -1;
+  }
+
+  key = _dircache_key(uri);
+  if (key == NULL) {
+    return -1;
+  }
+
+  rc = c_rbtree_insert(ctx->dircache, key);
+  if (rc != 0) {
+    /* known already or error */
+    SAFE_FREE(key);
+  }
+
+  return rc < 0 ? -1 : 0;
+}
+
+bool csync_vio_dircache_contains(CSYNC *ctx, const char *uri) {
+  char *key = NULL;
+  bool found;
+
+  if (ctx->dircache == NULL) {
+    return false;
+  }
+
+  key = _dircache_key(uri);
+  if (key == NULL) {
+    return false;
+  }
+
+  found = c_rbtree_find(ctx->dircache, key) != NULL;
+  SAFE_FREE(key);
+
+  return found;
+}
+
+/* the directory and everything below it, it was removed or renamed */
+void csync_vio_dircache_remove(CSYNC *ctx, const char *uri) {
+  c_rbnode_t *node = NULL;
+  c_list_t *gone = NULL;
+  c_list_t *walk = NULL;
+  char *key = NULL;
+  char *data = NULL;
+  size_t len;
+  bool below = false;
+
+  if (ctx->dircache == NULL) {
+    return;
+  }
+
+  key = _dircache_key(uri);
+  if (key == NULL) {
+    return;
+  }
+  len = strlen(key);
+
+  /*
+   * The keys below the directory start with "key/" and are adjacent in the
+   * order of the tree, the walk stops after them. Deleting a node while
+   * walking is not safe, they are deleted afterwards.
+   */
+  for (node = c_rbtree_head(ctx->dircache); node != NULL;
+       node = c_rbtree_node_next(node)) {
+    data = c_rbtree_node_data(node);
+
+    if (c_streq(data, key)) {
+      gone = c_list_prepend(gone, data);
+    } else if (strncmp(data, key, len) == 0 &&
+               (data[len] == '/' || (len > 0 && key[len - 1] == '/'))) {
+      gone = c_list_prepend(gone, data);
+      below = true;
+    } else if (below) {
+      break;
+    }
+  }
+
+  for (walk = gone; walk != NULL; walk = c_list_next(walk)) {
+    data = walk->data;
+    node = c_rbtree_find(ctx->dircache, data);
+    if (node != NULL) {
+      c_rbtree_node_delete(node);
+    }
+    SAFE_FREE(data);
+  }
+
+  c_list_free(gone);
+  SAFE_FREE(key);
+}
+
+void csync_vio_dircache_clear(CSYNC *ctx) {
+  c_rbtree_destroy(ctx->dircache, _dircache_destructor);
+  ctx->dircache = NULL;
+}
@@ -29,6 +29,7 @@
 #include "c_private.h"
 #include "vio/csync_vio_handle.h"
 #include "vio/csync_vio_file_stat.h"
+#include "vio/csync_vio_method.h"
 
 int csync_vio_init(CSYNC *ctx, const char *module, const char *args);
 void csync_vio_shutdown(CSYNC *ctx);
@@ -36,9 +37,17 @@ void csync_vio_shutdown(CSYNC *ctx);
 csync_vio_handle_t *csync_vio_open(CSYNC *ctx, const char *uri, int flags, mode_t mode);
 csync_vio_handle_t *csync_vio_creat(CSYNC *ctx, const char *uri, mode_t mode);
 int csync_vio_close(CSYNC *ctx, csync_vio_handle_t *handle);
+int csync_vio_close_stat(CSYNC *ctx, csync_vio_handle_t *fhandle, csync_vio_file_stat_t *buf);
 ssize_t csync_vio_read(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_t count);
+ssize_t csync_vio_read_full(CSYNC *ctx, csync_vio_handle_t *fhandle, void *buf, size_t count);
 ssize_t csync_vio_write(CSYNC *ctx, csync_vio_handle_t *fhandle, const void *buf, size_t count);
+int csync_vio_sendfile(CSYNC *ctx, csync_vio_handle_t *fhandle,
+    csync_vio_source_fn source, void *userdata, off_t size);
+int csync_vio_set_upload_mtime(CSYNC *ctx, csync_vio_handle_t *fhandle, time_t mtime);
 off_t csync_vio_lseek(CSYNC *ctx, csync_vio_handle_t *fhandle, off_t offset, int whence);
+int csync_vio_fsync(CSYNC *ctx, csync_vio_handle_t *fhandle);
+int csync_vio_fsync_dir(CSYNC *ctx, const char *uri);
+int csync_vio_syncfs(CSYNC *ctx, const char *uri);
 
 csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name);
 int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle);
@@ -56,11 +65,27 @@ int csync_vio_chmod(CSYNC *ctx, const char *uri, mode_t mode);
 int csync_vio_chown(CSYNC *ctx, const char *uri, uid_t owner, gid_t group);
 
 int csync_vio_utimes(CSYNC *ctx, const char *uri, const struct timeval *times);
+int csync_vio_setattr(CSYNC *ctx, const char *uri, mode_t mode, uid_t owner, gid_t group, time_t mtime);
+int csync_vio_checksum(CSYNC *ctx, const char *uri, const char *type, char *buf, size_t len);
+
+int csync_vio_submit(CSYNC *ctx, csync_vio_op_t *op);
+int csync_vio_complete(CSYNC *ctx, bool wait);
 
 int csync_vio_set_property(CSYNC *ctx, const char *key, void *data);
+void csync_vio_set_limit(struct csync_vio_bucket_s *bucket, int rate);
 
 char *csync_vio_get_status_string(CSYNC *ctx);
 
 int csync_vio_commit(CSYNC *ctx);
 
+/*
+ * The directories known to exist on the replicas in the current run, filled
+ * by the update detection and by mkdir. They are identified by the full uri
+ * and are forgotten on commit.
+ */
+int csync_vio_dircache_add(CSYNC *ctx, const char *uri);
+bool csync_vio_dircache_contains(CSYNC *ctx, const char *uri);
+void csync_vio_dircache_remove(CSYNC *ctx, const char *uri);
+void csync_vio_dircache_clear(CSYNC *ctx);
+
 #endif /* _CSYNC_VIO_H */
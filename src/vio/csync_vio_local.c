@@ -37,6 +37,82 @@ typedef struct fhandle_s {
   int fd;
 } fhandle_t;
 
+/* fill the file stat from the stat of the file system */
+static void _csync_vio_local_fill_stat(csync_stat_t *sb,
+    csync_vio_file_stat_t *buf) {
+  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  switch(sb->st_mode & S_IFMT) {
+    case S_IFBLK:
+      buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
+      break;
+    case S_IFCHR:
+      buf->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
+      break;
+    case S_IFDIR:
+      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      break;
+    case S_IFIFO:
+      buf->type = CSYNC_VIO_FILE_TYPE_FIFO;
+      break;
+    case S_IFLNK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    case S_IFREG:
+      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+      break;
+    case S_IFSOCK:
+      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
+      break;
+    default:
+      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
+      break;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+
+  buf->mode = sb->st_mode;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
+
+  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
+    /* FIXME: handle symlink */
+    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
+  } else {
+    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
+  }
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
+
+  buf->device = sb->st_dev;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DEVICE;
+
+  buf->inode = sb->st_ino;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
+
+  buf->nlink = sb->st_nlink;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
+
+  buf->uid = sb->st_uid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
+
+  buf->gid = sb->st_gid;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
+
+  buf->size = sb->st_size;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+
+  /* Both values are only initialized to zero as they are not used in csync */
+  /* They are deprecated and will be rmemoved later. */
+  buf->blksize  = 0;
+  buf->blkcount = 0;
+
+  buf->atime = sb->st_atime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
+
+  buf->mtime = sb->st_mtime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+
+  buf->ctime = sb->st_ctime;
+  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+}
 
 /* the url comes in as utf-8 and in windows, it needs to be multibyte. */
 csync_vio_method_handle_t *csync_vio_local_open(const char *durl, int flags, mode_t mode) {
@@ -103,6 +179,25 @@ int csync_vio_local_close(csync_vio_method_handle_t *fhandle) {
   return rc;
 }
 
+int csync_vio_local_close_stat(csync_vio_method_handle_t *fhandle,
+    csync_vio_file_stat_t *buf) {
+  fhandle_t *handle = NULL;
+  csync_stat_t sb;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  handle = (fhandle_t *) fhandle;
+
+  if (fstat(handle->fd, &sb) == 0) {
+    _csync_vio_local_fill_stat(&sb, buf);
+  }
+
+  return csync_vio_local_close(fhandle);
+}
+
 ssize_t csync_vio_local_read(csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
   fhandle_t *handle = NULL;
 
@@ -147,6 +242,72 @@ off_t csync_vio_local_lseek(csync_vio_method_handle_t *fhandle, off_t offset, in
   return lseek(handle->fd, offset, whence);
 }
 
+int csync_vio_local_fsync(csync_vio_method_handle_t *fhandle) {
+  fhandle_t *handle = NULL;
+
+  if (fhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  handle = (fhandle_t *) fhandle;
+
+#ifdef __unix__
+  return fsync(handle->fd);
+#else
+  return 0;
+#endif
+}
+
+int csync_vio_local_fsync_dir(const char *uri) {
+  int rc = 0;
+#ifdef __unix__
+  int fd = -1;
+  mbchar_t *dir = c_utf8_to_locale(uri);
+
+  fd = _topen(dir, O_RDONLY, 0);
+  c_free_locale_string(dir);
+  if (fd < 0) {
+    return -1;
+  }
+
+  rc = fsync(fd);
+  close(fd);
+#else
+  (void) uri;
+#endif
+
+  return rc;
+}
+
+/*
+ * Flush the file system of the uri. Without syncfs() all file systems
+ * are flushed.
+ */
+int csync_vio_local_syncfs(const char *uri) {
+  int rc = 0;
+#ifdef HAVE_SYNCFS
+  int fd = -1;
+  mbchar_t *dir = c_utf8_to_locale(uri);
+
+  fd = _topen(dir, O_RDONLY, 0);
+  c_free_locale_string(dir);
+  if (fd < 0) {
+    return -1;
+  }
+
+  rc = syncfs(fd);
+  close(fd);
+#elif defined(__unix__)
+  (void) uri;
+  sync();
+#else
+  (void) uri;
+#endif
+
+  return rc;
+}
+
 /*
  * directory functions
  */
@@ -285,78 +446,7 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
     c_free_locale_string(wuri);
     return -1;
   }
-  buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
-
-  switch(sb.st_mode & S_IFMT) {
-    case S_IFBLK:
-      buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
-      break;
-    case S_IFCHR:
-      buf->type = CSYNC_VIO_FILE_TYPE_CHARACTER_DEVICE;
-      break;
-    case S_IFDIR:
-      buf->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      break;
-    case S_IFIFO:
-      buf->type = CSYNC_VIO_FILE_TYPE_FIFO;
-      break;
-    case S_IFLNK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-    case S_IFREG:
-      buf->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      break;
-    case S_IFSOCK:
-      buf->type = CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK;
-      break;
-    default:
-      buf->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-      break;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-
-  buf->mode = sb.st_mode;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERMISSIONS;
-
-  if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
-    /* FIXME: handle symlink */
-    buf->flags = CSYNC_VIO_FILE_FLAGS_SYMLINK;
-  } else {
-    buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
-  }
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
-
-  buf->device = sb.st_dev;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DEVICE;
-
-  buf->inode = sb.st_ino;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
-
-  buf->nlink = sb.st_nlink;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_LINK_COUNT;
-
-  buf->uid = sb.st_uid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_UID;
-
-  buf->gid = sb.st_gid;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_GID;
-
-  buf->size = sb.st_size;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-
-  /* Both values are only initialized to zero as they are not used in csync */
-  /* They are deprecated and will be rmemoved later. */
-  buf->blksize  = 0;
-  buf->blkcount = 0;
-
-  buf->atime = sb.st_atime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
-
-  buf->mtime = sb.st_mtime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-
-  buf->ctime = sb.st_ctime;
-  buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
+  _csync_vio_local_fill_stat(&sb, buf);
 
   c_free_locale_string(wuri);
   return 0;
@@ -29,9 +29,13 @@
 csync_vio_method_handle_t *csync_vio_local_open(const char *durl, int flags, mode_t mode);
 csync_vio_method_handle_t *csync_vio_local_creat(const char *durl, mode_t mode);
 int csync_vio_local_close(csync_vio_method_handle_t *fhandle);
+int csync_vio_local_close_stat(csync_vio_method_handle_t *fhandle, csync_vio_file_stat_t *buf);
 ssize_t csync_vio_local_read(csync_vio_method_handle_t *fhandle, void *buf, size_t count);
 ssize_t csync_vio_local_write(csync_vio_method_handle_t *fhandle, const void *buf, size_t count);
 off_t csync_vio_local_lseek(csync_vio_method_handle_t *fhandle, off_t offset, int whence);
+int csync_vio_local_fsync(csync_vio_method_handle_t *fhandle);
+int csync_vio_local_fsync_dir(const char *uri);
+int csync_vio_local_syncfs(const char *uri);
 
 csync_vio_method_handle_t *csync_vio_local_opendir(const char *name);
 int csync_vio_local_closedir(csync_vio_method_handle_t *dhandle);
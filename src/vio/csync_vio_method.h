@@ -35,46 +35,121 @@
 
 typedef struct csync_vio_method_s csync_vio_method_t;
 
+/*
+ * The state of an instance of a module, it is created by vio_module_init
+ * and passed to every method. A module keeps its state there instead of in
+ * globals, so several instances, e.g. of two sync pairs, can be used in one
+ * process. The struct is defined by the module.
+ */
+typedef struct csync_vio_module_ctx_s csync_vio_module_ctx_t;
+
 struct csync_vio_capabilities_s {
  bool atomar_copy_support;
+ bool delta_transfer_support;   /* an existing file is written at any offset, see O_RDWR */
+ bool recursive_delete_support; /* rmdir removes a directory with its content */
+ bool upload_mtime_support;     /* the mtime is sent with the file, see set_upload_mtime */
 };
 
 typedef struct csync_vio_capabilities_s csync_vio_capabilities_t;
 
 typedef csync_vio_method_t *(*csync_vio_method_init_fn)(const char *method_name,
-    const char *config_args, csync_auth_callback cb, void *userdata);
-typedef void (*csync_vio_method_finish_fn)(csync_vio_method_t *method);
+    const char *config_args, csync_auth_callback cb, void *userdata,
+    csync_vio_module_ctx_t **mctx);
+typedef void (*csync_vio_method_finish_fn)(csync_vio_method_t *method,
+    csync_vio_module_ctx_t *mctx);
+
+typedef csync_vio_capabilities_t *(*csync_method_get_capabilities_fn)(csync_vio_module_ctx_t *mctx);
+
+typedef csync_vio_method_handle_t *(*csync_method_open_fn)(csync_vio_module_ctx_t *mctx, const char *durl, int flags, mode_t mode);
+typedef csync_vio_method_handle_t *(*csync_method_creat_fn)(csync_vio_module_ctx_t *mctx, const char *durl, mode_t mode);
+typedef int (*csync_method_close_fn)(csync_vio_module_ctx_t *mctx, csync_vio_method_handle_t *fhandle);
+typedef ssize_t (*csync_method_read_fn)(csync_vio_module_ctx_t *mctx, csync_vio_method_handle_t *fhandle, void *buf, size_t count);
+typedef ssize_t (*csync_method_write_fn)(csync_vio_module_ctx_t *mctx, csync_vio_method_handle_t *fhandle, const void *buf, size_t count);
+typedef off_t (*csync_method_lseek_fn)(csync_vio_module_ctx_t *mctx, csync_vio_method_handle_t *fhandle, off_t offset, int whence);
 
-typedef csync_vio_capabilities_t *(*csync_method_get_capabilities_fn)(void);
+typedef csync_vio_method_handle_t *(*csync_method_opendir_fn)(csync_vio_module_ctx_t *mctx, const char *name);
+typedef int (*csync_method_closedir_fn)(csync_vio_module_ctx_t *mctx, csync_vio_method_handle_t *dhandle);
+typedef csync_vio_file_stat_t *(*csync_method_readdir_fn)(csync_vio_module_ctx_t *mctx, csync_vio_method_handle_t *dhandle);
 
-typedef csync_vio_method_handle_t *(*csync_method_open_fn)(const char *durl, int flags, mode_t mode);
-typedef csync_vio_method_handle_t *(*csync_method_creat_fn)(const char *durl, mode_t mode);
-typedef int (*csync_method_close_fn)(csync_vio_method_handle_t *fhandle);
-typedef ssize_t (*csync_method_read_fn)(csync_vio_method_handle_t *fhandle, void *buf, size_t count);
-typedef ssize_t (*csync_method_write_fn)(csync_vio_method_handle_t *fhandle, const void *buf, size_t count);
-typedef off_t (*csync_method_lseek_fn)(csync_vio_method_handle_t *fhandle, off_t offset, int whence);
+typedef int (*csync_method_mkdir_fn)(csync_vio_module_ctx_t *mctx, const char *uri, mode_t mode);
+typedef int (*csync_method_rmdir_fn)(csync_vio_module_ctx_t *mctx, const char *uri);
 
-typedef csync_vio_method_handle_t *(*csync_method_opendir_fn)(const char *name);
-typedef int (*csync_method_closedir_fn)(csync_vio_method_handle_t *dhandle);
-typedef csync_vio_file_stat_t *(*csync_method_readdir_fn)(csync_vio_method_handle_t *dhandle);
+typedef int (*csync_method_stat_fn)(csync_vio_module_ctx_t *mctx, const char *uri, csync_vio_file_stat_t *buf);
+typedef int (*csync_method_rename_fn)(csync_vio_module_ctx_t *mctx, const char *olduri, const char *newuri);
+typedef int (*csync_method_unlink_fn)(csync_vio_module_ctx_t *mctx, const char *uri);
 
-typedef int (*csync_method_mkdir_fn)(const char *uri, mode_t mode);
-typedef int (*csync_method_rmdir_fn)(const char *uri);
+typedef int (*csync_method_chmod_fn)(csync_vio_module_ctx_t *mctx, const char *uri, mode_t mode);
+typedef int (*csync_method_chown_fn)(csync_vio_module_ctx_t *mctx, const char *uri, uid_t owner, gid_t group);
 
-typedef int (*csync_method_stat_fn)(const char *uri, csync_vio_file_stat_t *buf);
-typedef int (*csync_method_rename_fn)(const char *olduri, const char *newuri);
-typedef int (*csync_method_unlink_fn)(const char *uri);
+typedef int (*csync_method_utimes_fn)(csync_vio_module_ctx_t *mctx, const char *uri, const struct timeval times[2]);
 
-typedef int (*csync_method_chmod_fn)(const char *uri, mode_t mode);
-typedef int (*csync_method_chown_fn)(const char *uri, uid_t owner, gid_t group);
+typedef int (*csync_method_set_property_fn)(csync_vio_module_ctx_t *mctx, const char *key, void *data);
 
-typedef int (*csync_method_utimes_fn)(const char *uri, const struct timeval times[2]);
+typedef char* (*csync_method_get_error_string_fn)(csync_vio_module_ctx_t *mctx);
 
-typedef int (*csync_method_set_property_fn)(const char *key, void *data);
+typedef int (*csync_method_commit_fn)(csync_vio_module_ctx_t *mctx);
+
+typedef int (*csync_method_setattr_fn)(csync_vio_module_ctx_t *mctx,
+    const char *uri, mode_t mode, uid_t owner, gid_t group, time_t mtime);
+typedef int (*csync_method_close_stat_fn)(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_file_stat_t *buf);
+
+/*
+ * The checksum of the content of a file as lower case hex digits, of a type
+ * like "SHA1", if the module knows it without reading the file, e.g. from
+ * the server. Returns -1 with ENOTSUP if it doesn't know one of the type.
+ */
+typedef int (*csync_method_checksum_fn)(csync_vio_module_ctx_t *mctx,
+    const char *uri, const char *type, char *buf, size_t len);
 
-typedef char* (*csync_method_get_error_string_fn)();
+/*
+ * Provides the data of a file to send. It fills buf with up to count bytes
+ * and returns the number of bytes, 0 at the end of the data and -1 on an
+ * error. A call with a count of 0 restarts at the beginning of the data,
+ * e.g. if a request has to be sent again, and returns 0 on success.
+ */
+typedef ssize_t (*csync_vio_source_fn)(void *userdata, char *buf, size_t count);
+typedef int (*csync_method_sendfile_fn)(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_source_fn source,
+    void *userdata, off_t size);
+typedef int (*csync_method_set_upload_mtime_fn)(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, time_t mtime);
+
+/*
+ * A metadata operation which is queued with submit and run by the module
+ * while the caller goes on. Operations on the same path or on paths below
+ * each other run in the order they were submitted, others in parallel.
+ * The result is stored in rc and err and reported by calling done from
+ * complete, in the thread of the caller. The operation belongs to the
+ * module from submit until done is called.
+ */
+enum csync_vio_op_type_e {
+  CSYNC_VIO_OP_MKDIR,
+  CSYNC_VIO_OP_RMDIR,
+  CSYNC_VIO_OP_UNLINK,
+  CSYNC_VIO_OP_RENAME,
+  CSYNC_VIO_OP_UTIMES
+};
+
+typedef struct csync_vio_op_s csync_vio_op_t;
+typedef void (*csync_vio_op_done_fn)(csync_vio_op_t *op);
+
+struct csync_vio_op_s {
+  enum csync_vio_op_type_e type;
+  char *uri;
+  char *newuri;                 /* the target of a rename */
+  mode_t mode;                  /* the mode of a new directory */
+  time_t mtime;                 /* the mtime set by utimes */
+  int rc;                       /* 0 on success, -1 on error */
+  int err;                      /* the errno of the error */
+  csync_vio_op_done_fn done;
+  csync_vio_op_t *next;         /* used by the module while it is queued */
+};
 
-typedef int (*csync_method_commit_fn)();
+/* returns -1 with ENOTSUP if the module can't queue it now */
+typedef int (*csync_method_submit_fn)(csync_vio_module_ctx_t *mctx, csync_vio_op_t *op);
+/* reports the finished operations, if wait is set all of them */
+typedef int (*csync_method_complete_fn)(csync_vio_module_ctx_t *mctx, int wait);
 
 struct csync_vio_method_s {
   size_t method_table_size;           /* Used for versioning */
@@ -99,6 +174,13 @@ struct csync_vio_method_s {
   csync_method_set_property_fn set_property;
   csync_method_get_error_string_fn get_error_string;
   csync_method_commit_fn commit;
+  csync_method_setattr_fn setattr;
+  csync_method_close_stat_fn close_stat;
+  csync_method_sendfile_fn sendfile;
+  csync_method_set_upload_mtime_fn set_upload_mtime;
+  csync_method_submit_fn submit;
+  csync_method_complete_fn complete;
+  csync_method_checksum_fn checksum;
 };
 
 #endif /* _CSYNC_VIO_H */
@@ -26,7 +26,9 @@
 #include "vio/csync_vio_method.h"
 
 extern csync_vio_method_t *vio_module_init(const char *method_name,
-    const char *args, csync_auth_callback cb, void *userdata);
-extern void vio_module_shutdown(csync_vio_method_t *method);
+    const char *args, csync_auth_callback cb, void *userdata,
+    csync_vio_module_ctx_t **mctx);
+extern void vio_module_shutdown(csync_vio_method_t *method,
+    csync_vio_module_ctx_t *mctx);
 
 #endif /* _CSYNC_VIO_MODULE_H */
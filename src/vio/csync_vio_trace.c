@@ -0,0 +1,958 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ts=2 sw=2 et cindent
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "csync_private.h"
+#include "csync_time.h"
+#include "vio/csync_vio_trace.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.vio.trace"
+#include "csync_log.h"
+
+/*
+ * The trace is installed between csync and the module: it has a method
+ * table of its own which calls the methods of the module and writes a
+ * record for every call. Its state is passed as the context of the module.
+ */
+struct csync_vio_trace_s {
+  FILE *fp;
+  char *root;                   /* the path of the remote replica */
+  struct timespec start;
+  unsigned long next_handle;
+
+  csync_vio_method_t *method;   /* of the module */
+  csync_vio_module_ctx_t *mctx;
+  csync_vio_method_t trace_method;
+};
+
+typedef struct csync_vio_trace_s csync_vio_trace_t;
+
+#define TRACE(mctx) ((csync_vio_trace_t *) (mctx))
+
+/* the handles of the module get an id, to find their calls in the trace */
+struct _trace_handle_s {
+  csync_vio_method_handle_t *mh;
+  unsigned long id;
+};
+
+/*
+ * A queued operation is submitted to the module as a copy, its done
+ * callback writes the record and reports the original operation.
+ */
+struct _trace_op_s {
+  csync_vio_op_t op;            /* the copy, must be the first member */
+  csync_vio_op_t *orig;
+  csync_vio_trace_t *trace;
+  struct timespec start;
+};
+
+/*
+ * encoding
+ */
+
+static void _trace_put_uint(FILE *fp, uint64_t v) {
+  while (v >= 0x80) {
+    putc((int) (v & 0x7f) | 0x80, fp);
+    v >>= 7;
+  }
+  putc((int) v, fp);
+}
+
+/* signed numbers are zigzag encoded, small negative numbers stay short */
+static void _trace_put_int(FILE *fp, int64_t v) {
+  _trace_put_uint(fp, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+}
+
+static void _trace_put_string(FILE *fp, const char *s) {
+  size_t len = s != NULL ? strlen(s) : 0;
+
+  _trace_put_uint(fp, len);
+  if (len > 0) {
+    fwrite(s, 1, len, fp);
+  }
+}
+
+static int _trace_get_uint(FILE *fp, uint64_t *v) {
+  int shift = 0;
+  int c;
+
+  *v = 0;
+  do {
+    c = getc(fp);
+    if (c == EOF || shift > 63) {
+      return -1;
+    }
+    *v |= (uint64_t) (c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+
+  return 0;
+}
+
+static int _trace_get_int(FILE *fp, int64_t *v) {
+  uint64_t u;
+
+  if (_trace_get_uint(fp, &u) < 0) {
+    return -1;
+  }
+  *v = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+
+  return 0;
+}
+
+static int _trace_get_string(FILE *fp, char **s) {
+  uint64_t len;
+
+  if (_trace_get_uint(fp, &len) < 0 || len > 65536) {
+    return -1;
+  }
+  *s = c_malloc(len + 1);
+  if (*s == NULL) {
+    return -1;
+  }
+  if (len > 0 && fread(*s, 1, len, fp) != len) {
+    SAFE_FREE(*s);
+    return -1;
+  }
+  (*s)[len] = '\0';
+
+  return 0;
+}
+
+#define RECORD_PATH     0x02
+#define RECORD_NEWPATH  0x04
+#define RECORD_STAT     0x08
+
+static void _trace_put_stat(FILE *fp, const csync_vio_file_stat_t *st) {
+  _trace_put_uint(fp, st->fields);
+  _trace_put_uint(fp, st->type);
+  _trace_put_uint(fp, st->mode);
+  _trace_put_uint(fp, st->flags);
+  _trace_put_uint(fp, st->uid);
+  _trace_put_uint(fp, st->gid);
+  _trace_put_int(fp, st->atime);
+  _trace_put_int(fp, st->mtime);
+  _trace_put_int(fp, st->ctime);
+  _trace_put_int(fp, st->size);
+  _trace_put_uint(fp, st->inode);
+  _trace_put_uint(fp, st->nlink);
+  _trace_put_string(fp, st->name);
+}
+
+static int _trace_get_stat(FILE *fp, csync_vio_file_stat_t *st) {
+  uint64_t u[6];
+  int64_t i[4];
+
+  if (_trace_get_uint(fp, &u[0]) < 0 || _trace_get_uint(fp, &u[1]) < 0 ||
+      _trace_get_uint(fp, &u[2]) < 0 || _trace_get_uint(fp, &u[3]) < 0 ||
+      _trace_get_uint(fp, &u[4]) < 0 || _trace_get_uint(fp, &u[5]) < 0 ||
+      _trace_get_int(fp, &i[0]) < 0 || _trace_get_int(fp, &i[1]) < 0 ||
+      _trace_get_int(fp, &i[2]) < 0 || _trace_get_int(fp, &i[3]) < 0) {
+    return -1;
+  }
+
+  /* the names of the links and checksums are not in the trace */
+  st->fields = u[0] & ~(CSYNC_VIO_FILE_STAT_FIELDS_SYMLINK_NAME |
+                        CSYNC_VIO_FILE_STAT_FIELDS_CHECKSUM |
+                        CSYNC_VIO_FILE_STAT_FIELDS_ACL);
+  st->type = u[1];
+  st->mode = u[2];
+  st->flags = u[3];
+  st->uid = u[4];
+  st->gid = u[5];
+  st->atime = i[0];
+  st->mtime = i[1];
+  st->ctime = i[2];
+  st->size = i[3];
+
+  if (_trace_get_uint(fp, &u[0]) < 0 || _trace_get_uint(fp, &u[1]) < 0) {
+    return -1;
+  }
+  st->inode = u[0];
+  st->nlink = u[1];
+
+  if (_trace_get_string(fp, &st->name) < 0) {
+    return -1;
+  }
+  if (*st->name == '\0') {
+    SAFE_FREE(st->name);
+  }
+
+  return 0;
+}
+
+const char *csync_vio_trace_path(const char *root, const char *uri) {
+  const char *path;
+  const char *r;
+  size_t len;
+
+  path = strstr(uri, "://");
+  if (path != NULL) {
+    path += 3;
+    path += strcspn(path, "/");
+  } else {
+    path = uri;
+  }
+
+  if (root != NULL) {
+    r = csync_vio_trace_path(NULL, root);
+    len = strlen(r);
+    while (len > 0 && r[len - 1] == '/') {
+      len--;
+    }
+    while (*r == '/' && len > 0) {
+      r++;
+      len--;
+    }
+    while (*path == '/') {
+      path++;
+    }
+    if (strncmp(path, r, len) == 0 &&
+        (path[len] == '/' || path[len] == '\0')) {
+      path += len;
+    }
+  }
+
+  while (*path == '/') {
+    path++;
+  }
+
+  return path;
+}
+
+int csync_vio_trace_read_header(FILE *fp) {
+  char magic[sizeof(CSYNC_VIO_TRACE_MAGIC) - 1];
+
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      memcmp(magic, CSYNC_VIO_TRACE_MAGIC, sizeof(magic)) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+int csync_vio_trace_read(FILE *fp, csync_vio_trace_record_t *rec) {
+  uint64_t u;
+  int64_t v;
+  int present;
+  int c;
+  int i;
+
+  ZERO_STRUCTP(rec);
+
+  c = getc(fp);
+  if (c == EOF) {
+    return 0;
+  }
+  rec->op = c;
+  present = getc(fp);
+  if (present == EOF) {
+    goto err;
+  }
+  rec->flags = present & CSYNC_VIO_TRACE_QUEUED;
+
+  if (_trace_get_uint(fp, &u) < 0) {
+    goto err;
+  }
+  rec->handle = u;
+  if (_trace_get_uint(fp, &rec->start) < 0 ||
+      _trace_get_uint(fp, &rec->duration) < 0 ||
+      _trace_get_int(fp, &rec->result) < 0 ||
+      _trace_get_uint(fp, &u) < 0) {
+    goto err;
+  }
+  rec->err = u;
+
+  if (_trace_get_uint(fp, &u) < 0 || u > CSYNC_VIO_TRACE_ARGS) {
+    goto err;
+  }
+  rec->nargs = u;
+  for (i = 0; i < rec->nargs; i++) {
+    if (_trace_get_int(fp, &v) < 0) {
+      goto err;
+    }
+    rec->args[i] = v;
+  }
+
+  if ((present & RECORD_PATH) && _trace_get_string(fp, &rec->path) < 0) {
+    goto err;
+  }
+  if ((present & RECORD_NEWPATH) && _trace_get_string(fp, &rec->newpath) < 0) {
+    goto err;
+  }
+  if (present & RECORD_STAT) {
+    rec->st = csync_vio_file_stat_new();
+    if (rec->st == NULL || _trace_get_stat(fp, rec->st) < 0) {
+      goto err;
+    }
+  }
+
+  return 1;
+err:
+  csync_vio_trace_record_clear(rec);
+  errno = EINVAL;
+  return -1;
+}
+
+void csync_vio_trace_record_clear(csync_vio_trace_record_t *rec) {
+  SAFE_FREE(rec->path);
+  SAFE_FREE(rec->newpath);
+  if (rec->st != NULL) {
+    csync_vio_file_stat_destroy(rec->st);
+    rec->st = NULL;
+  }
+}
+
+/*
+ * recording
+ */
+
+static uint64_t _trace_usec(csync_vio_trace_t *t, struct timespec *ts) {
+  struct timespec diff = c_tspecdiff(*ts, t->start);
+
+  return (uint64_t) diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+}
+
+/*
+ * Write the record of a call which started at start and ended now. The errno
+ * of the call is kept.
+ */
+static void _trace_write(csync_vio_trace_t *t, csync_vio_trace_record_t *rec,
+    struct timespec *start, const char *uri, const char *newuri) {
+  struct timespec now;
+  int present = rec->flags;
+  int saved_errno = errno;
+  int i;
+
+  csync_gettime(&now);
+
+  if (uri != NULL) {
+    present |= RECORD_PATH;
+  }
+  if (newuri != NULL) {
+    present |= RECORD_NEWPATH;
+  }
+  if (rec->st != NULL) {
+    present |= RECORD_STAT;
+  }
+
+  putc(rec->op, t->fp);
+  putc(present, t->fp);
+  _trace_put_uint(t->fp, rec->handle);
+  _trace_put_uint(t->fp, _trace_usec(t, start));
+  _trace_put_uint(t->fp, _trace_usec(t, &now) - _trace_usec(t, start));
+  _trace_put_int(t->fp, rec->result);
+  _trace_put_uint(t->fp, rec->result < 0 ? rec->err : 0);
+  _trace_put_uint(t->fp, rec->nargs);
+  for (i = 0; i < rec->nargs; i++) {
+    _trace_put_int(t->fp, rec->args[i]);
+  }
+  if (uri != NULL) {
+    _trace_put_string(t->fp, csync_vio_trace_path(t->root, uri));
+  }
+  if (newuri != NULL) {
+    _trace_put_string(t->fp, csync_vio_trace_path(t->root, newuri));
+  }
+  if (rec->st != NULL) {
+    _trace_put_stat(t->fp, rec->st);
+  }
+
+  errno = saved_errno;
+}
+
+/* starts a record, the call is timed from here */
+#define TRACE_BEGIN(rec, o, h) \
+  csync_vio_trace_record_t rec; \
+  struct timespec rec##_start; \
+  ZERO_STRUCT(rec); \
+  rec.op = (o); \
+  rec.handle = (h); \
+  csync_gettime(&rec##_start)
+
+#define TRACE_END(t, rec, rc, uri, newuri) \
+  rec.result = (rc); \
+  rec.err = errno; \
+  _trace_write((t), &rec, &rec##_start, (uri), (newuri))
+
+static csync_vio_method_handle_t *_trace_handle(csync_vio_trace_t *t,
+    csync_vio_method_handle_t *mh, unsigned long *id) {
+  struct _trace_handle_s *h;
+  int saved_errno = errno;
+
+  *id = 0;
+  if (mh == NULL) {
+    return NULL;
+  }
+
+  h = c_malloc(sizeof(struct _trace_handle_s));
+  if (h == NULL) {
+    errno = saved_errno;
+    return NULL;
+  }
+  h->mh = mh;
+  h->id = *id = ++t->next_handle;
+
+  return (csync_vio_method_handle_t *) h;
+}
+
+#define HANDLE(h) ((struct _trace_handle_s *) (h))
+
+static csync_vio_capabilities_t *_trace_get_capabilities(csync_vio_module_ctx_t *mctx) {
+  csync_vio_trace_t *t = TRACE(mctx);
+
+  return t->method->get_capabilities(t->mctx);
+}
+
+static csync_vio_method_handle_t *_trace_open(csync_vio_module_ctx_t *mctx,
+    const char *durl, int flags, mode_t mode) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  csync_vio_method_handle_t *mh;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_OPEN, 0);
+
+  mh = t->method->open(t->mctx, durl, flags, mode);
+  mh = _trace_handle(t, mh, &rec.handle);
+
+  rec.nargs = 2;
+  rec.args[0] = flags;
+  rec.args[1] = mode;
+  TRACE_END(t, rec, mh != NULL ? 0 : -1, durl, NULL);
+
+  return mh;
+}
+
+static csync_vio_method_handle_t *_trace_creat(csync_vio_module_ctx_t *mctx,
+    const char *durl, mode_t mode) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  csync_vio_method_handle_t *mh;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_CREAT, 0);
+
+  mh = t->method->creat(t->mctx, durl, mode);
+  mh = _trace_handle(t, mh, &rec.handle);
+
+  rec.nargs = 1;
+  rec.args[0] = mode;
+  TRACE_END(t, rec, mh != NULL ? 0 : -1, durl, NULL);
+
+  return mh;
+}
+
+static int _trace_close(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_CLOSE, HANDLE(fhandle)->id);
+
+  rc = t->method->close(t->mctx, HANDLE(fhandle)->mh);
+  TRACE_END(t, rec, rc, NULL, NULL);
+
+  SAFE_FREE(fhandle);
+
+  return rc;
+}
+
+static ssize_t _trace_read(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, void *buf, size_t count) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  ssize_t rs;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_READ, HANDLE(fhandle)->id);
+
+  rs = t->method->read(t->mctx, HANDLE(fhandle)->mh, buf, count);
+
+  rec.nargs = 1;
+  rec.args[0] = count;
+  TRACE_END(t, rec, rs, NULL, NULL);
+
+  return rs;
+}
+
+static ssize_t _trace_write_fn(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, const void *buf, size_t count) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  ssize_t rs;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_WRITE, HANDLE(fhandle)->id);
+
+  rs = t->method->write(t->mctx, HANDLE(fhandle)->mh, buf, count);
+
+  rec.nargs = 1;
+  rec.args[0] = count;
+  TRACE_END(t, rec, rs, NULL, NULL);
+
+  return rs;
+}
+
+static off_t _trace_lseek(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, off_t offset, int whence) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  off_t ro;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_LSEEK, HANDLE(fhandle)->id);
+
+  ro = t->method->lseek(t->mctx, HANDLE(fhandle)->mh, offset, whence);
+
+  rec.nargs = 2;
+  rec.args[0] = offset;
+  rec.args[1] = whence;
+  TRACE_END(t, rec, ro, NULL, NULL);
+
+  return ro;
+}
+
+static csync_vio_method_handle_t *_trace_opendir(csync_vio_module_ctx_t *mctx,
+    const char *name) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  csync_vio_method_handle_t *mh;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_OPENDIR, 0);
+
+  mh = t->method->opendir(t->mctx, name);
+  mh = _trace_handle(t, mh, &rec.handle);
+
+  TRACE_END(t, rec, mh != NULL ? 0 : -1, name, NULL);
+
+  return mh;
+}
+
+static int _trace_closedir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_CLOSEDIR, HANDLE(dhandle)->id);
+
+  rc = t->method->closedir(t->mctx, HANDLE(dhandle)->mh);
+  TRACE_END(t, rec, rc, NULL, NULL);
+
+  SAFE_FREE(dhandle);
+
+  return rc;
+}
+
+/* the end of the directory is a record without a stat */
+static csync_vio_file_stat_t *_trace_readdir(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *dhandle) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  csync_vio_file_stat_t *fs;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_READDIR, HANDLE(dhandle)->id);
+
+  fs = t->method->readdir(t->mctx, HANDLE(dhandle)->mh);
+
+  rec.st = fs;
+  TRACE_END(t, rec, fs != NULL ? 0 : -1, NULL, NULL);
+
+  return fs;
+}
+
+static int _trace_mkdir(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_MKDIR, 0);
+
+  rc = t->method->mkdir(t->mctx, uri, mode);
+
+  rec.nargs = 1;
+  rec.args[0] = mode;
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_rmdir(csync_vio_module_ctx_t *mctx, const char *uri) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_RMDIR, 0);
+
+  rc = t->method->rmdir(t->mctx, uri);
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_stat(csync_vio_module_ctx_t *mctx, const char *uri,
+    csync_vio_file_stat_t *buf) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_STAT, 0);
+
+  rc = t->method->stat(t->mctx, uri, buf);
+
+  rec.st = rc == 0 ? buf : NULL;
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_rename(csync_vio_module_ctx_t *mctx, const char *olduri,
+    const char *newuri) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_RENAME, 0);
+
+  rc = t->method->rename(t->mctx, olduri, newuri);
+  TRACE_END(t, rec, rc, olduri, newuri);
+
+  return rc;
+}
+
+static int _trace_unlink(csync_vio_module_ctx_t *mctx, const char *uri) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_UNLINK, 0);
+
+  rc = t->method->unlink(t->mctx, uri);
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_chmod(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_CHMOD, 0);
+
+  rc = t->method->chmod(t->mctx, uri, mode);
+
+  rec.nargs = 1;
+  rec.args[0] = mode;
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_chown(csync_vio_module_ctx_t *mctx, const char *uri,
+    uid_t owner, gid_t group) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_CHOWN, 0);
+
+  rc = t->method->chown(t->mctx, uri, owner, group);
+
+  rec.nargs = 2;
+  rec.args[0] = owner;
+  rec.args[1] = group;
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_utimes(csync_vio_module_ctx_t *mctx, const char *uri,
+    const struct timeval times[2]) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_UTIMES, 0);
+
+  rc = t->method->utimes(t->mctx, uri, times);
+
+  if (times != NULL) {
+    rec.nargs = 2;
+    rec.args[0] = times[0].tv_sec;
+    rec.args[1] = times[1].tv_sec;
+  }
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_set_property(csync_vio_module_ctx_t *mctx, const char *key,
+    void *data) {
+  csync_vio_trace_t *t = TRACE(mctx);
+
+  return t->method->set_property(t->mctx, key, data);
+}
+
+static char *_trace_get_error_string(csync_vio_module_ctx_t *mctx) {
+  csync_vio_trace_t *t = TRACE(mctx);
+
+  return t->method->get_error_string(t->mctx);
+}
+
+static int _trace_commit(csync_vio_module_ctx_t *mctx) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_COMMIT, 0);
+
+  rc = t->method->commit(t->mctx);
+  TRACE_END(t, rec, rc, NULL, NULL);
+
+  fflush(t->fp);
+
+  return rc;
+}
+
+static int _trace_setattr(csync_vio_module_ctx_t *mctx, const char *uri,
+    mode_t mode, uid_t owner, gid_t group, time_t mtime) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_SETATTR, 0);
+
+  rc = t->method->setattr(t->mctx, uri, mode, owner, group, mtime);
+
+  rec.nargs = 4;
+  rec.args[0] = mode;
+  rec.args[1] = owner;
+  rec.args[2] = group;
+  rec.args[3] = mtime;
+  TRACE_END(t, rec, rc, uri, NULL);
+
+  return rc;
+}
+
+static int _trace_close_stat(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_file_stat_t *buf) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_CLOSE_STAT, HANDLE(fhandle)->id);
+
+  rc = t->method->close_stat(t->mctx, HANDLE(fhandle)->mh, buf);
+
+  rec.st = rc == 0 ? buf : NULL;
+  TRACE_END(t, rec, rc, NULL, NULL);
+
+  SAFE_FREE(fhandle);
+
+  return rc;
+}
+
+static int _trace_sendfile(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, csync_vio_source_fn source,
+    void *userdata, off_t size) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_SENDFILE, HANDLE(fhandle)->id);
+
+  rc = t->method->sendfile(t->mctx, HANDLE(fhandle)->mh, source, userdata,
+                           size);
+
+  rec.nargs = 1;
+  rec.args[0] = size;
+  TRACE_END(t, rec, rc, NULL, NULL);
+
+  return rc;
+}
+
+static int _trace_set_upload_mtime(csync_vio_module_ctx_t *mctx,
+    csync_vio_method_handle_t *fhandle, time_t mtime) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  int rc;
+  TRACE_BEGIN(rec, CSYNC_VIO_TRACE_SET_UPLOAD_MTIME, HANDLE(fhandle)->id);
+
+  rc = t->method->set_upload_mtime(t->mctx, HANDLE(fhandle)->mh, mtime);
+
+  rec.nargs = 1;
+  rec.args[0] = mtime;
+  TRACE_END(t, rec, rc, NULL, NULL);
+
+  return rc;
+}
+
+static const enum csync_vio_trace_op_e _trace_op_types[] = {
+  [CSYNC_VIO_OP_MKDIR] = CSYNC_VIO_TRACE_MKDIR,
+  [CSYNC_VIO_OP_RMDIR] = CSYNC_VIO_TRACE_RMDIR,
+  [CSYNC_VIO_OP_UNLINK] = CSYNC_VIO_TRACE_UNLINK,
+  [CSYNC_VIO_OP_RENAME] = CSYNC_VIO_TRACE_RENAME,
+  [CSYNC_VIO_OP_UTIMES] = CSYNC_VIO_TRACE_UTIMES
+};
+
+/* a queued operation is done, from the time it was submitted */
+static void _trace_op_done(csync_vio_op_t *op) {
+  struct _trace_op_s *top = (struct _trace_op_s *) op;
+  csync_vio_op_t *orig = top->orig;
+  csync_vio_trace_record_t rec;
+
+  ZERO_STRUCT(rec);
+  rec.op = _trace_op_types[op->type];
+  rec.flags = CSYNC_VIO_TRACE_QUEUED;
+  rec.result = op->rc;
+  rec.err = op->err;
+  if (op->type == CSYNC_VIO_OP_MKDIR) {
+    rec.nargs = 1;
+    rec.args[0] = op->mode;
+  } else if (op->type == CSYNC_VIO_OP_UTIMES) {
+    rec.nargs = 2;
+    rec.args[0] = rec.args[1] = op->mtime;
+  }
+  _trace_write(top->trace, &rec, &top->start, op->uri,
+               op->type == CSYNC_VIO_OP_RENAME ? op->newuri : NULL);
+
+  orig->rc = op->rc;
+  orig->err = op->err;
+  SAFE_FREE(top);
+
+  orig->done(orig);
+}
+
+static int _trace_submit(csync_vio_module_ctx_t *mctx, csync_vio_op_t *op) {
+  csync_vio_trace_t *t = TRACE(mctx);
+  struct _trace_op_s *top;
+  int saved_errno;
+  int rc;
+
+  if (op == NULL || (unsigned int) op->type > CSYNC_VIO_OP_UTIMES) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  top = c_malloc(sizeof(struct _trace_op_s));
+  if (top == NULL) {
+    return -1;
+  }
+  top->op = *op;
+  top->op.done = _trace_op_done;
+  top->op.next = NULL;
+  top->orig = op;
+  top->trace = t;
+  csync_gettime(&top->start);
+
+  rc = t->method->submit(t->mctx, &top->op);
+  if (rc < 0) {
+    /* csync runs it itself, the calls are traced then */
+    saved_errno = errno;
+    SAFE_FREE(top);
+    errno = saved_errno;
+  }
+
+  return rc;
+}
+
+static int _trace_complete(csync_vio_module_ctx_t *mctx, int wait) {
+  csync_vio_trace_t *t = TRACE(mctx);
+
+  return t->method->complete(t->mctx, wait);
+}
+
+#define TRACE_METHOD(t, name, fn) \
+  (t)->trace_method.name = VIO_METHOD_HAS_FUNC((t)->method, name) ? fn : NULL
+
+int csync_vio_trace_start(CSYNC *ctx, const char *file) {
+  csync_vio_trace_t *t = NULL;
+  csync_vio_capabilities_t *caps;
+  csync_vio_trace_record_t rec;
+  struct timespec now;
+  char errbuf[256] = {0};
+
+  if (ctx->module.method == NULL || ctx->module.trace != NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  t = c_malloc(sizeof(csync_vio_trace_t));
+  if (t == NULL) {
+    return -1;
+  }
+
+  t->fp = fopen(file, "wb");
+  if (t->fp == NULL) {
+    strerror_r(errno, errbuf, sizeof(errbuf));
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Can't write the trace %s: %s",
+        file, errbuf);
+    SAFE_FREE(t);
+    return -1;
+  }
+  t->root = c_strdup(ctx->remote.uri);
+  if (t->root == NULL) {
+    fclose(t->fp);
+    SAFE_FREE(t);
+    return -1;
+  }
+  fwrite(CSYNC_VIO_TRACE_MAGIC, 1, sizeof(CSYNC_VIO_TRACE_MAGIC) - 1, t->fp);
+  csync_gettime(&t->start);
+
+  t->method = ctx->module.method;
+  t->mctx = ctx->module.mctx;
+
+  t->trace_method.method_table_size = sizeof(csync_vio_method_t);
+  TRACE_METHOD(t, get_capabilities, _trace_get_capabilities);
+  TRACE_METHOD(t, open, _trace_open);
+  TRACE_METHOD(t, creat, _trace_creat);
+  TRACE_METHOD(t, close, _trace_close);
+  TRACE_METHOD(t, read, _trace_read);
+  TRACE_METHOD(t, write, _trace_write_fn);
+  TRACE_METHOD(t, lseek, _trace_lseek);
+  TRACE_METHOD(t, opendir, _trace_opendir);
+  TRACE_METHOD(t, closedir, _trace_closedir);
+  TRACE_METHOD(t, readdir, _trace_readdir);
+  TRACE_METHOD(t, mkdir, _trace_mkdir);
+  TRACE_METHOD(t, rmdir, _trace_rmdir);
+  TRACE_METHOD(t, stat, _trace_stat);
+  TRACE_METHOD(t, rename, _trace_rename);
+  TRACE_METHOD(t, unlink, _trace_unlink);
+  TRACE_METHOD(t, chmod, _trace_chmod);
+  TRACE_METHOD(t, chown, _trace_chown);
+  TRACE_METHOD(t, utimes, _trace_utimes);
+  TRACE_METHOD(t, set_property, _trace_set_property);
+  TRACE_METHOD(t, get_error_string, _trace_get_error_string);
+  TRACE_METHOD(t, commit, _trace_commit);
+  TRACE_METHOD(t, setattr, _trace_setattr);
+  TRACE_METHOD(t, close_stat, _trace_close_stat);
+  TRACE_METHOD(t, sendfile, _trace_sendfile);
+  TRACE_METHOD(t, set_upload_mtime, _trace_set_upload_mtime);
+  TRACE_METHOD(t, submit, _trace_submit);
+  TRACE_METHOD(t, complete, _trace_complete);
+
+  /* the replay has to offer the same capabilities */
+  if (VIO_METHOD_HAS_FUNC(t->method, get_capabilities)) {
+    caps = t->method->get_capabilities(t->mctx);
+    ZERO_STRUCT(rec);
+    rec.op = CSYNC_VIO_TRACE_CAPABILITIES;
+    rec.nargs = 4;
+    rec.args[0] = caps->atomar_copy_support;
+    rec.args[1] = caps->delta_transfer_support;
+    rec.args[2] = caps->recursive_delete_support;
+    rec.args[3] = caps->upload_mtime_support;
+    csync_gettime(&now);
+    _trace_write(t, &rec, &now, NULL, NULL);
+  }
+
+  ctx->module.trace = t;
+  ctx->module.method = &t->trace_method;
+  ctx->module.mctx = (csync_vio_module_ctx_t *) t;
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_INFO, "Tracing the calls of the module to %s",
+      file);
+
+  return 0;
+}
+
+void csync_vio_trace_stop(CSYNC *ctx) {
+  csync_vio_trace_t *t = ctx->module.trace;
+
+  if (t == NULL) {
+    return;
+  }
+
+  /* the queued operations report to the trace */
+  if (VIO_METHOD_HAS_FUNC(t->method, complete)) {
+    t->method->complete(t->mctx, 1);
+  }
+
+  ctx->module.method = t->method;
+  ctx->module.mctx = t->mctx;
+  ctx->module.trace = NULL;
+
+  fclose(t->fp);
+  SAFE_FREE(t->root);
+  SAFE_FREE(t);
+}
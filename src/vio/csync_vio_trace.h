@@ -0,0 +1,110 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ * vim: ft=c.doxygen ts=2 sw=2 et cindent
+ */
+
+#ifndef _CSYNC_VIO_TRACE_H
+#define _CSYNC_VIO_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "vio/csync_vio_method.h"
+
+/*
+ * A trace of the calls to the module of the remote replica. It is written
+ * while csync syncs with the vio_trace option set and served back by the
+ * replay module, to reproduce the timing of a remote offline.
+ *
+ * Only metadata is stored: the paths relative to the remote replica, the
+ * arguments, the results, the stats and the durations. The data read and
+ * written is not, only its size. The scheme, host and credentials of the
+ * uri are stripped.
+ *
+ * The file starts with CSYNC_VIO_TRACE_MAGIC, followed by the records. The
+ * numbers of a record are stored as variable length integers, so most of
+ * them take one or two bytes.
+ */
+
+#define CSYNC_VIO_TRACE_MAGIC "CSYNCVT1"
+
+enum csync_vio_trace_op_e {
+  CSYNC_VIO_TRACE_CAPABILITIES = 1,     /* the capabilities of the module */
+  CSYNC_VIO_TRACE_OPEN,
+  CSYNC_VIO_TRACE_CREAT,
+  CSYNC_VIO_TRACE_CLOSE,
+  CSYNC_VIO_TRACE_READ,
+  CSYNC_VIO_TRACE_WRITE,
+  CSYNC_VIO_TRACE_LSEEK,
+  CSYNC_VIO_TRACE_OPENDIR,
+  CSYNC_VIO_TRACE_CLOSEDIR,
+  CSYNC_VIO_TRACE_READDIR,
+  CSYNC_VIO_TRACE_MKDIR,
+  CSYNC_VIO_TRACE_RMDIR,
+  CSYNC_VIO_TRACE_STAT,
+  CSYNC_VIO_TRACE_RENAME,
+  CSYNC_VIO_TRACE_UNLINK,
+  CSYNC_VIO_TRACE_CHMOD,
+  CSYNC_VIO_TRACE_CHOWN,
+  CSYNC_VIO_TRACE_UTIMES,
+  CSYNC_VIO_TRACE_COMMIT,
+  CSYNC_VIO_TRACE_SETATTR,
+  CSYNC_VIO_TRACE_CLOSE_STAT,
+  CSYNC_VIO_TRACE_SENDFILE,
+  CSYNC_VIO_TRACE_SET_UPLOAD_MTIME,
+  CSYNC_VIO_TRACE_MAX
+};
+
+/* the record is of an operation which was queued with submit */
+#define CSYNC_VIO_TRACE_QUEUED 0x01
+
+#define CSYNC_VIO_TRACE_ARGS 4
+
+typedef struct csync_vio_trace_record_s {
+  enum csync_vio_trace_op_e op;
+  int flags;
+  unsigned long handle;         /* the file or directory, 0 for none */
+  uint64_t start;               /* microseconds since the trace started */
+  uint64_t duration;            /* microseconds the call took */
+  int64_t result;               /* the return value, 0 or -1 for a pointer */
+  int err;                      /* the errno if it failed */
+  int nargs;
+  int64_t args[CSYNC_VIO_TRACE_ARGS]; /* count, flags, mode, offset, ... */
+  char *path;                   /* relative to the remote replica */
+  char *newpath;                /* the target of a rename */
+  csync_vio_file_stat_t *st;    /* of stat, readdir and close_stat */
+} csync_vio_trace_record_t;
+
+/* install the trace around the module of the remote replica */
+int csync_vio_trace_start(CSYNC *ctx, const char *file);
+/* remove it again, before the module is shut down */
+void csync_vio_trace_stop(CSYNC *ctx);
+
+/* checks the magic at the start of the file, 0 if it is a trace */
+int csync_vio_trace_read_header(FILE *fp);
+/* returns 1 for a record, 0 at the end of the trace and -1 on an error */
+int csync_vio_trace_read(FILE *fp, csync_vio_trace_record_t *rec);
+void csync_vio_trace_record_clear(csync_vio_trace_record_t *rec);
+
+/*
+ * The path of an uri without scheme, user, password and host, relative to
+ * the root if it is below it.
+ */
+const char *csync_vio_trace_path(const char *root, const char *uri);
+
+#endif /* _CSYNC_VIO_TRACE_H */
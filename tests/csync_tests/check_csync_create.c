@@ -37,11 +37,42 @@ static void check_csync_create(void **state)
     assert_int_equal(rc, 0);
 }
 
+static void check_progress_callback(const CSYNC_PROGRESS *progress,
+                                    void *userdata)
+{
+    (void) progress;
+    (void) userdata;
+}
+
+static void check_csync_progress_callback(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    (void) state; /* unused */
+
+    rc = csync_set_progress_callback(NULL, check_progress_callback);
+    assert_int_equal(rc, -1);
+
+    rc = csync_create(&csync, "/tmp/csync1", "/tmp/csync2");
+    assert_int_equal(rc, 0);
+
+    assert_null(csync_get_progress_callback(csync));
+
+    rc = csync_set_progress_callback(csync, check_progress_callback);
+    assert_int_equal(rc, 0);
+    assert_true(csync_get_progress_callback(csync) == &check_progress_callback);
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test(check_csync_destroy_null),
         unit_test(check_csync_create),
+        unit_test(check_csync_progress_callback),
     };
 
     return run_tests(tests);
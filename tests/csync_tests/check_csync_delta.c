@@ -0,0 +1,307 @@
+#include "torture.h"
+
+#include "csync_private.h"
+#include "csync_delta.h"
+#include "vio/csync_vio.h"
+
+#define CSYNC_TEST_DIR "/tmp/check_csync_delta/"
+#define CSYNC_TEST_SRC CSYNC_TEST_DIR "source.img"
+#define CSYNC_TEST_DST CSYNC_TEST_DIR "destination.img"
+#define CSYNC_TEST_TMP CSYNC_TEST_DIR "destination.img.ctmp"
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("rm -rf " CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p " CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+
+    /* 2MB of random data as the old version of the file */
+    rc = system("dd if=/dev/urandom of=" CSYNC_TEST_DST " bs=1024 count=2048 2>/dev/null");
+    assert_int_equal(rc, 0);
+    rc = system("cp " CSYNC_TEST_DST " " CSYNC_TEST_SRC);
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/csync1", "/tmp/csync2");
+    assert_int_equal(rc, 0);
+
+    csync->replica = LOCAL_REPLICA;
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    rc = system("rm -rf " CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+/* writes the new version to a temporary file and renames it like csync */
+static int patch(CSYNC *csync, csync_delta_stats_t *stats)
+{
+    csync_vio_handle_t *sfp;
+    csync_vio_handle_t *tfp;
+    csync_vio_file_stat_t *fs;
+    int rc;
+
+    fs = csync_vio_file_stat_new();
+    assert_non_null(fs);
+    rc = csync_vio_stat(csync, CSYNC_TEST_SRC, fs);
+    assert_int_equal(rc, 0);
+
+    sfp = csync_vio_open(csync, CSYNC_TEST_SRC, O_RDONLY, 0);
+    assert_non_null(sfp);
+    tfp = csync_vio_open(csync, CSYNC_TEST_TMP, O_CREAT|O_EXCL|O_WRONLY, 0644);
+    assert_non_null(tfp);
+
+    rc = csync_delta_patch(csync, sfp, LOCAL_REPLICA, CSYNC_TEST_DST, tfp,
+                           LOCAL_REPLICA, fs->size, stats);
+
+    csync_vio_close(csync, tfp);
+    csync_vio_close(csync, sfp);
+    csync_vio_file_stat_destroy(fs);
+
+    if (rc == 0) {
+        assert_int_equal(csync_vio_rename(csync, CSYNC_TEST_TMP, CSYNC_TEST_DST), 0);
+    } else {
+        csync_vio_unlink(csync, CSYNC_TEST_TMP);
+    }
+
+    return rc;
+}
+
+/* patches the destination itself like csync does it on a module */
+static int patch_inplace(CSYNC *csync, csync_delta_stats_t *stats)
+{
+    csync_vio_handle_t *sfp;
+    csync_vio_handle_t *dfp;
+    csync_vio_file_stat_t *fs;
+    int rc;
+
+    fs = csync_vio_file_stat_new();
+    assert_non_null(fs);
+    rc = csync_vio_stat(csync, CSYNC_TEST_SRC, fs);
+    assert_int_equal(rc, 0);
+
+    sfp = csync_vio_open(csync, CSYNC_TEST_SRC, O_RDONLY, 0);
+    assert_non_null(sfp);
+    dfp = csync_vio_open(csync, CSYNC_TEST_DST, O_RDWR, 0);
+    assert_non_null(dfp);
+
+    rc = csync_delta_patch_inplace(csync, sfp, LOCAL_REPLICA, CSYNC_TEST_DST,
+                                   dfp, LOCAL_REPLICA, fs->size, stats);
+
+    csync_vio_close(csync, dfp);
+    csync_vio_close(csync, sfp);
+    csync_vio_file_stat_destroy(fs);
+
+    return rc;
+}
+
+static void check_csync_delta_checksum(void **state)
+{
+    csync_delta_sum_t a, b;
+    unsigned char buf[] = "This is a test";
+
+    (void) state; /* unused */
+
+    csync_delta_checksum(buf, sizeof(buf), &a);
+    csync_delta_checksum(buf, sizeof(buf), &b);
+    assert_true(a.weak == b.weak);
+    assert_memory_equal(a.strong, b.strong, C_SHA1_DIGEST_LEN);
+
+    buf[0] = 't';
+    csync_delta_checksum(buf, sizeof(buf), &b);
+    assert_false(a.weak == b.weak);
+    assert_memory_not_equal(a.strong, b.strong, C_SHA1_DIGEST_LEN);
+}
+
+static void check_csync_delta_block_size(void **state)
+{
+    (void) state; /* unused */
+
+    assert_int_equal(csync_delta_block_size(0), CSYNC_DELTA_MIN_BLOCK_SIZE);
+    assert_int_equal(csync_delta_block_size(2 * 1024 * 1024),
+                     CSYNC_DELTA_MIN_BLOCK_SIZE);
+    assert_int_equal(csync_delta_block_size(64 * 1024 * 1024), 8 * 1024);
+    assert_int_equal(csync_delta_block_size((off_t) 1 << 40),
+                     CSYNC_DELTA_MAX_BLOCK_SIZE);
+}
+
+static void check_csync_delta_patch_appended(void **state)
+{
+    CSYNC *csync = *state;
+    csync_delta_stats_t stats;
+    int rc;
+
+    rc = system("dd if=/dev/urandom bs=1024 count=64 2>/dev/null >> " CSYNC_TEST_SRC);
+    assert_int_equal(rc, 0);
+
+    rc = patch(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(stats.matched, 2048 * 1024);
+    assert_int_equal(stats.literal, 64 * 1024);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_delta_patch_edited(void **state)
+{
+    CSYNC *csync = *state;
+    csync_delta_stats_t stats;
+    int rc;
+
+    /* change a few bytes in the middle of the file */
+    rc = system("printf 'csync' | dd of=" CSYNC_TEST_SRC " bs=1 seek=1048580 conv=notrunc 2>/dev/null");
+    assert_int_equal(rc, 0);
+
+    rc = patch(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(stats.literal, CSYNC_DELTA_MIN_BLOCK_SIZE);
+    assert_int_equal(stats.matched, 2048 * 1024 - CSYNC_DELTA_MIN_BLOCK_SIZE);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_delta_patch_inserted(void **state)
+{
+    CSYNC *csync = *state;
+    csync_delta_stats_t stats;
+    int rc;
+
+    /* the blocks are found at another offset */
+    rc = system("(printf 'csync'; cat " CSYNC_TEST_DST ") > " CSYNC_TEST_SRC);
+    assert_int_equal(rc, 0);
+
+    rc = patch(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(stats.literal, 5);
+    assert_int_equal(stats.matched, 2048 * 1024);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_delta_patch_shrinked(void **state)
+{
+    CSYNC *csync = *state;
+    csync_delta_stats_t stats;
+    int rc;
+
+    rc = system("truncate -s 1500K " CSYNC_TEST_SRC);
+    assert_int_equal(rc, 0);
+
+    rc = patch(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(stats.literal, 0);
+    assert_int_equal(stats.matched, 1500 * 1024);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_delta_patch_small(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("truncate -s 512K " CSYNC_TEST_SRC);
+    assert_int_equal(rc, 0);
+
+    /* a small file is transferred as a whole */
+    rc = patch(csync, NULL);
+    assert_int_equal(rc, 1);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_false(rc == 0);
+}
+
+static void check_csync_delta_inplace_appended(void **state)
+{
+    CSYNC *csync = *state;
+    csync_delta_stats_t stats;
+    int rc;
+
+    rc = system("dd if=/dev/urandom bs=1024 count=64 2>/dev/null >> " CSYNC_TEST_SRC);
+    assert_int_equal(rc, 0);
+
+    rc = patch_inplace(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(stats.matched, 2048 * 1024);
+    assert_int_equal(stats.literal, 64 * 1024);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_delta_inplace_edited(void **state)
+{
+    CSYNC *csync = *state;
+    csync_delta_stats_t stats;
+    int rc;
+
+    /* the bytes span two blocks */
+    rc = system("printf 'csync' | dd of=" CSYNC_TEST_SRC " bs=1 seek=1048574 conv=notrunc 2>/dev/null");
+    assert_int_equal(rc, 0);
+
+    rc = patch_inplace(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(stats.literal, 2 * CSYNC_DELTA_MIN_BLOCK_SIZE);
+    assert_int_equal(stats.matched, 2048 * 1024 - 2 * CSYNC_DELTA_MIN_BLOCK_SIZE);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_delta_inplace_shrinked(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = system("truncate -s 1500K " CSYNC_TEST_SRC);
+    assert_int_equal(rc, 0);
+
+    /* the destination can't be truncated, it is transferred as a whole */
+    rc = patch_inplace(csync, NULL);
+    assert_int_equal(rc, 1);
+
+    rc = system("cmp -s " CSYNC_TEST_SRC " " CSYNC_TEST_DST);
+    assert_false(rc == 0);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test(check_csync_delta_checksum),
+        unit_test(check_csync_delta_block_size),
+        unit_test_setup_teardown(check_csync_delta_patch_appended, setup, teardown),
+        unit_test_setup_teardown(check_csync_delta_patch_edited, setup, teardown),
+        unit_test_setup_teardown(check_csync_delta_patch_inserted, setup, teardown),
+        unit_test_setup_teardown(check_csync_delta_patch_shrinked, setup, teardown),
+        unit_test_setup_teardown(check_csync_delta_patch_small, setup, teardown),
+        unit_test_setup_teardown(check_csync_delta_inplace_appended, setup, teardown),
+        unit_test_setup_teardown(check_csync_delta_inplace_edited, setup, teardown),
+        unit_test_setup_teardown(check_csync_delta_inplace_shrinked, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "torture.h"
+
+#include "c_jhash.h"
+#include "csync_private.h"
+#include "csync_util.h"
+#include "csync_delta.h"
+#include "vio/csync_vio.h"
+
+#define CSYNC_TEST_REMOTE "dummy://propagate/remote"
+
+static void setup_module(void **state) {
+    CSYNC *csync;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+
+    /* the dummy removes a directory with its content */
+    rc = setenv("CSYNC_DUMMY_ARGS", "latency=0,recursive_delete=1", 1);
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/check_csync1", CSYNC_TEST_REMOTE);
+    assert_int_equal(rc, 0);
+    rc = csync_set_config_dir(csync, "/tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+static void teardown(void **state) {
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    unsetenv("CSYNC_DUMMY_ARGS");
+
+    rc = system("rm -rf /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+static int _count_errors(void *obj, void *data) {
+    csync_file_stat_t *st = obj;
+    int *errors = data;
+
+    if (st->instruction == CSYNC_INSTRUCTION_ERROR) {
+        (*errors)++;
+    }
+
+    return 0;
+}
+
+static void _sync(CSYNC *csync) {
+    int errors = 0;
+    int rc;
+
+    rc = csync_update(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_reconcile(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_propagate(csync);
+    assert_int_equal(rc, 0);
+
+    /* every entry has been propagated */
+    rc = c_rbtree_walk(csync->local.tree, &errors, _count_errors);
+    assert_int_equal(rc, 0);
+    rc = c_rbtree_walk(csync->remote.tree, &errors, _count_errors);
+    assert_int_equal(rc, 0);
+    assert_int_equal(errors, 0);
+
+    rc = csync_commit(csync);
+    assert_int_equal(rc, 0);
+}
+
+static int _remote_exists(CSYNC *csync, const char *path) {
+    csync_vio_file_stat_t *fs;
+    char uri[256];
+    int rc;
+
+    snprintf(uri, sizeof(uri), "%s/%s", CSYNC_TEST_REMOTE, path);
+
+    fs = csync_vio_file_stat_new();
+    csync->replica = csync->remote.type;
+    rc = csync_vio_stat(csync, uri, fs);
+    csync_vio_file_stat_destroy(fs);
+
+    return rc == 0;
+}
+
+/*
+ * Every directory of a removed tree is marked, only the topmost one is
+ * removed. The entries below it are gone, whichever directory above them
+ * the walk finds first.
+ */
+static void check_csync_propagate_removed_tree(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    assert_true(csync->module.capabilities.recursive_delete_support);
+
+    rc = system("cd /tmp/check_csync1 && mkdir -p "
+                "tree/a/x/1 tree/a/x/2 tree/a/y/1 tree/b/x/1 tree/b/y/2");
+    assert_int_equal(rc, 0);
+    rc = system("cd /tmp/check_csync1 && for d in tree/a tree/a/x "
+                "tree/a/x/1 tree/a/x/2 tree/a/y tree/a/y/1 tree/b tree/b/x "
+                "tree/b/x/1 tree/b/y tree/b/y/2; do "
+                "echo one > $d/f1; echo two > $d/f2; done");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1/keep && "
+                "echo keep > /tmp/check_csync1/keep/f1");
+    assert_int_equal(rc, 0);
+
+    _sync(csync);
+    assert_true(_remote_exists(csync, "tree/a/x/1/f1"));
+    assert_true(_remote_exists(csync, "tree/b/y/2/f2"));
+
+    rc = system("rm -rf /tmp/check_csync1/tree");
+    assert_int_equal(rc, 0);
+
+    /* an entry left to remove would fail, it is gone already */
+    _sync(csync);
+    assert_false(_remote_exists(csync, "tree"));
+    assert_true(_remote_exists(csync, "keep/f1"));
+}
+
+static csync_file_stat_t *_remote_entry(CSYNC *csync, const char *path) {
+    c_rbnode_t *node;
+    uint64_t h;
+
+    h = c_jhash64((uint8_t *) path, strlen(path), 0);
+    node = c_rbtree_find(csync->remote.tree, &h);
+
+    return node != NULL ? node->data : NULL;
+}
+
+/*
+ * A directory with excluded files in it is not removed at once, the
+ * server would remove the files csync doesn't know of with it.
+ */
+static void check_csync_propagate_removed_tree_excluded(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *fh;
+    csync_file_stat_t *st;
+    int rc;
+
+    rc = system("cd /tmp/check_csync1 && mkdir -p ex/a tree/a && "
+                "echo one > ex/a/f1 && echo one > tree/a/f1");
+    assert_int_equal(rc, 0);
+    _sync(csync);
+
+    /* a file only on the server, which is excluded */
+    csync->replica = csync->remote.type;
+    fh = csync_vio_creat(csync, CSYNC_TEST_REMOTE "/ex/a/skip.tmp", 0644);
+    assert_non_null(fh);
+    rc = csync_vio_close(csync, fh);
+    assert_int_equal(rc, 0);
+
+    rc = system("echo '*.tmp' > /tmp/check_csync/exclude.conf");
+    assert_int_equal(rc, 0);
+    rc = csync_add_exclude_list(csync, "/tmp/check_csync/exclude.conf");
+    assert_int_equal(rc, 0);
+
+    rc = system("rm -rf /tmp/check_csync1/ex /tmp/check_csync1/tree");
+    assert_int_equal(rc, 0);
+
+    rc = csync_update(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_reconcile(csync);
+    assert_int_equal(rc, 0);
+
+    st = _remote_entry(csync, "tree");
+    assert_non_null(st);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_REMOVE);
+    assert_true(st->remove_tree);
+
+    st = _remote_entry(csync, "ex/a");
+    assert_non_null(st);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_REMOVE);
+    assert_false(st->remove_tree);
+    st = _remote_entry(csync, "ex");
+    assert_non_null(st);
+    assert_false(st->remove_tree);
+}
+
+static unsigned long long _remote_written(CSYNC *csync) {
+    struct csync_vio_stats_s stats;
+    int rc;
+
+    rc = csync_get_vio_stats(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    return stats.remote[CSYNC_VIO_STATS_WRITE].bytes +
+           stats.remote[CSYNC_VIO_STATS_SENDFILE].bytes;
+}
+
+/* an appended file is patched in place, the old blocks are not uploaded */
+static void check_csync_propagate_delta_inplace(void **state)
+{
+    CSYNC *csync = *state;
+    char local[C_SHA1_HEX_LEN];
+    char remote[C_SHA1_HEX_LEN];
+    unsigned long long written;
+    int rc;
+
+    assert_true(csync->module.capabilities.delta_transfer_support);
+    csync->options.delta_transfer = true;
+
+    rc = system("dd if=/dev/urandom of=/tmp/check_csync1/log bs=1024 "
+                "count=2048 2>/dev/null");
+    assert_int_equal(rc, 0);
+    _sync(csync);
+
+    rc = system("dd if=/dev/urandom bs=1024 count=64 2>/dev/null "
+                ">> /tmp/check_csync1/log && "
+                "touch -d '2030-01-01' /tmp/check_csync1/log");
+    assert_int_equal(rc, 0);
+
+    written = _remote_written(csync);
+    _sync(csync);
+    written = _remote_written(csync) - written;
+
+    /* the appended data and the last block before it */
+    assert_true(written > 0);
+    assert_true(written <= 64 * 1024 + CSYNC_DELTA_MIN_BLOCK_SIZE);
+
+    csync->replica = csync->local.type;
+    rc = csync_file_checksum(csync, "/tmp/check_csync1/log", local);
+    assert_int_equal(rc, 0);
+    csync->replica = csync->remote.type;
+    rc = csync_file_checksum(csync, CSYNC_TEST_REMOTE "/log", remote);
+    assert_int_equal(rc, 0);
+    assert_string_equal(local, remote);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_propagate_removed_tree, setup_module, teardown),
+        unit_test_setup_teardown(check_csync_propagate_removed_tree_excluded, setup_module, teardown),
+        unit_test_setup_teardown(check_csync_propagate_delta_inplace, setup_module, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -2,6 +2,7 @@
 
 #define CSYNC_TEST 1
 #include "csync_statedb.c"
+#include "csync_propagate.h"
 
 #define TESTDB "/tmp/check_csync1/test.db"
 #define TESTDBTMP "/tmp/check_csync1/test.db.ctmp"
@@ -282,6 +283,98 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     assert_null(tmp);
 }
 
+static void check_csync_statedb_progressinfo(void **state)
+{
+    CSYNC *csync = *state;
+    csync_progressinfo_t pi;
+    csync_progressinfo_t *tmp;
+    int rc;
+
+    pi.phash = 42;
+    pi.tmpfile = (char *) "/tmp/check_csync2/It's a rainy day.~csync.abcdef";
+    pi.size = 4096;
+    pi.modtime = 1234;
+    pi.transferred = 1024;
+    pi.checksum = 0xdeadbeefcafe;
+
+    rc = csync_statedb_write_progressinfo(csync, &pi);
+    assert_int_equal(rc, 0);
+
+    tmp = csync_statedb_get_progressinfo(csync, (uint64_t) 42);
+    assert_non_null(tmp);
+    assert_string_equal(tmp->tmpfile, pi.tmpfile);
+    assert_int_equal(tmp->size, 4096);
+    assert_int_equal(tmp->modtime, 1234);
+    assert_int_equal(tmp->transferred, 1024);
+    assert_true(tmp->checksum == pi.checksum);
+    csync_statedb_free_progressinfo(tmp);
+
+    rc = csync_statedb_delete_progressinfo(csync, (uint64_t) 42);
+    assert_int_equal(rc, 0);
+
+    tmp = csync_statedb_get_progressinfo(csync, (uint64_t) 42);
+    assert_null(tmp);
+}
+
+static void check_csync_statedb_progressinfo_sweep(void **state)
+{
+    CSYNC *csync = *state;
+    csync_progressinfo_t pi;
+    csync_file_stat_t *st;
+    c_list_t *list;
+    c_list_t *walk;
+    int rc;
+
+    rc = system("touch '/tmp/check_csync2/gone.~csync.aaaaaa' "
+                "'/tmp/check_csync2/pending.~csync.bbbbbb'");
+    assert_int_equal(rc, 0);
+
+    pi.size = 4096;
+    pi.modtime = 1234;
+    pi.transferred = 1024;
+    pi.checksum = 42;
+
+    pi.phash = 42;
+    pi.tmpfile = (char *) "/tmp/check_csync2/gone.~csync.aaaaaa";
+    rc = csync_statedb_write_progressinfo(csync, &pi);
+    assert_int_equal(rc, 0);
+
+    pi.phash = 43;
+    pi.tmpfile = (char *) "/tmp/check_csync2/pending.~csync.bbbbbb";
+    rc = csync_statedb_write_progressinfo(csync, &pi);
+    assert_int_equal(rc, 0);
+
+    list = csync_statedb_get_all_progressinfo(csync);
+    assert_int_equal(c_list_length(list), 2);
+    for (walk = list; walk != NULL; walk = c_list_next(walk)) {
+        csync_statedb_free_progressinfo(walk->data);
+    }
+    c_list_free(list);
+
+    /* only the second file is to be transferred in this run */
+    st = c_malloc(sizeof(csync_file_stat_t) + 8);
+    st->phash = 43;
+    st->instruction = CSYNC_INSTRUCTION_NEW;
+    strcpy(st->path, "pending");
+    st->pathlen = strlen(st->path);
+    rc = c_rbtree_insert(csync->local.tree, st);
+    assert_int_equal(rc, 0);
+
+    csync->status = CSYNC_STATUS_DONE;
+    csync_propagate_sweep_tmp_files(csync);
+    csync->status = CSYNC_STATUS_INIT;
+
+    assert_null(csync_statedb_get_progressinfo(csync, (uint64_t) 42));
+    assert_int_equal(access("/tmp/check_csync2/gone.~csync.aaaaaa", F_OK), -1);
+
+    list = csync_statedb_get_all_progressinfo(csync);
+    assert_int_equal(c_list_length(list), 1);
+    assert_true(((csync_progressinfo_t *) list->data)->phash == 43);
+    csync_statedb_free_progressinfo(list->data);
+    c_list_free(list);
+    assert_int_equal(access("/tmp/check_csync2/pending.~csync.bbbbbb", F_OK), 0);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -298,6 +391,8 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_progressinfo, setup, teardown),
+        unit_test_setup_teardown(check_csync_statedb_progressinfo_sweep, setup, teardown),
     };
 
     return run_tests(tests);
@@ -2,6 +2,40 @@
 
 #include "csync_util.h"
 
+#define CSYNC_TEST_DIR "/tmp/check_csync_util/"
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("rm -rf " CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p " CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+
+    rc = csync_create(&csync, "/tmp/csync1", "/tmp/csync2");
+    assert_int_equal(rc, 0);
+
+    csync->replica = LOCAL_REPLICA;
+
+    *state = csync;
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+
+    rc = system("rm -rf " CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
 static void check_csync_instruction_str(void **state)
 {
   const char *str;
@@ -22,11 +56,48 @@ static void check_csync_memstat(void **state)
   csync_memstat_check();
 }
 
+static void check_csync_file_checksum(void **state)
+{
+  CSYNC *csync = *state;
+  char a[C_SHA1_HEX_LEN];
+  char b[C_SHA1_HEX_LEN];
+  int rc;
+
+  rc = system("dd if=/dev/urandom of=" CSYNC_TEST_DIR "a bs=1024 count=100 2>/dev/null");
+  assert_int_equal(rc, 0);
+  rc = system("cp " CSYNC_TEST_DIR "a " CSYNC_TEST_DIR "b");
+  assert_int_equal(rc, 0);
+
+  rc = csync_file_checksum(csync, CSYNC_TEST_DIR "a", a);
+  assert_int_equal(rc, 0);
+  rc = csync_file_checksum(csync, CSYNC_TEST_DIR "b", b);
+  assert_int_equal(rc, 0);
+  assert_string_equal(a, b);
+
+  rc = system("printf 'csync' | dd of=" CSYNC_TEST_DIR "b bs=1 seek=50000 conv=notrunc 2>/dev/null");
+  assert_int_equal(rc, 0);
+
+  rc = csync_file_checksum(csync, CSYNC_TEST_DIR "b", b);
+  assert_int_equal(rc, 0);
+  assert_false(strcmp(a, b) == 0);
+
+  /* the SHA1 a server keeps of the file */
+  rc = system("printf 'abc' > " CSYNC_TEST_DIR "b");
+  assert_int_equal(rc, 0);
+  rc = csync_file_checksum(csync, CSYNC_TEST_DIR "b", b);
+  assert_int_equal(rc, 0);
+  assert_string_equal(b, "a9993e364706816aba3e25717850c26c9cd0d89d");
+
+  rc = csync_file_checksum(csync, CSYNC_TEST_DIR "nonexistent", b);
+  assert_int_equal(rc, -1);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test(check_csync_instruction_str),
         unit_test(check_csync_memstat),
+        unit_test_setup_teardown(check_csync_file_checksum, setup, teardown),
     };
 
     return run_tests(tests);
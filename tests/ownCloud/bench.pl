@@ -0,0 +1,208 @@
+#!/usr/bin/perl
+#
+# bench - a benchmark of the ownCloud module of csync. It runs offline
+# against the davserver.pl in this directory and syncs a synthetic tree
+# in three runs:
+#
+#   upload     the tree only exists locally and is uploaded
+#   noop       nothing changed, only the update detection asks the server
+#   download   the tree is synced into an empty local directory
+#
+# For every run the wall time, the requests per file by method, the
+# connections and the bytes on the wire are reported, as counted by the
+# server. The server can add latency and limit the bandwidth to see how
+# the module behaves on a slow line.
+#
+# Usage: bench.pl [--builddir DIR] [--files N] [--dirs N] [--size BYTES]
+#                 [--latency MS] [--bandwidth KB] [--port PORT] [--quick]
+#
+#   --builddir DIR   the build directory of csync, the client and the
+#                    modules are taken from there. The default is
+#                    $CSYNC_BUILDDIR or ../../build.
+#   --quick          a small tree, to run the benchmark as a test
+#
+# It fails if csync fails or the trees differ after a run.
+#
+
+use strict;
+use warnings;
+
+use FindBin;
+use Getopt::Long;
+use File::Path qw(mkpath);
+use File::Find;
+use File::Temp qw(tempdir);
+use Time::HiRes qw(gettimeofday tv_interval);
+
+my $builddir = $ENV{CSYNC_BUILDDIR} || "../../build";
+my $files = 200;
+my $dirs = 10;
+my $size = 16384;
+my $latency = 0;
+my $bandwidth = 0;
+my $port = 18081;
+my $quick = 0;
+
+GetOptions( "builddir=s"  => \$builddir,
+            "files=i"     => \$files,
+            "dirs=i"      => \$dirs,
+            "size=i"      => \$size,
+            "latency=i"   => \$latency,
+            "bandwidth=i" => \$bandwidth,
+            "port=i"      => \$port,
+            "quick"       => \$quick ) or die "Wrong options\n";
+
+if( $quick ) {
+    $files = 20;
+    $dirs = 4;
+    $size = 4096;
+}
+$dirs = 1 if( $dirs < 1 );
+
+my $ld_libpath = "$builddir/modules";
+my $csync = "$builddir/client/csync";
+die "No csync client in $builddir\n" unless( -x $csync );
+
+my $work = tempdir( "ocbenchXXXXXX", TMPDIR => 1, CLEANUP => 1 );
+my $davroot = "$work/davroot";
+my $stats = "$work/stats";
+my $log = "$work/csync.log";
+
+sub createFile( $$ )
+{
+    my ($file, $size) = @_;
+
+    open( my $fh, ">", $file ) or die "Can not create $file\n";
+    binmode( $fh );
+    while( $size > 0 ) {
+        my $len = $size > 65536 ? 65536 : $size;
+        print $fh pack( "N*", map { int( rand( 4294967295 )) } 1 .. ($len / 4) );
+        print $fh "x" x ($len % 4);
+        $size -= $len;
+    }
+    close( $fh );
+}
+
+# the files below a directory with their sizes, without the hidden ones
+sub listTree( $ )
+{
+    my ($dir) = @_;
+    my %tree;
+
+    find( sub {
+              return unless( -f $_ );
+              return if( /^\./ );   # the journal of csync
+              my $name = substr( $File::Find::name, length( $dir ) + 1 );
+              $tree{$name} = -s $_;
+          }, $dir );
+
+    return \%tree;
+}
+
+sub compareTrees( $$$ )
+{
+    my ($run, $dirA, $dirB) = @_;
+    my $ta = listTree( $dirA );
+    my $tb = listTree( $dirB );
+
+    die "$run: $dirA has " . scalar( keys %$ta ) . " files, $dirB has " . scalar( keys %$tb ) . "\n"
+        unless( keys %$ta == keys %$tb );
+    foreach my $f ( keys %$ta ) {
+        die "$run: $f differs\n" unless( defined $tb->{$f} && $tb->{$f} == $ta->{$f} );
+    }
+}
+
+# syncs and returns the wall time and the statistics of the server
+sub csync( $$ )
+{
+    my ($local, $remote) = @_;
+
+    unlink( $stats );
+    my $url = "owncloud://127.0.0.1:$port/$remote";
+    my $cmd = "HOME=$work LD_LIBRARY_PATH=$ld_libpath $csync $local $url >> $log 2>&1";
+
+    my $start = [gettimeofday];
+    system( $cmd ) == 0 or die "csync failed, see $log\n";
+    my $elapsed = tv_interval( $start );
+
+    my %result = ( time => $elapsed, requests => 0, connections => 0,
+                   in => 0, out => 0, methods => {} );
+    if( open( my $fh, "<", $stats )) {
+        while( my $line = <$fh> ) {
+            chomp( $line );
+            if( $line eq "connect" ) {
+                $result{connections}++;
+                next;
+            }
+            my ($method, $code, $in, $out) = split( / /, $line );
+            $result{requests}++;
+            $result{methods}{$method}++;
+            $result{in} += $in;
+            $result{out} += $out;
+        }
+        close( $fh );
+    }
+
+    return \%result;
+}
+
+sub report( $$ )
+{
+    my ($run, $r) = @_;
+
+    printf( "%-9s %8.2f s %6d requests %6.2f per file %4d connections %10d bytes up %10d bytes down\n",
+            $run, $r->{time}, $r->{requests}, $r->{requests} / $files,
+            $r->{connections}, $r->{in}, $r->{out} );
+    printf( "          %s\n", join( "  ", map { sprintf( "%s %.2f", $_, $r->{methods}{$_} / $files ) }
+                                         sort keys %{$r->{methods}} ));
+}
+
+# ====================================================================
+
+mkpath( [ "$davroot/bench", "$work/upload", "$work/download" ] );
+
+for( my $i = 0; $i < $dirs; $i++ ) {
+    mkpath( "$work/upload/dir$i" );
+}
+for( my $i = 0; $i < $files; $i++ ) {
+    createFile( sprintf( "%s/upload/dir%d/file%d.dat", $work, $i % $dirs, $i ), $size );
+}
+
+print "Syncing $files files of $size bytes in $dirs directories, "
+    . "latency $latency ms, bandwidth " . ($bandwidth ? "$bandwidth KB/s" : "unlimited") . "\n";
+
+my $pid = fork();
+die "Can not fork\n" unless( defined $pid );
+if( $pid == 0 ) {
+    open( STDOUT, ">", "$work/davserver.log" );
+    exec( "perl", "$FindBin::Bin/davserver.pl", "--port", $port, "--root", $davroot,
+          "--latency", $latency, "--bandwidth", $bandwidth, "--stats", $stats );
+    die "Can not start davserver.pl\n";
+}
+sleep( 1 );
+
+my $failed = 0;
+eval {
+    report( "upload", csync( "$work/upload", "bench" ));
+    compareTrees( "upload", "$work/upload", "$davroot/bench" );
+
+    my $noop = csync( "$work/upload", "bench" );
+    report( "noop", $noop );
+    die "noop: files were transferred\n" if( $noop->{methods}{PUT} || $noop->{methods}{GET} );
+
+    report( "download", csync( "$work/download", "bench" ));
+    compareTrees( "download", "$work/upload", "$work/download" );
+};
+if( $@ ) {
+    print STDERR $@;
+    if( open( my $fh, "<", $log )) {
+        print STDERR <$fh>;
+        close( $fh );
+    }
+    $failed = 1;
+}
+
+kill( "TERM", $pid );
+waitpid( $pid, 0 );
+
+exit( $failed );
@@ -0,0 +1,488 @@
+#!/usr/bin/perl
+#
+# davserver - a small WebDAV server to test the ownCloud module of csync
+# offline. It serves a local directory and implements what the module uses:
+# PROPFIND, GET with ranges, PUT, MKCOL, DELETE, MOVE and PROPPATCH of the
+# lastmodified property, and the chunked upload of ownCloud with the mtime
+# sent in the X-OC-Mtime header.
+#
+# Every connection is handled by its own process, so the sessions of the
+# module can work in parallel. Only core perl modules are used.
+#
+# Usage: davserver.pl [--port 8888] [--root ./davroot] [--fail-chunks N]
+#                     [--latency MS] [--bandwidth KB] [--stats FILE]
+#
+#   --fail-chunks N   answer every Nth chunk with 503 once, to test retries
+#   --latency MS      delay every answer by MS milliseconds, like the round
+#                     trip to a distant server
+#   --bandwidth KB    limit every connection to KB kilobytes per second in
+#                     each direction. The limit is per connection, parallel
+#                     connections get more in total, like on a real line.
+#   --stats FILE      append a line per request to FILE with the method, the
+#                     status and the bytes received and sent including the
+#                     headers, and a line "connect" per connection
+#
+
+use strict;
+use warnings;
+
+use IO::Socket::INET;
+use Getopt::Long;
+use File::Path qw(mkpath rmtree);
+use File::Basename;
+use POSIX qw(strftime :sys_wait_h);
+use Fcntl qw(:flock SEEK_SET);
+
+my $port = 8888;
+my $root = "./davroot";
+my $failChunks = 0;
+my $latency = 0;
+my $bandwidth = 0;
+my $statsFile;
+
+GetOptions( "port=i"        => \$port,
+            "root=s"        => \$root,
+            "fail-chunks=i" => \$failChunks,
+            "latency=i"     => \$latency,
+            "bandwidth=i"   => \$bandwidth,
+            "stats=s"       => \$statsFile ) or die "Wrong options\n";
+
+mkpath( $root ) unless( -d $root );
+$root =~ s#/+$##;
+
+# the chunks of uploads are collected here until the file is complete
+my $chunkDir = "$root/.chunks";
+mkpath( $chunkDir ) unless( -d $chunkDir );
+
+my $server = IO::Socket::INET->new( LocalAddr => "127.0.0.1",
+                                    LocalPort => $port,
+                                    Proto     => "tcp",
+                                    Listen    => 16,
+                                    ReuseAddr => 1 ) or die "Can not listen on $port: $!\n";
+
+sub handleConnection( $ );
+sub setMtime( $$ );
+sub throttle( $ );
+sub logStats( $ );
+
+$SIG{CHLD} = sub { while( waitpid( -1, WNOHANG ) > 0 ) {} };
+
+print "davserver listening on http://127.0.0.1:$port/ serving $root\n";
+
+while( 1 ) {
+    my $client = $server->accept();
+    next unless( $client );
+
+    my $pid = fork();
+    if( defined $pid && $pid == 0 ) {
+        $server->close();
+        handleConnection( $client );
+        exit( 0 );
+    }
+    $client->close();
+}
+
+# ====================================================================
+
+sub handleConnection( $ )
+{
+    my ($c) = @_;
+
+    binmode( $c );
+    logStats( "connect" );
+    while( my $req = readRequest( $c ) ) {
+        my $res = dispatch( $req );
+        select( undef, undef, undef, $latency / 1000 ) if( $latency > 0 );
+        my $sent = writeResponse( $c, $req, $res );
+        logStats( "$req->{method} $res->[0] $req->{bytes} $sent" );
+        last if( lc( $req->{headers}{connection} || "" ) eq "close" );
+    }
+    $c->close();
+}
+
+sub readRequest( $ )
+{
+    my ($c) = @_;
+    my %req;
+
+    my $line = <$c>;
+    return undef unless( defined $line );
+    $req{bytes} = length( $line );
+    $line =~ s/\r?\n$//;
+    ($req{method}, $req{uri}) = split( / /, $line );
+    return undef unless( $req{uri} );
+
+    while( my $h = <$c> ) {
+        $req{bytes} += length( $h );
+        $h =~ s/\r?\n$//;
+        last if( $h eq "" );
+        my ($k, $v) = split( /:\s*/, $h, 2 );
+        $req{headers}{lc $k} = $v;
+    }
+
+    $req{body} = "";
+    if( lc( $req{headers}{"transfer-encoding"} || "" ) eq "chunked" ) {
+        while( my $size = <$c> ) {
+            $req{bytes} += length( $size ) + 2;
+            $size = hex( $size );
+            last if( $size == 0 );
+            read( $c, my $data, $size );
+            throttle( length( $data ));
+            $req{body} .= $data;
+            <$c>;
+        }
+        while( my $t = <$c> ) {
+            $req{bytes} += length( $t );
+            last if( $t =~ /^\r?\n$/ );
+        }
+    } elsif( my $len = $req{headers}{"content-length"} ) {
+        my $got = 0;
+        while( $got < $len ) {
+            my $want = $len - $got;
+            $want = 65536 if( $want > 65536 );
+            my $n = read( $c, $req{body}, $want, $got );
+            last unless( $n );
+            throttle( $n );
+            $got += $n;
+        }
+    }
+    $req{bytes} += length( $req{body} );
+
+    $req{path} = cleanPath( $req{uri} );
+
+    return \%req;
+}
+
+# the path in the served directory of an uri
+sub cleanPath( $ )
+{
+    my ($path) = @_;
+
+    $path =~ s#^[a-z]+://[^/]+##i;   # absolute request uri
+    $path =~ s/\?.*$//;
+    $path =~ s/%([0-9A-Fa-f]{2})/chr(hex($1))/eg;
+    return "/" . join( "/", grep { $_ ne "" && $_ ne "." && $_ ne ".." } split( m#/#, $path ));
+}
+
+sub writeResponse( $$$ )
+{
+    my ($c, $req, $res) = @_;
+    my ($code, $headers, $body) = @$res;
+    my %text = ( 200 => "OK", 201 => "Created", 204 => "No Content",
+                 206 => "Partial Content", 207 => "Multi-Status",
+                 400 => "Bad Request", 403 => "Forbidden", 404 => "Not Found", 405 => "Method Not Allowed",
+                 409 => "Conflict", 412 => "Precondition Failed",
+                 416 => "Requested Range Not Satisfiable",
+                 500 => "Internal Server Error", 503 => "Service Unavailable" );
+
+    $body = "" unless( defined $body );
+    my $out = "HTTP/1.1 $code " . ($text{$code} || "Unknown") . "\r\n";
+    $headers->{"Content-Length"} = length( $body ) unless( exists $headers->{"Content-Length"} );
+    $headers->{"Date"} = httpDate( time );
+    $headers->{"Server"} = "davserver";
+    foreach my $k ( keys %$headers ) {
+        $out .= "$k: $headers->{$k}\r\n";
+    }
+    $out .= "\r\n";
+    $out .= $body unless( $req->{method} eq "HEAD" );
+
+    # in blocks, so that the throttled data trickles to the client
+    for( my $pos = 0; $pos < length( $out ); $pos += 65536 ) {
+        my $block = substr( $out, $pos, 65536 );
+        print $c $block;
+        throttle( length( $block ));
+    }
+
+    return length( $out );
+}
+
+# sleep as long as the transfer of the bytes takes with the bandwidth limit
+sub throttle( $ )
+{
+    my ($bytes) = @_;
+
+    return unless( $bandwidth > 0 );
+    select( undef, undef, undef, $bytes / ($bandwidth * 1024) );
+}
+
+# the processes of all connections append to the same file, so it is locked
+sub logStats( $ )
+{
+    my ($line) = @_;
+
+    return unless( $statsFile );
+    open( my $fh, ">>", $statsFile ) or return;
+    flock( $fh, LOCK_EX );
+    print $fh "$line\n";
+    close( $fh );
+}
+
+sub httpDate( $ )
+{
+    return strftime( "%a, %d %b %Y %H:%M:%S GMT", gmtime( $_[0] ));
+}
+
+sub dispatch( $ )
+{
+    my ($req) = @_;
+    my $m = $req->{method};
+
+    return doOptions( $req )   if( $m eq "OPTIONS" );
+    return doPropfind( $req )  if( $m eq "PROPFIND" );
+    return doGet( $req )       if( $m eq "GET" || $m eq "HEAD" );
+    return doPut( $req )       if( $m eq "PUT" );
+    return doMkcol( $req )     if( $m eq "MKCOL" );
+    return doDelete( $req )    if( $m eq "DELETE" );
+    return doMove( $req )      if( $m eq "MOVE" );
+    return doProppatch( $req ) if( $m eq "PROPPATCH" );
+
+    return [ 405, {}, "" ];
+}
+
+sub doOptions( $ )
+{
+    return [ 200, { "DAV" => "1,2",
+                    "Allow" => "OPTIONS, PROPFIND, GET, HEAD, PUT, MKCOL, DELETE, MOVE, PROPPATCH" }, "" ];
+}
+
+sub propResponse( $$ )
+{
+    my ($href, $file) = @_;
+    my @st = stat( $file );
+    my $props = "<d:getlastmodified>" . httpDate( $st[9] ) . "</d:getlastmodified>";
+
+    if( -d $file ) {
+        $href .= "/" unless( $href =~ m#/$# );
+        $props .= "<d:resourcetype><d:collection/></d:resourcetype>";
+    } else {
+        $props .= "<d:resourcetype/><d:getcontentlength>$st[7]</d:getcontentlength>";
+        $props .= "<d:getetag>\"$st[9]-$st[7]\"</d:getetag>";
+    }
+    $href =~ s/([^A-Za-z0-9\/._~-])/sprintf("%%%02X", ord($1))/eg;
+
+    return "<d:response><d:href>$href</d:href><d:propstat><d:prop>$props</d:prop>"
+         . "<d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>\n";
+}
+
+sub doPropfind( $ )
+{
+    my ($req) = @_;
+    my $file = $root . $req->{path};
+    my $depth = $req->{headers}{depth};
+    $depth = 1 unless( defined $depth );
+
+    return [ 404, {}, "" ] unless( -e $file );
+
+    my $body = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<d:multistatus xmlns:d=\"DAV:\">\n";
+    $body .= propResponse( $req->{path}, $file );
+    if( -d $file && $depth ne "0" ) {
+        opendir( my $dh, $file ) or return [ 403, {}, "" ];
+        foreach my $e ( sort readdir( $dh )) {
+            next if( $e eq "." || $e eq ".." || $e eq ".chunks" );
+            my $href = $req->{path};
+            $href .= "/" unless( $href =~ m#/$# );
+            $body .= propResponse( $href . $e, "$file/$e" );
+        }
+        closedir( $dh );
+    }
+    $body .= "</d:multistatus>\n";
+
+    return [ 207, { "Content-Type" => "application/xml; charset=utf-8" }, $body ];
+}
+
+sub doGet( $ )
+{
+    my ($req) = @_;
+    my $file = $root . $req->{path};
+
+    return [ 404, {}, "" ] unless( -e $file );
+    return [ 403, {}, "" ] if( -d $file );
+
+    open( my $fh, "<", $file ) or return [ 403, {}, "" ];
+    binmode( $fh );
+    local $/;
+    my $data = <$fh>;
+    $data = "" unless( defined $data );
+    close( $fh );
+
+    my @st = stat( $file );
+    my %headers = ( "Last-Modified" => httpDate( $st[9] ),
+                    "ETag" => "\"$st[9]-$st[7]\"" );
+
+    if( ( $req->{headers}{range} || "" ) =~ /^bytes=(\d+)-$/ ) {
+        my $offset = $1;
+        return [ 416, {}, "" ] if( $offset > length( $data ));
+        $headers{"Content-Range"} = "bytes $offset-" . (length( $data ) - 1) . "/" . length( $data );
+        return [ 206, \%headers, substr( $data, $offset ) ];
+    }
+
+    return [ 200, \%headers, $data ];
+}
+
+sub writeFile( $$ )
+{
+    my ($file, $data) = @_;
+
+    open( my $fh, ">", "$file.~dav" ) or return 0;
+    binmode( $fh );
+    print $fh $data;
+    close( $fh );
+
+    return rename( "$file.~dav", $file );
+}
+
+sub doPut( $ )
+{
+    my ($req) = @_;
+    my $file = $root . $req->{path};
+
+    return [ 409, {}, "" ] unless( -d dirname( $file ));
+    return [ 405, {}, "" ] if( -d $file );
+
+    if( $req->{path} =~ /^(.+)-chunking-(\d+)-(\d+)-(\d+)$/ ) {
+        return doPutChunk( $req, $1, $2, $3, $4 );
+    }
+
+    my $existed = -e $file;
+    writeFile( $file, $req->{body} ) or return [ 500, {}, "" ];
+
+    return [ $existed ? 204 : 201, setMtime( $req, $file ), "" ];
+}
+
+#
+# The client may send the mtime with the PUT in the X-OC-Mtime header. It
+# is set on the file and confirmed with "X-OC-MTime: accepted".
+#
+sub setMtime( $$ )
+{
+    my ($req, $file) = @_;
+    my $mtime = $req->{headers}{"x-oc-mtime"};
+
+    return {} unless( defined $mtime && $mtime =~ /^\d+$/ );
+    utime( $mtime, $mtime, $file ) or return {};
+
+    return { "X-OC-MTime" => "accepted" };
+}
+
+#
+# A chunk of an upload. The chunks are stored until all are there, then
+# the file is assembled. The chunks may arrive in any order and at the
+# same time on different connections, so the check is done under a lock.
+#
+sub doPutChunk( $$$$$ )
+{
+    my ($req, $path, $transferId, $count, $index) = @_;
+    my $file = $root . $path;
+    my $prefix = "$chunkDir/$transferId";
+    my $headers = {};
+
+    return [ 409, {}, "" ] unless( -d dirname( $file ));
+    return [ 412, {}, "" ] unless( $index < $count );
+
+    if( $failChunks > 0 && ! -e "$prefix-failed-$index" && ($index + 1) % $failChunks == 0 ) {
+        open( my $fh, ">", "$prefix-failed-$index" );
+        close( $fh ) if( $fh );
+        return [ 503, {}, "" ];
+    }
+
+    writeFile( "$prefix-$index", $req->{body} ) or return [ 500, {}, "" ];
+
+    open( my $lock, ">", "$prefix.lock" ) or return [ 500, {}, "" ];
+    flock( $lock, LOCK_EX );
+
+    my $complete = 1;
+    for( my $i = 0; $i < $count; $i++ ) {
+        $complete = 0 unless( -e "$prefix-$i" );
+    }
+    if( $complete ) {
+        my $data = "";
+        for( my $i = 0; $i < $count; $i++ ) {
+            open( my $fh, "<", "$prefix-$i" ) or return [ 500, {}, "" ];
+            binmode( $fh );
+            local $/;
+            my $chunk = <$fh>;
+            $data .= $chunk if( defined $chunk );
+            close( $fh );
+        }
+        writeFile( $file, $data ) or return [ 500, {}, "" ];
+        $headers = setMtime( $req, $file );
+        unlink( glob( "$prefix-*" ));
+        unlink( "$prefix.lock" );
+        print "Assembled $path from $count chunks\n";
+    }
+    close( $lock );
+
+    return [ 201, $headers, "" ];
+}
+
+sub doMkcol( $ )
+{
+    my ($req) = @_;
+    my $file = $root . $req->{path};
+
+    return [ 405, {}, "" ] if( -e $file );
+    return [ 409, {}, "" ] unless( -d dirname( $file ));
+    mkdir( $file ) or return [ 403, {}, "" ];
+
+    return [ 201, {}, "" ];
+}
+
+sub doDelete( $ )
+{
+    my ($req) = @_;
+    my $file = $root . $req->{path};
+
+    return [ 404, {}, "" ] unless( -e $file );
+    return [ 403, {}, "" ] if( $req->{path} eq "/" );
+    if( -d $file ) {
+        rmtree( $file );
+    } else {
+        unlink( $file ) or return [ 403, {}, "" ];
+    }
+
+    return [ 204, {}, "" ];
+}
+
+sub doMove( $ )
+{
+    my ($req) = @_;
+    my $file = $root . $req->{path};
+    my $dest = $req->{headers}{destination};
+
+    return [ 404, {}, "" ] unless( -e $file );
+    return [ 400, {}, "" ] unless( $dest );
+
+    my $target = $root . cleanPath( $dest );
+    return [ 409, {}, "" ] unless( -d dirname( $target ));
+
+    my $existed = -e $target;
+    if( $existed && ( $req->{headers}{overwrite} || "T" ) eq "F" ) {
+        return [ 412, {}, "" ];
+    }
+    rmtree( $target ) if( $existed && -d $target );
+    rename( $file, $target ) or return [ 403, {}, "" ];
+
+    return [ $existed ? 204 : 201, {}, "" ];
+}
+
+#
+# Only the modification time is stored, it is set through the lastmodified
+# property by the module.
+#
+sub doProppatch( $ )
+{
+    my ($req) = @_;
+    my $file = $root . $req->{path};
+
+    return [ 404, {}, "" ] unless( -e $file );
+
+    if( $req->{body} =~ /lastmodified[^>]*>\s*(\d+)\s*</ ) {
+        utime( $1, $1, $file );
+    }
+
+    my $body = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<d:multistatus xmlns:d=\"DAV:\">"
+             . "<d:response><d:href>$req->{path}</d:href><d:propstat><d:prop/>"
+             . "<d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response></d:multistatus>\n";
+
+    return [ 207, { "Content-Type" => "application/xml; charset=utf-8" }, $body ];
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/perl
+#
+# t2 - a test of the chunked upload of the ownCloud module of csync.
+# It runs offline against the davserver.pl in this directory, which
+# implements the chunk protocol of ownCloud.
+#
+# Large files are uploaded in chunks of 10 MB. The server refuses every
+# second chunk once, so the upload only succeeds if the chunks are retried.
+# The mtime of the files is sent with the upload.
+#
+# Set CSYNC_BUILDDIR to the build directory of csync, the client and the
+# modules are taken from there.
+#
+
+use Carp::Assert;
+use Digest::MD5;
+use File::Path qw(mkpath rmtree);
+
+use strict;
+
+my $builddir = $ENV{CSYNC_BUILDDIR} || "../../build";
+my $ld_libpath = "$builddir/modules";
+my $csync = "$builddir/client/csync";
+my $port = 18080;
+my $davroot = "./t2_davroot";
+my $localDir = "./t2";
+
+print "Hello, this is t2, a tester for the chunked upload of csync.\n";
+
+sub md5File( $ )
+{
+    my ($file) = @_;
+
+    open( my $fh, "<", $file ) or return "";
+    binmode( $fh );
+    my $md5 = Digest::MD5->new->addfile( $fh )->hexdigest;
+    close( $fh );
+
+    return $md5;
+}
+
+sub createFile( $$ )
+{
+    my ($file, $size) = @_;
+
+    open( my $fh, ">", $file ) or die "Can not create $file\n";
+    binmode( $fh );
+    while( $size > 0 ) {
+        my $len = $size > 65536 ? 65536 : $size;
+        print $fh pack( "N*", map { int( rand( 4294967295 )) } 1 .. ($len / 4) );
+        print $fh "x" x ($len % 4);
+        $size -= $len;
+    }
+    close( $fh );
+}
+
+sub csync( $$ )
+{
+    my ($local, $remote) = @_;
+
+    my $url = "owncloud://127.0.0.1:$port/$remote";
+    my $cmd = "LD_LIBRARY_PATH=$ld_libpath $csync $local $url";
+    print "Starting: $cmd\n";
+
+    system( $cmd );
+}
+
+# ====================================================================
+
+rmtree( [ $davroot, $localDir ] );
+mkpath( [ "$davroot/t2", $localDir ] );
+
+my $pid = fork();
+if( $pid == 0 ) {
+    exec( "perl", "./davserver.pl", "--port", $port, "--root", $davroot,
+          "--fail-chunks", 2 );
+    die "Can not start davserver.pl\n";
+}
+sleep( 1 );
+
+# one file below the chunk size, two above, one not a multiple of it
+createFile( "$localDir/small.dat", 4096 );
+createFile( "$localDir/twochunks.dat", 20 * 1024 * 1024 );
+createFile( "$localDir/large.dat", 25 * 1024 * 1024 + 123 );
+
+csync( $localDir, "t2" );
+
+foreach my $f ( "small.dat", "twochunks.dat", "large.dat" ) {
+    print "Checking $f\n";
+    assert( -e "$davroot/t2/$f", "$f is not on the server" );
+    assert( -s "$localDir/$f" == -s "$davroot/t2/$f", "$f has a wrong size" );
+    assert( md5File( "$localDir/$f" ) eq md5File( "$davroot/t2/$f" ), "$f differs" );
+    # the mtime is sent with the upload
+    assert( (stat( "$localDir/$f" ))[9] == (stat( "$davroot/t2/$f" ))[9], "$f has a wrong mtime" );
+}
+
+# no chunks are left over on the server
+opendir( my $dh, "$davroot/.chunks" ) || die;
+my @left = grep { !/^\.+$/ } readdir( $dh );
+closedir( $dh );
+assert( @left == 0, "Chunks are left on the server: @left" );
+
+kill( "TERM", $pid );
+waitpid( $pid, 0 );
+
+rmtree( [ $davroot, $localDir ] );
+
+print "t2 passed.\n";
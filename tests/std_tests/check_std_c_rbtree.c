@@ -264,6 +264,38 @@ static void check_c_rbtree_delete(void **state)
     assert_int_equal(rc, 0);
 }
 
+static void check_c_rbtree_delete_inner(void **state)
+{
+    c_rbtree_t *tree = *state;
+    c_rbnode_t *node = NULL;
+    c_rbnode_t *keep = NULL;
+    test_t *freedata = NULL;
+    int rc, i = 99;
+
+    keep = c_rbtree_find(tree, (void *) &i);
+    assert_non_null(keep);
+
+    /* deleting the root moves its successor up, which must stay valid */
+    for (i = 0; i < 99; i++) {
+        node = tree->root;
+        if (node == keep) {
+            node = c_rbtree_head(tree);
+        }
+
+        freedata = (test_t *) c_rbtree_node_data(node);
+        rc = c_rbtree_node_delete(node);
+        assert_int_equal(rc, 0);
+        SAFE_FREE(freedata);
+
+        rc = c_rbtree_check_sanity(tree);
+        assert_int_equal(rc, 0);
+    }
+
+    assert_int_equal(c_rbtree_size(tree), 1);
+    assert_true(c_rbtree_head(tree) == keep);
+    assert_int_equal(((test_t *) c_rbtree_node_data(keep))->key, 99);
+}
+
 static void check_c_rbtree_walk(void **state)
 {
     c_rbtree_t *tree = *state;
@@ -357,6 +389,7 @@ int torture_run_tests(void)
       unit_test_setup_teardown(check_c_rbtree_insert_duplicate, setup, teardown),
       unit_test_setup_teardown(check_c_rbtree_find, setup_complete_tree, teardown),
       unit_test_setup_teardown(check_c_rbtree_delete, setup_complete_tree, teardown),
+      unit_test_setup_teardown(check_c_rbtree_delete_inner, setup_complete_tree, teardown),
       unit_test_setup_teardown(check_c_rbtree_walk, setup_complete_tree, teardown),
       unit_test_setup_teardown(check_c_rbtree_walk_null, setup_complete_tree, teardown),
       unit_test_setup_teardown(check_c_rbtree_dup, setup_complete_tree, teardown),
@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "torture.h"
+
+#include "std/c_sha1.h"
+
+static void sha1(const char *data, size_t len, char hex[C_SHA1_HEX_LEN])
+{
+    c_sha1_t s;
+
+    c_sha1_init(&s);
+    c_sha1_update(&s, data, len);
+    c_sha1_final(&s, hex);
+}
+
+/* the test vectors of FIPS 180 */
+static void check_c_sha1_vectors(void **state)
+{
+    char hex[C_SHA1_HEX_LEN];
+
+    (void) state; /* unused */
+
+    sha1("", 0, hex);
+    assert_string_equal(hex, "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+
+    sha1("abc", 3, hex);
+    assert_string_equal(hex, "a9993e364706816aba3e25717850c26c9cd0d89d");
+
+    sha1("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56, hex);
+    assert_string_equal(hex, "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+}
+
+/* the digest doesn't depend on how the data is split */
+static void check_c_sha1_split(void **state)
+{
+    char data[1000];
+    char hex[C_SHA1_HEX_LEN];
+    char split[C_SHA1_HEX_LEN];
+    c_sha1_t s;
+    size_t i;
+
+    (void) state; /* unused */
+
+    memset(data, 'a', sizeof(data));
+    sha1(data, sizeof(data), hex);
+    assert_string_equal(hex, "291e9a6c66994949b57ba5e650361e98fc36b1ba");
+
+    c_sha1_init(&s);
+    for (i = 0; i < sizeof(data); i += 7) {
+        c_sha1_update(&s, data + i, i + 7 < sizeof(data) ? 7 : sizeof(data) - i);
+    }
+    c_sha1_final(&s, split);
+    assert_string_equal(split, hex);
+}
+
+static void check_c_sha1_digest(void **state)
+{
+    uint8_t digest[C_SHA1_DIGEST_LEN];
+    c_sha1_t s;
+
+    (void) state; /* unused */
+
+    c_sha1_init(&s);
+    c_sha1_update(&s, "abc", 3);
+    c_sha1_digest(&s, digest);
+    assert_int_equal(digest[0], 0xa9);
+    assert_int_equal(digest[1], 0x99);
+    assert_int_equal(digest[C_SHA1_DIGEST_LEN - 1], 0x9d);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test(check_c_sha1_vectors),
+        unit_test(check_c_sha1_split),
+        unit_test(check_c_sha1_digest),
+    };
+
+    return run_tests(tests);
+}
@@ -8,6 +8,7 @@
 #include "torture.h"
 
 #include "csync_private.h"
+#include "csync_time.h"
 #include "vio/csync_vio.h"
 
 #define CSYNC_TEST_DIR "/tmp/csync/"
@@ -96,6 +97,36 @@ static void check_csync_vio_load_bad_plugin(void **state)
     csync_vio_shutdown(csync);
 }
 
+static void check_csync_vio_load_two_instances(void **state)
+{
+    CSYNC *csync = *state;
+    CSYNC *csync2;
+    int rc;
+
+    rc = csync_create(&csync2, "/tmp/csync3", "/tmp/csync4");
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_init(csync, "dummy", NULL);
+    assert_int_equal(rc, 0);
+    rc = csync_vio_init(csync2, "dummy", NULL);
+    assert_int_equal(rc, 0);
+
+    /* every context has its own instance of the module */
+    assert_non_null(csync->module.mctx);
+    assert_non_null(csync2->module.mctx);
+    assert_true(csync->module.mctx != csync2->module.mctx);
+
+    csync_vio_shutdown(csync);
+    assert_null(csync->module.mctx);
+
+    /* the other instance is still usable */
+    assert_non_null(csync2->module.method);
+    csync_vio_shutdown(csync2);
+
+    rc = csync_destroy(csync2);
+    assert_int_equal(rc, 0);
+}
+
 /*
  * Test directory function
  */
@@ -155,6 +186,54 @@ static void check_csync_vio_mkdirs_some_exist(void **state)
     c_free_locale_string(stat_dir);
 }
 
+static void check_csync_vio_mkdirs_dircache(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_vio_mkdirs(csync, CSYNC_TEST_DIRS, 0755);
+    assert_int_equal(rc, 0);
+
+    assert_true(csync_vio_dircache_contains(csync, CSYNC_TEST_DIRS));
+    assert_true(csync_vio_dircache_contains(csync, "/tmp/csync/this/"));
+    assert_false(csync_vio_dircache_contains(csync, "/tmp/csync/that"));
+
+    rc = csync_vio_rmdir(csync, CSYNC_TEST_DIRS);
+    assert_int_equal(rc, 0);
+    assert_false(csync_vio_dircache_contains(csync, CSYNC_TEST_DIRS));
+
+    /* known directories are not checked again */
+    rc = csync_vio_mkdirs(csync, CSYNC_TEST_DIRS, 0755);
+    assert_int_equal(rc, 0);
+
+    csync_vio_dircache_clear(csync);
+    assert_false(csync_vio_dircache_contains(csync, CSYNC_TEST_DIRS));
+}
+
+static void check_csync_vio_dircache_rename(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    rc = csync_vio_mkdirs(csync, CSYNC_TEST_DIRS, 0755);
+    assert_int_equal(rc, 0);
+    rc = csync_vio_mkdirs(csync, "/tmp/csync/this-too", 0755);
+    assert_int_equal(rc, 0);
+
+    /* the directories below the renamed one are gone as well */
+    rc = csync_vio_rename(csync, "/tmp/csync/this", "/tmp/csync/that");
+    assert_int_equal(rc, 0);
+    assert_false(csync_vio_dircache_contains(csync, "/tmp/csync/this"));
+    assert_false(csync_vio_dircache_contains(csync, "/tmp/csync/this/is"));
+    assert_false(csync_vio_dircache_contains(csync, CSYNC_TEST_DIRS));
+    assert_true(csync_vio_dircache_contains(csync, "/tmp/csync/this-too"));
+
+    /* and are created again */
+    rc = csync_vio_mkdirs(csync, CSYNC_TEST_DIRS, 0755);
+    assert_int_equal(rc, 0);
+    assert_int_equal(access(CSYNC_TEST_DIRS, F_OK), 0);
+}
+
 static void check_csync_vio_rmdir(void **state)
 {
     CSYNC *csync = *state;
@@ -420,6 +499,64 @@ static void check_csync_vio_stat_file(void **state)
     csync_vio_file_stat_destroy(fs);
 }
 
+static void check_csync_vio_stats(void **state)
+{
+    CSYNC *csync = *state;
+    struct csync_vio_stats_s stats;
+    csync_vio_file_stat_t *fs;
+    csync_vio_handle_t *fh;
+    char buf[64];
+    unsigned long sum = 0;
+    int i;
+    int rc;
+
+    rc = csync_reset_vio_stats(csync);
+    assert_int_equal(rc, 0);
+
+    fs = csync_vio_file_stat_new();
+    rc = csync_vio_stat(csync, CSYNC_TEST_FILE, fs);
+    assert_int_equal(rc, 0);
+    csync_vio_file_stat_destroy(fs);
+
+    fs = csync_vio_file_stat_new();
+    rc = csync_vio_stat(csync, CSYNC_TEST_DIR "nonexistent", fs);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOENT);
+    csync_vio_file_stat_destroy(fs);
+
+    fh = csync_vio_open(csync, CSYNC_TEST_FILE, O_RDONLY, 0644);
+    assert_non_null(fh);
+    rc = csync_vio_read(csync, fh, buf, sizeof(buf));
+    assert_int_equal(rc, 15);
+    csync_vio_close(csync, fh);
+
+    rc = csync_get_vio_stats(csync, &stats);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_STAT].calls, 2);
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_STAT].errors, 1);
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_OPEN].calls, 1);
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_READ].calls, 1);
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_READ].bytes, 15);
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_CLOSE].calls, 1);
+    assert_int_equal(stats.remote[CSYNC_VIO_STATS_STAT].calls, 0);
+
+    for (i = 0; i < CSYNC_VIO_STATS_BUCKETS; i++) {
+        sum += stats.local[CSYNC_VIO_STATS_STAT].histogram[i];
+    }
+    assert_int_equal(sum, 2);
+
+    assert_string_equal(csync_vio_stats_op_name(CSYNC_VIO_STATS_READDIR),
+                        "readdir");
+
+    rc = csync_reset_vio_stats(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_get_vio_stats(csync, &stats);
+    assert_int_equal(rc, 0);
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_STAT].calls, 0);
+    assert_int_equal(stats.local[CSYNC_VIO_STATS_READ].bytes, 0);
+}
+
 static void check_csync_vio_rename_dir(void **state)
 {
     CSYNC *csync = *state;
@@ -528,16 +665,557 @@ static void check_csync_vio_utimes(void **state)
     c_free_locale_string(file);
 }
 
+static void check_csync_vio_setattr(void **state)
+{
+    CSYNC *csync = *state;
+    csync_stat_t sb;
+    long modtime = 0;
+    mbchar_t *file = c_utf8_to_locale(CSYNC_TEST_FILE);
+    int rc;
+
+    rc = _tstat(file, &sb);
+    assert_int_equal(rc, 0);
+    modtime = sb.st_mtime + 10;
+
+    rc = csync_vio_setattr(csync, CSYNC_TEST_FILE, 0600,
+                           (uid_t) -1, (gid_t) -1, modtime);
+    assert_int_equal(rc, 0);
+
+    rc = _tstat(file, &sb);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(modtime, sb.st_mtime);
+#ifndef _WIN32
+    assert_int_equal(sb.st_mode & 07777, 0600);
+#endif
+
+    c_free_locale_string(file);
+}
+
+static void check_csync_vio_close_stat(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *fh;
+    csync_vio_file_stat_t *fs;
+    char str[] = "This is a test";
+    ssize_t rc;
+
+    fh = csync_vio_creat(csync, CSYNC_TEST_FILE, 0644);
+    assert_non_null(fh);
+
+    rc = csync_vio_write(csync, fh, str, sizeof(str));
+    assert_int_equal(rc, sizeof(str));
+
+    fs = csync_vio_file_stat_new();
+    assert_non_null(fs);
+
+    rc = csync_vio_close_stat(csync, fh, fs);
+    assert_int_equal(rc, 0);
+
+    assert_true(fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_SIZE);
+    assert_true(fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_INODE);
+    assert_int_equal(fs->size, sizeof(str));
+
+    csync_vio_file_stat_destroy(fs);
+}
+
+static void check_csync_vio_fsync(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *fh;
+    char str[] = "This is a test";
+    ssize_t rc;
+
+    fh = csync_vio_creat(csync, CSYNC_TEST_FILE, 0644);
+    assert_non_null(fh);
+
+    rc = csync_vio_write(csync, fh, str, sizeof(str));
+    assert_int_equal(rc, sizeof(str));
+
+    rc = csync_vio_fsync(csync, fh);
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_close(csync, fh);
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_fsync_dir(csync, CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_syncfs(csync, CSYNC_TEST_DIR);
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_fsync_dir(csync, CSYNC_TEST_DIR "nonexistent");
+    assert_int_equal(rc, -1);
+}
+
+static ssize_t _check_source(void *userdata, char *buf, size_t count)
+{
+    (void) userdata;
+    (void) buf;
+    (void) count;
+
+    return 0;
+}
+
+static void check_csync_vio_sendfile_local(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *fh;
+    int rc;
+
+    fh = csync_vio_creat(csync, CSYNC_TEST_FILE, 0644);
+    assert_non_null(fh);
+
+    /* local files are written, the caller has to fall back */
+    rc = csync_vio_sendfile(csync, fh, _check_source, NULL, 0);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOTSUP);
+
+    rc = csync_vio_close(csync, fh);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_vio_set_upload_mtime_local(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *fh;
+    int rc;
+
+    fh = csync_vio_creat(csync, CSYNC_TEST_FILE, 0644);
+    assert_non_null(fh);
+
+    /* the mtime of local files is set with utimes */
+    rc = csync_vio_set_upload_mtime(csync, fh, 1234567890);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOTSUP);
+
+    rc = csync_vio_close(csync, fh);
+    assert_int_equal(rc, 0);
+}
+
+struct check_op_s {
+    csync_vio_op_t op;
+    int count;
+};
+
+static void _check_op_done(csync_vio_op_t *op)
+{
+    struct check_op_s *check = (struct check_op_s *) op;
+
+    check->count++;
+}
+
+static void check_csync_vio_submit_local(void **state)
+{
+    CSYNC *csync = *state;
+    struct check_op_s check;
+    csync_stat_t sb;
+    int rc;
+
+    /* local operations run right away, done is called before it returns */
+    ZERO_STRUCT(check);
+    check.op.type = CSYNC_VIO_OP_MKDIR;
+    check.op.uri = (char *) CSYNC_TEST_DIR;
+    check.op.mode = 0755;
+    check.op.done = _check_op_done;
+
+    rc = csync_vio_submit(csync, &check.op);
+    assert_int_equal(rc, 0);
+    assert_int_equal(check.count, 1);
+    assert_int_equal(check.op.rc, 0);
+
+    rc = lstat(CSYNC_TEST_DIR, &sb);
+    assert_int_equal(rc, 0);
+
+    /* creating an existing directory is fine */
+    rc = csync_vio_submit(csync, &check.op);
+    assert_int_equal(rc, 0);
+    assert_int_equal(check.count, 2);
+    assert_int_equal(check.op.rc, 0);
+
+    check.op.type = CSYNC_VIO_OP_RMDIR;
+    rc = csync_vio_submit(csync, &check.op);
+    assert_int_equal(rc, 0);
+    assert_int_equal(check.count, 3);
+    assert_int_equal(check.op.rc, 0);
+
+    rc = lstat(CSYNC_TEST_DIR, &sb);
+    assert_int_equal(rc, -1);
+
+    /* the error is reported in the operation */
+    rc = csync_vio_submit(csync, &check.op);
+    assert_int_equal(rc, 0);
+    assert_int_equal(check.count, 4);
+    assert_int_equal(check.op.rc, -1);
+    assert_int_equal(check.op.err, ENOENT);
+
+    rc = csync_vio_complete(csync, true);
+    assert_int_equal(rc, 0);
+}
+
+static void check_csync_vio_ops_limit(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_file_stat_t *fs;
+    struct timespec start, finish;
+    int limit = 20;
+    int i, rc;
+
+    rc = csync_vio_set_property(csync, "local_ops_limit", &limit);
+    assert_int_equal(rc, 0);
+
+    csync_gettime(&start);
+    /* a burst of 20 calls and 10 more at 20 calls per second */
+    for (i = 0; i < 30; i++) {
+        fs = csync_vio_file_stat_new();
+        rc = csync_vio_stat(csync, CSYNC_TEST_FILE, fs);
+        assert_int_equal(rc, 0);
+        csync_vio_file_stat_destroy(fs);
+    }
+    csync_gettime(&finish);
+
+    assert_true(c_secdiff(finish, start) >= 0.4);
+
+    limit = 0;
+    rc = csync_vio_set_property(csync, "local_ops_limit", &limit);
+    assert_int_equal(rc, 0);
+}
+
+/*
+ * The in-memory remote of the dummy module
+ */
+
+static void setup_dummy(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    setup(state);
+    csync = *state;
+
+    rc = csync_vio_init(csync, "dummy", "latency=0,error_rate=0");
+    assert_int_equal(rc, 0);
+
+    csync->replica = REMOTE_REPLICA;
+}
+
+static void teardown_dummy(void **state)
+{
+    CSYNC *csync = *state;
+
+    csync_vio_shutdown(csync);
+
+    teardown(state);
+}
+
+static void check_csync_vio_dummy_tree(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *dh;
+    csync_vio_handle_t *fh;
+    csync_vio_file_stat_t *fs;
+    char buf[16] = {0};
+    int rc;
+
+    /* the first directory opened is the root of the replica */
+    dh = csync_vio_opendir(csync, "dummy://tree/remote");
+    assert_non_null(dh);
+    fs = csync_vio_readdir(csync, dh);
+    assert_null(fs);
+    rc = csync_vio_closedir(csync, dh);
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_mkdir(csync, "dummy://tree/remote/dir", 0755);
+    assert_int_equal(rc, 0);
+    rc = csync_vio_mkdir(csync, "dummy://tree/remote/dir", 0755);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EEXIST);
+
+    fh = csync_vio_creat(csync, "dummy://tree/remote/dir/file.txt", 0644);
+    assert_non_null(fh);
+    rc = csync_vio_write(csync, fh, "This is a test", 14);
+    assert_int_equal(rc, 14);
+    rc = csync_vio_close(csync, fh);
+    assert_int_equal(rc, 0);
+
+    fs = csync_vio_file_stat_new();
+    rc = csync_vio_stat(csync, "dummy://tree/remote/dir/file.txt", fs);
+    assert_int_equal(rc, 0);
+    assert_string_equal(fs->name, "file.txt");
+    assert_int_equal(fs->size, 14);
+    csync_vio_file_stat_destroy(fs);
+
+    rc = csync_vio_rename(csync, "dummy://tree/remote/dir/file.txt",
+                                 "dummy://tree/remote/moved.txt");
+    assert_int_equal(rc, 0);
+
+    fh = csync_vio_open(csync, "dummy://tree/remote/moved.txt", O_RDONLY, 0644);
+    assert_non_null(fh);
+    rc = csync_vio_read(csync, fh, buf, sizeof(buf));
+    assert_int_equal(rc, 14);
+    assert_string_equal(buf, "This is a test");
+    rc = csync_vio_close(csync, fh);
+    assert_int_equal(rc, 0);
+
+    /* the entries are sorted by name */
+    dh = csync_vio_opendir(csync, "dummy://tree/remote");
+    assert_non_null(dh);
+    fs = csync_vio_readdir(csync, dh);
+    assert_non_null(fs);
+    assert_string_equal(fs->name, "dir");
+    assert_int_equal(fs->type, CSYNC_VIO_FILE_TYPE_DIRECTORY);
+    csync_vio_file_stat_destroy(fs);
+    fs = csync_vio_readdir(csync, dh);
+    assert_non_null(fs);
+    assert_string_equal(fs->name, "moved.txt");
+    assert_int_equal(fs->type, CSYNC_VIO_FILE_TYPE_REGULAR);
+    csync_vio_file_stat_destroy(fs);
+    fs = csync_vio_readdir(csync, dh);
+    assert_null(fs);
+    rc = csync_vio_closedir(csync, dh);
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_rmdir(csync, "dummy://tree/remote/dir");
+    assert_int_equal(rc, 0);
+    rc = csync_vio_unlink(csync, "dummy://tree/remote/moved.txt");
+    assert_int_equal(rc, 0);
+    rc = csync_vio_unlink(csync, "dummy://tree/remote/moved.txt");
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOENT);
+
+    /* a missing directory is not created once the root exists */
+    dh = csync_vio_opendir(csync, "dummy://tree/missing");
+    assert_null(dh);
+    assert_int_equal(errno, ENOENT);
+}
+
+static void check_csync_vio_dummy_errors(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *dh;
+    int error_rate = 1000;
+    int rc;
+
+    dh = csync_vio_opendir(csync, "dummy://errors/remote");
+    assert_non_null(dh);
+    csync_vio_closedir(csync, dh);
+
+    rc = csync_vio_set_property(csync, "error_rate", &error_rate);
+    assert_int_equal(rc, 0);
+
+    rc = csync_vio_mkdir(csync, "dummy://errors/remote/dir", 0755);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, EIO);
+
+    error_rate = 1001;
+    rc = csync_vio_set_property(csync, "error_rate", &error_rate);
+    assert_int_equal(rc, -1);
+}
+
+static void check_csync_vio_dummy_latency(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_file_stat_t *fs;
+    struct timespec start, finish;
+    int latency = 100;
+    int rc;
+
+    rc = csync_vio_set_property(csync, "latency", &latency);
+    assert_int_equal(rc, 0);
+
+    csync_gettime(&start);
+    fs = csync_vio_file_stat_new();
+    rc = csync_vio_stat(csync, "dummy://latency/remote", fs);
+    assert_int_equal(rc, -1);
+    csync_vio_file_stat_destroy(fs);
+    csync_gettime(&finish);
+
+    assert_true(c_secdiff(finish, start) >= 0.1);
+}
+
+/* the dummy knows the checksum of a file like a server, without a read */
+static void check_csync_vio_dummy_checksum(void **state)
+{
+    CSYNC *csync = *state;
+    struct csync_vio_stats_s stats;
+    csync_vio_handle_t *dh;
+    csync_vio_handle_t *fh;
+    char sum[41];
+    int rc;
+
+    dh = csync_vio_opendir(csync, "dummy://checksum/remote");
+    assert_non_null(dh);
+    csync_vio_closedir(csync, dh);
+
+    fh = csync_vio_creat(csync, "dummy://checksum/remote/file.txt", 0644);
+    assert_non_null(fh);
+    rc = csync_vio_write(csync, fh, "This is a test", 14);
+    assert_int_equal(rc, 14);
+    rc = csync_vio_close(csync, fh);
+    assert_int_equal(rc, 0);
+
+    rc = csync_reset_vio_stats(csync);
+    assert_int_equal(rc, 0);
+    rc = csync_vio_checksum(csync, "dummy://checksum/remote/file.txt", "SHA1",
+                            sum, sizeof(sum));
+    assert_int_equal(rc, 0);
+    assert_string_equal(sum, "a54d88e06612d820bc3be72877c74f257b561b19");
+    rc = csync_get_vio_stats(csync, &stats);
+    assert_int_equal(rc, 0);
+    assert_int_equal(stats.remote[CSYNC_VIO_STATS_CHECKSUM].calls, 1);
+    assert_int_equal(stats.remote[CSYNC_VIO_STATS_OPEN].calls, 0);
+
+    rc = csync_vio_checksum(csync, "dummy://checksum/remote/file.txt", "MD5",
+                            sum, sizeof(sum));
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOTSUP);
+
+    rc = csync_vio_checksum(csync, "dummy://checksum/remote/missing", "SHA1",
+                            sum, sizeof(sum));
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOENT);
+
+    /* the local replica has no module to ask */
+    csync->replica = LOCAL_REPLICA;
+    rc = csync_vio_checksum(csync, CSYNC_TEST_DIR, "SHA1", sum, sizeof(sum));
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOTSUP);
+}
+
+static void check_csync_vio_dummy_submit(void **state)
+{
+    CSYNC *csync = *state;
+    struct check_op_s check[4];
+    csync_vio_handle_t *dh;
+    csync_vio_file_stat_t *fs;
+    char uri[64];
+    int parallel = 4;
+    int i, rc;
+
+    dh = csync_vio_opendir(csync, "dummy://submit/remote");
+    assert_non_null(dh);
+    csync_vio_closedir(csync, dh);
+
+    rc = csync_vio_set_property(csync, "max_parallel", &parallel);
+    assert_int_equal(rc, 0);
+
+    for (i = 0; i < 4; i++) {
+        snprintf(uri, sizeof(uri), "dummy://submit/remote/dir%d", i);
+        ZERO_STRUCT(check[i]);
+        check[i].op.type = CSYNC_VIO_OP_MKDIR;
+        check[i].op.uri = c_strdup(uri);
+        check[i].op.mode = 0755;
+        check[i].op.done = _check_op_done;
+
+        rc = csync_vio_submit(csync, &check[i].op);
+        assert_int_equal(rc, 0);
+    }
+
+    /* without threads they ran right away */
+    rc = csync_vio_complete(csync, true);
+    assert_true(rc >= 0);
+
+    for (i = 0; i < 4; i++) {
+        assert_int_equal(check[i].count, 1);
+        assert_int_equal(check[i].op.rc, 0);
+
+        fs = csync_vio_file_stat_new();
+        rc = csync_vio_stat(csync, check[i].op.uri, fs);
+        assert_int_equal(rc, 0);
+        assert_int_equal(fs->type, CSYNC_VIO_FILE_TYPE_DIRECTORY);
+        csync_vio_file_stat_destroy(fs);
+        SAFE_FREE(check[i].op.uri);
+    }
+}
+
+static void check_csync_vio_trace_replay(void **state)
+{
+    CSYNC *csync = *state;
+    csync_vio_handle_t *dh;
+    csync_vio_handle_t *fh;
+    csync_vio_file_stat_t *fs;
+    struct timespec start, finish;
+    int rc;
+
+    SAFE_FREE(csync->remote.uri);
+    csync->remote.uri = c_strdup("dummy://trace/remote");
+    csync->options.vio_trace = c_strdup(CSYNC_TEST_DIR "trace");
+
+    /* record */
+    rc = csync_vio_init(csync, "dummy", "latency=50");
+    assert_int_equal(rc, 0);
+    assert_non_null(csync->module.trace);
+    csync->replica = REMOTE_REPLICA;
+
+    dh = csync_vio_opendir(csync, "dummy://trace/remote");
+    assert_non_null(dh);
+    fs = csync_vio_readdir(csync, dh);
+    assert_null(fs);
+    csync_vio_closedir(csync, dh);
+
+    rc = csync_vio_mkdir(csync, "dummy://trace/remote/dir", 0755);
+    assert_int_equal(rc, 0);
+    fh = csync_vio_creat(csync, "dummy://trace/remote/dir/file.txt", 0644);
+    assert_non_null(fh);
+    rc = csync_vio_write(csync, fh, "This is a test", 14);
+    assert_int_equal(rc, 14);
+    csync_vio_close(csync, fh);
+
+    fs = csync_vio_file_stat_new();
+    rc = csync_vio_stat(csync, "dummy://trace/remote/dir/file.txt", fs);
+    assert_int_equal(rc, 0);
+    csync_vio_file_stat_destroy(fs);
+
+    csync_vio_shutdown(csync);
+    assert_null(csync->module.trace);
+    SAFE_FREE(csync->options.vio_trace);
+
+    /* and replay on another host */
+    rc = csync_vio_init(csync, "replay", "trace=" CSYNC_TEST_DIR "trace");
+    assert_int_equal(rc, 0);
+
+    dh = csync_vio_opendir(csync, "replay://elsewhere/remote");
+    assert_non_null(dh);
+    fs = csync_vio_readdir(csync, dh);
+    assert_null(fs);
+    csync_vio_closedir(csync, dh);
+
+    rc = csync_vio_mkdir(csync, "replay://elsewhere/remote/dir", 0755);
+    assert_int_equal(rc, 0);
+
+    /* the stat takes as long as when it was recorded */
+    csync_gettime(&start);
+    fs = csync_vio_file_stat_new();
+    rc = csync_vio_stat(csync, "replay://elsewhere/remote/dir/file.txt", fs);
+    assert_int_equal(rc, 0);
+    assert_int_equal(fs->size, 14);
+    csync_vio_file_stat_destroy(fs);
+    csync_gettime(&finish);
+    assert_true(c_secdiff(finish, start) >= 0.04);
+
+    /* unknown paths don't exist */
+    fs = csync_vio_file_stat_new();
+    rc = csync_vio_stat(csync, "replay://elsewhere/remote/other.txt", fs);
+    assert_int_equal(rc, -1);
+    assert_int_equal(errno, ENOENT);
+    csync_vio_file_stat_destroy(fs);
+
+    csync_vio_shutdown(csync);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
         unit_test_setup_teardown(check_csync_vio_load, setup, teardown),
         unit_test_setup_teardown(check_csync_vio_load_wrong_proto, setup, teardown),
         unit_test_setup_teardown(check_csync_vio_load_bad_plugin, setup, teardown),
+        unit_test_setup_teardown(check_csync_vio_load_two_instances, setup, teardown),
 
         unit_test_setup_teardown(check_csync_vio_mkdir, setup, teardown),
         unit_test_setup_teardown(check_csync_vio_mkdirs, setup, teardown),
         unit_test_setup_teardown(check_csync_vio_mkdirs_some_exist, setup_dir, teardown),
+        unit_test_setup_teardown(check_csync_vio_mkdirs_dircache, setup, teardown),
+        unit_test_setup_teardown(check_csync_vio_dircache_rename, setup, teardown),
         unit_test_setup_teardown(check_csync_vio_rmdir, setup, teardown),
         unit_test_setup_teardown(check_csync_vio_opendir, setup_dir, teardown),
         unit_test_setup_teardown(check_csync_vio_opendir_perm, setup, teardown),
@@ -556,6 +1234,7 @@ int torture_run_tests(void)
 
         unit_test_setup_teardown(check_csync_vio_stat_dir, setup_dir, teardown),
         unit_test_setup_teardown(check_csync_vio_stat_file, setup_file, teardown),
+        unit_test_setup_teardown(check_csync_vio_stats, setup_file, teardown),
 
         unit_test_setup_teardown(check_csync_vio_rename_dir, setup_dir, teardown),
         unit_test_setup_teardown(check_csync_vio_rename_file, setup_file, teardown),
@@ -565,6 +1244,20 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_vio_chown, setup_file, teardown),
 #endif
         unit_test_setup_teardown(check_csync_vio_utimes, setup_file, teardown),
+        unit_test_setup_teardown(check_csync_vio_setattr, setup_file, teardown),
+        unit_test_setup_teardown(check_csync_vio_ops_limit, setup_file, teardown),
+        unit_test_setup_teardown(check_csync_vio_close_stat, setup_dir, teardown),
+        unit_test_setup_teardown(check_csync_vio_fsync, setup_dir, teardown),
+        unit_test_setup_teardown(check_csync_vio_sendfile_local, setup_dir, teardown),
+        unit_test_setup_teardown(check_csync_vio_set_upload_mtime_local, setup_dir, teardown),
+        unit_test_setup_teardown(check_csync_vio_submit_local, setup, teardown),
+
+        unit_test_setup_teardown(check_csync_vio_dummy_tree, setup_dummy, teardown_dummy),
+        unit_test_setup_teardown(check_csync_vio_dummy_errors, setup_dummy, teardown_dummy),
+        unit_test_setup_teardown(check_csync_vio_dummy_latency, setup_dummy, teardown_dummy),
+        unit_test_setup_teardown(check_csync_vio_dummy_checksum, setup_dummy, teardown_dummy),
+        unit_test_setup_teardown(check_csync_vio_dummy_submit, setup_dummy, teardown_dummy),
+        unit_test_setup_teardown(check_csync_vio_trace_replay, setup_dir, teardown),
     };
 
     return run_tests(tests);